@@ -0,0 +1,915 @@
+#define _POSIX_C_SOURCE 200809L
+// wait4 and ru_maxrss are BSD extensions
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "codec.h"
+#include "../Image compression/bmp_io.h"
+#include "../Text compression/file_util.h"
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <process.h>
+#include <psapi.h>
+#else
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+
+// Runs every codec of the codec library over the sample text and images and a set of synthetic inputs, and
+// reports compress / decompress speed (median and 99th percentile over the trials), compression ratio, peak
+// memory and whether every trial round-tripped. Results can be saved as CSV or JSON, and a saved CSV can be
+// given as a baseline so that slowdowns and worse ratios are reported as regressions.
+// The standalone programs' own coders (LZ77, BWT, the text and image Huffman modes, selective RLE and its frame
+// sequences, image LZW) have no in-memory interface, so when their executables are found in the --programs
+// directory each one is run as a child process on the same corpora, once to compress and once to decompress.
+//
+// Build: gcc -O2 Benchmark.c codec.c -lm -pthread -o benchmark
+// Usage: benchmark [--trials N] [--csv out.csv] [--json out.json] [--baseline old.csv] [--threshold percent]
+//                  [--text dir] [--images dir] [--programs dir]
+
+#define MAX_CASES 256
+#define MAX_TRIALS 1000
+#define DEFAULT_TRIALS 5
+#define DEFAULT_THRESHOLD 10.0          // Percent a median speed may drop before it counts as a regression
+#define SYNTHETIC_BYTES (4 << 20)       // Size of each synthetic byte corpus
+#define SYNTHETIC_WIDTH 1024            // Synthetic images are SYNTHETIC_WIDTH x SYNTHETIC_HEIGHT
+#define SYNTHETIC_HEIGHT 768
+
+#define KIND_BYTES 0
+#define KIND_IMAGE 1
+
+// Synthetic corpora
+#define SYNTHETIC_NONE 0
+#define SYNTHETIC_RANDOM 1       // Uniform random bytes or pixels: nothing to gain
+#define SYNTHETIC_RUNS 2         // Nothing but runs of 16 to 4096 units
+#define SYNTHETIC_LOW_ENTROPY 3  // A few values with skewed frequencies, in no particular order
+#define SYNTHETIC_HUGE_ALPHABET 4  // An image in which every pixel has a different color
+
+// Standalone program cases
+#define PROGRAM_ARGS 8
+#define SEQUENCE_FRAMES 8      // Frames of an RLE sequence case, made from one image
+#define SEQUENCE_LAST "7"      // SEQUENCE_FRAMES - 1, the last frame to decode
+#define SEQUENCE_INTERVAL "4"  // Keyframe interval
+#define SEQUENCE_OBJECT 48     // Side of the square that moves across the frames, in pixels
+
+typedef struct {
+    char name[320];
+    char path[1024];  // Source file, empty for synthetic corpora
+    int kind;
+    int synthetic;
+} Corpus;
+
+typedef struct {
+    int verified;  // 1 if every trial decoded back to the input
+    int chosen;    // Codec recorded in the block header, which for CODEC_AUTO is the one it picked
+    int error;     // First codec error, or CODEC_OK
+    uint64_t originalSize;
+    uint64_t compressedSize;
+    double compressMedian;  // MB/s
+    double compressP99;     // MB/s of the trial at the 99th percentile of time, i.e. the slow tail
+    double decompressMedian;
+    double decompressP99;
+    long peakRssKb;  // Peak resident memory of the process that ran the case, 0 if not measured
+    int exitStatus;  // Exit status of a standalone program that failed
+} CaseResult;
+
+// A standalone program case. Its times include starting the program and reading and writing files, so they
+// compare with the other program cases rather than with the library's in-memory ones.
+typedef struct {
+    const char *name;        // Shown in the codec column
+    const char *executable;  // File name in the programs directory
+    int kind;
+    int sequence;  // 1: compress SEQUENCE_FRAMES frames made from the image into one RLE sequence file
+    // Arguments; "<in>" and "<out>" stand for the input and output paths (a frame pattern when decoding frames)
+    const char *compress[PROGRAM_ARGS];
+    const char *decompress[PROGRAM_ARGS];
+} Program;
+
+static const Program programs[] = {
+    {"lz77", "lz77", KIND_BYTES, 0, {"compress", "<in>", "<out>"}, {"decompress", "<in>", "<out>"}},
+    {"lz77-tans", "lz77", KIND_BYTES, 0, {"compress", "<in>", "<out>", "6", "20", "tans"},
+     {"decompress", "<in>", "<out>"}},
+    {"bwt", "bwt", KIND_BYTES, 0, {"compress", "<in>", "<out>"}, {"decompress", "<in>", "<out>"}},
+    {"huffman-o1", "text-huffman", KIND_BYTES, 0, {"compress", "<in>", "<out>", "order1"},
+     {"decompress", "<in>", "<out>"}},
+    // Color mode switches to the palette mode by itself for images with at most 256 colors
+    {"himg-color", "image-huffman", KIND_IMAGE, 0, {"compress", "<in>", "<out>", "color"},
+     {"decompress", "<in>", "<out>"}},
+    {"himg-pred", "image-huffman", KIND_IMAGE, 0, {"compress", "<in>", "<out>", "predictive"},
+     {"decompress", "<in>", "<out>"}},
+    {"rle-image", "image-rle", KIND_IMAGE, 0, {"compress", "<in>", "<out>"}, {"decompress", "<in>", "<out>"}},
+    {"rle-frames", "image-rle", KIND_IMAGE, 1, {"sequence", "<out>", SEQUENCE_INTERVAL},
+     {"frames", "<in>", "0", SEQUENCE_LAST, "<out>"}},
+    {"lzw-image", "image-lzw", KIND_IMAGE, 0, {"compress", "<in>", "<out>"}, {"decompress", "<in>", "<out>"}},
+};
+#define PROGRAM_COUNT ((int)(sizeof(programs) / sizeof(programs[0])))
+
+typedef struct {
+    const Corpus *corpus;
+    int codec;
+    const Program *program;  // A standalone program case instead of a library codec
+    CaseResult result;
+} Case;
+
+static uint64_t nextRandom(uint64_t *state) {
+    // xorshift64*, so every run generates the same corpora
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ull;
+}
+
+// Fill count units of unitSize bytes for a synthetic corpus
+static void generate(int synthetic, uint8_t *data, size_t count, int unitSize) {
+    uint64_t state = 0x9E3779B97F4A7C15ull + synthetic;
+    size_t i = 0;
+    while (i < count) {
+        uint64_t r = nextRandom(&state);
+        uint8_t unit[3] = {(uint8_t)r, (uint8_t)(r >> 8), (uint8_t)(r >> 16)};
+        size_t run = 1;
+        if (synthetic == SYNTHETIC_RUNS) {
+            run = 16 + (r >> 32) % 4081;
+        } else if (synthetic == SYNTHETIC_LOW_ENTROPY) {
+            // Value k of 8 turns up with probability 2^-(k+1)
+            int k = 0;
+            while (k < 7 && ((r >> (32 + k)) & 1)) k++;
+            unit[0] = (uint8_t)('a' + k);
+            unit[1] = (uint8_t)(k * 17);
+            unit[2] = (uint8_t)(255 - k * 31);
+        } else if (synthetic == SYNTHETIC_HUGE_ALPHABET) {
+            // Steps through all 2^24 colors with an odd stride, so no color repeats
+            uint32_t color = (uint32_t)((i * 2654435761u) & 0xFFFFFF);
+            unit[0] = (uint8_t)color;
+            unit[1] = (uint8_t)(color >> 8);
+            unit[2] = (uint8_t)(color >> 16);
+        }
+        for (size_t k = 0; k < run && i < count; k++, i++) memcpy(&data[i * unitSize], unit, unitSize);
+    }
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Sort the trial times and return the nearest-rank percentile
+static double percentile(double *times, int count, double fraction) {
+    qsort(times, count, sizeof(double), compareDoubles);
+    int rank = (int)(fraction * count + 0.999999);
+    if (rank < 1) rank = 1;
+    return times[rank - 1];
+}
+
+// A corpus in memory: bytes, or an image mapped from its file or generated
+typedef struct {
+    uint8_t *input;
+    size_t size;  // Bytes, or packed pixel bytes of the image
+    CodecImage image;
+    BmpImage bmp;
+    int bmpOpen;
+} LoadedCorpus;
+
+static int loadCorpus(const Corpus *corpus, LoadedCorpus *loaded) {
+    memset(loaded, 0, sizeof(*loaded));
+    if (corpus->kind == KIND_BYTES && corpus->synthetic == SYNTHETIC_NONE) {
+        loaded->input = read_file(corpus->path, &loaded->size);
+    } else if (corpus->kind == KIND_BYTES) {
+        loaded->size = SYNTHETIC_BYTES;
+        loaded->input = (uint8_t *)malloc(loaded->size);
+        if (loaded->input != NULL) generate(corpus->synthetic, loaded->input, loaded->size, 1);
+    } else if (corpus->synthetic == SYNTHETIC_NONE) {
+        if (bmp_open(corpus->path, &loaded->bmp) == 0) {
+            loaded->bmpOpen = 1;
+            loaded->image.width = loaded->bmp.width;
+            loaded->image.height = loaded->bmp.rows;
+            loaded->image.stride = loaded->bmp.rowSize;
+            loaded->image.pixels = loaded->bmp.pixels;
+        }
+    } else {
+        CodecImage *image = &loaded->image;
+        image->width = SYNTHETIC_WIDTH;
+        image->height = SYNTHETIC_HEIGHT;
+        image->stride = (size_t)SYNTHETIC_WIDTH * 3;
+        image->pixels = (uint8_t *)malloc(image->stride * image->height);
+        if (image->pixels != NULL) generate(corpus->synthetic, image->pixels, (size_t)image->width * image->height, 3);
+    }
+    if (corpus->kind == KIND_IMAGE) loaded->size = (size_t)loaded->image.width * 3 * loaded->image.height;
+    return corpus->kind == KIND_BYTES ? (loaded->input != NULL ? 0 : -1) : (loaded->image.pixels != NULL ? 0 : -1);
+}
+
+static void freeCorpus(const Corpus *corpus, LoadedCorpus *loaded) {
+    free(loaded->input);
+    if (loaded->bmpOpen) {
+        bmp_close(&loaded->bmp);
+    } else if (corpus->kind == KIND_IMAGE) {
+        free(loaded->image.pixels);
+    }
+}
+
+// Turn the trial times into MB/s of the original size
+static void finishSpeeds(CaseResult *result, double *compressTimes, double *decompressTimes, int trials) {
+    double megabytes = result->originalSize / 1e6;
+    result->compressMedian = megabytes / percentile(compressTimes, trials, 0.5);
+    result->compressP99 = megabytes / percentile(compressTimes, trials, 0.99);
+    result->decompressMedian = megabytes / percentile(decompressTimes, trials, 0.5);
+    result->decompressP99 = megabytes / percentile(decompressTimes, trials, 0.99);
+}
+
+// Run one case: an untimed warm-up trial (which also lets the context allocate its tables), then the timed
+// trials, each checked against the input
+static void runCase(const Corpus *corpus, int codec, int trials, CaseResult *result) {
+    memset(result, 0, sizeof(*result));
+    result->error = CODEC_OK;
+
+    LoadedCorpus loaded;
+    if (loadCorpus(corpus, &loaded) != 0) {
+        freeCorpus(corpus, &loaded);
+        result->error = CODEC_ERROR_IO;
+        return;
+    }
+    const uint8_t *input = loaded.input;
+    size_t size = loaded.size;
+    CodecImage image = loaded.image;
+    result->originalSize = size;
+
+    CodecContext *context = codec_create();
+    size_t capacity = corpus->kind == KIND_BYTES ? codec_compress_bound(codec, size)
+                                                 : codec_compress_image_bound(codec, image.width, image.height);
+    size_t rowBytes = (size_t)image.width * 3;
+    uint8_t *compressed = (uint8_t *)malloc(capacity);
+    uint8_t *output = (uint8_t *)malloc(size > 0 ? size : 1);
+    double *compressTimes = (double *)malloc(trials * sizeof(double));
+    double *decompressTimes = (double *)malloc(trials * sizeof(double));
+    if (context == NULL || compressed == NULL || output == NULL || compressTimes == NULL || decompressTimes == NULL) {
+        result->error = CODEC_ERROR_MEMORY;
+    }
+
+    result->verified = result->error == CODEC_OK;
+    for (int trial = -1; trial < trials && result->error == CODEC_OK; trial++) {
+        size_t compressedSize = 0, outputSize = size;
+        CodecImage decoded = {image.width, image.height, rowBytes, output};
+        double start = wall_seconds();
+        int error = corpus->kind == KIND_BYTES
+                        ? codec_compress(context, codec, input, size, compressed, capacity, &compressedSize)
+                        : codec_compress_image(context, codec, &image, compressed, capacity, &compressedSize);
+        double middle = wall_seconds();
+        if (error == CODEC_OK) {
+            error = corpus->kind == KIND_BYTES
+                        ? codec_decompress(context, compressed, compressedSize, output, size, &outputSize)
+                        : codec_decompress_image(context, compressed, compressedSize, &decoded);
+        }
+        double end = wall_seconds();
+        if (error != CODEC_OK) {
+            result->error = error;
+            result->verified = 0;
+            break;
+        }
+
+        int same = outputSize == size;
+        if (corpus->kind == KIND_BYTES) {
+            same = same && memcmp(input, output, size) == 0;
+        } else {
+            for (int y = 0; y < image.height && same; y++) {
+                same = memcmp(&image.pixels[y * image.stride], &output[y * rowBytes], rowBytes) == 0;
+            }
+        }
+        result->verified &= same;
+        result->compressedSize = compressedSize;
+        result->chosen = compressed[0];
+        if (trial >= 0) {
+            compressTimes[trial] = middle - start;
+            decompressTimes[trial] = end - middle;
+        }
+    }
+
+    if (result->error == CODEC_OK) {
+        finishSpeeds(result, compressTimes, decompressTimes, trials);
+    }
+    codec_free(context);
+    free(compressed);
+    free(output);
+    free(compressTimes);
+    free(decompressTimes);
+    freeCorpus(corpus, &loaded);
+}
+
+#ifdef _WIN32
+// No fork here: cases run in this process, and the peak only ever grows, so it is an upper bound
+static void measureCase(const Corpus *corpus, int codec, int trials, CaseResult *result) {
+    runCase(corpus, codec, trials, result);
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        result->peakRssKb = (long)(counters.PeakWorkingSetSize / 1024);
+    }
+}
+#else
+// Run the case in a child process, so its peak resident memory is its own and not that of earlier cases.
+// The child loads its input itself and sends the result back through a pipe.
+static void measureCase(const Corpus *corpus, int codec, int trials, CaseResult *result) {
+    int fds[2];
+    fflush(stdout);
+    if (pipe(fds) != 0) {
+        perror("Error creating pipe");
+        runCase(corpus, codec, trials, result);
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        runCase(corpus, codec, trials, result);
+        ssize_t written = write(fds[1], result, sizeof(*result));
+        _exit(written == (ssize_t)sizeof(*result) ? 0 : 1);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        perror("Error starting benchmark process");
+        close(fds[0]);
+        runCase(corpus, codec, trials, result);
+        return;
+    }
+    size_t got = 0;
+    while (got < sizeof(*result)) {
+        ssize_t n = read(fds[0], (char *)result + got, sizeof(*result) - got);
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    wait4(pid, &status, 0, &usage);
+    if (got != sizeof(*result)) {
+        memset(result, 0, sizeof(*result));
+        result->error = CODEC_ERROR_IO;  // The child crashed
+    }
+#ifdef __APPLE__
+    result->peakRssKb = usage.ru_maxrss / 1024;  // Bytes on macOS
+#else
+    result->peakRssKb = usage.ru_maxrss;
+#endif
+}
+#endif
+
+// ---- Standalone programs ----
+
+static void putU32(unsigned char *p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static int writeFile(const char *path, const uint8_t *data, size_t size) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror("Error creating benchmark input");
+        return -1;
+    }
+    size_t written = fwrite(data, 1, size, file);
+    return fclose(file) == 0 && written == size ? 0 : -1;
+}
+
+static long fileSize(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// Write width x height pixels (rows stride bytes apart) as a 24-bit BMP, rows in the same order
+static int writeBmp(const char *path, const uint8_t *pixels, size_t stride, int width, int height) {
+    unsigned char header[BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE];
+    memset(header, 0, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    putU32(&header[2], (uint32_t)(sizeof(header) + bmp_row_size(width) * height));
+    putU32(&header[10], sizeof(header));
+    putU32(&header[14], BMP_INFO_HEADER_SIZE);
+    putU32(&header[18], (uint32_t)width);
+    putU32(&header[22], (uint32_t)height);
+    header[26] = 1;   // Planes
+    header[28] = 24;  // Bits per pixel
+    BmpImage bmp;
+    if (bmp_create(path, header, sizeof(header), width, height, &bmp) != 0) {
+        return -1;
+    }
+    for (int y = 0; y < height; y++) memcpy(bmp_row(&bmp, y), &pixels[y * stride], (size_t)width * 3);
+    bmp_close(&bmp);
+    return 0;
+}
+
+// 1 if the BMP at path has exactly the given dimensions and pixels
+static int sameImage(const char *path, const uint8_t *pixels, size_t stride, int width, int height) {
+    BmpImage bmp;
+    if (bmp_open(path, &bmp) != 0) {
+        return 0;
+    }
+    int same = bmp.width == width && bmp.rows == height;
+    for (int y = 0; y < height && same; y++) {
+        same = memcmp(bmp_row(&bmp, y), &pixels[y * stride], (size_t)width * 3) == 0;
+    }
+    bmp_close(&bmp);
+    return same;
+}
+
+// Frame k of a sequence made from an image: the image with a square moving across it, as a fixed camera
+// would see an object passing. Writes packed rows to frame.
+static void makeFrame(const CodecImage *image, int k, uint8_t *frame) {
+    size_t rowBytes = (size_t)image->width * 3;
+    for (int y = 0; y < image->height; y++) memcpy(&frame[y * rowBytes], &image->pixels[y * image->stride], rowBytes);
+    int left = k * SEQUENCE_OBJECT / 2;
+    int top = image->height / 2 - SEQUENCE_OBJECT / 2;
+    for (int y = top < 0 ? 0 : top; y < top + SEQUENCE_OBJECT && y < image->height; y++) {
+        for (int x = left; x < left + SEQUENCE_OBJECT && x < image->width; x++) {
+            uint8_t *pixel = &frame[y * rowBytes + (size_t)x * 3];
+            pixel[0] = (uint8_t)(40 * k);
+            pixel[1] = 200;
+            pixel[2] = (uint8_t)(255 - 20 * k);
+        }
+    }
+}
+
+// Full path of a program in directory; returns 1 if it exists and can be run
+static int findProgram(char *path, size_t size, const char *directory, const char *executable) {
+#ifdef _WIN32
+    snprintf(path, size, "%s\\%s.exe", directory, executable);
+    return _access(path, 0) == 0;
+#else
+    snprintf(path, size, "%s/%s", directory, executable);
+    return access(path, X_OK) == 0;
+#endif
+}
+
+static int makeWorkDirectory(char *path, size_t size) {
+#ifdef _WIN32
+    char base[MAX_PATH];
+    if (GetTempPathA(sizeof(base), base) == 0) return -1;
+    snprintf(path, size, "%sbenchmark%lu", base, (unsigned long)GetCurrentProcessId());
+    return _mkdir(path) == 0 ? 0 : -1;
+#else
+    const char *base = getenv("TMPDIR");
+    snprintf(path, size, "%s/benchmarkXXXXXX", base != NULL && base[0] != '\0' ? base : "/tmp");
+    return mkdtemp(path) != NULL ? 0 : -1;
+#endif
+}
+
+// Build argv for a program: "<in>" and "<out>" are replaced by the paths. Returns the argument count.
+static int buildArguments(const char **argv, const char *executable, const char *const *args, const char *in,
+                          const char *out) {
+    int count = 0;
+    argv[count++] = executable;
+    for (int i = 0; i < PROGRAM_ARGS && args[i] != NULL; i++) {
+        argv[count++] = strcmp(args[i], "<in>") == 0 ? in : strcmp(args[i], "<out>") == 0 ? out : args[i];
+    }
+    argv[count] = NULL;
+    return count;
+}
+
+// Run a program with its output discarded. Returns its exit status (-1 if it could not be run or crashed) and
+// raises *peakRssKb to the run's peak resident memory.
+static int runProgram(const char **argv, long *peakRssKb) {
+#ifdef _WIN32
+    (void)peakRssKb;
+    fflush(stdout);
+    return (int)_spawnv(_P_WAIT, argv[0], argv);
+#else
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+        }
+        execv(argv[0], (char *const *)argv);
+        _exit(127);
+    }
+    if (pid < 0) {
+        perror("Error starting program");
+        return -1;
+    }
+    int status;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    long peak = usage.ru_maxrss / 1024;
+#else
+    long peak = usage.ru_maxrss;
+#endif
+    if (peak > *peakRssKb) *peakRssKb = peak;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+}
+
+// Run one program case in the work directory: an untimed warm-up trial, then the timed trials. Each trial
+// compresses the corpus file, decompresses the result and compares it with the corpus.
+static void runProgramCase(const Corpus *corpus, const Program *program, const char *programPath, const char *work,
+                           int trials, CaseResult *result) {
+    memset(result, 0, sizeof(*result));
+    result->error = CODEC_OK;
+    LoadedCorpus loaded;
+    if (loadCorpus(corpus, &loaded) != 0) {
+        freeCorpus(corpus, &loaded);
+        result->error = CODEC_ERROR_IO;
+        return;
+    }
+    const CodecImage *image = &loaded.image;
+    size_t rowBytes = (size_t)image->width * 3;
+    int frameCount = program->sequence ? SEQUENCE_FRAMES : 0;
+    result->originalSize = loaded.size * (frameCount > 0 ? frameCount : 1);
+
+    char inputPath[1100], compressedPath[1100], decodedPath[1100], framePaths[SEQUENCE_FRAMES][1100];
+    snprintf(compressedPath, sizeof(compressedPath), "%s/compressed", work);
+    snprintf(decodedPath, sizeof(decodedPath), "%s/%s", work, frameCount > 0 ? "decoded%d.bmp" : "decoded");
+    const char *source = corpus->path;
+    int ready = 0;
+    uint8_t *frame = frameCount > 0 ? (uint8_t *)malloc(loaded.size > 0 ? loaded.size : 1) : NULL;
+    if (frameCount > 0) {
+        // The frames are written once; the case then codes them all into one sequence file
+        ready = frame != NULL;
+        for (int k = 0; k < frameCount && ready; k++) {
+            snprintf(framePaths[k], sizeof(framePaths[k]), "%s/frame%d.bmp", work, k);
+            makeFrame(image, k, frame);
+            ready = writeBmp(framePaths[k], frame, rowBytes, image->width, image->height) == 0;
+        }
+    } else if (corpus->synthetic != SYNTHETIC_NONE) {
+        snprintf(inputPath, sizeof(inputPath), "%s/input%s", work, corpus->kind == KIND_IMAGE ? ".bmp" : "");
+        source = inputPath;
+        ready = corpus->kind == KIND_IMAGE
+                    ? writeBmp(inputPath, image->pixels, image->stride, image->width, image->height) == 0
+                    : writeFile(inputPath, loaded.input, loaded.size) == 0;
+    } else {
+        ready = 1;
+    }
+    double *compressTimes = (double *)malloc(trials * sizeof(double));
+    double *decompressTimes = (double *)malloc(trials * sizeof(double));
+    if (!ready || compressTimes == NULL || decompressTimes == NULL) {
+        result->error = ready ? CODEC_ERROR_MEMORY : CODEC_ERROR_IO;
+    }
+
+    const char *argv[PROGRAM_ARGS + SEQUENCE_FRAMES + 2];
+    result->verified = result->error == CODEC_OK;
+    for (int trial = -1; trial < trials && result->error == CODEC_OK; trial++) {
+        int count = buildArguments(argv, programPath, program->compress, source, compressedPath);
+        for (int k = 0; k < frameCount; k++) argv[count++] = framePaths[k];
+        argv[count] = NULL;
+        double start = wall_seconds();
+        int status = runProgram(argv, &result->peakRssKb);
+        double middle = wall_seconds();
+        if (status == 0) {
+            buildArguments(argv, programPath, program->decompress, compressedPath, decodedPath);
+            status = runProgram(argv, &result->peakRssKb);
+        }
+        double end = wall_seconds();
+        long compressedSize = fileSize(compressedPath);
+        if (status != 0 || compressedSize < 0) {
+            result->error = CODEC_ERROR_IO;
+            result->exitStatus = status;
+            result->verified = 0;
+            break;
+        }
+
+        int same = 1;
+        if (frameCount > 0) {
+            for (int k = 0; k < frameCount && same; k++) {
+                char path[1100];
+                snprintf(path, sizeof(path), "%s/decoded%d.bmp", work, k);
+                makeFrame(image, k, frame);
+                same = sameImage(path, frame, rowBytes, image->width, image->height);
+            }
+        } else if (corpus->kind == KIND_IMAGE) {
+            same = sameImage(decodedPath, image->pixels, image->stride, image->width, image->height);
+        } else {
+            size_t decodedSize = 0;
+            uint8_t *decoded = read_file(decodedPath, &decodedSize);
+            same = decoded != NULL && decodedSize == loaded.size && memcmp(decoded, loaded.input, loaded.size) == 0;
+            free(decoded);
+        }
+        result->verified &= same;
+        result->compressedSize = (uint64_t)compressedSize;
+        if (trial >= 0) {
+            compressTimes[trial] = middle - start;
+            decompressTimes[trial] = end - middle;
+        }
+    }
+    if (result->error == CODEC_OK) {
+        finishSpeeds(result, compressTimes, decompressTimes, trials);
+    }
+
+    remove(compressedPath);
+    if (source == inputPath) remove(inputPath);
+    for (int k = 0; k < frameCount; k++) {
+        char path[1100];
+        snprintf(path, sizeof(path), "%s/decoded%d.bmp", work, k);
+        remove(path);
+        remove(framePaths[k]);
+    }
+    if (frameCount == 0) remove(decodedPath);
+    free(frame);
+    free(compressTimes);
+    free(decompressTimes);
+    freeCorpus(corpus, &loaded);
+}
+
+static int hasSuffix(const char *name, const char *suffix) {
+    size_t length = strlen(name), suffixLength = strlen(suffix);
+    return length >= suffixLength && strcmp(name + length - suffixLength, suffix) == 0;
+}
+
+static int compareCorpora(const void *a, const void *b) {
+    return strcmp(((const Corpus *)a)->name, ((const Corpus *)b)->name);
+}
+
+// Add every file in directory whose name ends in suffix, in name order
+static int addDirectory(Corpus *corpora, int count, int capacity, const char *directory, const char *suffix,
+                        const char *label, int kind) {
+    int first = count;
+#ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*%s", directory, suffix);
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    if (find == INVALID_HANDLE_VALUE) {
+        printf("No %s files found in %s\n", suffix, directory);
+        return count;
+    }
+    do {
+        const char *name = entry.cFileName;
+#else
+    DIR *dir = opendir(directory);
+    if (dir == NULL) {
+        printf("Cannot open %s; skipping it.\n", directory);
+        return count;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+#endif
+        if (count < capacity && hasSuffix(name, suffix)) {
+            Corpus *corpus = &corpora[count++];
+            snprintf(corpus->name, sizeof(corpus->name), "%s/%s", label, name);
+            snprintf(corpus->path, sizeof(corpus->path), "%s/%s", directory, name);
+            corpus->kind = kind;
+            corpus->synthetic = SYNTHETIC_NONE;
+        }
+#ifdef _WIN32
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    }
+    closedir(dir);
+#endif
+    qsort(&corpora[first], count - first, sizeof(Corpus), compareCorpora);
+    return count;
+}
+
+static int addSynthetic(Corpus *corpora, int count, const char *name, int kind, int synthetic) {
+    Corpus *corpus = &corpora[count];
+    snprintf(corpus->name, sizeof(corpus->name), "synthetic/%s", name);
+    corpus->path[0] = '\0';
+    corpus->kind = kind;
+    corpus->synthetic = synthetic;
+    return count + 1;
+}
+
+static double ratio(const CaseResult *result) {
+    return result->compressedSize > 0 ? (double)result->originalSize / result->compressedSize : 0;
+}
+
+static const char *kindName(int kind) {
+    return kind == KIND_IMAGE ? "image" : "bytes";
+}
+
+// The codec column: a library codec or a program case
+static const char *caseCodec(const Case *c) {
+    return c->program != NULL ? c->program->name : codec_name(c->codec);
+}
+
+static const char *caseChosen(const Case *c) {
+    return c->program != NULL ? c->program->name : codec_name(c->result.chosen);
+}
+
+static int writeCsv(const char *filename, const Case *cases, int count) {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error writing CSV file");
+        return -1;
+    }
+    fprintf(file, "corpus,kind,codec,original_bytes,compressed_bytes,ratio,compress_mbs_median,compress_mbs_p99,"
+                  "decompress_mbs_median,decompress_mbs_p99,peak_rss_kb,verified,chosen\n");
+    for (int i = 0; i < count; i++) {
+        const CaseResult *r = &cases[i].result;
+        fprintf(file, "%s,%s,%s,%llu,%llu,%.4f,%.2f,%.2f,%.2f,%.2f,%ld,%d,%s\n", cases[i].corpus->name,
+                kindName(cases[i].corpus->kind), caseCodec(&cases[i]), (unsigned long long)r->originalSize,
+                (unsigned long long)r->compressedSize, ratio(r), r->compressMedian, r->compressP99,
+                r->decompressMedian, r->decompressP99, r->peakRssKb, r->verified, caseChosen(&cases[i]));
+    }
+    fclose(file);
+    return 0;
+}
+
+static int writeJson(const char *filename, const Case *cases, int count, int trials) {
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        perror("Error writing JSON file");
+        return -1;
+    }
+    fprintf(file, "{\n  \"trials\": %d,\n  \"results\": [\n", trials);
+    for (int i = 0; i < count; i++) {
+        const CaseResult *r = &cases[i].result;
+        fprintf(file,
+                "    {\"corpus\": \"%s\", \"kind\": \"%s\", \"codec\": \"%s\", \"original_bytes\": %llu, "
+                "\"compressed_bytes\": %llu, \"ratio\": %.4f, \"compress_mbs\": {\"median\": %.2f, \"p99\": %.2f}, "
+                "\"decompress_mbs\": {\"median\": %.2f, \"p99\": %.2f}, \"peak_rss_kb\": %ld, \"verified\": %s, "
+                "\"chosen\": \"%s\", \"error\": \"%s\"}%s\n",
+                cases[i].corpus->name, kindName(cases[i].corpus->kind), caseCodec(&cases[i]),
+                (unsigned long long)r->originalSize, (unsigned long long)r->compressedSize, ratio(r),
+                r->compressMedian, r->compressP99, r->decompressMedian, r->decompressP99, r->peakRssKb,
+                r->verified ? "true" : "false", caseChosen(&cases[i]), codec_error_string(r->error), i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 0;
+}
+
+// Compare against a CSV written by an earlier run. A case regresses if either median speed dropped by more
+// than threshold percent or it compresses to more bytes than before. Returns the number of regressions.
+static int compareBaseline(const char *filename, const Case *cases, int count, double threshold) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        perror("Error reading baseline");
+        return -1;
+    }
+    char line[2048];
+    int regressions = 0, matched = 0;
+    printf("\nAgainst baseline %s (threshold %.1f%%):\n", filename, threshold);
+    if (fgets(line, sizeof(line), file) == NULL) line[0] = '\0';  // Header
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *fields[12];
+        int fieldCount = 0;
+        char *p = line;
+        while (fieldCount < 12) {
+            fields[fieldCount++] = p;
+            p = strchr(p, ',');
+            if (p == NULL) break;
+            *p++ = '\0';
+        }
+        if (fieldCount < 12) continue;
+        for (int i = 0; i < count; i++) {
+            const Case *c = &cases[i];
+            if (strcmp(fields[0], c->corpus->name) != 0 || strcmp(fields[1], kindName(c->corpus->kind)) != 0 ||
+                strcmp(fields[2], caseCodec(c)) != 0) {
+                continue;
+            }
+            matched++;
+            const CaseResult *r = &c->result;
+            unsigned long long oldCompressed = strtoull(fields[4], NULL, 10);
+            double oldCompress = atof(fields[6]), oldDecompress = atof(fields[8]);
+            double compressChange = oldCompress > 0 ? (r->compressMedian / oldCompress - 1) * 100 : 0;
+            double decompressChange = oldDecompress > 0 ? (r->decompressMedian / oldDecompress - 1) * 100 : 0;
+            int slower = compressChange < -threshold || decompressChange < -threshold;
+            int larger = r->compressedSize > oldCompressed;
+            if (slower || larger) {
+                regressions++;
+                printf("  REGRESSION %-36s %-10s compress %+6.1f%%  decompress %+6.1f%%  size %llu -> %llu\n",
+                       c->corpus->name, caseCodec(c), compressChange, decompressChange, oldCompressed,
+                       (unsigned long long)r->compressedSize);
+            }
+        }
+    }
+    fclose(file);
+    printf("  %d of %d cases matched the baseline, %d regression%s.\n", matched, count, regressions,
+           regressions == 1 ? "" : "s");
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    int trials = DEFAULT_TRIALS;
+    double threshold = DEFAULT_THRESHOLD;
+    const char *csvFilename = NULL, *jsonFilename = NULL, *baselineFilename = NULL;
+    const char *textDirectory = "../Text compression/Sample Text";
+    const char *imageDirectory = "../Image compression/Sample Images";
+    const char *programDirectory = "programs";
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (value != NULL && strcmp(argv[i], "--trials") == 0) {
+            trials = atoi(value);
+        } else if (value != NULL && strcmp(argv[i], "--csv") == 0) {
+            csvFilename = value;
+        } else if (value != NULL && strcmp(argv[i], "--json") == 0) {
+            jsonFilename = value;
+        } else if (value != NULL && strcmp(argv[i], "--baseline") == 0) {
+            baselineFilename = value;
+        } else if (value != NULL && strcmp(argv[i], "--threshold") == 0) {
+            threshold = atof(value);
+        } else if (value != NULL && strcmp(argv[i], "--text") == 0) {
+            textDirectory = value;
+        } else if (value != NULL && strcmp(argv[i], "--images") == 0) {
+            imageDirectory = value;
+        } else if (value != NULL && strcmp(argv[i], "--programs") == 0) {
+            programDirectory = value;
+        } else {
+            printf("Usage: benchmark [--trials N] [--csv out.csv] [--json out.json] [--baseline old.csv] "
+                   "[--threshold percent] [--text dir] [--images dir] [--programs dir]\n");
+            return 1;
+        }
+        i++;
+    }
+    if (trials < 1 || trials > MAX_TRIALS) {
+        printf("Trials must be between 1 and %d.\n", MAX_TRIALS);
+        return 1;
+    }
+
+    static Corpus corpora[MAX_CASES];
+    int corpusCount = addDirectory(corpora, 0, MAX_CASES - 8, textDirectory, ".txt", "text", KIND_BYTES);
+    corpusCount = addDirectory(corpora, corpusCount, MAX_CASES - 8, imageDirectory, ".bmp", "image", KIND_IMAGE);
+    corpusCount = addSynthetic(corpora, corpusCount, "random", KIND_BYTES, SYNTHETIC_RANDOM);
+    corpusCount = addSynthetic(corpora, corpusCount, "runs", KIND_BYTES, SYNTHETIC_RUNS);
+    corpusCount = addSynthetic(corpora, corpusCount, "low-entropy", KIND_BYTES, SYNTHETIC_LOW_ENTROPY);
+    corpusCount = addSynthetic(corpora, corpusCount, "random-image", KIND_IMAGE, SYNTHETIC_RANDOM);
+    corpusCount = addSynthetic(corpora, corpusCount, "runs-image", KIND_IMAGE, SYNTHETIC_RUNS);
+    corpusCount = addSynthetic(corpora, corpusCount, "low-entropy-image", KIND_IMAGE, SYNTHETIC_LOW_ENTROPY);
+    corpusCount = addSynthetic(corpora, corpusCount, "huge-alphabet-image", KIND_IMAGE, SYNTHETIC_HUGE_ALPHABET);
+
+    // The standalone programs that were built, and a scratch directory for their files
+    char programPaths[PROGRAM_COUNT][1100];
+    int found[PROGRAM_COUNT], foundCount = 0;
+    for (int p = 0; p < PROGRAM_COUNT; p++) {
+        found[p] = findProgram(programPaths[p], sizeof(programPaths[p]), programDirectory, programs[p].executable);
+        foundCount += found[p];
+    }
+    char work[1024];
+    if (foundCount == 0) {
+        printf("No standalone programs in %s, so only the library is measured (see the README to add them).\n",
+               programDirectory);
+    } else if (makeWorkDirectory(work, sizeof(work)) != 0) {
+        perror("Error creating a work directory for the standalone programs");
+        foundCount = 0;
+    }
+
+    // Every codec, then automatic selection, then the programs for this kind of corpus
+    static const int codecs[] = {CODEC_HUFFMAN, CODEC_RLE, CODEC_LZW, CODEC_STORE, CODEC_AUTO};
+    const int codecCount = (int)(sizeof(codecs) / sizeof(codecs[0]));
+    static Case cases[MAX_CASES * (5 + PROGRAM_COUNT)];
+    int caseCount = 0, failures = 0;
+    printf("%-36s %-10s %10s %8s %19s %19s %9s %s\n", "corpus", "codec", "bytes", "ratio", "compress MB/s",
+           "decompress MB/s", "peak RSS", "verified");
+    printf("%-36s %-10s %10s %8s %9s %9s %9s %9s %9s\n", "", "", "", "", "median", "p99", "median", "p99", "KB");
+    for (int i = 0; i < corpusCount; i++) {
+        for (int k = 0; k < codecCount + PROGRAM_COUNT; k++) {
+            const Program *program = k >= codecCount ? &programs[k - codecCount] : NULL;
+            if (program != NULL && (foundCount == 0 || !found[k - codecCount] || program->kind != corpora[i].kind)) {
+                continue;
+            }
+            Case *c = &cases[caseCount++];
+            c->corpus = &corpora[i];
+            c->codec = program != NULL ? CODEC_AUTO : codecs[k];
+            c->program = program;
+            if (program != NULL) {
+                runProgramCase(c->corpus, program, programPaths[k - codecCount], work, trials, &c->result);
+            } else {
+                measureCase(c->corpus, c->codec, trials, &c->result);
+            }
+            const CaseResult *r = &c->result;
+            if (r->error != CODEC_OK && program != NULL && r->exitStatus != 0) {
+                printf("%-36s %-10s failed: exit status %d\n", c->corpus->name, caseCodec(c), r->exitStatus);
+            } else if (r->error != CODEC_OK) {
+                printf("%-36s %-10s failed: %s\n", c->corpus->name, caseCodec(c), codec_error_string(r->error));
+            } else {
+                printf("%-36s %-10s %10llu %8.3f %9.1f %9.1f %9.1f %9.1f %9ld %s", c->corpus->name,
+                       caseCodec(c), (unsigned long long)r->originalSize, ratio(r), r->compressMedian,
+                       r->compressP99, r->decompressMedian, r->decompressP99, r->peakRssKb,
+                       r->verified ? "yes" : "NO");
+                if (program == NULL && c->codec == CODEC_AUTO) printf(" (%s)", codec_name(r->chosen));
+                printf("\n");
+            }
+            failures += r->error != CODEC_OK || !r->verified;
+        }
+    }
+    if (foundCount > 0) {
+#ifdef _WIN32
+        _rmdir(work);
+#else
+        rmdir(work);
+#endif
+    }
+
+    if (csvFilename != NULL && writeCsv(csvFilename, cases, caseCount) != 0) failures++;
+    if (jsonFilename != NULL && writeJson(jsonFilename, cases, caseCount, trials) != 0) failures++;
+    int regressions = baselineFilename != NULL ? compareBaseline(baselineFilename, cases, caseCount, threshold) : 0;
+    if (failures > 0) printf("%d case%s failed or did not round-trip.\n", failures, failures == 1 ? "" : "s");
+    return failures > 0 || regressions != 0 ? 1 : 0;
+}
@@ -0,0 +1,1241 @@
+#define _POSIX_C_SOURCE 200809L
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+#include "codec.h"
+#include "../Image compression/lzw_coder.h"
+#include "../Image compression/row_filter.h"
+#include "../Image compression/selective_rle.h"
+#include "../Text compression/context_huffman.h"
+#include "../Text compression/crc32c.h"
+#include "../Text compression/parallel_for.h"
+
+#define CODEC_KIND_BYTES 0
+#define CODEC_KIND_IMAGE 1
+
+// Largest table section of a context Huffman stream: count, context map and CONTEXT_HUFFMAN_MAX_TABLES
+// tables of 256 four-bit lengths
+#define CODEC_HUFFMAN_TABLE_BYTES \
+    ((8 + CONTEXT_HUFFMAN_CONTEXTS * 5 + CONTEXT_HUFFMAN_MAX_TABLES * (16 + 256 * 4)) / 8 + 8)
+
+// Codec prediction samples up to PREDICT_CHUNKS spread-out chunks of PREDICT_CHUNK_BYTES
+#define PREDICT_CHUNKS 16
+#define PREDICT_CHUNK_BYTES 4096
+#define PREDICT_HASH_BITS 12
+
+struct CodecContext {
+    BitWriter writer;                // Block under construction; keeps its capacity between calls
+    ContextHuffmanModel *model;      // Allocated on first use, like everything below
+    ContextHuffmanDecoder *decoder;
+    LzwEncoder lzwEncoder;  // The image LZW program's dictionaries
+    LzwDecoder lzwDecoder;
+    uint8_t *scratch;  // Packed or filtered image bytes
+    size_t scratchCapacity;
+    uint8_t *frame;  // A container frame read for an archive, and a block decoded from it for a partial read
+    size_t frameCapacity;
+    uint8_t *block;
+    size_t blockCapacity;
+};
+
+// A container index entry: where a frame starts in the file and the sizes of its block
+typedef struct {
+    uint64_t offset;
+    uint32_t compressedSize;
+    uint32_t size;
+} IndexEntry;
+
+struct CodecStream {
+    CodecContext *context;
+    int codec;
+    CodecWriteFn write;
+    CodecReadFn read;
+    void *opaque;
+    uint8_t *block;  // Uncompressed bytes waiting to be compressed, or decoded bytes waiting to be read
+    size_t blockSize;
+    size_t blockPos;
+    size_t blockLimit;  // The container's block size
+    uint8_t *packed;    // One compressed frame
+    size_t packedCapacity;
+    uint64_t offset;  // Bytes written so far, and the index of the frames among them
+    uint64_t total;
+    IndexEntry *index;
+    size_t indexCount;
+    size_t indexCapacity;
+    int started;  // The container header has been written or read
+    int ended;
+    int error;
+};
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_header(uint8_t *p, int codec, int kind, uint32_t a, uint32_t b) {
+    p[0] = (uint8_t)codec;
+    p[1] = (uint8_t)kind;
+    put_u32(&p[2], a);
+    put_u32(&p[6], b);
+}
+
+static int read_header(const void *src, size_t srcSize, int kind, int *codec, uint32_t *a, uint32_t *b) {
+    const uint8_t *p = (const uint8_t *)src;
+    if (src == NULL || srcSize < CODEC_HEADER_SIZE || p[0] >= CODEC_COUNT || p[1] != kind) {
+        return CODEC_ERROR_CORRUPT;
+    }
+    *codec = p[0];
+    *a = get_u32(&p[2]);
+    *b = get_u32(&p[6]);
+    return CODEC_OK;
+}
+
+// Empty the context's writer, keeping its buffer
+static BitWriter *reset_writer(CodecContext *context) {
+    BitWriter *writer = &context->writer;
+    writer->size = 0;
+    writer->bits = 0;
+    writer->count = 0;
+    writer->failed = 0;
+    return writer;
+}
+
+static int reserve_scratch(CodecContext *context, size_t size) {
+    if (size <= context->scratchCapacity) {
+        return CODEC_OK;
+    }
+    uint8_t *scratch = (uint8_t *)realloc(context->scratch, size);
+    if (scratch == NULL) {
+        return CODEC_ERROR_MEMORY;
+    }
+    context->scratch = scratch;
+    context->scratchCapacity = size;
+    return CODEC_OK;
+}
+
+static int ensure_huffman(CodecContext *context) {
+    if (context->model == NULL) context->model = (ContextHuffmanModel *)malloc(sizeof(ContextHuffmanModel));
+    if (context->decoder == NULL) context->decoder = (ContextHuffmanDecoder *)malloc(sizeof(ContextHuffmanDecoder));
+    return context->model == NULL || context->decoder == NULL ? CODEC_ERROR_MEMORY : CODEC_OK;
+}
+
+CodecContext *codec_create(void) {
+    return (CodecContext *)calloc(1, sizeof(CodecContext));
+}
+
+void codec_free(CodecContext *context) {
+    if (context == NULL) {
+        return;
+    }
+    free(context->writer.data);
+    free(context->model);
+    free(context->decoder);
+    lzw_encoder_free(&context->lzwEncoder);
+    lzw_decoder_free(&context->lzwDecoder);
+    free(context->scratch);
+    free(context->frame);
+    free(context->block);
+    free(context);
+}
+
+const char *codec_name(int codec) {
+    switch (codec) {
+        case CODEC_HUFFMAN: return "huffman";
+        case CODEC_RLE: return "rle";
+        case CODEC_LZW: return "lzw";
+        case CODEC_STORE: return "store";
+        case CODEC_AUTO: return "auto";
+        default: return "unknown";
+    }
+}
+
+const char *codec_error_string(int error) {
+    switch (error) {
+        case CODEC_OK: return "success";
+        case CODEC_ERROR_ARGUMENT: return "invalid argument";
+        case CODEC_ERROR_MEMORY: return "out of memory";
+        case CODEC_ERROR_DST_TOO_SMALL: return "destination buffer too small";
+        case CODEC_ERROR_CORRUPT: return "corrupt or truncated data";
+        case CODEC_ERROR_IO: return "read or write failed";
+        case CODEC_ERROR_CHECKSUM: return "checksum mismatch";
+        default: return "unknown error";
+    }
+}
+
+// ---- RLE ----
+
+// The image RLE program's selective RLE codes an int-sized buffer, so longer spans are coded in pieces of
+// RLE_SPAN_BYTES (whole pixels) and the decoder cuts its output at the same points
+#define RLE_SPAN_BYTES (3 << 20)
+
+// Most packet bytes a span of length bytes can take
+static size_t rle_span_bound(size_t length) {
+    return (length / 3 + length / RLE_SPAN_BYTES + 1) * 4;
+}
+
+// Append the selective RLE packets of length bytes
+static void rle_encode_span(BitWriter *writer, const uint8_t *data, size_t length) {
+    for (size_t start = 0; start < length; start += RLE_SPAN_BYTES) {
+        int piece = (int)(length - start < RLE_SPAN_BYTES ? length - start : RLE_SPAN_BYTES);
+        if (bit_writer_reserve(writer, ((size_t)piece / 3 + 1) * 4) != 0) return;
+        writer->size += selective_compress_rle(&data[start], piece, &writer->data[writer->size]);
+    }
+}
+
+// Decode exactly length bytes from the packets at input[*pos], moving *pos past them
+static int rle_decode_span(const uint8_t *input, size_t inputSize, size_t *pos, uint8_t *output, size_t length) {
+    for (size_t start = 0; start < length; start += RLE_SPAN_BYTES) {
+        int piece = (int)(length - start < RLE_SPAN_BYTES ? length - start : RLE_SPAN_BYTES);
+        long used = decompress_rle(&input[*pos], inputSize - *pos, &output[start], piece);
+        if (used < 0) return CODEC_ERROR_CORRUPT;
+        *pos += (size_t)used;
+    }
+    return CODEC_OK;
+}
+
+// ---- LZW ----
+
+static int lzw_encode_block(CodecContext *context, BitWriter *writer, const uint8_t *input, size_t size) {
+    if (context->lzwEncoder.keys == NULL && lzw_encoder_init(&context->lzwEncoder) != 0) {
+        return CODEC_ERROR_MEMORY;
+    }
+    return lzw_encode(&context->lzwEncoder, writer, input, size) == 0 ? CODEC_OK : CODEC_ERROR_MEMORY;
+}
+
+// Decode an LZW code stream into exactly size bytes
+static int lzw_decode_block(CodecContext *context, const uint8_t *input, size_t inputSize, uint8_t *output,
+                            size_t size) {
+    if (context->lzwDecoder.prefix == NULL && lzw_decoder_init(&context->lzwDecoder) != 0) {
+        return CODEC_ERROR_MEMORY;
+    }
+    return lzw_decode(&context->lzwDecoder, input, inputSize, output, size) == 0 ? CODEC_OK : CODEC_ERROR_CORRUPT;
+}
+
+// ---- Codec prediction ----
+
+// Checks the dimensions and returns the bytes in one packed row, or 0 if the image is unusable
+static size_t image_row_bytes(int width, int height) {
+    if (width <= 0 || height <= 0 || (uint64_t)width * 3 * height > SIZE_MAX / 4) {
+        return 0;
+    }
+    return (size_t)width * 3;
+}
+
+typedef struct {
+    uint32_t histogram[256];                  // Bytes, or for images the residuals against the pixel to the left
+    uint32_t recent[1 << PREDICT_HASH_BITS];  // Last 4-byte sequence seen with each hash
+    uint64_t bytes;
+    uint64_t pixels;   // Whole 3-byte pixels
+    uint64_t packets;  // Selective RLE packets they would take
+    uint64_t windows;  // 4-byte sequences looked up
+    uint64_t repeats;  // ... and found, as LZW would find a dictionary phrase
+} Sample;
+
+static void sample_chunk(Sample *sample, const uint8_t *p, size_t length, int unitSize) {
+    uint32_t window = 0;
+    for (size_t i = 0; i < length; i++) {
+        sample->histogram[unitSize == 3 && i >= 3 ? (uint8_t)(p[i] - p[i - 3]) : p[i]]++;
+        window = window << 8 | p[i];
+        if (i >= 3) {
+            uint32_t *slot = &sample->recent[(window * 2654435761u) >> (32 - PREDICT_HASH_BITS)];
+            sample->repeats += *slot == window;
+            *slot = window;
+            sample->windows++;
+        }
+    }
+    for (int i = 0; i + 3 <= (int)length;) {
+        int run = scan_run(p, i, (int)length);
+        sample->packets += run >= RLE_THRESHOLD ? 1 : run;
+        sample->pixels += run;
+        i += run * 3;
+    }
+    sample->bytes += length;
+}
+
+// Estimate each codec's output for size bytes from the sample and return the smallest; ties go to the faster
+// codec. The estimates were fitted on the sample files and a range of binaries: RLE writes a 4-byte packet per
+// long run and per pixel outside one,
+// Huffman with its order-1 contexts comes to about 0.9 of the order-0 entropy but never below a bit per byte,
+// and LZW output shrinks roughly in step with how many 4-byte sequences have been seen before.
+static int predict_codec(const Sample *sample, size_t size, size_t huffmanExtra) {
+    if (sample->bytes == 0) {
+        return CODEC_STORE;
+    }
+    double entropy = 0;
+    for (int s = 0; s < 256; s++) {
+        if (sample->histogram[s] == 0) continue;
+        double p = (double)sample->histogram[s] / sample->bytes;
+        entropy -= p * log2(p);
+    }
+    double repeatShare = sample->windows ? (double)sample->repeats / sample->windows : 0;
+    double estimates[CODEC_COUNT];
+    // A codec has to promise a 2% saving to be worth its time; sampled entropy of random data comes out a
+    // little under 8 bits, which would otherwise send it to Huffman only to be stored after all
+    estimates[CODEC_STORE] = 0.98 * size;
+    estimates[CODEC_RLE] = sample->pixels ? (double)sample->packets / sample->pixels * ((double)size / 3) * 4 : 0.98 * size;
+    // The order-1 gain fades out over the last bit of entropy: random data has no context to exploit
+    double contextGain = entropy > 7 ? 0.9 + 0.1 * (entropy - 7) : 0.9;
+    estimates[CODEC_HUFFMAN] = size * fmax(contextGain * entropy, 1.0) / 8 + 512 + huffmanExtra;
+    estimates[CODEC_LZW] = size * (0.02 + 1.1 * (1 - repeatShare));
+
+    static const int byCost[CODEC_COUNT] = {CODEC_STORE, CODEC_RLE, CODEC_HUFFMAN, CODEC_LZW};
+    int best = CODEC_STORE;
+    for (int i = 1; i < CODEC_COUNT; i++) {
+        if (estimates[byCost[i]] < estimates[best]) best = byCost[i];
+    }
+    return best;
+}
+
+int codec_predict(const void *src, size_t size) {
+    const uint8_t *data = (const uint8_t *)src;
+    if (data == NULL || size == 0) {
+        return CODEC_STORE;
+    }
+    Sample sample;
+    memset(&sample, 0, sizeof(sample));
+    if (size <= PREDICT_CHUNKS * PREDICT_CHUNK_BYTES) {
+        sample_chunk(&sample, data, size, 1);
+    } else {
+        size_t step = (size - PREDICT_CHUNK_BYTES) / (PREDICT_CHUNKS - 1);
+        for (int i = 0; i < PREDICT_CHUNKS; i++) sample_chunk(&sample, &data[i * step], PREDICT_CHUNK_BYTES, 1);
+    }
+    return predict_codec(&sample, size, 0);
+}
+
+int codec_predict_image(const CodecImage *image) {
+    size_t rowBytes = image != NULL && image->pixels != NULL ? image_row_bytes(image->width, image->height) : 0;
+    if (rowBytes == 0) {
+        return CODEC_STORE;
+    }
+    // The start of up to PREDICT_CHUNKS evenly spaced rows, in whole pixels
+    size_t length = rowBytes < PREDICT_CHUNK_BYTES ? rowBytes : PREDICT_CHUNK_BYTES / 3 * 3;
+    int rows = image->height < PREDICT_CHUNKS ? image->height : PREDICT_CHUNKS;
+    Sample sample;
+    memset(&sample, 0, sizeof(sample));
+    for (int i = 0; i < rows; i++) {
+        size_t y = rows > 1 ? (size_t)(image->height - 1) * i / (rows - 1) : 0;
+        sample_chunk(&sample, &image->pixels[y * image->stride], length, 3);
+    }
+    return predict_codec(&sample, rowBytes * image->height, (size_t)image->height);
+}
+
+// ---- Bytes ----
+
+size_t codec_compress_bound(int codec, size_t size) {
+    switch (codec) {
+        case CODEC_STORE:
+        case CODEC_AUTO: return CODEC_HEADER_SIZE + size;
+        case CODEC_HUFFMAN: return CODEC_HEADER_SIZE + CODEC_HUFFMAN_TABLE_BYTES + size + size / 2 + 8;
+        case CODEC_RLE: return CODEC_HEADER_SIZE + rle_span_bound(size);
+        // At most one 16-bit code per byte, a clear code per dictionary and the end code
+        case CODEC_LZW: return CODEC_HEADER_SIZE + 2 * size + 2 * (size / (LZW_MAX_CODES - LZW_FIRST_CODE)) + 8;
+        default: return 0;
+    }
+}
+
+// Move a finished block from the context's writer to dst
+static int finish_block(CodecContext *context, void *dst, size_t dstCapacity, size_t *dstSize) {
+    BitWriter *writer = &context->writer;
+    if (writer->failed) {
+        return CODEC_ERROR_MEMORY;
+    }
+    if (writer->size > dstCapacity) {
+        return CODEC_ERROR_DST_TOO_SMALL;
+    }
+    memcpy(dst, writer->data, writer->size);
+    *dstSize = writer->size;
+    return CODEC_OK;
+}
+
+// Code a bytes block into the context's writer
+static int encode_bytes(CodecContext *context, int codec, const uint8_t *data, size_t srcSize) {
+    BitWriter *writer = reset_writer(context);
+    if (bit_writer_reserve(writer, CODEC_HEADER_SIZE) != 0) {
+        return CODEC_ERROR_MEMORY;
+    }
+    put_header(writer->data, codec, CODEC_KIND_BYTES, (uint32_t)srcSize, (uint32_t)((uint64_t)srcSize >> 32));
+    writer->size = CODEC_HEADER_SIZE;
+
+    int result = CODEC_OK;
+    if (codec == CODEC_HUFFMAN) {
+        result = ensure_huffman(context);
+        if (result == CODEC_OK) {
+            context_huffman_build(context->model, data, srcSize, 1);
+            context_huffman_encode(writer, context->model, data, srcSize);
+        }
+    } else if (codec == CODEC_RLE) {
+        rle_encode_span(writer, data, srcSize);
+    } else if (codec == CODEC_LZW) {
+        result = lzw_encode_block(context, writer, data, srcSize);
+    } else if (bit_writer_reserve(writer, srcSize) == 0) {
+        memcpy(&writer->data[writer->size], data, srcSize);
+        writer->size += srcSize;
+    }
+    return result == CODEC_OK && writer->failed ? CODEC_ERROR_MEMORY : result;
+}
+
+int codec_compress(CodecContext *context, int codec, const void *src, size_t srcSize, void *dst, size_t dstCapacity,
+                   size_t *dstSize) {
+    if (context == NULL || (src == NULL && srcSize > 0) || dst == NULL || dstSize == NULL || codec < CODEC_AUTO ||
+        codec >= CODEC_COUNT) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    const uint8_t *data = (const uint8_t *)src;
+    int chosen = codec == CODEC_AUTO ? codec_predict(data, srcSize) : codec;
+    int result = encode_bytes(context, chosen, data, srcSize);
+    // A misprediction must not cost more than the header
+    if (result == CODEC_OK && codec == CODEC_AUTO && context->writer.size > CODEC_HEADER_SIZE + srcSize) {
+        result = encode_bytes(context, CODEC_STORE, data, srcSize);
+    }
+    return result == CODEC_OK ? finish_block(context, dst, dstCapacity, dstSize) : result;
+}
+
+int codec_decompressed_size(const void *src, size_t srcSize, uint64_t *size) {
+    int codec;
+    uint32_t low, high;
+    int result = read_header(src, srcSize, CODEC_KIND_BYTES, &codec, &low, &high);
+    if (result == CODEC_OK) *size = low | (uint64_t)high << 32;
+    return result;
+}
+
+int codec_decompress(CodecContext *context, const void *src, size_t srcSize, void *dst, size_t dstCapacity,
+                     size_t *dstSize) {
+    if (context == NULL || dstSize == NULL || (dst == NULL && dstCapacity > 0)) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    int codec;
+    uint32_t low, high;
+    int result = read_header(src, srcSize, CODEC_KIND_BYTES, &codec, &low, &high);
+    if (result != CODEC_OK) {
+        return result;
+    }
+    uint64_t size = low | (uint64_t)high << 32;
+    if (size > dstCapacity) {
+        return CODEC_ERROR_DST_TOO_SMALL;
+    }
+    const uint8_t *input = (const uint8_t *)src + CODEC_HEADER_SIZE;
+    size_t inputSize = srcSize - CODEC_HEADER_SIZE;
+    uint8_t *output = (uint8_t *)dst;
+
+    if (codec == CODEC_HUFFMAN) {
+        // No code is shorter than a bit
+        if (size / 8 > inputSize) return CODEC_ERROR_CORRUPT;
+        result = ensure_huffman(context);
+        if (result != CODEC_OK) return result;
+        BitReader reader;
+        bit_reader_init(&reader, input, inputSize);
+        if (context_huffman_read_tables(&reader, context->decoder) != 0 ||
+            context_huffman_decode(&reader, context->decoder, output, size) != 0) {
+            result = CODEC_ERROR_CORRUPT;
+        }
+    } else if (codec == CODEC_RLE) {
+        size_t pos = 0;
+        result = rle_decode_span(input, inputSize, &pos, output, (size_t)size);
+        if (result == CODEC_OK && pos != inputSize) result = CODEC_ERROR_CORRUPT;
+    } else if (codec == CODEC_LZW) {
+        result = lzw_decode_block(context, input, inputSize, output, size);
+    } else if (inputSize == size) {
+        memcpy(output, input, inputSize);
+    } else {
+        result = CODEC_ERROR_CORRUPT;
+    }
+    if (result == CODEC_OK) *dstSize = (size_t)size;
+    return result;
+}
+
+// ---- Images ----
+
+size_t codec_compress_image_bound(int codec, int width, int height) {
+    size_t rowBytes = image_row_bytes(width, height);
+    if (rowBytes == 0) {
+        return 0;
+    }
+    size_t size = rowBytes * height;
+    switch (codec) {
+        case CODEC_STORE:
+        case CODEC_AUTO: return CODEC_HEADER_SIZE + size;
+        case CODEC_HUFFMAN: return codec_compress_bound(CODEC_HUFFMAN, size) + height;
+        case CODEC_RLE: return CODEC_HEADER_SIZE + height * rle_span_bound(rowBytes);
+        case CODEC_LZW: return codec_compress_bound(CODEC_LZW, size);
+        default: return 0;
+    }
+}
+
+// Code an image block into the context's writer
+static int encode_image(CodecContext *context, int codec, const CodecImage *image) {
+    size_t rowBytes = (size_t)image->width * 3;
+    size_t height = (size_t)image->height;
+    size_t size = rowBytes * height;
+    // Huffman keeps the residual planes plus the chosen row, a filter trial row and a zero row; LZW a packed copy
+    size_t scratchSize = codec == CODEC_HUFFMAN ? size + 3 * rowBytes : codec == CODEC_LZW ? size : 0;
+    int result = reserve_scratch(context, scratchSize);
+    if (result != CODEC_OK) {
+        return result;
+    }
+    BitWriter *writer = reset_writer(context);
+    if (bit_writer_reserve(writer, CODEC_HEADER_SIZE + (codec == CODEC_HUFFMAN ? height : 0)) != 0) {
+        return CODEC_ERROR_MEMORY;
+    }
+    put_header(writer->data, codec, CODEC_KIND_IMAGE, (uint32_t)image->width, (uint32_t)image->height);
+    writer->size = CODEC_HEADER_SIZE;
+
+    uint8_t *scratch = context->scratch;
+    if (codec == CODEC_HUFFMAN) {
+        // Each row gets the filter with the smallest sum of absolute residuals. The residuals are split into
+        // blue, green and red planes, so the order-1 contexts see one channel at a time.
+        size_t pixelCount = size / 3;
+        uint8_t *residuals = &scratch[size];
+        uint8_t *trial = &scratch[size + rowBytes];
+        uint8_t *zeros = &scratch[size + 2 * rowBytes];
+        memset(zeros, 0, rowBytes);
+        for (size_t y = 0; y < height; y++) {
+            const uint8_t *row = &image->pixels[y * image->stride];
+            const uint8_t *previous = y > 0 ? &image->pixels[(y - 1) * image->stride] : zeros;
+            writer->data[writer->size++] = (uint8_t)row_filter_choose(row, previous, rowBytes, residuals, trial);
+            size_t pixel = y * (size_t)image->width;
+            for (size_t x = 0; x < (size_t)image->width; x++) {
+                scratch[pixel + x] = residuals[x * 3];
+                scratch[pixelCount + pixel + x] = residuals[x * 3 + 1];
+                scratch[2 * pixelCount + pixel + x] = residuals[x * 3 + 2];
+            }
+        }
+        result = ensure_huffman(context);
+        if (result != CODEC_OK) return result;
+        context_huffman_build(context->model, scratch, size, 1);
+        context_huffman_encode(writer, context->model, scratch, size);
+    } else if (codec == CODEC_RLE) {
+        // Each row on its own, as the image RLE program's row layout codes them
+        for (size_t y = 0; y < height; y++) rle_encode_span(writer, &image->pixels[y * image->stride], rowBytes);
+    } else if (codec == CODEC_LZW) {
+        const uint8_t *packed = image->pixels;
+        if (image->stride != rowBytes) {
+            for (size_t y = 0; y < height; y++) memcpy(&scratch[y * rowBytes], &image->pixels[y * image->stride], rowBytes);
+            packed = scratch;
+        }
+        result = lzw_encode_block(context, writer, packed, size);
+    } else if (bit_writer_reserve(writer, size) == 0) {
+        for (size_t y = 0; y < height; y++) {
+            memcpy(&writer->data[writer->size], &image->pixels[y * image->stride], rowBytes);
+            writer->size += rowBytes;
+        }
+    }
+    return result == CODEC_OK && writer->failed ? CODEC_ERROR_MEMORY : result;
+}
+
+int codec_compress_image(CodecContext *context, int codec, const CodecImage *image, void *dst, size_t dstCapacity,
+                         size_t *dstSize) {
+    if (context == NULL || image == NULL || image->pixels == NULL || dst == NULL || dstSize == NULL ||
+        codec < CODEC_AUTO || codec >= CODEC_COUNT) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    size_t rowBytes = image_row_bytes(image->width, image->height);
+    if (rowBytes == 0 || image->stride < rowBytes) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    size_t size = rowBytes * image->height;
+    int chosen = codec == CODEC_AUTO ? codec_predict_image(image) : codec;
+    int result = encode_image(context, chosen, image);
+    if (result == CODEC_OK && codec == CODEC_AUTO && context->writer.size > CODEC_HEADER_SIZE + size) {
+        result = encode_image(context, CODEC_STORE, image);
+    }
+    return result == CODEC_OK ? finish_block(context, dst, dstCapacity, dstSize) : result;
+}
+
+int codec_image_info(const void *src, size_t srcSize, int *width, int *height) {
+    int codec;
+    uint32_t w, h;
+    int result = read_header(src, srcSize, CODEC_KIND_IMAGE, &codec, &w, &h);
+    if (result != CODEC_OK) {
+        return result;
+    }
+    if (w > INT32_MAX || h > INT32_MAX || image_row_bytes((int)w, (int)h) == 0) {
+        return CODEC_ERROR_CORRUPT;
+    }
+    *width = (int)w;
+    *height = (int)h;
+    return CODEC_OK;
+}
+
+int codec_decompress_image(CodecContext *context, const void *src, size_t srcSize, CodecImage *image) {
+    if (context == NULL || image == NULL || image->pixels == NULL) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    int codec, width, height;
+    uint32_t w, h;
+    int result = read_header(src, srcSize, CODEC_KIND_IMAGE, &codec, &w, &h);
+    if (result == CODEC_OK) result = codec_image_info(src, srcSize, &width, &height);
+    if (result != CODEC_OK) {
+        return result;
+    }
+    size_t rowBytes = (size_t)width * 3;
+    if (image->width != width || image->height != height || image->stride < rowBytes) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    size_t size = rowBytes * height;
+    const uint8_t *input = (const uint8_t *)src + CODEC_HEADER_SIZE;
+    size_t inputSize = srcSize - CODEC_HEADER_SIZE;
+    if (codec == CODEC_RLE) {
+        size_t pos = 0;
+        for (size_t y = 0; y < (size_t)height; y++) {
+            result = rle_decode_span(input, inputSize, &pos, &image->pixels[y * image->stride], rowBytes);
+            if (result != CODEC_OK) return result;
+        }
+        return pos == inputSize ? CODEC_OK : CODEC_ERROR_CORRUPT;
+    }
+    // Packed rows can be decoded in place when the image has no row padding; stored rows are copied directly
+    int inPlace = codec == CODEC_STORE || (codec == CODEC_LZW && image->stride == rowBytes);
+    if (!inPlace) {
+        result = reserve_scratch(context, codec == CODEC_HUFFMAN ? size + rowBytes : size);
+        if (result != CODEC_OK) return result;
+    }
+    uint8_t *packed = inPlace ? image->pixels : context->scratch;
+
+    if (codec == CODEC_HUFFMAN) {
+        if ((size_t)height > inputSize || (size - height) / 8 > inputSize) return CODEC_ERROR_CORRUPT;
+        for (int y = 0; y < height; y++) {
+            if (input[y] >= FILTER_COUNT) return CODEC_ERROR_CORRUPT;
+        }
+        result = ensure_huffman(context);
+        if (result != CODEC_OK) return result;
+        BitReader reader;
+        bit_reader_init(&reader, input + height, inputSize - height);
+        if (context_huffman_read_tables(&reader, context->decoder) != 0 ||
+            context_huffman_decode(&reader, context->decoder, packed, size) != 0) {
+            return CODEC_ERROR_CORRUPT;
+        }
+        size_t pixelCount = size / 3;
+        uint8_t *zeros = &packed[size];
+        memset(zeros, 0, rowBytes);
+        for (size_t y = 0; y < (size_t)height; y++) {
+            uint8_t *row = &image->pixels[y * image->stride];
+            size_t pixel = y * (size_t)width;
+            for (size_t x = 0; x < (size_t)width; x++) {
+                row[x * 3] = packed[pixel + x];
+                row[x * 3 + 1] = packed[pixelCount + pixel + x];
+                row[x * 3 + 2] = packed[2 * pixelCount + pixel + x];
+            }
+            row_filter_undo(input[y], row, y > 0 ? &image->pixels[(y - 1) * image->stride] : zeros, rowBytes);
+        }
+        return CODEC_OK;
+    }
+    if (codec == CODEC_STORE) {
+        if (inputSize != size) return CODEC_ERROR_CORRUPT;
+        for (size_t y = 0; y < (size_t)height; y++) memcpy(&image->pixels[y * image->stride], &input[y * rowBytes], rowBytes);
+        return CODEC_OK;
+    }
+    result = lzw_decode_block(context, input, inputSize, packed, size);
+    if (result == CODEC_OK && !inPlace) {
+        for (size_t y = 0; y < (size_t)height; y++) memcpy(&image->pixels[y * image->stride], &packed[y * rowBytes], rowBytes);
+    }
+    return result;
+}
+
+// ---- CRC32C ----
+
+uint32_t codec_crc32c(uint32_t crc, const void *data, size_t size) {
+    return crc32c(crc, data, size);
+}
+
+// ---- Container ----
+
+// File layout (all integers little-endian):
+//   header   "CDCF", version (u8), 3 reserved bytes, block size (u32)
+//   frames   compressed size (u32), CRC32C of the decompressed block (u32), then the block with its own header
+//            (codec and decompressed size). Every block but the last decompresses to exactly the block size.
+//   end      a compressed size of 0
+//   index    one entry per frame: file offset of the frame (u64), compressed size (u32), decompressed size (u32)
+//   footer   frame count (u32), total decompressed size (u64), CRC32C of the index and the count and total (u32),
+//            "CDCX"
+// A stream reader needs only the header and frames. The index lets a reader that can seek find the block
+// holding any offset with one division and decode blocks on several threads.
+#define CONTAINER_MAGIC "CDCF"
+#define CONTAINER_INDEX_MAGIC "CDCX"
+#define CONTAINER_VERSION 1
+#define CONTAINER_HEADER_SIZE 12
+#define FRAME_HEADER_SIZE 8
+#define INDEX_ENTRY_SIZE 16
+#define FOOTER_SIZE 20
+#define CONTAINER_MAX_BLOCK (64 << 20)  // Larger block sizes in a header are taken as damage
+#define EXTRACT_BATCH_PER_THREAD 2      // Blocks each thread decodes before a batch is written out
+
+static void put_u64(uint8_t *p, uint64_t value) {
+    put_u32(p, (uint32_t)value);
+    put_u32(p + 4, (uint32_t)(value >> 32));
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static int reserve_buffer(uint8_t **buffer, size_t *capacity, size_t size) {
+    if (size <= *capacity) {
+        return CODEC_OK;
+    }
+    uint8_t *grown = (uint8_t *)realloc(*buffer, size);
+    if (grown == NULL) {
+        return CODEC_ERROR_MEMORY;
+    }
+    *buffer = grown;
+    *capacity = size;
+    return CODEC_OK;
+}
+
+// ---- Streams ----
+
+static CodecStream *stream_create(CodecContext *context, int codec, size_t packedCapacity) {
+    CodecStream *stream = (CodecStream *)calloc(1, sizeof(CodecStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    stream->context = context;
+    stream->codec = codec;
+    stream->blockLimit = CODEC_STREAM_BLOCK;
+    stream->block = (uint8_t *)malloc(CODEC_STREAM_BLOCK);
+    stream->packed = (uint8_t *)malloc(packedCapacity);
+    stream->packedCapacity = packedCapacity;
+    if (stream->block == NULL || stream->packed == NULL) {
+        codec_stream_free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+void codec_stream_free(CodecStream *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    free(stream->block);
+    free(stream->packed);
+    free(stream->index);
+    free(stream);
+}
+
+CodecStream *codec_stream_compressor(CodecContext *context, int codec, CodecWriteFn write, void *opaque) {
+    if (context == NULL || write == NULL || codec < CODEC_AUTO || codec >= CODEC_COUNT) {
+        return NULL;
+    }
+    CodecStream *stream =
+        stream_create(context, codec, FRAME_HEADER_SIZE + codec_compress_bound(codec, CODEC_STREAM_BLOCK));
+    if (stream != NULL) {
+        stream->write = write;
+        stream->opaque = opaque;
+    }
+    return stream;
+}
+
+static int stream_emit(CodecStream *stream, const void *data, size_t size) {
+    if (stream->write(stream->opaque, data, size) != 0) {
+        return CODEC_ERROR_IO;
+    }
+    stream->offset += size;
+    return CODEC_OK;
+}
+
+static int stream_write_header(CodecStream *stream) {
+    uint8_t header[CONTAINER_HEADER_SIZE] = {0};
+    memcpy(header, CONTAINER_MAGIC, 4);
+    header[4] = CONTAINER_VERSION;
+    put_u32(&header[8], CODEC_STREAM_BLOCK);
+    stream->started = 1;
+    return stream_emit(stream, header, sizeof(header));
+}
+
+// Compress the collected bytes as one frame, note it in the index and pass it on
+static int stream_flush(CodecStream *stream) {
+    if (stream->indexCount == stream->indexCapacity) {
+        size_t capacity = stream->indexCapacity ? stream->indexCapacity * 2 : 64;
+        IndexEntry *index = (IndexEntry *)realloc(stream->index, capacity * sizeof(IndexEntry));
+        if (index == NULL) return CODEC_ERROR_MEMORY;
+        stream->index = index;
+        stream->indexCapacity = capacity;
+    }
+    size_t size;
+    int result = codec_compress(stream->context, stream->codec, stream->block, stream->blockSize,
+                                stream->packed + FRAME_HEADER_SIZE, stream->packedCapacity - FRAME_HEADER_SIZE, &size);
+    if (result == CODEC_OK) {
+        IndexEntry *entry = &stream->index[stream->indexCount++];
+        entry->offset = stream->offset;
+        entry->compressedSize = (uint32_t)size;
+        entry->size = (uint32_t)stream->blockSize;
+        stream->total += stream->blockSize;
+        put_u32(stream->packed, (uint32_t)size);
+        put_u32(stream->packed + 4, codec_crc32c(0, stream->block, stream->blockSize));
+        result = stream_emit(stream, stream->packed, size + FRAME_HEADER_SIZE);
+    }
+    stream->blockSize = 0;
+    return result;
+}
+
+int codec_stream_write(CodecStream *stream, const void *data, size_t size) {
+    if (stream == NULL || stream->write == NULL || (data == NULL && size > 0)) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    if (stream->error == CODEC_OK && !stream->started) stream->error = stream_write_header(stream);
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (stream->error == CODEC_OK && size > 0) {
+        size_t take = CODEC_STREAM_BLOCK - stream->blockSize;
+        if (take > size) take = size;
+        memcpy(&stream->block[stream->blockSize], bytes, take);
+        stream->blockSize += take;
+        bytes += take;
+        size -= take;
+        if (stream->blockSize == CODEC_STREAM_BLOCK) stream->error = stream_flush(stream);
+    }
+    return stream->error;
+}
+
+// Flush the last frame, then write the end marker, the index and the footer
+int codec_stream_finish(CodecStream *stream) {
+    if (stream == NULL || stream->write == NULL) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    if (stream->error == CODEC_OK && !stream->started) stream->error = stream_write_header(stream);
+    if (stream->error == CODEC_OK && stream->blockSize > 0) stream->error = stream_flush(stream);
+    if (stream->error != CODEC_OK || stream->ended) {
+        return stream->error;
+    }
+    size_t indexSize = 4 + stream->indexCount * INDEX_ENTRY_SIZE + FOOTER_SIZE;
+    uint8_t *tail = (uint8_t *)malloc(indexSize);
+    if (tail == NULL) {
+        stream->error = CODEC_ERROR_MEMORY;
+        return stream->error;
+    }
+    put_u32(tail, 0);
+    uint8_t *p = tail + 4;
+    for (size_t i = 0; i < stream->indexCount; i++, p += INDEX_ENTRY_SIZE) {
+        put_u64(p, stream->index[i].offset);
+        put_u32(p + 8, stream->index[i].compressedSize);
+        put_u32(p + 12, stream->index[i].size);
+    }
+    put_u32(p, (uint32_t)stream->indexCount);
+    put_u64(p + 4, stream->total);
+    put_u32(p + 12, codec_crc32c(0, tail + 4, (size_t)(p + 12 - (tail + 4))));
+    memcpy(p + 16, CONTAINER_INDEX_MAGIC, 4);
+    stream->error = stream_emit(stream, tail, indexSize);
+    free(tail);
+    stream->ended = 1;
+    return stream->error;
+}
+
+CodecStream *codec_stream_decompressor(CodecContext *context, CodecReadFn read, void *opaque) {
+    if (context == NULL || read == NULL) {
+        return NULL;
+    }
+    CodecStream *stream = stream_create(context, 0, 4096);
+    if (stream != NULL) {
+        stream->read = read;
+        stream->opaque = opaque;
+    }
+    return stream;
+}
+
+static int read_exactly(CodecStream *stream, uint8_t *data, size_t size) {
+    while (size > 0) {
+        long got = stream->read(stream->opaque, data, size);
+        if (got < 0) return CODEC_ERROR_IO;
+        if (got == 0) return CODEC_ERROR_CORRUPT;  // The stream ends inside a frame
+        data += got;
+        size -= (size_t)got;
+    }
+    return CODEC_OK;
+}
+
+// Check the container header and size the block buffer for its block size
+static int stream_read_header(CodecStream *stream) {
+    uint8_t header[CONTAINER_HEADER_SIZE];
+    int result = read_exactly(stream, header, sizeof(header));
+    if (result != CODEC_OK) {
+        return result;
+    }
+    size_t blockLimit = get_u32(&header[8]);
+    if (memcmp(header, CONTAINER_MAGIC, 4) != 0 || header[4] != CONTAINER_VERSION || blockLimit == 0 ||
+        blockLimit > CONTAINER_MAX_BLOCK) {
+        return CODEC_ERROR_CORRUPT;
+    }
+    if (blockLimit > stream->blockLimit) {
+        uint8_t *block = (uint8_t *)realloc(stream->block, blockLimit);
+        if (block == NULL) return CODEC_ERROR_MEMORY;
+        stream->block = block;
+    }
+    stream->blockLimit = blockLimit;
+    stream->started = 1;
+    return CODEC_OK;
+}
+
+// Read, decode and check the next frame, or note the end of the frames
+static int stream_next_block(CodecStream *stream) {
+    uint8_t prefix[FRAME_HEADER_SIZE];
+    int result = read_exactly(stream, prefix, 4);
+    if (result != CODEC_OK) {
+        return result;
+    }
+    size_t packedSize = get_u32(prefix);
+    if (packedSize == 0) {
+        stream->ended = 1;
+        return CODEC_OK;
+    }
+    result = read_exactly(stream, prefix + 4, 4);
+    if (result == CODEC_OK) result = reserve_buffer(&stream->packed, &stream->packedCapacity, packedSize);
+    if (result == CODEC_OK) result = read_exactly(stream, stream->packed, packedSize);
+    if (result != CODEC_OK) {
+        return result;
+    }
+    uint64_t size;
+    result = codec_decompressed_size(stream->packed, packedSize, &size);
+    if (result == CODEC_OK && size > stream->blockLimit) result = CODEC_ERROR_CORRUPT;
+    if (result == CODEC_OK) {
+        result = codec_decompress(stream->context, stream->packed, packedSize, stream->block, stream->blockLimit,
+                                  &stream->blockSize);
+    }
+    if (result == CODEC_OK && codec_crc32c(0, stream->block, stream->blockSize) != get_u32(prefix + 4)) {
+        result = CODEC_ERROR_CHECKSUM;
+    }
+    stream->blockPos = 0;
+    if (result != CODEC_OK) stream->blockSize = 0;
+    return result;
+}
+
+long codec_stream_read(CodecStream *stream, void *data, size_t size) {
+    if (stream == NULL || stream->read == NULL || (data == NULL && size > 0)) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    if (stream->error == CODEC_OK && !stream->started) stream->error = stream_read_header(stream);
+    uint8_t *bytes = (uint8_t *)data;
+    size_t done = 0;
+    if (size > LONG_MAX) size = LONG_MAX;
+    while (done < size && stream->error == CODEC_OK) {
+        if (stream->blockPos == stream->blockSize) {
+            if (stream->ended) break;
+            stream->error = stream_next_block(stream);
+            continue;
+        }
+        size_t take = stream->blockSize - stream->blockPos;
+        if (take > size - done) take = size - done;
+        memcpy(&bytes[done], &stream->block[stream->blockPos], take);
+        stream->blockPos += take;
+        done += take;
+    }
+    return stream->error != CODEC_OK ? stream->error : (long)done;
+}
+
+// ---- Archives: random access and parallel decoding through the index ----
+
+struct CodecArchive {
+#ifdef _WIN32
+    HANDLE file;
+#else
+    int fd;
+#endif
+    uint64_t fileSize;
+    uint64_t total;
+    size_t blockSize;
+    uint32_t count;
+    IndexEntry *index;
+};
+
+// Read size bytes at offset. Positioned reads leave no shared file position, so threads can read at once.
+static int read_at(const CodecArchive *archive, uint64_t offset, void *data, size_t size) {
+    uint8_t *bytes = (uint8_t *)data;
+    while (size > 0) {
+#ifdef _WIN32
+        OVERLAPPED position;
+        memset(&position, 0, sizeof(position));
+        position.Offset = (DWORD)offset;
+        position.OffsetHigh = (DWORD)(offset >> 32);
+        DWORD chunk = size > (1u << 30) ? (1u << 30) : (DWORD)size, got = 0;
+        if (!ReadFile(archive->file, bytes, chunk, &got, &position) || got == 0) return CODEC_ERROR_IO;
+#else
+        ssize_t got = pread(archive->fd, bytes, size, (off_t)offset);
+        if (got <= 0) return CODEC_ERROR_IO;
+#endif
+        bytes += got;
+        offset += got;
+        size -= (size_t)got;
+    }
+    return CODEC_OK;
+}
+
+void codec_archive_close(CodecArchive *archive) {
+    if (archive == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    if (archive->file != INVALID_HANDLE_VALUE) CloseHandle(archive->file);
+#else
+    if (archive->fd >= 0) close(archive->fd);
+#endif
+    free(archive->index);
+    free(archive);
+}
+
+// Open a container file and load and check its index. Every frame must lie between the header and the end
+// marker, follow the one before it, and hold a full block except the last.
+int codec_archive_open(const char *path, CodecArchive **opened) {
+    if (path == NULL || opened == NULL) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    *opened = NULL;
+    CodecArchive *archive = (CodecArchive *)calloc(1, sizeof(CodecArchive));
+    if (archive == NULL) {
+        return CODEC_ERROR_MEMORY;
+    }
+#ifdef _WIN32
+    archive->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER fileSize;
+    if (archive->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(archive->file, &fileSize)) {
+        codec_archive_close(archive);
+        return CODEC_ERROR_IO;
+    }
+    archive->fileSize = (uint64_t)fileSize.QuadPart;
+#else
+    struct stat info;
+    archive->fd = open(path, O_RDONLY);
+    if (archive->fd < 0 || fstat(archive->fd, &info) != 0) {
+        codec_archive_close(archive);
+        return CODEC_ERROR_IO;
+    }
+    archive->fileSize = (uint64_t)info.st_size;
+#endif
+
+    uint8_t header[CONTAINER_HEADER_SIZE], footer[FOOTER_SIZE];
+    int result = CODEC_ERROR_CORRUPT;
+    if (archive->fileSize >= CONTAINER_HEADER_SIZE + 4 + FOOTER_SIZE) {
+        result = read_at(archive, 0, header, sizeof(header));
+        if (result == CODEC_OK) result = read_at(archive, archive->fileSize - FOOTER_SIZE, footer, sizeof(footer));
+    }
+    if (result == CODEC_OK) {
+        archive->blockSize = get_u32(&header[8]);
+        archive->count = get_u32(footer);
+        archive->total = get_u64(&footer[4]);
+        if (memcmp(header, CONTAINER_MAGIC, 4) != 0 || header[4] != CONTAINER_VERSION || archive->blockSize == 0 ||
+            archive->blockSize > CONTAINER_MAX_BLOCK || memcmp(&footer[16], CONTAINER_INDEX_MAGIC, 4) != 0 ||
+            (uint64_t)archive->count * INDEX_ENTRY_SIZE > archive->fileSize - CONTAINER_HEADER_SIZE - 4 - FOOTER_SIZE) {
+            result = CODEC_ERROR_CORRUPT;
+        }
+    }
+    size_t indexBytes = (size_t)archive->count * INDEX_ENTRY_SIZE;
+    uint8_t *raw = NULL;
+    if (result == CODEC_OK) {
+        raw = (uint8_t *)malloc(indexBytes + 4 + 16);
+        archive->index = (IndexEntry *)malloc((archive->count ? archive->count : 1) * sizeof(IndexEntry));
+        if (raw == NULL || archive->index == NULL) result = CODEC_ERROR_MEMORY;
+    }
+    // The end marker, the entries, then the count and total that the footer's CRC also covers
+    uint64_t endMarker = archive->fileSize - FOOTER_SIZE - indexBytes - 4;
+    if (result == CODEC_OK) result = read_at(archive, endMarker, raw, indexBytes + 4);
+    if (result == CODEC_OK) {
+        memcpy(raw + 4 + indexBytes, footer, 12);
+        if (get_u32(raw) != 0 || codec_crc32c(0, raw + 4, indexBytes + 12) != get_u32(&footer[12])) {
+            result = CODEC_ERROR_CHECKSUM;
+        }
+    }
+    uint64_t expected = CONTAINER_HEADER_SIZE, total = 0;
+    for (uint32_t i = 0; result == CODEC_OK && i < archive->count; i++) {
+        const uint8_t *p = raw + 4 + (size_t)i * INDEX_ENTRY_SIZE;
+        IndexEntry *entry = &archive->index[i];
+        entry->offset = get_u64(p);
+        entry->compressedSize = get_u32(p + 8);
+        entry->size = get_u32(p + 12);
+        int lastBlock = i + 1 == archive->count;
+        if (entry->offset != expected || entry->compressedSize < CODEC_HEADER_SIZE ||
+            (lastBlock ? entry->size == 0 || entry->size > archive->blockSize : entry->size != archive->blockSize)) {
+            result = CODEC_ERROR_CORRUPT;
+        }
+        expected += FRAME_HEADER_SIZE + (uint64_t)entry->compressedSize;
+        total += entry->size;
+    }
+    if (result == CODEC_OK && (expected != endMarker || total != archive->total)) {
+        result = CODEC_ERROR_CORRUPT;
+    }
+    free(raw);
+    if (result != CODEC_OK) {
+        codec_archive_close(archive);
+        return result;
+    }
+    *opened = archive;
+    return CODEC_OK;
+}
+
+uint64_t codec_archive_size(const CodecArchive *archive) {
+    return archive != NULL ? archive->total : 0;
+}
+
+int codec_archive_block_count(const CodecArchive *archive) {
+    return archive != NULL ? (int)archive->count : 0;
+}
+
+// Read frame block of the archive and decode it into dst, which must hold the block. The frame is read into
+// the context's frame buffer, so each thread needs its own context.
+static int archive_decode_block(const CodecArchive *archive, CodecContext *context, uint32_t block, uint8_t *dst) {
+    const IndexEntry *entry = &archive->index[block];
+    size_t frameSize = FRAME_HEADER_SIZE + (size_t)entry->compressedSize;
+    int result = reserve_buffer(&context->frame, &context->frameCapacity, frameSize);
+    if (result == CODEC_OK) result = read_at(archive, entry->offset, context->frame, frameSize);
+    if (result != CODEC_OK) {
+        return result;
+    }
+    const uint8_t *frame = context->frame;
+    uint64_t size;
+    size_t decoded;
+    if (get_u32(frame) != entry->compressedSize ||
+        codec_decompressed_size(frame + FRAME_HEADER_SIZE, entry->compressedSize, &size) != CODEC_OK ||
+        size != entry->size) {
+        return CODEC_ERROR_CORRUPT;
+    }
+    result = codec_decompress(context, frame + FRAME_HEADER_SIZE, entry->compressedSize, dst, entry->size, &decoded);
+    if (result == CODEC_OK && codec_crc32c(0, dst, decoded) != get_u32(frame + 4)) {
+        result = CODEC_ERROR_CHECKSUM;
+    }
+    return result;
+}
+
+// Read size bytes starting at decompressed offset. Only the blocks that hold them are read and decoded.
+int codec_archive_read(CodecArchive *archive, CodecContext *context, uint64_t offset, void *dst, size_t size,
+                       size_t *got) {
+    if (archive == NULL || context == NULL || got == NULL || (dst == NULL && size > 0)) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    *got = 0;
+    if (offset >= archive->total) {
+        return CODEC_OK;
+    }
+    if (size > archive->total - offset) size = (size_t)(archive->total - offset);
+    uint8_t *output = (uint8_t *)dst;
+    while (*got < size) {
+        uint64_t position = offset + *got;
+        uint32_t block = (uint32_t)(position / archive->blockSize);
+        size_t start = (size_t)(position % archive->blockSize);
+        size_t length = archive->index[block].size - start;
+        if (length > size - *got) length = size - *got;
+        int result;
+        if (start == 0 && length == archive->index[block].size) {
+            result = archive_decode_block(archive, context, block, &output[*got]);
+        } else {
+            // Part of a block: decode all of it on the side
+            result = reserve_buffer(&context->block, &context->blockCapacity, archive->blockSize);
+            if (result == CODEC_OK) result = archive_decode_block(archive, context, block, context->block);
+            if (result == CODEC_OK) memcpy(&output[*got], &context->block[start], length);
+        }
+        if (result != CODEC_OK) {
+            return result;
+        }
+        *got += length;
+    }
+    return CODEC_OK;
+}
+
+// One batch of blocks, decoded by workers threads into consecutive blockSize slots of output
+typedef struct {
+    const CodecArchive *archive;
+    uint8_t *output;
+    uint32_t first;
+    int workers;
+    CodecContext *contexts[PARALLEL_MAX_THREADS];
+    int results[PARALLEL_MAX_THREADS];
+} ExtractBatch;
+
+// parallel_for task: block first + index, decoded with its worker's context
+static void extract_block(void *context, int index) {
+    ExtractBatch *batch = (ExtractBatch *)context;
+    int worker = index % batch->workers;
+    if (batch->results[worker] == CODEC_OK) {
+        batch->results[worker] = archive_decode_block(batch->archive, batch->contexts[worker], batch->first + index,
+                                                      &batch->output[(size_t)index * batch->archive->blockSize]);
+    }
+}
+
+// Decode the whole archive into outputPath on threadCount threads (0: one per core). Blocks are decoded a
+// batch at a time, each thread with its own context, and each batch is written out in order.
+int codec_archive_extract(CodecArchive *archive, CodecContext *context, const char *outputPath, int threadCount) {
+    if (archive == NULL || context == NULL || outputPath == NULL) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    if (threadCount <= 0) threadCount = parallel_thread_count();
+    threadCount = parallel_for_threads(archive->count, threadCount);
+    uint32_t batchBlocks = (uint32_t)threadCount * EXTRACT_BATCH_PER_THREAD;
+    if (batchBlocks > archive->count) batchBlocks = archive->count > 0 ? archive->count : 1;
+
+    ExtractBatch batch;
+    batch.archive = archive;
+    batch.output = (uint8_t *)malloc((size_t)batchBlocks * archive->blockSize);
+    FILE *output = batch.output != NULL ? fopen(outputPath, "wb") : NULL;
+    int result = batch.output == NULL ? CODEC_ERROR_MEMORY : output == NULL ? CODEC_ERROR_IO : CODEC_OK;
+    for (int t = 0; t < threadCount; t++) {
+        batch.contexts[t] = t == 0 ? context : codec_create();
+        if (batch.contexts[t] == NULL) result = CODEC_ERROR_MEMORY;
+    }
+
+    for (uint32_t first = 0; result == CODEC_OK && first < archive->count; first += batchBlocks) {
+        int count = (int)(archive->count - first < batchBlocks ? archive->count - first : batchBlocks);
+        batch.first = first;
+        batch.workers = parallel_for_threads(count, threadCount);
+        for (int t = 0; t < batch.workers; t++) batch.results[t] = CODEC_OK;
+        parallel_for(count, batch.workers, extract_block, &batch);
+        for (int t = 0; t < batch.workers && result == CODEC_OK; t++) result = batch.results[t];
+
+        size_t bytes = (size_t)(count - 1) * archive->blockSize + archive->index[first + count - 1].size;
+        if (result == CODEC_OK && fwrite(batch.output, 1, bytes, output) != bytes) result = CODEC_ERROR_IO;
+    }
+    for (int t = 1; t < threadCount; t++) codec_free(batch.contexts[t]);
+    if (output != NULL && fclose(output) != 0 && result == CODEC_OK) result = CODEC_ERROR_IO;
+    if (output != NULL && result != CODEC_OK) remove(outputPath);  // Never leave a partial file behind
+    free(batch.output);
+    return result;
+}
+
+// ---- Files ----
+
+static int file_write(void *opaque, const void *data, size_t size) {
+    return fwrite(data, 1, size, (FILE *)opaque) == size ? 0 : -1;
+}
+
+int codec_compress_file(CodecContext *context, int codec, const char *inputPath, const char *outputPath) {
+    if (context == NULL || inputPath == NULL || outputPath == NULL || codec < CODEC_AUTO || codec >= CODEC_COUNT) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    FILE *input = fopen(inputPath, "rb");
+    FILE *output = input != NULL ? fopen(outputPath, "wb") : NULL;
+    CodecStream *stream = output != NULL ? codec_stream_compressor(context, codec, file_write, output) : NULL;
+    int result = output == NULL ? CODEC_ERROR_IO : stream == NULL ? CODEC_ERROR_MEMORY : CODEC_OK;
+    uint8_t buffer[65536];
+    while (result == CODEC_OK) {
+        size_t got = fread(buffer, 1, sizeof(buffer), input);
+        if (got == 0) {
+            result = ferror(input) ? CODEC_ERROR_IO : codec_stream_finish(stream);
+            break;
+        }
+        result = codec_stream_write(stream, buffer, got);
+    }
+    codec_stream_free(stream);
+    if (output != NULL && fclose(output) != 0 && result == CODEC_OK) result = CODEC_ERROR_IO;
+    if (output != NULL && result != CODEC_OK) remove(outputPath);  // Never leave a partial file behind
+    if (input != NULL) fclose(input);
+    return result;
+}
+
+// Files are decoded through their index, on one thread per core
+int codec_decompress_file(CodecContext *context, const char *inputPath, const char *outputPath) {
+    if (context == NULL || inputPath == NULL || outputPath == NULL) {
+        return CODEC_ERROR_ARGUMENT;
+    }
+    CodecArchive *archive;
+    int result = codec_archive_open(inputPath, &archive);
+    if (result == CODEC_OK) {
+        result = codec_archive_extract(archive, context, outputPath, 0);
+        codec_archive_close(archive);
+    }
+    return result;
+}
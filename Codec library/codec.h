@@ -0,0 +1,129 @@
+// One interface to the project's Huffman, RLE and LZW coders (plus plain storage), for byte buffers (text or any other data) and for
+// 24-bit images, so they can be called in-process instead of through the standalone programs.
+//
+// The LZW code stream, the PNG-style row filters and the selective RLE packets are the image programs' own
+// coders, from the shared headers in Image compression; bytes Huffman is the text Huffman program's context
+// coder. The files are not interchangeable, though: every block carries the header below and files are the
+// container below, and the image Huffman layout (filter bytes, then blue, green and red residual planes) is not
+// the image Huffman program's format. The library cannot read or write the standalone programs' files.
+//
+// Build it as a static library next to the Text compression and Image compression folders, whose headers it uses:
+//   gcc -O2 -c codec.c && ar rcs libcodec.a codec.o
+// and link programs that use it with -lm -pthread.
+//
+// Every call takes a CodecContext. It owns the coders' scratch state (Huffman tables, the LZW dictionary and
+// output buffers), which is allocated on first use and kept, so a program that codes many buffers should
+// create one context and reuse it. A context must not be used by two threads at once; give each thread its own.
+//
+// A compressed block starts with a CODEC_HEADER_SIZE byte header:
+//   codec (u8), kind (u8: 0 bytes, 1 image), then two little-endian u32:
+//   the original size (low and high halves) for bytes, or the width and height for images.
+// Streams and files are a container: a header with the magic "CDCF", a version and the block size, then one frame
+// per block (its compressed size, a CRC32C of its decompressed bytes, the block), a compressed size of 0, and an
+// index of the frames with a footer ending in "CDCX". codec.c describes the layout field by field.
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CODEC_HUFFMAN 0  // Order-1 context Huffman for bytes; row-filtered residuals for images
+#define CODEC_RLE 1      // Selective RLE: [count u8][3 bytes] packets, one per long run or per pixel
+#define CODEC_LZW 2      // GIF-style LZW with 9 to 16 bit codes
+#define CODEC_STORE 3    // The bytes or packed pixel rows as they are
+#define CODEC_COUNT 4
+// Accepted wherever a codec is chosen: each block gets the codec codec_predict expects to code it smallest,
+// and is stored if that codec would still make it larger. The block header records the codec used.
+#define CODEC_AUTO -1
+
+#define CODEC_OK 0
+#define CODEC_ERROR_ARGUMENT -1       // Unknown codec, null pointer or image too large
+#define CODEC_ERROR_MEMORY -2
+#define CODEC_ERROR_DST_TOO_SMALL -3  // The output would not fit in the capacity given
+#define CODEC_ERROR_CORRUPT -4        // The compressed data is invalid, truncated or of the wrong kind
+#define CODEC_ERROR_IO -5             // A stream callback or file operation failed
+#define CODEC_ERROR_CHECKSUM -6       // A decoded block or a container index does not match its CRC32C
+
+#define CODEC_HEADER_SIZE 10
+#define CODEC_STREAM_BLOCK (1 << 20)  // Bytes a stream or file collects before it compresses a block
+
+typedef struct CodecContext CodecContext;
+typedef struct CodecStream CodecStream;
+typedef struct CodecArchive CodecArchive;
+
+// A 24-bit image: 3 bytes per pixel (blue, green, red, as in a BMP), rows stride bytes apart
+typedef struct {
+    int width;
+    int height;
+    size_t stride;
+    uint8_t *pixels;
+} CodecImage;
+
+// Stream callbacks. A writer returns 0, or -1 on failure. A reader returns the number of bytes it read
+// (0 at the end of its input), or -1 on failure.
+typedef int (*CodecWriteFn)(void *opaque, const void *data, size_t size);
+typedef long (*CodecReadFn)(void *opaque, void *data, size_t size);
+
+CodecContext *codec_create(void);
+void codec_free(CodecContext *context);
+const char *codec_name(int codec);
+const char *codec_error_string(int error);
+
+// Sample a buffer or image cheaply (byte entropy, how many RLE packets its pixels take, how often 4-byte
+// sequences recur) and return the codec expected to code it smallest: CODEC_STORE when nothing pays off.
+int codec_predict(const void *src, size_t size);
+int codec_predict_image(const CodecImage *image);
+
+// Buffers. codec_compress_bound is the largest block codec_compress can produce for size bytes, so a
+// destination of that capacity never fails with CODEC_ERROR_DST_TOO_SMALL.
+size_t codec_compress_bound(int codec, size_t size);
+int codec_compress(CodecContext *context, int codec, const void *src, size_t srcSize, void *dst, size_t dstCapacity,
+                   size_t *dstSize);
+// Original size of a bytes block, read from its header
+int codec_decompressed_size(const void *src, size_t srcSize, uint64_t *size);
+int codec_decompress(CodecContext *context, const void *src, size_t srcSize, void *dst, size_t dstCapacity,
+                     size_t *dstSize);
+
+// Images. codec_image_info reads an image block's dimensions, so the caller can allocate the pixels that
+// codec_decompress_image fills; image->width and image->height must match them.
+size_t codec_compress_image_bound(int codec, int width, int height);
+int codec_compress_image(CodecContext *context, int codec, const CodecImage *image, void *dst, size_t dstCapacity,
+                         size_t *dstSize);
+int codec_image_info(const void *src, size_t srcSize, int *width, int *height);
+int codec_decompress_image(CodecContext *context, const void *src, size_t srcSize, CodecImage *image);
+
+// CRC32C (Castagnoli) of size bytes, continuing from crc (0 to start). Uses the SSE4.2 or ARMv8 CRC
+// instructions when the CPU has them.
+uint32_t codec_crc32c(uint32_t crc, const void *data, size_t size);
+
+// Incremental streams. A compressor collects written bytes into blocks of CODEC_STREAM_BLOCK and passes each
+// compressed frame to write; codec_stream_finish flushes the last one and writes the index. A decompressor
+// pulls frames through read as codec_stream_read needs them, checks each block's CRC32C, and returns 0 once
+// the frames have ended; it never needs the index, so it can read from a pipe.
+// The context is borrowed for the stream's lifetime.
+CodecStream *codec_stream_compressor(CodecContext *context, int codec, CodecWriteFn write, void *opaque);
+int codec_stream_write(CodecStream *stream, const void *data, size_t size);
+int codec_stream_finish(CodecStream *stream);
+CodecStream *codec_stream_decompressor(CodecContext *context, CodecReadFn read, void *opaque);
+long codec_stream_read(CodecStream *stream, void *data, size_t size);
+void codec_stream_free(CodecStream *stream);
+
+// Container files opened through their index. codec_archive_read decodes only the blocks that hold the bytes
+// asked for, so any offset is reached in one step; *got is short only at the end of the data.
+// codec_archive_extract decodes every block on threadCount threads (0: one per core), each with its own
+// context besides the one given, and writes them to outputPath in order; on failure outputPath is removed.
+// An archive may be read by several threads at once, each with its own context.
+int codec_archive_open(const char *path, CodecArchive **archive);
+uint64_t codec_archive_size(const CodecArchive *archive);
+int codec_archive_block_count(const CodecArchive *archive);
+int codec_archive_read(CodecArchive *archive, CodecContext *context, uint64_t offset, void *dst, size_t size,
+                       size_t *got);
+int codec_archive_extract(CodecArchive *archive, CodecContext *context, const char *outputPath, int threadCount);
+void codec_archive_close(CodecArchive *archive);
+
+// Whole files: compressed through a stream, decompressed through an archive on every core. On failure the
+// partial outputPath is removed.
+int codec_compress_file(CodecContext *context, int codec, const char *inputPath, const char *outputPath);
+int codec_decompress_file(CodecContext *context, const char *inputPath, const char *outputPath);
+
+#endif
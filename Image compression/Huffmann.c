@@ -1,116 +1,306 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include "bmp_io.h"
+#include "row_filter.h"
+#include "../Text compression/file_util.h"
+#include "../Text compression/parallel_for.h"
 #define MAX_COLORS 16777216 // 256^3 for 24-bit RGB colors
+#define MAX_CODE_LENGTH 32  // Longest Huffman code, so a code fits in an unsigned int
 
-#pragma pack(push, 1)
+// Color histogram that starts as a small open-addressing hash map and only switches to a dense
+// MAX_COLORS table once the hash map would need more memory than the dense table. A slot costs 8 bytes
+// (key and value), so that is the growth to 8M slots: the map holds up to 2M colors in 4M slots (32 MB)
+// and the next color beyond that moves everything into the 64 MB dense table.
+// After the Huffman symbols are assigned, each value is replaced by the color's symbol index so
+// the same structure serves code lookups during encoding.
+#define HISTOGRAM_INITIAL_CAPACITY 4096  // Hash slots to start with (power of two)
+#define EMPTY_SLOT 0xFFFFFFFFu           // Never a 24-bit color
 
-// BMP file header (14 bytes)
 typedef struct {
-    unsigned char bfType[2];        // File type
-    unsigned int bfSize;            // Size of the file
-    unsigned short bfReserved1;     // Reserved; must be zero
-    unsigned short bfReserved2;     // Reserved; must be zero
-    unsigned int bfOffBits;         // Offset to start of pixel data
-} BMPFileHeader;
-
-// DIB header (typically 40 bytes for BITMAPINFOHEADER)
-typedef struct {
-    unsigned int biSize;            // Size of the header
-    int biWidth;                    // Width of the image
-    int biHeight;                   // Height of the image
-    unsigned short biPlanes;        // Number of color planes
-    unsigned short biBitCount;      // Bits per pixel
-    unsigned int biCompression;     // Compression type
-    unsigned int biSizeImage;       // Size of the image data
-    int biXPelsPerMeter;             // Horizontal resolution
-    int biYPelsPerMeter;             // Vertical resolution
-    unsigned int biClrUsed;         // Number of colors in the color palette
-    unsigned int biClrImportant;    // Important colors
-} BMPDIBHeader;
-
-#pragma pack(pop)
-
-void readBMP(const char *filename, unsigned char **pixelData, int *width, int *height, unsigned int *colorFrequency) {
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        perror("Error opening BMP file");
-        return;
+    unsigned int *keys;     // Colors in the hash map (EMPTY_SLOT if unused)
+    unsigned int *values;   // Frequency (or symbol index) of each color
+    unsigned int capacity;  // Number of hash slots, always a power of two
+    unsigned int count;     // Number of distinct colors
+    unsigned int *dense;    // MAX_COLORS values indexed by color once the map is dense, else NULL
+    unsigned int slotLimit; // Most hash slots the map may grow to (0: no limit, it goes dense instead)
+} ColorHistogram;
+
+static unsigned int hashColor(unsigned int color, unsigned int mask) {
+    return (color * 2654435761u) & mask; // Knuth multiplicative hash
+}
+
+int initColorHistogram(ColorHistogram *histogram) {
+    histogram->capacity = HISTOGRAM_INITIAL_CAPACITY;
+    histogram->count = 0;
+    histogram->dense = NULL;
+    histogram->slotLimit = 0;
+    histogram->keys = (unsigned int *)malloc(histogram->capacity * sizeof(unsigned int));
+    histogram->values = (unsigned int *)calloc(histogram->capacity, sizeof(unsigned int));
+    if (histogram->keys == NULL || histogram->values == NULL) {
+        perror("Error allocating memory for color histogram");
+        free(histogram->keys);
+        free(histogram->values);
+        histogram->keys = histogram->values = NULL;
+        return -1;
     }
+    memset(histogram->keys, 0xFF, histogram->capacity * sizeof(unsigned int));
+    return 0;
+}
 
-    // Read BMP file header
-    BMPFileHeader fileHeader;
-    fread(&fileHeader, sizeof(BMPFileHeader), 1, file);
+void freeColorHistogram(ColorHistogram *histogram) {
+    free(histogram->keys);
+    free(histogram->values);
+    free(histogram->dense);
+    histogram->keys = histogram->values = histogram->dense = NULL;
+}
 
-    // Verify if it's a BMP file
-    if (fileHeader.bfType[0] != 'B' || fileHeader.bfType[1] != 'M') {
-        printf("Not a valid BMP file.\n");
-        fclose(file);
-        return;
+// Rehash into twice as many slots, or move every color into the dense table when that is smaller.
+// Returns 1 without changing anything when the map would pass its slot limit.
+static int growColorHistogram(ColorHistogram *histogram) {
+    unsigned int newCapacity = histogram->capacity * 2;
+    size_t hashBytes = (size_t)newCapacity * 2 * sizeof(unsigned int);
+    if (histogram->slotLimit != 0 && newCapacity > histogram->slotLimit) {
+        return 1;
     }
 
-    // Read DIB header
-    BMPDIBHeader dibHeader;
-    fread(&dibHeader, sizeof(BMPDIBHeader), 1, file);
+    if (hashBytes >= (size_t)MAX_COLORS * sizeof(unsigned int)) {
+        histogram->dense = (unsigned int *)calloc(MAX_COLORS, sizeof(unsigned int));
+        if (histogram->dense == NULL) {
+            perror("Error allocating memory for color frequency array");
+            return -1;
+        }
+        for (unsigned int i = 0; i < histogram->capacity; i++) {
+            if (histogram->keys[i] != EMPTY_SLOT) {
+                histogram->dense[histogram->keys[i]] = histogram->values[i];
+            }
+        }
+        free(histogram->keys);
+        free(histogram->values);
+        histogram->keys = histogram->values = NULL;
+        return 0;
+    }
 
-    // Check for valid bit count (only 24-bit is supported)
-    if (dibHeader.biBitCount != 24) {
-        printf("Only 24-bit BMP files are supported. Found: %u bits.\n", dibHeader.biBitCount);
-        fclose(file);
-        return;
+    unsigned int *keys = (unsigned int *)malloc(newCapacity * sizeof(unsigned int));
+    unsigned int *values = (unsigned int *)calloc(newCapacity, sizeof(unsigned int));
+    if (keys == NULL || values == NULL) {
+        perror("Error allocating memory for color histogram");
+        free(keys);
+        free(values);
+        return -1;
     }
+    memset(keys, 0xFF, newCapacity * sizeof(unsigned int));
 
-    // Check for uncompressed BMP (compression type 0)
-    if (dibHeader.biCompression != 0) {
-        printf("Only uncompressed BMP files are supported. Found compression type: %u.\n", dibHeader.biCompression);
-        fclose(file);
-        return;
+    for (unsigned int i = 0; i < histogram->capacity; i++) {
+        if (histogram->keys[i] != EMPTY_SLOT) {
+            unsigned int slot = hashColor(histogram->keys[i], newCapacity - 1);
+            while (keys[slot] != EMPTY_SLOT) {
+                slot = (slot + 1) & (newCapacity - 1);
+            }
+            keys[slot] = histogram->keys[i];
+            values[slot] = histogram->values[i];
+        }
     }
+    free(histogram->keys);
+    free(histogram->values);
+    histogram->keys = keys;
+    histogram->values = values;
+    histogram->capacity = newCapacity;
+    return 0;
+}
 
-    // Set width and height
-    *width = dibHeader.biWidth;
-    *height = dibHeader.biHeight;
+// Return the value slot for a color, inserting it (with value 0) if insert is set; NULL if absent
+unsigned int *colorHistogramSlot(ColorHistogram *histogram, unsigned int color, int insert) {
+    if (histogram->dense != NULL) {
+        if (histogram->dense[color] == 0 && insert) {
+            histogram->count++;
+        }
+        return &histogram->dense[color];
+    }
 
-    // Calculate the padded row size (each row is padded to a multiple of 4 bytes)
-    int row_padded = (*width * 3 + 3) & (~3);
-    
-    // Allocate memory for pixel data
-    *pixelData = (unsigned char *)malloc(row_padded * (*height));
-    if (*pixelData == NULL) {
-        perror("Error allocating memory for pixel data");
-        fclose(file);
-        return;
+    unsigned int mask = histogram->capacity - 1;
+    unsigned int slot = hashColor(color, mask);
+    while (histogram->keys[slot] != color) {
+        if (histogram->keys[slot] == EMPTY_SLOT) {
+            if (!insert) {
+                return NULL;
+            }
+            // Keep the load factor at or below 1/2
+            if ((histogram->count + 1) * 2 > histogram->capacity) {
+                if (growColorHistogram(histogram) != 0) {
+                    return NULL;
+                }
+                return colorHistogramSlot(histogram, color, insert);
+            }
+            histogram->keys[slot] = color;
+            histogram->values[slot] = 0;
+            histogram->count++;
+            break;
+        }
+        slot = (slot + 1) & mask;
     }
+    return &histogram->values[slot];
+}
 
-    // Move the file pointer to the start of pixel data
-    fseek(file, fileHeader.bfOffBits, SEEK_SET);
+// Add every color count of source into destination
+int mergeColorHistogram(ColorHistogram *destination, ColorHistogram *source) {
+    if (source->dense != NULL) {
+        for (unsigned int color = 0; color < MAX_COLORS; color++) {
+            if (source->dense[color] > 0) {
+                unsigned int *slot = colorHistogramSlot(destination, color, 1);
+                if (slot == NULL) return -1;
+                *slot += source->dense[color];
+            }
+        }
+        return 0;
+    }
+    for (unsigned int i = 0; i < source->capacity; i++) {
+        if (source->keys[i] != EMPTY_SLOT) {
+            unsigned int *slot = colorHistogramSlot(destination, source->keys[i], 1);
+            if (slot == NULL) return -1;
+            *slot += source->values[i];
+        }
+    }
+    return 0;
+}
 
-    // Read pixel data
-    size_t bytesRead = fread(*pixelData, sizeof(unsigned char), row_padded * (*height), file);
-    if (bytesRead != row_padded * (*height)) {
-        printf("Error reading pixel data from BMP file. Bytes read: %zu\n", bytesRead);
-        free(*pixelData);
-        fclose(file);
+// Row shards for the parallel color count; shard 0 counts into the caller's histogram.
+// Each shard's hash map may take 1/shardCount of the dense table's memory. If any shard needs more, the
+// image has too many colors for hash maps to pay off, and one shared dense table is filled instead: every
+// shard scans all rows but only counts its own range of colors, so no two threads write the same entry.
+// Either way the count never holds more than about one dense table.
+typedef struct {
+    const unsigned char *pixelData;
+    int width;
+    int height;
+    int row_padded;
+    int shardCount;
+    ColorHistogram *histograms;
+    int *status;               // 0 done, 1 over the slot limit, -1 out of memory
+    unsigned int *dense;       // The shared dense table, for countDenseColorRange
+    unsigned int *distinct;    // Colors each range found
+} ColorCountContext;
+
+static void countColorShard(void *context, int shard) {
+    ColorCountContext *ctx = (ColorCountContext *)context;
+    ColorHistogram *histogram = &ctx->histograms[shard];
+    int firstRow = (int)((long long)ctx->height * shard / ctx->shardCount);
+    int endRow = (int)((long long)ctx->height * (shard + 1) / ctx->shardCount);
+    ctx->status[shard] = -1;
+    if (shard > 0 && initColorHistogram(histogram) != 0) {
         return;
     }
+    if (ctx->shardCount > 1) {
+        histogram->slotLimit = (unsigned int)((size_t)MAX_COLORS / 2 / ctx->shardCount);
+    }
 
-    // Process pixel data to create color frequency
-    for (int i = 0; i < *height; i++) {
-        for (int j = 0; j < *width; j++) {
-            // Calculate the index for pixel data
-            int pixelIndex = (i * row_padded) + (j * 3);
-            unsigned char blue = (*pixelData)[pixelIndex];
-            unsigned char green = (*pixelData)[pixelIndex + 1];
-            unsigned char red = (*pixelData)[pixelIndex + 2];
-
+    unsigned int lastColor = EMPTY_SLOT;
+    unsigned int *lastCount = NULL;
+    for (int i = firstRow; i < endRow; i++) {
+        const unsigned char *row = &ctx->pixelData[(size_t)i * ctx->row_padded];
+        for (int j = 0; j < ctx->width; j++) {
             // Combine RGB into a single color value
-            unsigned int color = (red << 16) | (green << 8) | blue;
-            colorFrequency[color]++;
+            unsigned int color = (row[j * 3 + 2] << 16) | (row[j * 3 + 1] << 8) | row[j * 3];
+
+            // Neighbouring pixels usually share a color, so skip the lookup for repeats
+            if (color != lastColor) {
+                lastCount = colorHistogramSlot(histogram, color, 1);
+                if (lastCount == NULL) {
+                    // A failed grow leaves the capacity as it was, so the limit tells the two failures apart
+                    if (histogram->slotLimit != 0 && histogram->capacity * 2 > histogram->slotLimit) {
+                        ctx->status[shard] = 1;
+                    }
+                    return;
+                }
+                lastColor = color;
+            }
+            (*lastCount)++;
+        }
+    }
+    ctx->status[shard] = 0;
+}
+
+// Count the colors in [range * MAX_COLORS / shardCount, (range + 1) * MAX_COLORS / shardCount) into ctx->dense
+static void countDenseColorRange(void *context, int range) {
+    ColorCountContext *ctx = (ColorCountContext *)context;
+    unsigned int first = (unsigned int)((long long)MAX_COLORS * range / ctx->shardCount);
+    unsigned int span = (unsigned int)((long long)MAX_COLORS * (range + 1) / ctx->shardCount) - first;
+    unsigned int *dense = ctx->dense;
+    unsigned int distinct = 0;
+    for (int i = 0; i < ctx->height; i++) {
+        const unsigned char *row = &ctx->pixelData[(size_t)i * ctx->row_padded];
+        for (int j = 0; j < ctx->width; j++) {
+            unsigned int color = (row[j * 3 + 2] << 16) | (row[j * 3 + 1] << 8) | row[j * 3];
+            if (color - first < span) {
+                distinct += dense[color] == 0;
+                dense[color]++;
+            }
         }
     }
+    ctx->distinct[range] = distinct;
+}
 
+// Count the colors of the padded pixel rows into histogram, one row shard per thread, then merge the shards
+int countColors(const unsigned char *pixelData, int width, int height, int row_padded, ColorHistogram *histogram) {
+    int shardCount = parallel_thread_count();
+    if (shardCount > height) shardCount = height;
+    if (shardCount < 1) return 0;
+
+    ColorHistogram histograms[PARALLEL_MAX_THREADS];
+    int status[PARALLEL_MAX_THREADS];
+    unsigned int distinct[PARALLEL_MAX_THREADS];
+    memset(histograms, 0, sizeof(histograms));
+    histograms[0] = *histogram;
+    ColorCountContext ctx = {pixelData, width, height, row_padded, shardCount, histograms, status, NULL, distinct};
+    parallel_for(shardCount, parallel_thread_count(), countColorShard, &ctx);
+    *histogram = histograms[0];
+    histogram->slotLimit = 0;
+
+    int result = 0, overLimit = 0;
+    for (int shard = 0; shard < shardCount; shard++) {
+        if (status[shard] < 0) result = -1;
+        if (status[shard] > 0) overLimit = 1;
+    }
+    for (int shard = 1; shard < shardCount; shard++) {
+        if (result == 0 && !overLimit) {
+            result = mergeColorHistogram(histogram, &histograms[shard]);
+        }
+        if (histograms[shard].keys != NULL || histograms[shard].dense != NULL) {
+            freeColorHistogram(&histograms[shard]);
+        }
+    }
+    if (result != 0 || !overLimit) {
+        return result;
+    }
+
+    // Too many colors for the shards' maps: drop them and count again into one dense table
+    freeColorHistogram(histogram);
+    histogram->dense = (unsigned int *)calloc(MAX_COLORS, sizeof(unsigned int));
+    if (histogram->dense == NULL) {
+        perror("Error allocating memory for color frequency array");
+        return -1;
+    }
+    ctx.dense = histogram->dense;
+    parallel_for(shardCount, parallel_thread_count(), countDenseColorRange, &ctx);
+    histogram->count = 0;
+    for (int range = 0; range < shardCount; range++) histogram->count += distinct[range];
+    return 0;
+}
+
+// Map a 24-bit BMP and count its colors (skipped when histogram is NULL).
+// The header bytes and padded pixel rows are used in place from the mapping; bmp_close releases them.
+int readBMP(const char *filename, BmpImage *image, ColorHistogram *histogram) {
+    if (bmp_open(filename, image) != 0) {
+        return -1;
+    }
+    if (histogram != NULL && countColors(image->pixels, image->width, image->rows, (int)image->rowSize, histogram) != 0) {
+        bmp_close(image);
+        return -1;
+    }
     printf("Successfully read the image file!\n");
-    fclose(file);
+    return 0;
 }
 
 typedef struct ColorFrequencyPair {
@@ -118,18 +308,19 @@ typedef struct ColorFrequencyPair {
     unsigned int frequency; // Frequency of the color
 } ColorFrequencyPair;
 
-ColorFrequencyPair* createColorFrequencyPairs(unsigned int *colorFrequency, int *size) {
-    int count = 0;
+static int compareColorFrequencyPairs(const void *a, const void *b) {
+    unsigned int colorA = ((const ColorFrequencyPair *)a)->color;
+    unsigned int colorB = ((const ColorFrequencyPair *)b)->color;
+    return (colorA > colorB) - (colorA < colorB);
+}
 
-    // Count the number of unique colors
-    for (int i = 0; i < MAX_COLORS; i++) {
-        if (colorFrequency[i] > 0) {
-            count++;
-        }
-    }
+// Collect the distinct colors and their frequencies, then replace each histogram value by the color's
+// index in the returned array so the histogram can map colors to symbols.
+ColorFrequencyPair* createColorFrequencyPairs(ColorHistogram *histogram, int *size) {
+    int count = histogram->count;
 
     // Allocate memory for the color frequency pairs
-    ColorFrequencyPair *pairs = (ColorFrequencyPair *)malloc(count * sizeof(ColorFrequencyPair));
+    ColorFrequencyPair *pairs = (ColorFrequencyPair *)malloc((count > 0 ? count : 1) * sizeof(ColorFrequencyPair));
     if (pairs == NULL) {
         perror("Error allocating memory for color frequency pairs");
         return NULL; // Memory allocation failed
@@ -137,11 +328,27 @@ ColorFrequencyPair* createColorFrequencyPairs(unsigned int *colorFrequency, int
 
     // Populate the pairs array with colors and their frequencies
     int index = 0;
-    for (int i = 0; i < MAX_COLORS; i++) {
-        if (colorFrequency[i] > 0) {
-            pairs[index].color = i;              // Set color
-            pairs[index].frequency = colorFrequency[i]; // Set frequency
-            index++;
+    if (histogram->dense != NULL) {
+        for (unsigned int i = 0; i < MAX_COLORS; i++) {
+            if (histogram->dense[i] > 0) {
+                pairs[index].color = i;                       // Set color
+                pairs[index].frequency = histogram->dense[i]; // Set frequency
+                histogram->dense[i] = index++;
+            }
+        }
+    } else {
+        for (unsigned int i = 0; i < histogram->capacity; i++) {
+            if (histogram->keys[i] != EMPTY_SLOT) {
+                pairs[index].color = histogram->keys[i];
+                pairs[index].frequency = histogram->values[i];
+                index++;
+            }
+        }
+
+        // Keep the pairs in color order, as the dense scan produces them
+        qsort(pairs, count, sizeof(ColorFrequencyPair), compareColorFrequencyPairs);
+        for (index = 0; index < count; index++) {
+            *colorHistogramSlot(histogram, pairs[index].color, 0) = index;
         }
     }
 
@@ -256,247 +463,1864 @@ void buildHuffmanTree(ColorFrequencyPair *pairs, int size, HuffmanNode **root) {
 
     // The remaining node is the root of the Huffman tree
     *root = extractMin(minHeap);
+
+    // A single-color image still needs a one-bit code, so hang the lone leaf under a root
+    if (!(*root)->left && !(*root)->right) {
+        HuffmanNode *leaf = *root;
+        *root = createHuffmanNode(0, leaf->frequency);
+        (*root)->left = leaf;
+    }
+
+    free(minHeap->array);
+    free(minHeap);
 }
 
-// Function to generate Huffman codes from the tree
-void generateHuffmanCodes(HuffmanNode *root, char **codes, char *codeBuffer, int depth) {
+void freeHuffmanTree(HuffmanNode *root) {
     if (root == NULL) return;
+    freeHuffmanTree(root->left);
+    freeHuffmanTree(root->right);
+    free(root);
+}
+
+// Depth of the deepest leaf, i.e. the longest code length
+int huffmanTreeDepth(HuffmanNode *root) {
+    if (root == NULL || (!root->left && !root->right)) return 0;
+    int left = huffmanTreeDepth(root->left);
+    int right = huffmanTreeDepth(root->right);
+    return 1 + (left > right ? left : right);
+}
+
+// Build a Huffman tree whose codes fit in MAX_CODE_LENGTH bits.
+// Very skewed histograms can produce deeper trees; flattening the frequencies (halving them, keeping
+// every color at least 1) and rebuilding costs a little ratio but bounds the code length.
+void buildLengthLimitedHuffmanTree(ColorFrequencyPair *pairs, int size, HuffmanNode **root) {
+    buildHuffmanTree(pairs, size, root);
+    if (huffmanTreeDepth(*root) <= MAX_CODE_LENGTH) {
+        return;
+    }
 
-    // If it's a leaf node, store the code and print it
+    ColorFrequencyPair *scaled = (ColorFrequencyPair *)malloc(size * sizeof(ColorFrequencyPair));
+    memcpy(scaled, pairs, size * sizeof(ColorFrequencyPair));
+    do {
+        freeHuffmanTree(*root);
+        for (int i = 0; i < size; i++) {
+            scaled[i].frequency = (scaled[i].frequency >> 1) | 1;
+        }
+        buildHuffmanTree(scaled, size, root);
+    } while (huffmanTreeDepth(*root) > MAX_CODE_LENGTH);
+    free(scaled);
+}
+
+// Huffman code of one color: the low length bits of code, most significant bit first
+typedef struct {
+    unsigned int code;
+    unsigned int length;
+} HuffmanCode;
+
+// Function to generate Huffman codes from the tree; codes is indexed by the color's symbol index
+void generateHuffmanCodes(HuffmanNode *root, ColorHistogram *histogram, HuffmanCode *codes, unsigned int code, int depth) {
+    if (root == NULL) return;
+
+    // If it's a leaf node, store the code
     if (!root->left && !root->right) {
-        codeBuffer[depth] = '\0'; // Null terminate the string
-        codes[root->color] = strdup(codeBuffer); // Store the code for the color
-        
-        // Print the color and its Huffman code
-        unsigned char red = (root->color >> 16) & 0xFF;
-        unsigned char green = (root->color >> 8) & 0xFF;
-        unsigned char blue = root->color & 0xFF;
-        //printf("Color RGB(%u, %u, %u): Huffman Code: %s\n", red, green, blue, codeBuffer);
+        HuffmanCode *entry = &codes[*colorHistogramSlot(histogram, root->color, 0)];
+        entry->code = code;
+        entry->length = depth;
         return;
     }
 
     // Traverse left and right
-    codeBuffer[depth] = '0';
-    generateHuffmanCodes(root->left, codes, codeBuffer, depth + 1);
-    codeBuffer[depth] = '1';
-    generateHuffmanCodes(root->right, codes, codeBuffer, depth + 1);
+    generateHuffmanCodes(root->left, histogram, codes, code << 1, depth + 1);
+    generateHuffmanCodes(root->right, histogram, codes, (code << 1) | 1, depth + 1);
 }
 
+// Replace the tree's codes by canonical codes with the same lengths: codes are handed out in order of
+// (length, symbol index), so the decoder can rebuild them from the lengths alone
+void assignCanonicalCodes(HuffmanCode *codes, int size) {
+    unsigned int lengthCount[MAX_CODE_LENGTH + 1] = {0};
+    unsigned int nextCode[MAX_CODE_LENGTH + 1];
 
-void encodePixelData(unsigned char *pixelData, int width, int height, int row_padded, char **codes, unsigned char **encodedData, size_t *encodedSize) {
-    // Temporary buffer for encoded bits
-    size_t bufferCapacity = row_padded * height * 8; // Approximate capacity in bits
-    *encodedData = (unsigned char *)malloc((bufferCapacity + 7) / 8); // Allocate space for the encoded data in bytes
-    if (*encodedData == NULL) {
+    for (int i = 0; i < size; i++) {
+        lengthCount[codes[i].length]++;
+    }
+    unsigned int code = 0;
+    lengthCount[0] = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+    for (int i = 0; i < size; i++) {
+        if (codes[i].length) {
+            codes[i].code = nextCode[codes[i].length]++;
+        }
+    }
+}
+
+static void storeSymbolCodeLengths(HuffmanNode *root, HuffmanCode *codes, int depth) {
+    if (root == NULL) return;
+    if (!root->left && !root->right) {
+        codes[root->color].length = depth;
+        return;
+    }
+    storeSymbolCodeLengths(root->left, codes, depth + 1);
+    storeSymbolCodeLengths(root->right, codes, depth + 1);
+}
+
+// Canonical Huffman codes for a small alphabet indexed by symbol; unused symbols get length 0.
+// Returns 0, or -1 if out of memory.
+int buildSymbolCodes(const unsigned int *frequency, int alphabetSize, HuffmanCode *codes) {
+    ColorFrequencyPair *pairs = (ColorFrequencyPair *)malloc(alphabetSize * sizeof(ColorFrequencyPair));
+    if (pairs == NULL) {
+        perror("Error allocating memory for Huffman codes");
+        return -1;
+    }
+    int size = 0;
+    for (int symbol = 0; symbol < alphabetSize; symbol++) {
+        if (frequency[symbol] > 0) {
+            pairs[size].color = symbol;
+            pairs[size].frequency = frequency[symbol];
+            size++;
+        }
+    }
+
+    memset(codes, 0, alphabetSize * sizeof(HuffmanCode));
+    if (size > 0) {
+        HuffmanNode *root = NULL;
+        buildLengthLimitedHuffmanTree(pairs, size, &root);
+        storeSymbolCodeLengths(root, codes, 0);
+        freeHuffmanTree(root);
+        assignCanonicalCodes(codes, alphabetSize);
+    }
+    free(pairs);
+    return 0;
+}
+
+// Exact size of the encoded bitstream, used to size the output buffer up front
+size_t encodedBitCount(ColorFrequencyPair *pairs, int size, HuffmanCode *codes) {
+    size_t bits = 0;
+    for (int i = 0; i < size; i++) {
+        bits += (size_t)pairs[i].frequency * codes[i].length;
+    }
+    return bits;
+}
+
+// MSB-first bit writer that collects bits in a 64-bit accumulator and stores 32 bits at a time
+typedef struct {
+    unsigned char *data;
+    size_t size;                    // Bytes written to data
+    size_t capacity;                // Bytes allocated for data
+    unsigned long long accumulator; // Pending bits live in the low bitCount bits
+    int bitCount;                   // Always below 32 between calls
+} BitWriter;
+
+int initBitWriter(BitWriter *writer, size_t capacity) {
+    writer->capacity = capacity < 64 ? 64 : capacity;
+    writer->data = (unsigned char *)malloc(writer->capacity);
+    writer->size = 0;
+    writer->accumulator = 0;
+    writer->bitCount = 0;
+    if (writer->data == NULL) {
         perror("Error allocating memory for encoded data");
+        return -1;
+    }
+    return 0;
+}
+
+static int growBitWriter(BitWriter *writer) {
+    size_t capacity = writer->capacity * 2;
+    unsigned char *data = (unsigned char *)realloc(writer->data, capacity);
+    if (data == NULL) {
+        perror("Error growing encoded data buffer");
+        return -1;
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+    return 0;
+}
+
+// Append the low length bits of code (length at most 32)
+static inline int writeBits(BitWriter *writer, unsigned int code, unsigned int length) {
+    writer->accumulator = (writer->accumulator << length) | code;
+    writer->bitCount += length;
+    if (writer->bitCount >= 32) {
+        if (writer->size + 4 > writer->capacity && growBitWriter(writer) != 0) {
+            return -1;
+        }
+        writer->bitCount -= 32;
+        unsigned int word = (unsigned int)(writer->accumulator >> writer->bitCount);
+        unsigned char *out = &writer->data[writer->size];
+        out[0] = word >> 24;
+        out[1] = word >> 16;
+        out[2] = word >> 8;
+        out[3] = word;
+        writer->size += 4;
+    }
+    return 0;
+}
+
+// Write out the remaining bits, zero-padded to a whole byte
+int flushBitWriter(BitWriter *writer) {
+    while (writer->bitCount > 0) {
+        if (writer->size + 1 > writer->capacity && growBitWriter(writer) != 0) {
+            return -1;
+        }
+        int shift = writer->bitCount - 8;
+        unsigned int byte = shift >= 0 ? (unsigned int)(writer->accumulator >> shift)
+                                       : (unsigned int)(writer->accumulator << -shift);
+        writer->data[writer->size++] = byte & 0xFF;
+        writer->bitCount = shift > 0 ? shift : 0;
+    }
+    return 0;
+}
+
+void encodePixelData(unsigned char *pixelData, int width, int height, int row_padded, ColorHistogram *histogram, HuffmanCode *codes, size_t expectedSize, unsigned char **encodedData, size_t *encodedSize) {
+    *encodedData = NULL;
+    *encodedSize = 0;
+
+    BitWriter writer;
+    if (initBitWriter(&writer, expectedSize + 4) != 0) {
         return;
     }
 
-    size_t bitPos = 0; // Current bit position in the encodedData buffer
+    unsigned int lastColor = EMPTY_SLOT;
+    HuffmanCode code = {0, 0};
 
     for (int i = 0; i < height; i++) {
+        unsigned char *row = &pixelData[(size_t)i * row_padded];
         for (int j = 0; j < width; j++) {
-            // Calculate the index for pixel data
-            int pixelIndex = (i * row_padded) + (j * 3);
-            unsigned char blue = pixelData[pixelIndex];
-            unsigned char green = pixelData[pixelIndex + 1];
-            unsigned char red = pixelData[pixelIndex + 2];
-
             // Combine RGB into a single color value
-            unsigned int color = (red << 16) | (green << 8) | blue;
+            unsigned int color = (row[j * 3 + 2] << 16) | (row[j * 3 + 1] << 8) | row[j * 3];
 
             // Get the Huffman code for this color
-            char *code = codes[color];
-            if (code == NULL) {
-                fprintf(stderr, "No Huffman code found for color %u\n", color);
-                free(*encodedData);
-                *encodedData = NULL;
-                *encodedSize = 0;
-                return;
+            if (color != lastColor) {
+                unsigned int *symbol = colorHistogramSlot(histogram, color, 0);
+                if (symbol == NULL) {
+                    fprintf(stderr, "No Huffman code found for color %u\n", color);
+                    free(writer.data);
+                    return;
+                }
+                code = codes[*symbol];
+                lastColor = color;
             }
 
-            // Write the code bit by bit to the encodedData buffer
-            for (size_t k = 0; k < strlen(code); k++) {
-                if (code[k] == '1') {
-                    (*encodedData)[bitPos / 8] |= (1 << (7 - (bitPos % 8)));
-                }
-                bitPos++;
+            if (writeBits(&writer, code.code, code.length) != 0) {
+                free(writer.data);
+                return;
             }
         }
     }
 
-    *encodedSize = (bitPos + 7) / 8; // Calculate the final size in bytes
+    if (flushBitWriter(&writer) != 0) {
+        free(writer.data);
+        return;
+    }
+    *encodedData = writer.data;
+    *encodedSize = writer.size;
 }
 
-void writeEncodedDataToFile(const char *outputFileName, unsigned char *encodedData, size_t encodedSize) {
-    FILE *outputFile = fopen(outputFileName, "wb");
-    if (outputFile == NULL) {
-        perror("Error creating output file");
-        return;
+// Encoded image container (all integers little-endian):
+//   "HIMG", version byte, mode byte
+//   uint32 headerSize, then the original BMP bytes up to bfOffBits
+//   int32 width, int32 rows, uint32 pixel count, uint32 tile width, uint32 tile height (see SegmentLayout)
+//   the mode's code tables (see writeEncodedDataToFile, encodePredictiveImage and encodePaletteImage)
+//   the segment table and bitstreams (see writeSegments)
+#define HIMG_VERSION 3
+#define HIMG_MODE_COLOR 0       // One symbol per 24-bit color
+#define HIMG_MODE_PREDICTIVE 1  // Row-filtered residuals, one 256-symbol alphabet per channel
+#define HIMG_MODE_PALETTE 2     // Palette indices and index runs (chosen automatically for few colors)
+
+#define PALETTE_MAX_COLORS 256  // Images with at most this many colors use HIMG_MODE_PALETTE
+#define PALETTE_RUN_SYMBOLS 16  // Run symbol r repeats the previous pixel 2^r + (r extra bits) times
+
+// Optional preview pyramid appended after the full image: each level is a complete HIMG_MODE_PREDICTIVE container
+// of the previous level halved. Trailer: per level a uint64 offset and a uint64 size, then uint32 level count, "HPYR".
+#define PREVIEW_LEVELS 3  // Previews at 1/2, 1/4 and 1/8 scale
+#define PREVIEW_MAGIC "HPYR"
+
+#define SEGMENT_TARGET_PIXELS (1 << 18)  // Pixels per independently coded row range
+#define MAX_TILE_SIZE 65536              // Largest tile side accepted on the command line
+
+// How the image is cut into independently coded segments: full-width row ranges by default,
+// or square tiles so that a region can be decoded without touching the rest of the image
+typedef struct {
+    int tileWidth;   // Columns per segment (the image width for row segments)
+    int tileHeight;  // Rows per segment
+} SegmentLayout;
+
+// Full-width segments of about SEGMENT_TARGET_PIXELS pixels
+SegmentLayout rowSegmentLayout(int width) {
+    SegmentLayout layout = {width, SEGMENT_TARGET_PIXELS / width > 0 ? SEGMENT_TARGET_PIXELS / width : 1};
+    return layout;
+}
+
+// A rectangle of the image whose codes form a separate bitstream, so segments can be encoded and decoded
+// in parallel, or alone. No code or prediction crosses a segment boundary.
+typedef struct {
+    int firstRow;
+    int rows;
+    int firstColumn;
+    int columns;
+    size_t firstLine;           // Segment rows in the segments before this one (indexes per-row tables)
+    size_t firstPixel;          // Pixels in the segments before this one (indexes per-pixel buffers)
+    const unsigned char *data;  // Encoded bitstream (allocated by the encoder, inside the file when decoding)
+    size_t size;                // Bytes in data
+    int status;                 // -1 if a pass over the segment failed (or the segment is corrupt)
+} ImageSegment;
+
+// Cut the image into layout's tiles, in row-major tile order (tiles on the right and top edges may be smaller).
+// Returns NULL if the layout is invalid.
+ImageSegment *createImageSegments(int width, int height, const SegmentLayout *layout, int *count) {
+    if (layout->tileWidth <= 0 || layout->tileHeight <= 0) {
+        return NULL;
+    }
+    int across = (int)((width + (long long)layout->tileWidth - 1) / layout->tileWidth);
+    int down = (int)((height + (long long)layout->tileHeight - 1) / layout->tileHeight);
+    *count = across * down;
+    ImageSegment *segments = (ImageSegment *)calloc(*count > 0 ? *count : 1, sizeof(ImageSegment));
+    if (segments == NULL) {
+        perror("Error allocating memory for image segments");
+        return NULL;
+    }
+    size_t lines = 0, pixels = 0;
+    for (int s = 0; s < *count; s++) {
+        ImageSegment *segment = &segments[s];
+        segment->firstRow = (s / across) * layout->tileHeight;
+        segment->firstColumn = (s % across) * layout->tileWidth;
+        segment->rows = height - segment->firstRow < layout->tileHeight ? height - segment->firstRow : layout->tileHeight;
+        segment->columns = width - segment->firstColumn < layout->tileWidth ? width - segment->firstColumn : layout->tileWidth;
+        segment->firstLine = lines;
+        segment->firstPixel = pixels;
+        lines += segment->rows;
+        pixels += (size_t)segment->rows * segment->columns;
+    }
+    return segments;
+}
+
+// Free the encoder's segment bitstreams and the segment array
+void freeImageSegments(ImageSegment *segments, int count) {
+    for (int s = 0; s < count && segments != NULL; s++) {
+        free((void *)segments[s].data);
+    }
+    free(segments);
+}
+
+// Total encoded size, or 0 if a segment failed to encode
+size_t encodedSegmentsSize(ImageSegment *segments, int count) {
+    size_t total = 0;
+    for (int s = 0; s < count; s++) {
+        if (segments[s].data == NULL) return 0;
+        total += segments[s].size;
+    }
+    return total;
+}
+
+static void writeU32(FILE *file, unsigned int value) {
+    unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+    fwrite(bytes, 1, 4, file);
+}
+
+static void writeVarint(FILE *file, unsigned int value) {
+    while (value >= 0x80) {
+        fputc((value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    fputc(value, file);
+}
+
+// Write the fields shared by every mode, up to the mode's code tables
+static void writeImageHeader(FILE *outputFile, int mode, unsigned char *bmpHeader, int headerSize, int width, int height,
+                             const SegmentLayout *layout) {
+    fwrite("HIMG", 1, 4, outputFile);
+    fputc(HIMG_VERSION, outputFile);
+    fputc(mode, outputFile);
+
+    // Original BMP headers, so the decoder doesn't need the source image
+    writeU32(outputFile, headerSize);
+    fwrite(bmpHeader, sizeof(unsigned char), headerSize, outputFile);
+    writeU32(outputFile, width);
+    writeU32(outputFile, height);
+    writeU32(outputFile, (unsigned int)width * height);
+    writeU32(outputFile, layout->tileWidth);
+    writeU32(outputFile, layout->tileHeight);
+}
+
+// Segment table (the tile index): uint32 segment count, a uint64 byte size per segment in row-major tile order,
+// then the segment bitstreams back to back. Each bitstream is zero-padded to a whole byte.
+static void writeSegments(FILE *outputFile, ImageSegment *segments, int count) {
+    writeU32(outputFile, count);
+    for (int s = 0; s < count; s++) {
+        writeU32(outputFile, (unsigned int)segments[s].size);
+        writeU32(outputFile, (unsigned int)((unsigned long long)segments[s].size >> 32));
+    }
+    for (int s = 0; s < count; s++) {
+        fwrite(segments[s].data, sizeof(unsigned char), segments[s].size, outputFile);
+    }
+}
+
+// HIMG_MODE_COLOR tables: uint32 symbol count, each symbol's color as a varint delta from the previous
+// color (colors are stored in ascending order), then one code-length byte per symbol
+void writeEncodedDataToFile(FILE *outputFile, unsigned char *bmpHeader, int headerSize, int width, int height,
+                            const SegmentLayout *layout, ColorFrequencyPair *pairs, HuffmanCode *codes, int size,
+                            ImageSegment *segments, int segmentCount) {
+    writeImageHeader(outputFile, HIMG_MODE_COLOR, bmpHeader, headerSize, width, height, layout);
+
+    // Code table: delta-coded colors, then code lengths
+    writeU32(outputFile, size);
+    unsigned int previous = 0;
+    for (int i = 0; i < size; i++) {
+        writeVarint(outputFile, pairs[i].color - previous);
+        previous = pairs[i].color;
+    }
+    for (int i = 0; i < size; i++) {
+        fputc(codes[i].length, outputFile);
     }
 
     // Write the encoded data to the file
-    fwrite(encodedData, sizeof(unsigned char), encodedSize, outputFile);
+    writeSegments(outputFile, segments, segmentCount);
+}
 
-    printf("Encoded data successfully written to %s\n", outputFileName);
+// Shared state of the per-segment HIMG_MODE_COLOR encoders
+typedef struct {
+    unsigned char *pixelData;
+    size_t pixelCount;
+    int row_padded;
+    ColorHistogram *histogram;  // Only read, so the threads can share it
+    HuffmanCode *codes;
+    size_t expectedSize;        // Encoded size of the whole image
+    ImageSegment *segments;
+} ColorEncodeContext;
+
+static void encodeColorSegment(void *context, int index) {
+    ColorEncodeContext *ctx = (ColorEncodeContext *)context;
+    ImageSegment *segment = &ctx->segments[index];
+    unsigned char *data = NULL;
+    size_t expectedSize = (size_t)((double)ctx->expectedSize * segment->rows * segment->columns / ctx->pixelCount);
+    encodePixelData(&ctx->pixelData[(size_t)segment->firstRow * ctx->row_padded + segment->firstColumn * 3], segment->columns,
+                    segment->rows, ctx->row_padded, ctx->histogram, ctx->codes, expectedSize, &data, &segment->size);
+    segment->data = data;
+}
+
+// Optional color decorrelation: blue and red are stored as differences from green
+static void transformRow(const unsigned char *pixels, int width, int decorrelate, unsigned char *out) {
+    for (int j = 0; j < width * 3; j += 3) {
+        unsigned char green = pixels[j + 1];
+        out[j] = decorrelate ? pixels[j] - green : pixels[j];
+        out[j + 1] = green;
+        out[j + 2] = decorrelate ? pixels[j + 2] - green : pixels[j + 2];
+    }
+}
+
+static void inverseTransformRow(unsigned char *pixels, int width, int decorrelate) {
+    if (!decorrelate) return;
+    for (int j = 0; j < width * 3; j += 3) {
+        pixels[j] += pixels[j + 1];
+        pixels[j + 2] += pixels[j + 1];
+    }
+}
 
-    fclose(outputFile);
+// Shared state of the per-segment HIMG_MODE_PREDICTIVE passes
+typedef struct {
+    unsigned char *pixelData;
+    int row_padded;
+    int decorrelate;
+    unsigned char *residuals;         // 3 bytes per pixel, segment by segment
+    unsigned char *filters;           // One filter per segment row
+    unsigned int (*frequency)[3][256]; // Residual counts of each segment
+    HuffmanCode (*codes)[256];
+    ImageSegment *segments;
+} PredictiveContext;
+
+// Transform and filter a segment's rows, counting its residuals per channel.
+// The row above a segment's first row is zeros, so segments decode independently.
+static void filterPredictiveSegment(void *context, int index) {
+    PredictiveContext *ctx = (PredictiveContext *)context;
+    ImageSegment *segment = &ctx->segments[index];
+    unsigned int (*frequency)[256] = ctx->frequency[index];
+    int rowBytes = segment->columns * 3;
+    unsigned char *rows = (unsigned char *)calloc((size_t)rowBytes * 3, 1);
+    if (rows == NULL) {
+        perror("Error allocating memory for predictive encoding");
+        segment->status = -1;
+        return;
+    }
+    unsigned char *current = rows, *previous = &rows[rowBytes], *scratch = &rows[rowBytes * 2];
+
+    for (int y = 0; y < segment->rows; y++) {
+        unsigned char *out = &ctx->residuals[(segment->firstPixel + (size_t)y * segment->columns) * 3];
+        size_t offset = (size_t)(segment->firstRow + y) * ctx->row_padded + segment->firstColumn * 3;
+        transformRow(&ctx->pixelData[offset], segment->columns, ctx->decorrelate, current);
+        ctx->filters[segment->firstLine + y] = row_filter_choose(current, previous, rowBytes, out, scratch);
+        for (int k = 0; k < rowBytes; k += 3) {
+            frequency[0][out[k]]++;
+            frequency[1][out[k + 1]]++;
+            frequency[2][out[k + 2]]++;
+        }
+        unsigned char *swap = previous;
+        previous = current;
+        current = swap;
+    }
+    free(rows);
 }
 
-void decodeBinaryFile(const char *encodedFileName, HuffmanNode *huffmanRoot, int width, int height, int row_padded, unsigned char *bmpHeader, int headerSize) {
-    FILE *encodedFile = fopen(encodedFileName, "rb");
-    if (encodedFile == NULL) {
-        perror("Error opening encoded file");
+static void encodePredictiveSegment(void *context, int index) {
+    PredictiveContext *ctx = (PredictiveContext *)context;
+    ImageSegment *segment = &ctx->segments[index];
+    HuffmanCode (*codes)[256] = ctx->codes;
+
+    size_t expectedBits = 0;
+    for (int c = 0; c < 3; c++) {
+        for (int symbol = 0; symbol < 256; symbol++) {
+            expectedBits += (size_t)ctx->frequency[index][c][symbol] * codes[c][symbol].length;
+        }
+    }
+    BitWriter writer;
+    if (initBitWriter(&writer, expectedBits / 8 + 4) != 0) {
         return;
     }
 
-    unsigned char *decodedPixelData = (unsigned char *)malloc(row_padded * height);
-    if (decodedPixelData == NULL) {
-        perror("Error allocating memory for decoded pixel data");
-        fclose(encodedFile);
+    const unsigned char *residuals = &ctx->residuals[segment->firstPixel * 3];
+    size_t total = (size_t)segment->rows * segment->columns * 3;
+    for (size_t k = 0; k < total; k += 3) {
+        HuffmanCode blue = codes[0][residuals[k]];
+        HuffmanCode green = codes[1][residuals[k + 1]];
+        HuffmanCode red = codes[2][residuals[k + 2]];
+        if (writeBits(&writer, blue.code, blue.length) != 0 || writeBits(&writer, green.code, green.length) != 0 ||
+            writeBits(&writer, red.code, red.length) != 0) {
+            free(writer.data);
+            return;
+        }
+    }
+    if (flushBitWriter(&writer) != 0) {
+        free(writer.data);
         return;
     }
+    segment->data = writer.data;
+    segment->size = writer.size;
+}
 
-    unsigned char buffer;
-    int bitPos = 0;
-    HuffmanNode *currentNode = huffmanRoot;
-    size_t pixelIndex = 0;
+// Encode with HIMG_MODE_PREDICTIVE and write the container. Tables after the common header:
+//   byte decorrelate flag, one filter byte per segment row (segment by segment),
+//   3 x 256 code-length bytes (blue, green, red residuals)
+// Each segment's bitstream holds the blue, green and red residual codes of each pixel in turn.
+int encodePredictiveImage(FILE *outputFile, unsigned char *bmpHeader, int headerSize, unsigned char *pixelData,
+                          int width, int height, const SegmentLayout *layout, int decorrelate) {
+    int segmentCount = 0;
+    ImageSegment *segments = createImageSegments(width, height, layout, &segmentCount);
+    size_t filterCount = segments != NULL ? segments[segmentCount - 1].firstLine + segments[segmentCount - 1].rows : 0;
+    unsigned char *residuals = (unsigned char *)malloc((size_t)width * height * 3);
+    unsigned char *filters = (unsigned char *)malloc(filterCount > 0 ? filterCount : 1);
+    unsigned int (*frequency)[3][256] = (unsigned int (*)[3][256])calloc(segmentCount, sizeof(*frequency));
+    if (segments == NULL || residuals == NULL || filters == NULL || frequency == NULL) {
+        perror("Error allocating memory for predictive encoding");
+        free(segments);
+        free(residuals);
+        free(filters);
+        free(frequency);
+        return -1;
+    }
 
-    // Decode the binary data using the Huffman Tree
-    while (fread(&buffer, sizeof(unsigned char), 1, encodedFile) == 1) {
-        for (int i = 7; i >= 0; i--) {
-            int bit = (buffer >> i) & 1;
-            currentNode = bit == 0 ? currentNode->left : currentNode->right;
+    // Transform and filter every segment, then build one set of codes from the merged counts
+    HuffmanCode codes[3][256];
+    PredictiveContext ctx = {pixelData, (width * 3 + 3) & (~3), decorrelate, residuals, filters, frequency, codes, segments};
+    parallel_for(segmentCount, parallel_thread_count(), filterPredictiveSegment, &ctx);
+
+    unsigned int total[3][256] = {{0}};
+    int failed = 0;
+    for (int s = 0; s < segmentCount; s++) {
+        failed |= segments[s].status != 0;
+        for (int c = 0; c < 3; c++) {
+            for (int symbol = 0; symbol < 256; symbol++) {
+                total[c][symbol] += frequency[s][c][symbol];
+            }
+        }
+    }
+    for (int c = 0; c < 3 && !failed; c++) {
+        failed = buildSymbolCodes(total[c], 256, codes[c]) != 0;
+    }
 
-            if (!currentNode->left && !currentNode->right) {
-                unsigned int color = currentNode->color;
-                decodedPixelData[pixelIndex++] = color & 0xFF;
-                decodedPixelData[pixelIndex++] = (color >> 8) & 0xFF;
-                decodedPixelData[pixelIndex++] = (color >> 16) & 0xFF;
-                currentNode = huffmanRoot;
+    size_t encodedSize = 0;
+    if (!failed) {
+        parallel_for(segmentCount, parallel_thread_count(), encodePredictiveSegment, &ctx);
+        encodedSize = encodedSegmentsSize(segments, segmentCount);
+    }
+    free(residuals);
+    free(frequency);
+    if (encodedSize == 0) {
+        freeImageSegments(segments, segmentCount);
+        free(filters);
+        return -1;
+    }
+    printf("Encoded data size (in bytes): %zu\n", encodedSize);
 
-                if (pixelIndex >= row_padded * height) {
-                    break;
-                }
+    writeImageHeader(outputFile, HIMG_MODE_PREDICTIVE, bmpHeader, headerSize, width, height, layout);
+    fputc(decorrelate, outputFile);
+    fwrite(filters, 1, filterCount, outputFile);
+    for (int c = 0; c < 3; c++) {
+        for (int symbol = 0; symbol < 256; symbol++) {
+            fputc(codes[c][symbol].length, outputFile);
+        }
+    }
+    writeSegments(outputFile, segments, segmentCount);
+
+    freeImageSegments(segments, segmentCount);
+    free(filters);
+    return 0;
+}
+
+// Shared state of the per-segment HIMG_MODE_PALETTE passes
+typedef struct {
+    unsigned char *pixelData;
+    int row_padded;
+    ColorHistogram *histogram;  // Maps each color to its palette index; only read
+    int size;                   // Palette size
+    int alphabetSize;           // size + PALETTE_RUN_SYMBOLS
+    unsigned int *tokens;       // At most one token per pixel, so a segment's tokens start at its firstPixel
+    size_t *tokenCounts;        // Tokens in each segment
+    unsigned int *frequency;    // alphabetSize symbol counts per segment
+    HuffmanCode *codes;
+    ImageSegment *segments;
+} PaletteContext;
+
+// Tokenize a segment's rows: symbol in the low 16 bits, run extra bits above
+static void tokenizePaletteSegment(void *context, int index) {
+    PaletteContext *ctx = (PaletteContext *)context;
+    ImageSegment *segment = &ctx->segments[index];
+    unsigned int *tokens = &ctx->tokens[segment->firstPixel];
+    unsigned int *frequency = &ctx->frequency[(size_t)index * ctx->alphabetSize];
+    int size = ctx->size;
+
+    size_t tokenCount = 0;
+    int width = segment->columns;
+    for (int i = segment->firstRow; i < segment->firstRow + segment->rows; i++) {
+        unsigned char *row = &ctx->pixelData[(size_t)i * ctx->row_padded + segment->firstColumn * 3];
+        int j = 0;
+        while (j < width) {
+            unsigned int color = (row[j * 3 + 2] << 16) | (row[j * 3 + 1] << 8) | row[j * 3];
+            unsigned int paletteIndex = *colorHistogramSlot(ctx->histogram, color, 0);
+            tokens[tokenCount++] = paletteIndex;
+            frequency[paletteIndex]++;
+
+            // Count how often the pixel repeats within the row
+            int run = 1;
+            while (j + run < width && memcmp(&row[(j + run) * 3], &row[j * 3], 3) == 0) {
+                run++;
+            }
+            j += run;
+            run--;
+
+            while (run > 0) {
+                int count = run < (1 << PALETTE_RUN_SYMBOLS) - 1 ? run : (1 << PALETTE_RUN_SYMBOLS) - 1;
+                int r = 0;
+                while ((count >> (r + 1)) != 0) r++;
+                tokens[tokenCount++] = (size + r) | ((unsigned int)(count - (1 << r)) << 16);
+                frequency[size + r]++;
+                run -= count;
             }
         }
     }
+    ctx->tokenCounts[index] = tokenCount;
+}
 
-    fclose(encodedFile);
+static void encodePaletteSegment(void *context, int index) {
+    PaletteContext *ctx = (PaletteContext *)context;
+    ImageSegment *segment = &ctx->segments[index];
+    const unsigned int *tokens = &ctx->tokens[segment->firstPixel];
+    const unsigned int *frequency = &ctx->frequency[(size_t)index * ctx->alphabetSize];
+    HuffmanCode *codes = ctx->codes;
+    unsigned int size = ctx->size;
+
+    size_t expectedBits = 0;
+    for (int symbol = 0; symbol < ctx->alphabetSize; symbol++) {
+        int extraBits = symbol >= (int)size ? symbol - (int)size : 0;
+        expectedBits += (size_t)frequency[symbol] * (codes[symbol].length + extraBits);
+    }
+    BitWriter writer;
+    if (initBitWriter(&writer, expectedBits / 8 + 4) != 0) {
+        return;
+    }
+    for (size_t t = 0; t < ctx->tokenCounts[index]; t++) {
+        unsigned int symbol = tokens[t] & 0xFFFF;
+        int failed = writeBits(&writer, codes[symbol].code, codes[symbol].length);
+        if (!failed && symbol > size) {
+            failed = writeBits(&writer, tokens[t] >> 16, symbol - size);
+        }
+        if (failed) {
+            free(writer.data);
+            return;
+        }
+    }
+    if (flushBitWriter(&writer) != 0) {
+        free(writer.data);
+        return;
+    }
+    segment->data = writer.data;
+    segment->size = writer.size;
+}
 
-    // Check if pixel data is complete
-    if (pixelIndex != row_padded * height) {
-        printf("Decoded data might be incomplete. Pixel data length: %zu\n", pixelIndex);
+// Encode with HIMG_MODE_PALETTE and write the container. Tables after the common header:
+//   uint32 palette size n, n colors as 3 bytes (blue, green, red) in ascending color order,
+//   n + PALETTE_RUN_SYMBOLS code-length bytes
+// Symbols below n are palette indices (the pairs' order, so the histogram gives each color's index);
+// symbol n + r repeats the previous pixel of the segment row 2^r + extra times, with extra in the next r bits.
+int encodePaletteImage(FILE *outputFile, unsigned char *bmpHeader, int headerSize, unsigned char *pixelData,
+                       int width, int height, const SegmentLayout *layout, ColorHistogram *histogram,
+                       ColorFrequencyPair *pairs, int size) {
+    int alphabetSize = size + PALETTE_RUN_SYMBOLS;
+    int segmentCount = 0;
+    ImageSegment *segments = createImageSegments(width, height, layout, &segmentCount);
+    unsigned int *tokens = (unsigned int *)malloc((size_t)width * height * sizeof(unsigned int));
+    size_t *tokenCounts = (size_t *)calloc(segmentCount, sizeof(size_t));
+    unsigned int *frequency = (unsigned int *)calloc((size_t)segmentCount * alphabetSize, sizeof(unsigned int));
+    unsigned int *total = (unsigned int *)calloc(alphabetSize, sizeof(unsigned int));
+    HuffmanCode *codes = (HuffmanCode *)malloc(alphabetSize * sizeof(HuffmanCode));
+    size_t encodedSize = 0;
+    if (segments == NULL || tokens == NULL || tokenCounts == NULL || frequency == NULL || total == NULL || codes == NULL) {
+        perror("Error allocating memory for palette encoding");
     } else {
-        printf("Decoding completed successfully!\n");
+        // Tokenize every segment, build one set of codes from the merged counts, then encode the segments
+        PaletteContext ctx = {pixelData, (width * 3 + 3) & (~3), histogram, size, alphabetSize,
+                              tokens, tokenCounts, frequency, codes, segments};
+        parallel_for(segmentCount, parallel_thread_count(), tokenizePaletteSegment, &ctx);
+        for (int s = 0; s < segmentCount; s++) {
+            for (int symbol = 0; symbol < alphabetSize; symbol++) {
+                total[symbol] += frequency[(size_t)s * alphabetSize + symbol];
+            }
+        }
+        if (buildSymbolCodes(total, alphabetSize, codes) == 0) {
+            parallel_for(segmentCount, parallel_thread_count(), encodePaletteSegment, &ctx);
+            encodedSize = encodedSegmentsSize(segments, segmentCount);
+        }
+    }
+    free(tokens);
+    free(tokenCounts);
+    free(frequency);
+    free(total);
+    if (encodedSize == 0) {
+        freeImageSegments(segments, segmentCount);
+        free(codes);
+        return -1;
     }
+    printf("Palette of %d colors, encoded data size (in bytes): %zu\n", size, encodedSize);
 
-    // Open the output file for writing the BMP image
-    const char *outputFileName = "decoded_image.bmp";
-    FILE *outputFile = fopen(outputFileName, "wb");
-    if (outputFile == NULL) {
-        perror("Error creating output BMP file");
-        free(decodedPixelData);
+    writeImageHeader(outputFile, HIMG_MODE_PALETTE, bmpHeader, headerSize, width, height, layout);
+    writeU32(outputFile, size);
+    for (int i = 0; i < size; i++) {
+        fputc(pairs[i].color & 0xFF, outputFile);
+        fputc((pairs[i].color >> 8) & 0xFF, outputFile);
+        fputc((pairs[i].color >> 16) & 0xFF, outputFile);
+    }
+    for (int symbol = 0; symbol < alphabetSize; symbol++) {
+        fputc(codes[symbol].length, outputFile);
+    }
+    writeSegments(outputFile, segments, segmentCount);
+
+    freeImageSegments(segments, segmentCount);
+    free(codes);
+    return 0;
+}
+
+// Bounds-checked cursor over an in-memory encoded file
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    int error;
+} ByteReader;
+
+static const unsigned char *readBytes(ByteReader *reader, size_t count) {
+    if (reader->error || count > reader->size - reader->pos) {
+        reader->error = 1;
+        return NULL;
+    }
+    const unsigned char *bytes = &reader->data[reader->pos];
+    reader->pos += count;
+    return bytes;
+}
+
+static unsigned int readU32(ByteReader *reader) {
+    const unsigned char *bytes = readBytes(reader, 4);
+    if (bytes == NULL) return 0;
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+static unsigned int readVarint(ByteReader *reader) {
+    unsigned int value = 0;
+    for (int shift = 0; shift < 32; shift += 7) {
+        const unsigned char *byte = readBytes(reader, 1);
+        if (byte == NULL) return 0;
+        value |= (unsigned int)(*byte & 0x7F) << shift;
+        if (!(*byte & 0x80)) return value;
+    }
+    reader->error = 1;
+    return 0;
+}
+
+// Two-level lookup table for canonical codes.
+// The primary table is indexed by the next PRIMARY_TABLE_BITS bits of the stream and resolves every
+// code up to that length in one probe; longer codes point to a sub-table indexed by the bits that follow.
+#define PRIMARY_TABLE_BITS 11
+
+typedef struct {
+    unsigned int value;     // Color of a leaf, or index of the first entry of a sub-table
+    unsigned char length;   // Code length of a leaf (0 marks a bit pattern no code uses)
+    unsigned char subBits;  // Index bits of the sub-table, 0 for a leaf
+} DecodeEntry;
+
+typedef struct {
+    DecodeEntry *entries;   // Primary table followed by all sub-tables
+} LookupDecoder;
+
+int buildLookupDecoder(LookupDecoder *decoder, const unsigned int *colors, const unsigned char *lengths, int size) {
+    unsigned int lengthCount[MAX_CODE_LENGTH + 1] = {0};
+    unsigned int nextCode[MAX_CODE_LENGTH + 1], nextIndex[MAX_CODE_LENGTH + 1];
+
+    decoder->entries = NULL;
+    for (int i = 0; i < size; i++) {
+        if (lengths[i] > MAX_CODE_LENGTH) {
+            printf("Invalid code length %u in code table.\n", lengths[i]);
+            return -1;
+        }
+        lengthCount[lengths[i]]++;
+    }
+    lengthCount[0] = 0; // Symbols with length 0 are unused
+
+    // The lengths must satisfy the Kraft inequality, or codes would overlap
+    unsigned long long kraft = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+        kraft += (unsigned long long)lengthCount[length] << (MAX_CODE_LENGTH - length);
+    }
+    if (kraft > (1ULL << MAX_CODE_LENGTH)) {
+        printf("Code lengths do not form a prefix code.\n");
+        return -1;
+    }
+
+    // Same assignment as assignCanonicalCodes, plus each symbol's position in canonical order
+    unsigned int code = 0, index = 0;
+    for (int length = 1; length <= MAX_CODE_LENGTH; length++) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+        nextIndex[length] = index;
+        index += lengthCount[length];
+    }
+
+    unsigned int *orderColor = (unsigned int *)malloc(size * sizeof(unsigned int));
+    unsigned int *orderCode = (unsigned int *)malloc(size * sizeof(unsigned int));
+    unsigned char *orderLength = (unsigned char *)malloc(size);
+    unsigned char subMax[1 << PRIMARY_TABLE_BITS] = {0};
+    if (orderColor == NULL || orderCode == NULL || orderLength == NULL) {
+        perror("Error allocating memory for decoding table");
+        free(orderColor);
+        free(orderCode);
+        free(orderLength);
+        return -1;
+    }
+    for (int i = 0; i < size; i++) {
+        if (lengths[i] == 0) {
+            continue;
+        }
+        unsigned int position = nextIndex[lengths[i]]++;
+        orderColor[position] = colors[i];
+        orderCode[position] = nextCode[lengths[i]]++;
+        orderLength[position] = lengths[i];
+    }
+
+    // Size each sub-table for the longest code sharing its primary prefix
+    size = index;
+    size_t entryCount = 1 << PRIMARY_TABLE_BITS;
+    for (int i = 0; i < size; i++) {
+        if (orderLength[i] > PRIMARY_TABLE_BITS) {
+            unsigned int prefix = orderCode[i] >> (orderLength[i] - PRIMARY_TABLE_BITS);
+            if (orderLength[i] > subMax[prefix]) subMax[prefix] = orderLength[i];
+        }
+    }
+    size_t subOffset[1 << PRIMARY_TABLE_BITS];
+    for (int prefix = 0; prefix < (1 << PRIMARY_TABLE_BITS); prefix++) {
+        subOffset[prefix] = entryCount;
+        if (subMax[prefix]) entryCount += (size_t)1 << (subMax[prefix] - PRIMARY_TABLE_BITS);
+    }
+
+    decoder->entries = (DecodeEntry *)calloc(entryCount, sizeof(DecodeEntry));
+    if (decoder->entries == NULL) {
+        perror("Error allocating memory for decoding table");
+        free(orderColor);
+        free(orderCode);
+        free(orderLength);
+        return -1;
+    }
+    for (int prefix = 0; prefix < (1 << PRIMARY_TABLE_BITS); prefix++) {
+        if (subMax[prefix]) {
+            decoder->entries[prefix].value = (unsigned int)subOffset[prefix];
+            decoder->entries[prefix].subBits = subMax[prefix] - PRIMARY_TABLE_BITS;
+        }
+    }
+
+    // Every code fills all table slots whose index starts with it
+    for (int i = 0; i < size; i++) {
+        DecodeEntry entry = {orderColor[i], orderLength[i], 0};
+        DecodeEntry *table;
+        unsigned int first, fill;
+        if (orderLength[i] <= PRIMARY_TABLE_BITS) {
+            table = decoder->entries;
+            first = orderCode[i] << (PRIMARY_TABLE_BITS - orderLength[i]);
+            fill = 1u << (PRIMARY_TABLE_BITS - orderLength[i]);
+        } else {
+            int tail = orderLength[i] - PRIMARY_TABLE_BITS;
+            unsigned int prefix = orderCode[i] >> tail;
+            int subBits = subMax[prefix] - PRIMARY_TABLE_BITS;
+            table = &decoder->entries[subOffset[prefix]];
+            first = (orderCode[i] & ((1u << tail) - 1)) << (subBits - tail);
+            fill = 1u << (subBits - tail);
+        }
+        for (unsigned int k = 0; k < fill; k++) {
+            table[first + k] = entry;
+        }
+    }
+
+    free(orderColor);
+    free(orderCode);
+    free(orderLength);
+    return 0;
+}
+
+// MSB-first bit reader over an in-memory buffer; the top count bits of buffer are the next stream bits
+typedef struct {
+    const unsigned char *data;
+    size_t size;
+    size_t pos;
+    unsigned long long buffer;
+    int count;
+} BitReader;
+
+// Top up the buffer to at least 56 bits, reading zeros past the end of the data
+static inline void refillBitReader(BitReader *reader) {
+    if (reader->pos + 8 <= reader->size) {
+        const unsigned char *p = &reader->data[reader->pos];
+        unsigned long long word = ((unsigned long long)p[0] << 56) | ((unsigned long long)p[1] << 48) |
+                                  ((unsigned long long)p[2] << 40) | ((unsigned long long)p[3] << 32) |
+                                  ((unsigned long long)p[4] << 24) | ((unsigned long long)p[5] << 16) |
+                                  ((unsigned long long)p[6] << 8) | p[7];
+        reader->buffer |= word >> reader->count;
+        reader->pos += (63 - reader->count) >> 3;
+        reader->count |= 56;
+    } else {
+        while (reader->count <= 56) {
+            unsigned long long byte = reader->pos < reader->size ? reader->data[reader->pos] : 0;
+            reader->buffer |= byte << (56 - reader->count);
+            reader->pos++;
+            reader->count += 8;
+        }
+    }
+}
+
+// Bits consumed so far
+static inline size_t bitReaderPosition(const BitReader *reader) {
+    return reader->pos * 8 - reader->count;
+}
+
+// Decode one code; returns its table entry (length 0 for an invalid code)
+static inline DecodeEntry decodeSymbol(const LookupDecoder *decoder, BitReader *reader) {
+    refillBitReader(reader);
+    DecodeEntry entry = decoder->entries[reader->buffer >> (64 - PRIMARY_TABLE_BITS)];
+    if (entry.subBits) {
+        unsigned long long tail = reader->buffer << PRIMARY_TABLE_BITS;
+        entry = decoder->entries[entry.value + (tail >> (64 - entry.subBits))];
+    }
+    reader->buffer <<= entry.length;
+    reader->count -= entry.length;
+    return entry;
+}
+
+// Read the segment table written by writeSegments; the segment data points into the reader's buffer
+static ImageSegment *readSegments(ByteReader *reader, int width, int height, const SegmentLayout *layout, int *count) {
+    unsigned int segmentCount = readU32(reader);
+    if (reader->error || (size_t)segmentCount * 8 > reader->size - reader->pos) {
+        return NULL;
+    }
+    ImageSegment *segments = createImageSegments(width, height, layout, count);
+    if (segments == NULL || (unsigned int)*count != segmentCount) {
+        free(segments);
+        return NULL;
+    }
+    for (int s = 0; s < *count; s++) {
+        segments[s].size = readU32(reader);
+        segments[s].size |= (size_t)((unsigned long long)readU32(reader) << 32);
+    }
+    for (int s = 0; s < *count; s++) {
+        segments[s].data = readBytes(reader, segments[s].size);
+    }
+    if (reader->error) {
+        free(segments);
+        return NULL;
+    }
+    return segments;
+}
+
+// Rectangle of the image to decode, in stored row order, and where it goes:
+// pixel (row, column) lands at pixels + (row - firstRow) * stride + (column - firstColumn) * 3
+typedef struct {
+    unsigned char *pixels;
+    size_t stride;
+    int firstRow;
+    int rows;
+    int firstColumn;
+    int columns;
+} DecodeTarget;
+
+// Shared state of the per-segment decoders (each mode uses the fields it needs)
+typedef struct {
+    const DecodeTarget *target;
+    const LookupDecoder *decoders;  // One per channel in HIMG_MODE_PREDICTIVE, else one
+    const unsigned char *filters;   // HIMG_MODE_PREDICTIVE filters, one per segment row
+    int decorrelate;
+    const unsigned char *palette;   // HIMG_MODE_PALETTE colors, 3 bytes each
+    unsigned int paletteSize;
+    ImageSegment *segments;
+    int *selected;                  // Indices of the segments that overlap the target
+} DecodeContext;
+
+// Number of pixels shared by a segment and the target
+static long segmentOverlap(const ImageSegment *segment, const DecodeTarget *target) {
+    int top = segment->firstRow > target->firstRow ? segment->firstRow : target->firstRow;
+    int bottom = segment->firstRow + segment->rows < target->firstRow + target->rows ? segment->firstRow + segment->rows
+                                                                                      : target->firstRow + target->rows;
+    int left = segment->firstColumn > target->firstColumn ? segment->firstColumn : target->firstColumn;
+    int right = segment->firstColumn + segment->columns < target->firstColumn + target->columns
+                    ? segment->firstColumn + segment->columns : target->firstColumn + target->columns;
+    return top < bottom && left < right ? (long)(bottom - top) * (right - left) : 0;
+}
+
+// Last image row of a segment that must be decoded for the target (rows are coded top to bottom in the stream)
+static int segmentEndRow(const ImageSegment *segment, const DecodeTarget *target) {
+    int end = target->firstRow + target->rows;
+    return segment->firstRow + segment->rows < end ? segment->firstRow + segment->rows : end;
+}
+
+// Where image row i of a segment is decoded: straight into the target when the whole segment row lies inside it,
+// otherwise into scratch (see clipSegmentRow)
+static unsigned char *segmentRowOutput(const DecodeTarget *target, const ImageSegment *segment, int i, unsigned char *scratch) {
+    if (i >= target->firstRow && segment->firstColumn >= target->firstColumn &&
+        segment->firstColumn + segment->columns <= target->firstColumn + target->columns) {
+        return &target->pixels[(size_t)(i - target->firstRow) * target->stride + (size_t)(segment->firstColumn - target->firstColumn) * 3];
+    }
+    return scratch;
+}
+
+// Copy the part of a row decoded into scratch that lies inside the target
+static void clipSegmentRow(const DecodeTarget *target, const ImageSegment *segment, int i, const unsigned char *row,
+                           const unsigned char *scratch) {
+    if (row != scratch || i < target->firstRow) {
         return;
     }
+    int left = segment->firstColumn > target->firstColumn ? segment->firstColumn : target->firstColumn;
+    int right = segment->firstColumn + segment->columns < target->firstColumn + target->columns
+                    ? segment->firstColumn + segment->columns : target->firstColumn + target->columns;
+    if (left < right) {
+        memcpy(&target->pixels[(size_t)(i - target->firstRow) * target->stride + (size_t)(left - target->firstColumn) * 3],
+               &scratch[(left - segment->firstColumn) * 3], (size_t)(right - left) * 3);
+    }
+}
 
-    // Write the BMP header and info header from the original BMP file
-    fwrite(bmpHeader, sizeof(unsigned char), headerSize, outputFile);
+// Decode every segment that overlaps the target with worker, in parallel.
+// Returns the number of target pixels decoded, or -1 if memory runs out.
+static long decodeSegments(DecodeContext *ctx, int count, void (*worker)(void *context, int index)) {
+    ctx->selected = (int *)malloc((count > 0 ? count : 1) * sizeof(int));
+    if (ctx->selected == NULL) {
+        perror("Error allocating memory for segment selection");
+        return -1;
+    }
+    int selectedCount = 0;
+    for (int s = 0; s < count; s++) {
+        if (segmentOverlap(&ctx->segments[s], ctx->target) > 0) {
+            ctx->selected[selectedCount++] = s;
+        }
+    }
+    parallel_for(selectedCount, parallel_thread_count(), worker, ctx);
 
-    // Write the decoded pixel data
-    fwrite(decodedPixelData, sizeof(unsigned char), row_padded * height, outputFile);
+    long decodedPixels = 0;
+    for (int k = 0; k < selectedCount; k++) {
+        ImageSegment *segment = &ctx->segments[ctx->selected[k]];
+        if (segment->status == 0) {
+            decodedPixels += segmentOverlap(segment, ctx->target);
+        }
+    }
+    free(ctx->selected);
+    return decodedPixels;
+}
 
-    free(decodedPixelData);
-    printf("Decoded image successfully written to %s\n", outputFileName);
-    fclose(outputFile);
+// Decode one code per pixel, writing each pixel straight into its padded scanline
+static void decodeColorSegment(void *context, int index) {
+    DecodeContext *ctx = (DecodeContext *)context;
+    ImageSegment *segment = &ctx->segments[ctx->selected[index]];
+    const LookupDecoder *decoder = ctx->decoders;
+    BitReader bits = {segment->data, segment->size, 0, 0, 0};
+    size_t totalBits = segment->size * 8;
+    int endRow = segmentEndRow(segment, ctx->target);
+    segment->status = -1;
+
+    unsigned char *scratch = (unsigned char *)malloc((size_t)segment->columns * 3);
+    if (scratch == NULL) {
+        perror("Error allocating memory for segment decoding");
+        return;
+    }
+    int i = segment->firstRow;
+    for (; i < endRow; i++) {
+        unsigned char *row = segmentRowOutput(ctx->target, segment, i, scratch);
+        int j = 0;
+        for (; j < segment->columns; j++) {
+            DecodeEntry entry = decodeSymbol(decoder, &bits);
+            if (entry.length == 0) {
+                break;
+            }
+            row[j * 3] = entry.value & 0xFF;
+            row[j * 3 + 1] = (entry.value >> 8) & 0xFF;
+            row[j * 3 + 2] = (entry.value >> 16) & 0xFF;
+        }
+        // Codes running past the end of the stream only decode the zero padding
+        if (j < segment->columns || bitReaderPosition(&bits) > totalBits) {
+            break;
+        }
+        clipSegmentRow(ctx->target, segment, i, row, scratch);
+    }
+    free(scratch);
+    if (i == endRow) {
+        segment->status = 0;
+    }
 }
-void getBmpDimensions(const char *filename, int *width, int *height, int *row_padded) {
-    FILE *bmpFile = fopen(filename, "rb");
-    if (!bmpFile) {
-        perror("Error opening BMP file");
+
+// Decode HIMG_MODE_COLOR tables and the segments that overlap target.
+// Returns the number of target pixels decoded, or -1 if the tables are corrupt.
+long decodeColorPixels(ByteReader *reader, int width, int height, const SegmentLayout *layout, const DecodeTarget *target) {
+    unsigned int size = readU32(reader);
+    if (reader->error || size == 0 || size > MAX_COLORS || size > reader->size) {
+        return -1;
+    }
+
+    unsigned int *colors = (unsigned int *)malloc(size * sizeof(unsigned int));
+    if (colors == NULL) {
+        perror("Error allocating memory for code table");
+        return -1;
+    }
+    unsigned int color = 0;
+    for (unsigned int i = 0; i < size; i++) {
+        color += readVarint(reader);
+        colors[i] = color;
+    }
+    const unsigned char *lengths = readBytes(reader, size);
+    int segmentCount;
+    ImageSegment *segments = reader->error ? NULL : readSegments(reader, width, height, layout, &segmentCount);
+
+    LookupDecoder decoder;
+    if (segments == NULL || buildLookupDecoder(&decoder, colors, lengths, size) != 0) {
+        free(colors);
+        free(segments);
+        return -1;
+    }
+    free(colors);
+
+    DecodeContext ctx = {target, &decoder, NULL, 0, NULL, 0, segments, NULL};
+    long decodedPixels = decodeSegments(&ctx, segmentCount, decodeColorSegment);
+    free(decoder.entries);
+    free(segments);
+    return decodedPixels;
+}
+
+// Residuals are decoded into a row buffer, unfiltered against the previous (still transformed) row,
+// then the color transform is undone in the output. The row above a segment's first row is zeros.
+static void decodePredictiveSegment(void *context, int index) {
+    DecodeContext *ctx = (DecodeContext *)context;
+    ImageSegment *segment = &ctx->segments[ctx->selected[index]];
+    const LookupDecoder *decoders = ctx->decoders;
+    int rowBytes = segment->columns * 3;
+    int endRow = segmentEndRow(segment, ctx->target);
+    segment->status = -1;
+
+    unsigned char *transformed = (unsigned char *)calloc((size_t)rowBytes * 3, 1);
+    if (transformed == NULL) {
+        perror("Error allocating memory for predictive decoding");
         return;
     }
+    unsigned char *current = transformed, *previous = &transformed[rowBytes], *scratch = &transformed[rowBytes * 2];
+
+    BitReader bits = {segment->data, segment->size, 0, 0, 0};
+    size_t totalBits = segment->size * 8;
+    int i = segment->firstRow;
+    for (; i < endRow; i++) {
+        int k = 0;
+        for (; k < rowBytes; k += 3) {
+            DecodeEntry blue = decodeSymbol(&decoders[0], &bits);
+            DecodeEntry green = decodeSymbol(&decoders[1], &bits);
+            DecodeEntry red = decodeSymbol(&decoders[2], &bits);
+            if (blue.length == 0 || green.length == 0 || red.length == 0) {
+                break;
+            }
+            current[k] = blue.value;
+            current[k + 1] = green.value;
+            current[k + 2] = red.value;
+        }
+        if (k < rowBytes || bitReaderPosition(&bits) > totalBits) {
+            break;
+        }
 
-    unsigned char bmpHeader[54];
-    fread(bmpHeader, sizeof(unsigned char), 54, bmpFile);
-    fclose(bmpFile);
+        row_filter_undo(ctx->filters[segment->firstLine + (i - segment->firstRow)], current, previous, rowBytes);
+        unsigned char *row = segmentRowOutput(ctx->target, segment, i, scratch);
+        memcpy(row, current, rowBytes);
+        inverseTransformRow(row, segment->columns, ctx->decorrelate);
+        clipSegmentRow(ctx->target, segment, i, row, scratch);
+
+        unsigned char *swap = previous;
+        previous = current;
+        current = swap;
+    }
+    free(transformed);
+    if (i == endRow) {
+        segment->status = 0;
+    }
+}
+
+// Decode HIMG_MODE_PREDICTIVE tables and the segments that overlap target
+long decodePredictivePixels(ByteReader *reader, int width, int height, const SegmentLayout *layout, const DecodeTarget *target) {
+    size_t filterCount = (size_t)height * ((width + (long long)layout->tileWidth - 1) / layout->tileWidth);
+    const unsigned char *decorrelate = readBytes(reader, 1);
+    const unsigned char *filters = readBytes(reader, filterCount);
+    const unsigned char *lengths = readBytes(reader, 3 * 256);
+    if (reader->error) {
+        return -1;
+    }
+    for (size_t i = 0; i < filterCount; i++) {
+        if (filters[i] >= FILTER_COUNT) {
+            return -1;
+        }
+    }
+    int segmentCount;
+    ImageSegment *segments = readSegments(reader, width, height, layout, &segmentCount);
+    if (segments == NULL) {
+        return -1;
+    }
 
-    // Retrieve width and height from the BMP header
-    *width = *(int*)&bmpHeader[18];
-    *height = *(int*)&bmpHeader[22];
+    unsigned int symbols[256];
+    for (int symbol = 0; symbol < 256; symbol++) {
+        symbols[symbol] = symbol;
+    }
+    LookupDecoder decoders[3];
+    for (int c = 0; c < 3; c++) {
+        if (buildLookupDecoder(&decoders[c], symbols, &lengths[c * 256], 256) != 0) {
+            for (int k = 0; k < c; k++) free(decoders[k].entries);
+            free(segments);
+            return -1;
+        }
+    }
 
-    // Calculate the padded row size
-    int bytesPerPixel = 3; // 24-bit BMP
-    int unpaddedRowSize = *width * bytesPerPixel;
-    *row_padded = (unpaddedRowSize + 3) & (~3); // Round up to the nearest multiple of 4
+    DecodeContext ctx = {target, decoders, filters, *decorrelate, NULL, 0, segments, NULL};
+    long decodedPixels = decodeSegments(&ctx, segmentCount, decodePredictiveSegment);
+    for (int c = 0; c < 3; c++) free(decoders[c].entries);
+    free(segments);
+    return decodedPixels;
 }
 
-int main() {
-    const char *inputFileName = "sample.bmp";
-    unsigned char *pixelData = NULL;
-    unsigned int *colorFrequency = (unsigned int *)calloc(MAX_COLORS, sizeof(unsigned int));
-    if (colorFrequency == NULL) {
-        perror("Error allocating memory for color frequency array");
-        return 1;
+// Each index is one palette lookup, each run a fill from the previous pixel
+static void decodePaletteSegment(void *context, int index) {
+    DecodeContext *ctx = (DecodeContext *)context;
+    ImageSegment *segment = &ctx->segments[ctx->selected[index]];
+    const LookupDecoder *decoder = ctx->decoders;
+    unsigned int size = ctx->paletteSize;
+    int width = segment->columns;
+    int endRow = segmentEndRow(segment, ctx->target);
+    BitReader bits = {segment->data, segment->size, 0, 0, 0};
+    size_t totalBits = segment->size * 8;
+    segment->status = -1;
+
+    unsigned char *scratch = (unsigned char *)malloc((size_t)width * 3);
+    if (scratch == NULL) {
+        perror("Error allocating memory for segment decoding");
+        return;
     }
-    
-    int width, height;
+    int i = segment->firstRow;
+    for (; i < endRow; i++) {
+        unsigned char *row = segmentRowOutput(ctx->target, segment, i, scratch);
+        int j = 0;
+        while (j < width) {
+            DecodeEntry entry = decodeSymbol(decoder, &bits);
+            if (entry.length == 0) {
+                break;
+            }
+            if (entry.value < size) {
+                memcpy(&row[j * 3], &ctx->palette[entry.value * 3], 3);
+                j++;
+                continue;
+            }
 
-    // Read the BMP file
-    readBMP(inputFileName, &pixelData, &width, &height, colorFrequency);
+            // Run of the previous pixel; the extra bits are already in the buffer after decodeSymbol's refill
+            int r = entry.value - size;
+            int run = 1 << r;
+            if (r > 0) {
+                run += (int)(bits.buffer >> (64 - r));
+                bits.buffer <<= r;
+                bits.count -= r;
+            }
+            if (j == 0 || run > width - j) {
+                break;
+            }
+            for (int k = 0; k < run; k++, j++) {
+                memcpy(&row[j * 3], &row[(j - 1) * 3], 3);
+            }
+        }
+        if (j < width || bitReaderPosition(&bits) > totalBits) {
+            break;
+        }
+        clipSegmentRow(ctx->target, segment, i, row, scratch);
+    }
+    free(scratch);
+    if (i == endRow) {
+        segment->status = 0;
+    }
+}
 
-    // Create color frequency pairs
-    ColorFrequencyPair *pairs;
-    int size;
-    pairs = createColorFrequencyPairs(colorFrequency, &size);
-    if (pairs == NULL) {
-        return 1;
+// Decode HIMG_MODE_PALETTE tables and the segments that overlap target
+long decodePalettePixels(ByteReader *reader, int width, int height, const SegmentLayout *layout, const DecodeTarget *target) {
+    unsigned int size = readU32(reader);
+    if (reader->error || size == 0 || size > MAX_COLORS || size > reader->size) {
+        return -1;
+    }
+    const unsigned char *palette = readBytes(reader, (size_t)size * 3);
+    unsigned int alphabetSize = size + PALETTE_RUN_SYMBOLS;
+    const unsigned char *lengths = readBytes(reader, alphabetSize);
+    int segmentCount;
+    ImageSegment *segments = reader->error ? NULL : readSegments(reader, width, height, layout, &segmentCount);
+    if (segments == NULL) {
+        return -1;
     }
 
-    // Build the Huffman tree
-    HuffmanNode *huffmanRoot = NULL;
-    buildHuffmanTree(pairs, size, &huffmanRoot);
+    unsigned int *symbols = (unsigned int *)malloc(alphabetSize * sizeof(unsigned int));
+    if (symbols == NULL) {
+        perror("Error allocating memory for palette decoding");
+        free(segments);
+        return -1;
+    }
+    for (unsigned int symbol = 0; symbol < alphabetSize; symbol++) {
+        symbols[symbol] = symbol;
+    }
+    LookupDecoder decoder;
+    int built = buildLookupDecoder(&decoder, symbols, lengths, alphabetSize);
+    free(symbols);
+    if (built != 0) {
+        free(segments);
+        return -1;
+    }
 
-    // Generate Huffman codes and print them
-    char **codes = (char **)malloc(MAX_COLORS * sizeof(char *));
-    char codeBuffer[256];
-    generateHuffmanCodes(huffmanRoot, codes, codeBuffer, 0);
+    DecodeContext ctx = {target, &decoder, NULL, 0, palette, size, segments, NULL};
+    long decodedPixels = decodeSegments(&ctx, segmentCount, decodePaletteSegment);
+    free(decoder.entries);
+    free(segments);
+    return decodedPixels;
+}
 
-    // Encode the pixel data
-    unsigned char *encodedData = NULL;
-    size_t encodedSize = 0;
-    encodePixelData(pixelData, width, height, (width * 3 + 3) & (~3), codes, &encodedData, &encodedSize);
+// Fields shared by every mode, as stored by writeImageHeader
+typedef struct {
+    int mode;
+    const unsigned char *bmpHeader;
+    unsigned int headerSize;
+    int width;
+    int height;
+    SegmentLayout layout;
+} ImageHeader;
+
+// Parse the common header of the container that starts at reader's position and fills the rest of reader;
+// reader is left at the mode's tables. Returns 0 on success, -1 (with an error printed) otherwise.
+static int parseImageHeader(ByteReader *reader, ImageHeader *header) {
+    const unsigned char *magic = readBytes(reader, 6);
+    if (magic == NULL || memcmp(magic, "HIMG", 4) != 0 || magic[4] != HIMG_VERSION) {
+        printf("Not an encoded image.\n");
+        return -1;
+    }
+    header->mode = magic[5];
+    header->headerSize = readU32(reader);
+    header->bmpHeader = readBytes(reader, header->headerSize);
+    header->width = (int)readU32(reader);
+    header->height = (int)readU32(reader);
+    unsigned int pixelCount = readU32(reader);
+    header->layout.tileWidth = (int)readU32(reader);
+    header->layout.tileHeight = (int)readU32(reader);
+
+    // Every pixel costs at least one bit, except palette runs: at least 16 bits for up to 65535 pixels
+    size_t maxPixelsPerByte = header->mode == HIMG_MODE_PALETTE ? (1 << PALETTE_RUN_SYMBOLS) / 2 : 8;
+    if (reader->error || header->width <= 0 || header->height <= 0 ||
+        pixelCount != (unsigned int)header->width * header->height ||
+        (size_t)header->width * header->height > reader->size * maxPixelsPerByte ||
+        header->layout.tileWidth <= 0 || header->layout.tileHeight <= 0) {
+        printf("Corrupt encoded image header.\n");
+        return -1;
+    }
+    return 0;
+}
 
-    printf("Encoded data size (in bytes): %zu\n", encodedSize);
+// Map an encoded image and parse its common header; reader is left at the mode's tables.
+// On failure an error is printed and nothing stays open.
+static int openEncodedImage(const char *encodedFileName, BmpImage *file, ByteReader *reader, ImageHeader *header) {
+    if (bmp_map_file(encodedFileName, file) != 0) {
+        return -1;
+    }
+    reader->data = file->data;
+    reader->size = file->size;
+    reader->pos = 0;
+    reader->error = 0;
+    if (parseImageHeader(reader, header) != 0) {
+        printf("Cannot decode %s\n", encodedFileName);
+        bmp_close(file);
+        return -1;
+    }
+    return 0;
+}
 
-    const char *outputFileName = "encoded_output.bin"; // Change to desired file name
+// Decode the mode's tables and the part of the image covered by target.
+// Returns the number of target pixels decoded, or -1 if the data is corrupt.
+static long decodeImagePixels(ByteReader *reader, const ImageHeader *header, const DecodeTarget *target) {
+    if (header->mode == HIMG_MODE_COLOR) {
+        return decodeColorPixels(reader, header->width, header->height, &header->layout, target);
+    } else if (header->mode == HIMG_MODE_PREDICTIVE) {
+        return decodePredictivePixels(reader, header->width, header->height, &header->layout, target);
+    } else if (header->mode == HIMG_MODE_PALETTE) {
+        return decodePalettePixels(reader, header->width, header->height, &header->layout, target);
+    }
+    printf("Unknown encoding mode %d.\n", header->mode);
+    return -1;
+}
 
-    // Call the write function with the encoded data
-    writeEncodedDataToFile(outputFileName, encodedData, encodedSize);
+// Decode an encoded image container into a BMP file; needs nothing but the container itself
+int decodeBinaryFile(const char *encodedFileName, const char *outputFileName) {
+    BmpImage file;
+    ByteReader reader;
+    ImageHeader header;
+    if (openEncodedImage(encodedFileName, &file, &reader, &header) != 0) {
+        return -1;
+    }
+    int width = header.width, height = header.height;
+    long pixelCount = (long)width * height;
+
+    // Decode straight into the mapped output file; its padding bytes start out zero
+    int row_padded = (width * 3 + 3) & (~3);
+    BmpImage output;
+    if (bmp_create(outputFileName, header.bmpHeader, header.headerSize, width, height, &output) != 0) {
+        bmp_close(&file);
+        return -1;
+    }
 
-    const char *encodedFileName = "encoded_output.bin";
+    double start = wall_seconds();
+    DecodeTarget target = {output.pixels, output.rowSize, 0, height, 0, width};
+    long decodedPixels = decodeImagePixels(&reader, &header, &target);
+    double seconds = wall_seconds() - start;
+
+    if (decodedPixels < 0) {
+        printf("Corrupt or truncated encoded image.\n");
+        bmp_close(&output);
+        remove(outputFileName);
+        bmp_close(&file);
+        return -1;
+    }
 
-    // Assuming these values are from the encoding stage
-      // Replace with the actual Huffman tree from encoding
-    int  row_padded ; // Replace with actual image width, height, and padded row size
-    getBmpDimensions("sample.bmp", &width, &height, &row_padded);
+    // Check if pixel data is complete
+    if (decodedPixels != pixelCount) {
+        printf("Decoded data might be incomplete. Pixels decoded: %ld of %ld\n", decodedPixels, pixelCount);
+    } else {
+        printf("Decoding completed successfully!\n");
+        if (seconds > 0) {
+            printf("Decoding speed: %.1f MB/s\n", (double)row_padded * height / seconds / 1e6);
+        }
+    }
 
+    bmp_close(&output);
+    bmp_close(&file);
+    printf("Decoded image successfully written to %s\n", outputFileName);
+    return decodedPixels == pixelCount ? 0 : -1;
+}
 
-    // Load BMP header from the original file
-    FILE *originalBmpFile = fopen("sample.bmp", "rb");
-    if (!originalBmpFile) {
-        perror("Error opening original BMP file");
-        return 1;
+// Decode the rectangle of columns [x, x + regionWidth) and stored rows [y, y + regionHeight) of an encoded image
+// into pixels, whose rows are stride bytes apart (3 bytes per pixel, blue green red).
+// Only the segments that overlap the rectangle are decoded, so a tiled image costs O(region), not O(image).
+// Returns 0 on success, -1 on error.
+int decodeImageRegion(const char *encodedFileName, int x, int y, int regionWidth, int regionHeight,
+                      unsigned char *pixels, size_t stride) {
+    BmpImage file;
+    ByteReader reader;
+    ImageHeader header;
+    if (openEncodedImage(encodedFileName, &file, &reader, &header) != 0) {
+        return -1;
+    }
+    if (x < 0 || y < 0 || regionWidth <= 0 || regionHeight <= 0 || x > header.width - regionWidth ||
+        y > header.height - regionHeight) {
+        printf("Region %d,%d %dx%d is outside the %dx%d image.\n", x, y, regionWidth, regionHeight, header.width, header.height);
+        bmp_close(&file);
+        return -1;
+    }
+
+    DecodeTarget target = {pixels, stride, y, regionHeight, x, regionWidth};
+    long decodedPixels = decodeImagePixels(&reader, &header, &target);
+    bmp_close(&file);
+    if (decodedPixels != (long)regionWidth * regionHeight) {
+        printf("Corrupt or truncated encoded image.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Copy of a BMP header (at least BITMAPINFOHEADER sized) for a width x height image: patches bfSize, biWidth,
+// biHeight (keeping the row order) and biSizeImage. Returns NULL if out of memory; the caller frees the copy.
+unsigned char *resizedBmpHeader(const unsigned char *header, size_t headerSize, int width, int height) {
+    unsigned char *bmpHeader = (unsigned char *)malloc(headerSize);
+    if (bmpHeader == NULL) {
+        perror("Error allocating memory for BMP header");
+        return NULL;
+    }
+    memcpy(bmpHeader, header, headerSize);
+    size_t imageSize = bmp_row_size(width) * height;
+    int storedHeight = (int)bmp_u32(&bmpHeader[22]) < 0 ? -height : height;
+    unsigned int fields[4][2] = {{2, (unsigned int)(headerSize + imageSize)}, {18, (unsigned int)width},
+                                 {22, (unsigned int)storedHeight}, {34, (unsigned int)imageSize}};
+    for (int f = 0; f < 4; f++) {
+        unsigned int value = fields[f][1];
+        unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+        memcpy(&bmpHeader[fields[f][0]], bytes, 4);
+    }
+    return bmpHeader;
+}
+
+// Write a region of an encoded image as a BMP of its own (same header bytes with the region's dimensions)
+int writeImageRegion(const char *encodedFileName, const char *outputFileName, int x, int y, int regionWidth, int regionHeight) {
+    BmpImage file;
+    ByteReader reader;
+    ImageHeader header;
+    if (openEncodedImage(encodedFileName, &file, &reader, &header) != 0) {
+        return -1;
+    }
+    if (header.headerSize < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE || x < 0 || y < 0 || regionWidth <= 0 ||
+        regionHeight <= 0 || x > header.width - regionWidth || y > header.height - regionHeight) {
+        printf("Region %d,%d %dx%d is outside the %dx%d image.\n", x, y, regionWidth, regionHeight, header.width, header.height);
+        bmp_close(&file);
+        return -1;
+    }
+
+    unsigned char *bmpHeader = resizedBmpHeader(header.bmpHeader, header.headerSize, regionWidth, regionHeight);
+    if (bmpHeader == NULL) {
+        bmp_close(&file);
+        return -1;
+    }
+
+    BmpImage output;
+    int created = bmp_create(outputFileName, bmpHeader, header.headerSize, regionWidth, regionHeight, &output);
+    free(bmpHeader);
+    if (created != 0) {
+        bmp_close(&file);
+        return -1;
+    }
+
+    double start = wall_seconds();
+    DecodeTarget target = {output.pixels, output.rowSize, y, regionHeight, x, regionWidth};
+    long decodedPixels = decodeImagePixels(&reader, &header, &target);
+    double seconds = wall_seconds() - start;
+    bmp_close(&output);
+    bmp_close(&file);
+    if (decodedPixels != (long)regionWidth * regionHeight) {
+        printf("Corrupt or truncated encoded image.\n");
+        remove(outputFileName);
+        return -1;
+    }
+    printf("Region %d,%d %dx%d decoded in %.2f ms and written to %s\n", x, y, regionWidth, regionHeight, seconds * 1e3,
+           outputFileName);
+    return 0;
+}
+
+// Decode the smallest stored preview that is at least minWidth x minHeight (or the full image if none is) into a BMP.
+// Thumbnails only read and decode their own level, e.g. 1/64 of the pixels for the 1/8 level.
+int writeImagePreview(const char *encodedFileName, const char *outputFileName, int minWidth, int minHeight) {
+    BmpImage file;
+    ByteReader reader;
+    ImageHeader header;
+    if (openEncodedImage(encodedFileName, &file, &reader, &header) != 0) {
+        return -1;
+    }
+
+    // Levels are stored largest first, so search from the end of the trailer
+    unsigned int levels = 0;
+    const unsigned char *trailer = &file.data[file.size - (file.size >= 8 ? 8 : file.size)];
+    if (file.size >= 8 && memcmp(&trailer[4], PREVIEW_MAGIC, 4) == 0) {
+        levels = bmp_u32(trailer);
+        if (levels > PREVIEW_LEVELS || file.size < 8 + (size_t)levels * 16) {
+            levels = 0;
+        }
+    }
+    const unsigned char *table = trailer - (size_t)levels * 16;
+    for (int level = (int)levels - 1; level >= 0; level--) {
+        const unsigned char *entry = &table[level * 16];
+        unsigned long long offset = bmp_u32(entry) | (unsigned long long)bmp_u32(&entry[4]) << 32;
+        unsigned long long size = bmp_u32(&entry[8]) | (unsigned long long)bmp_u32(&entry[12]) << 32;
+        if (offset > file.size || size > file.size - offset) {
+            continue;
+        }
+        ByteReader levelReader = {file.data + offset, (size_t)size, 0, 0};
+        ImageHeader levelHeader;
+        if (parseImageHeader(&levelReader, &levelHeader) == 0 && levelHeader.width >= minWidth &&
+            levelHeader.height >= minHeight) {
+            reader = levelReader;
+            header = levelHeader;
+            break;
+        }
+    }
+
+    BmpImage output;
+    if (bmp_create(outputFileName, header.bmpHeader, header.headerSize, header.width, header.height, &output) != 0) {
+        bmp_close(&file);
+        return -1;
+    }
+    double start = wall_seconds();
+    DecodeTarget target = {output.pixels, output.rowSize, 0, header.height, 0, header.width};
+    long decodedPixels = decodeImagePixels(&reader, &header, &target);
+    double seconds = wall_seconds() - start;
+    bmp_close(&output);
+    bmp_close(&file);
+    if (decodedPixels != (long)header.width * header.height) {
+        printf("Corrupt or truncated encoded image.\n");
+        remove(outputFileName);
+        return -1;
     }
+    printf("Preview %dx%d decoded in %.2f ms and written to %s\n", header.width, header.height, seconds * 1e3,
+           outputFileName);
+    return 0;
+}
 
-    // Read BMP headers (file header + info header)
-    unsigned char bmpHeader[54];
-    fread(bmpHeader, sizeof(unsigned char), 54, originalBmpFile);
-    fclose(originalBmpFile);
+// Halve an image with a 2x2 box filter (a last odd row or column is averaged with itself). Rows keep their stored
+// order and are padded to whole words. Returns NULL if out of memory; the caller frees the result.
+unsigned char *downsampleImage(const unsigned char *pixels, int width, int height, size_t rowSize, int *halfWidth,
+                               int *halfHeight) {
+    int w = (width + 1) / 2, h = (height + 1) / 2;
+    size_t halfRowSize = bmp_row_size(w);
+    unsigned char *half = (unsigned char *)calloc(halfRowSize * h, 1);
+    if (half == NULL) {
+        perror("Error allocating memory for preview");
+        return NULL;
+    }
+    for (int y = 0; y < h; y++) {
+        const unsigned char *row0 = &pixels[(size_t)(2 * y) * rowSize];
+        const unsigned char *row1 = 2 * y + 1 < height ? row0 + rowSize : row0;
+        unsigned char *out = &half[(size_t)y * halfRowSize];
+        for (int x = 0; x < w; x++) {
+            int x0 = 2 * x * 3, x1 = 2 * x + 1 < width ? x0 + 3 : x0;
+            for (int c = 0; c < 3; c++) {
+                out[x * 3 + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+            }
+        }
+    }
+    *halfWidth = w;
+    *halfHeight = h;
+    return half;
+}
 
-    // Call decode function with the BMP header information
-    decodeBinaryFile(encodedFileName, huffmanRoot, width, height, row_padded, bmpHeader, 54);
+// Append up to PREVIEW_LEVELS halved copies of the image and the trailer that indexes them
+int writePreviewLevels(FILE *outputFile, unsigned char *bmpHeader, int headerSize, unsigned char *pixelData, int width,
+                       int height, int decorrelate) {
+    unsigned long long offsets[PREVIEW_LEVELS], sizes[PREVIEW_LEVELS];
+    unsigned char *level = NULL;
+    int levels = 0;
+    while (levels < PREVIEW_LEVELS && (width > 1 || height > 1)) {
+        unsigned char *half = downsampleImage(level != NULL ? level : pixelData, width, height, bmp_row_size(width),
+                                              &width, &height);
+        free(level);
+        level = half;
+        unsigned char *levelHeader = level != NULL ? resizedBmpHeader(bmpHeader, headerSize, width, height) : NULL;
+        if (levelHeader == NULL) {
+            free(level);
+            return -1;
+        }
+        SegmentLayout layout = rowSegmentLayout(width);
+        long start = ftell(outputFile);
+        int result = encodePredictiveImage(outputFile, levelHeader, headerSize, level, width, height, &layout,
+                                           decorrelate);
+        free(levelHeader);
+        if (result != 0 || start < 0) {
+            free(level);
+            return -1;
+        }
+        offsets[levels] = (unsigned long long)start;
+        sizes[levels] = (unsigned long long)(ftell(outputFile) - start);
+        levels++;
+    }
+    free(level);
 
+    for (int i = 0; i < levels; i++) {
+        writeU32(outputFile, (unsigned int)offsets[i]);
+        writeU32(outputFile, (unsigned int)(offsets[i] >> 32));
+        writeU32(outputFile, (unsigned int)sizes[i]);
+        writeU32(outputFile, (unsigned int)(sizes[i] >> 32));
+    }
+    writeU32(outputFile, levels);
+    fwrite(PREVIEW_MAGIC, 1, 4, outputFile);
     return 0;
 }
-    
\ No newline at end of file
+
+// Compress a 24-bit BMP into a self-contained encoded image file using one of the HIMG_MODE_* modes.
+// tileSize > 0 codes tileSize x tileSize tiles independently (for decodeImageRegion); 0 codes full-width row segments.
+// With previews set, the 1/2, 1/4 and 1/8 scale levels are appended for writeImagePreview.
+// decorrelate stores blue and red as differences from green in the predictive mode and the previews; it helps
+// photographs, whose channels move together, and can be turned off for images whose channels are unrelated.
+int compressImageFile(const char *inputFileName, const char *outputFileName, int mode, int tileSize, int previews,
+                      int decorrelate) {
+    BmpImage image;
+    ColorHistogram histogram;
+    if (mode == HIMG_MODE_COLOR && initColorHistogram(&histogram) != 0) {
+        return -1;
+    }
+
+    double start = wall_seconds();
+
+    // Map the BMP file (the predictive mode doesn't need the color histogram)
+    if (readBMP(inputFileName, &image, mode == HIMG_MODE_COLOR ? &histogram : NULL) != 0) {
+        if (mode == HIMG_MODE_COLOR) freeColorHistogram(&histogram);
+        return -1;
+    }
+    unsigned char *bmpHeader = image.data;
+    int headerSize = (int)image.headerSize;
+    unsigned char *pixelData = image.pixels;
+    int width = image.width, height = image.rows;
+    SegmentLayout layout = rowSegmentLayout(width);
+    if (tileSize > 0) {
+        layout.tileWidth = layout.tileHeight = tileSize;
+    }
+
+    FILE *outputFile = fopen(outputFileName, "wb");
+    if (outputFile == NULL) {
+        perror("Error creating output file");
+        bmp_close(&image);
+        if (mode == HIMG_MODE_COLOR) freeColorHistogram(&histogram);
+        return -1;
+    }
+
+    int result = -1;
+    if (mode == HIMG_MODE_PREDICTIVE) {
+        result = encodePredictiveImage(outputFile, bmpHeader, headerSize, pixelData, width, height, &layout,
+                                       decorrelate);
+    } else {
+        // Create color frequency pairs
+        ColorFrequencyPair *pairs;
+        int size;
+        pairs = createColorFrequencyPairs(&histogram, &size);
+
+        if (pairs != NULL && size <= PALETTE_MAX_COLORS) {
+            // Low-color images are coded as palette indices instead
+            result = encodePaletteImage(outputFile, bmpHeader, headerSize, pixelData, width, height, &layout, &histogram,
+                                        pairs, size);
+        } else if (pairs != NULL) {
+            // Build the Huffman tree
+            HuffmanNode *huffmanRoot = NULL;
+            buildLengthLimitedHuffmanTree(pairs, size, &huffmanRoot);
+
+            // Generate canonical Huffman codes
+            HuffmanCode *codes = (HuffmanCode *)calloc(size, sizeof(HuffmanCode));
+            generateHuffmanCodes(huffmanRoot, &histogram, codes, 0, 0);
+            assignCanonicalCodes(codes, size);
+            freeHuffmanTree(huffmanRoot);
+
+            // Encode the pixel data, one segment per task
+            int segmentCount = 0;
+            ImageSegment *segments = createImageSegments(width, height, &layout, &segmentCount);
+            size_t encodedSize = 0;
+            if (segments != NULL) {
+                size_t expectedSize = (encodedBitCount(pairs, size, codes) + 7) / 8;
+                ColorEncodeContext ctx = {pixelData, (size_t)width * height, (width * 3 + 3) & (~3), &histogram, codes,
+                                          expectedSize, segments};
+                parallel_for(segmentCount, parallel_thread_count(), encodeColorSegment, &ctx);
+                encodedSize = encodedSegmentsSize(segments, segmentCount);
+            }
+
+            printf("Encoded data size (in bytes): %zu\n", encodedSize);
+
+            // Call the write function with the encoded data
+            if (encodedSize > 0) {
+                writeEncodedDataToFile(outputFile, bmpHeader, headerSize, width, height, &layout, pairs, codes, size,
+                                       segments, segmentCount);
+                result = 0;
+            }
+            freeImageSegments(segments, segmentCount);
+            free(codes);
+        }
+        free(pairs);
+        freeColorHistogram(&histogram);
+    }
+
+    if (result == 0 && previews) {
+        result = writePreviewLevels(outputFile, bmpHeader, headerSize, pixelData, width, height, decorrelate);
+    }
+    if (fclose(outputFile) != 0) {
+        result = -1;
+    }
+    double seconds = wall_seconds() - start;
+    bmp_close(&image);
+    if (result != 0) {
+        remove(outputFileName);
+        return -1;
+    }
+
+    printf("Encoded data successfully written to %s\n", outputFileName);
+    if (seconds > 0) {
+        printf("Encoding speed: %.1f MB/s\n", (double)((width * 3 + 3) & (~3)) * height / seconds / 1e6);
+    }
+    return 0;
+}
+
+// Parse a tile size argument: digits only, 1 to MAX_TILE_SIZE. Returns the size, or 0 if the text is not one.
+static int parseTileSize(const char *text) {
+    int size = 0;
+    if (*text == '\0') return 0;
+    for (const char *p = text; *p; p++) {
+        if (*p < '0' || *p > '9') return 0;
+        size = size * 10 + (*p - '0');
+        if (size > MAX_TILE_SIZE) return 0;
+    }
+    return size;
+}
+
+// Usage: Huffmann [compress <input.bmp> <output.bin> [color|predictive] [nodecorrelate] [<tile size>] [preview]
+//                  | decompress <input.bin> <output.bmp>
+//                  | region <input.bin> <output.bmp> <x> <y> <width> <height>
+//                  | preview <input.bin> <output.bmp> <min width> <min height>]
+// Without arguments, sample.bmp is compressed to encoded_output.bin and decoded back to decoded_image.bmp.
+int main(int argc, char **argv) {
+    if (argc >= 4 && argc <= 8 && strcmp(argv[1], "compress") == 0) {
+        int mode = HIMG_MODE_COLOR, tileSize = 0, previews = 0, decorrelate = 1;
+        for (int i = 4; i < argc; i++) {
+            if (strcmp(argv[i], "predictive") == 0) {
+                mode = HIMG_MODE_PREDICTIVE;
+            } else if (strcmp(argv[i], "preview") == 0) {
+                previews = 1;
+            } else if (strcmp(argv[i], "nodecorrelate") == 0) {
+                decorrelate = 0;
+            } else if (strcmp(argv[i], "color") != 0) {
+                tileSize = parseTileSize(argv[i]);
+                if (tileSize == 0) {
+                    printf("Unknown option: %s (use color, predictive, nodecorrelate, preview or a tile size from 1 to %d)\n",
+                           argv[i], MAX_TILE_SIZE);
+                    return 1;
+                }
+            }
+        }
+        return compressImageFile(argv[2], argv[3], mode, tileSize, previews, decorrelate) == 0 ? 0 : 1;
+    }
+    if (argc == 4 && strcmp(argv[1], "decompress") == 0) {
+        return decodeBinaryFile(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+    if (argc == 8 && strcmp(argv[1], "region") == 0) {
+        return writeImageRegion(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]), atoi(argv[6]), atoi(argv[7])) == 0 ? 0 : 1;
+    }
+    if (argc == 6 && strcmp(argv[1], "preview") == 0) {
+        return writeImagePreview(argv[2], argv[3], atoi(argv[4]), atoi(argv[5])) == 0 ? 0 : 1;
+    }
+
+    const char *inputFileName = "sample.bmp";
+    const char *encodedFileName = "encoded_output.bin"; // Change to desired file name
+    const char *decodedFileName = "decoded_image.bmp";
+    int mode = HIMG_MODE_COLOR; // Or HIMG_MODE_PREDICTIVE for photographic images
+
+    if (compressImageFile(inputFileName, encodedFileName, mode, 0, 0, 1) != 0) {
+        return 1;
+    }
+
+    // The decoder only reads the encoded file
+    return decodeBinaryFile(encodedFileName, decodedFileName) == 0 ? 0 : 1;
+}
@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bmp_io.h"
+#include "lzw_coder.h"
+#include "../Text compression/crc32c.h"
+
+// LZW over BMP pixel data, with the byte-oriented coder in lzw_coder.h. Unlike the text LZW programs, the
+// dictionary is built over bytes, so any binary buffer can be coded, including NUL bytes.
+#define LZWI_VERSION 2  // Version 2 added the CRC32C
+#define LZWI_MODE_BYTES 0    // Blue, green and red bytes of each row, rows back to back without padding
+#define LZWI_MODE_PALETTE 1  // One palette index per pixel (images with at most LZWI_PALETTE_MAX colors)
+#define LZWI_PALETTE_MAX 256
+
+// LZW-code size bytes of input.
+// Returns the packed codes (the caller frees them) and their byte count, or NULL if out of memory.
+unsigned char *lzwCompress(const unsigned char *input, size_t size, size_t *outputSize) {
+    LzwEncoder encoder;
+    if (lzw_encoder_init(&encoder) != 0) {
+        perror("Error allocating memory for LZW dictionary");
+        return NULL;
+    }
+    BitWriter writer = {NULL, 0, 0, 0, 0, 0};
+    int result = lzw_encode(&encoder, &writer, input, size);
+    lzw_encoder_free(&encoder);
+    if (result != 0) {
+        perror("Error allocating memory for LZW codes");
+        free(writer.data);
+        return NULL;
+    }
+    *outputSize = writer.size;
+    return writer.data;
+}
+
+// Decode an LZW code stream into exactly size bytes of output.
+// Returns 0 on success, -1 if the stream is corrupt or does not decode to size bytes.
+int lzwDecompress(const unsigned char *input, size_t inputSize, unsigned char *output, size_t size) {
+    LzwDecoder decoder;
+    if (lzw_decoder_init(&decoder) != 0) {
+        perror("Error allocating memory for LZW dictionary");
+        return -1;
+    }
+    int result = lzw_decode(&decoder, input, inputSize, output, size);
+    lzw_decoder_free(&decoder);
+    return result;
+}
+
+static void writeU32(FILE *file, unsigned int value) {
+    unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+    fwrite(bytes, 1, 4, file);
+}
+
+// Collect the distinct colors of an image if there are at most LZWI_PALETTE_MAX of them.
+// Returns the color count, or 0 if there are more.
+static int collectPalette(const BmpImage *image, unsigned int *palette) {
+    int count = 0;
+    for (int y = 0; y < image->rows; y++) {
+        const unsigned char *row = bmp_row(image, y);
+        unsigned int last = 0xFFFFFFFFu;
+        for (int x = 0; x < image->width; x++) {
+            unsigned int color = row[x * 3] | (row[x * 3 + 1] << 8) | (row[x * 3 + 2] << 16);
+            if (color == last) continue;
+            last = color;
+            int i = 0;
+            while (i < count && palette[i] != color) i++;
+            if (i == count) {
+                if (count == LZWI_PALETTE_MAX) return 0;
+                palette[count++] = color;
+            }
+        }
+    }
+    return count;
+}
+
+// Compress a 24-bit BMP into a self-contained LZW image file:
+//   "LZWI", byte version, byte mode, uint32 header size, the original BMP headers,
+//   for LZWI_MODE_PALETTE a uint32 color count and 3 bytes (blue, green, red) per color,
+//   uint32 code stream size, uint32 CRC32C of the row bytes or palette indices, then their code stream.
+int compressLZWImage(const char *inputFileName, const char *outputFileName) {
+    BmpImage image;
+    if (bmp_open(inputFileName, &image) != 0) {
+        return -1;
+    }
+
+    // Gather the bytes to code: palette indices when the image has few colors, otherwise the unpadded rows
+    unsigned int palette[LZWI_PALETTE_MAX];
+    int paletteSize = collectPalette(&image, palette);
+    int mode = paletteSize > 0 ? LZWI_MODE_PALETTE : LZWI_MODE_BYTES;
+    size_t rowBytes = mode == LZWI_MODE_PALETTE ? (size_t)image.width : (size_t)image.width * 3;
+    unsigned char *input = (unsigned char *)malloc(rowBytes * image.rows);
+    if (input == NULL) {
+        perror("Error allocating memory for pixel data");
+        bmp_close(&image);
+        return -1;
+    }
+    for (int y = 0; y < image.rows; y++) {
+        const unsigned char *row = bmp_row(&image, y);
+        unsigned char *out = &input[rowBytes * y];
+        if (mode == LZWI_MODE_BYTES) {
+            memcpy(out, row, rowBytes);
+            continue;
+        }
+        int index = 0;
+        for (int x = 0; x < image.width; x++) {
+            unsigned int color = row[x * 3] | (row[x * 3 + 1] << 8) | (row[x * 3 + 2] << 16);
+            if (palette[index] != color) {
+                index = 0;
+                while (palette[index] != color) index++;
+            }
+            out[x] = (unsigned char)index;
+        }
+    }
+
+    size_t encodedSize = 0;
+    unsigned char *encoded = lzwCompress(input, rowBytes * image.rows, &encodedSize);
+    unsigned int crc = crc32c(0, input, rowBytes * image.rows);
+    free(input);
+    if (encoded == NULL) {
+        bmp_close(&image);
+        return -1;
+    }
+
+    FILE *outputFile = fopen(outputFileName, "wb");
+    if (outputFile == NULL) {
+        perror("Error creating output file");
+        free(encoded);
+        bmp_close(&image);
+        return -1;
+    }
+    fwrite("LZWI", 1, 4, outputFile);
+    fputc(LZWI_VERSION, outputFile);
+    fputc(mode, outputFile);
+    writeU32(outputFile, (unsigned int)image.headerSize);
+    fwrite(image.data, 1, image.headerSize, outputFile);
+    if (mode == LZWI_MODE_PALETTE) {
+        writeU32(outputFile, paletteSize);
+        for (int i = 0; i < paletteSize; i++) {
+            unsigned char bytes[3] = {palette[i] & 0xFF, (palette[i] >> 8) & 0xFF, palette[i] >> 16};
+            fwrite(bytes, 1, 3, outputFile);
+        }
+    }
+    writeU32(outputFile, (unsigned int)encodedSize);
+    writeU32(outputFile, crc);
+    fwrite(encoded, 1, encodedSize, outputFile);
+    int result = fclose(outputFile) == 0 ? 0 : -1;
+
+    printf("%s: %zu bytes of %s coded to %zu bytes\n", outputFileName, rowBytes * image.rows,
+           mode == LZWI_MODE_PALETTE ? "palette indices" : "pixel bytes", encodedSize);
+    free(encoded);
+    bmp_close(&image);
+    return result;
+}
+
+// Decode an LZW image file into a BMP; needs nothing but the encoded file itself
+int decompressLZWImage(const char *inputFileName, const char *outputFileName) {
+    BmpImage file;
+    if (bmp_map_file(inputFileName, &file) != 0) {
+        return -1;
+    }
+    const unsigned char *data = file.data;
+    size_t size = file.size, pos = 10;
+    if (size < pos || memcmp(data, "LZWI", 4) != 0 || data[4] != LZWI_VERSION || data[5] > LZWI_MODE_PALETTE) {
+        printf("Not an LZW image file: %s\n", inputFileName);
+        bmp_close(&file);
+        return -1;
+    }
+    int mode = data[5];
+    size_t headerSize = bmp_u32(&data[6]);
+    const unsigned char *header = &data[pos];
+    unsigned int paletteSize = 0;
+    const unsigned char *palette = NULL;
+    int valid = headerSize >= BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE && headerSize <= size - pos;
+    if (valid) {
+        pos += headerSize;
+    }
+    if (valid && mode == LZWI_MODE_PALETTE) {
+        valid = size - pos >= 4 && (paletteSize = bmp_u32(&data[pos])) >= 1 && paletteSize <= LZWI_PALETTE_MAX &&
+                size - pos - 4 >= paletteSize * 3;
+        palette = &data[pos + 4];
+        pos += valid ? 4 + paletteSize * 3 : 0;
+    }
+    size_t encodedSize = valid && size - pos >= 4 ? bmp_u32(&data[pos]) : 0;
+    int width = valid ? (int)bmp_u32(&header[18]) : 0;
+    int height = valid ? (int)bmp_u32(&header[22]) : 0;
+    int rows = height < 0 ? -height : height;
+    if (!valid || encodedSize == 0 || size - pos < 8 || encodedSize > size - pos - 8 || width <= 0 || rows <= 0 ||
+        (size_t)width * rows / 65536 > encodedSize) {
+        printf("Corrupt LZW image header.\n");
+        bmp_close(&file);
+        return -1;
+    }
+    unsigned int crc = bmp_u32(&data[pos + 4]);
+    const unsigned char *encoded = &data[pos + 8];
+
+    size_t rowBytes = mode == LZWI_MODE_PALETTE ? (size_t)width : (size_t)width * 3;
+    unsigned char *decoded = (unsigned char *)malloc(rowBytes * rows);
+    BmpImage output;
+    if (decoded == NULL || bmp_create(outputFileName, header, headerSize, width, rows, &output) != 0) {
+        if (decoded == NULL) perror("Error allocating memory for pixel data");
+        free(decoded);
+        bmp_close(&file);
+        return -1;
+    }
+
+    clock_t start = clock();
+    int result = lzwDecompress(encoded, encodedSize, decoded, rowBytes * rows);
+    if (result == 0 && crc32c(0, decoded, rowBytes * rows) != crc) {
+        result = -1;
+    }
+    for (int y = 0; result == 0 && y < rows; y++) {
+        unsigned char *row = bmp_row(&output, y);
+        const unsigned char *in = &decoded[rowBytes * y];
+        if (mode == LZWI_MODE_BYTES) {
+            memcpy(row, in, rowBytes);
+            continue;
+        }
+        for (int x = 0; x < width; x++) {
+            if (in[x] >= paletteSize) {
+                result = -1;
+                break;
+            }
+            memcpy(&row[x * 3], &palette[in[x] * 3], 3);
+        }
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    free(decoded);
+    bmp_close(&output);
+    bmp_close(&file);
+    if (result != 0) {
+        printf("Corrupt or truncated LZW image.\n");
+        remove(outputFileName);
+        return -1;
+    }
+    printf("Decoded %dx%d image in %.2f ms and written to %s\n", width, rows, seconds * 1e3, outputFileName);
+    return 0;
+}
+
+// Usage: LZW [compress <input.bmp> <output.lzw> | decompress <input.lzw> <output.bmp>]
+// Without arguments, sample.bmp is compressed to compressed.lzw and decoded back to decompressed_lzw.bmp.
+int main(int argc, char **argv) {
+    if (argc == 4 && strcmp(argv[1], "compress") == 0) {
+        return compressLZWImage(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+    if (argc == 4 && strcmp(argv[1], "decompress") == 0) {
+        return decompressLZWImage(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+
+    const char *inputFileName = "sample.bmp";
+    const char *encodedFileName = "compressed.lzw";
+    const char *decodedFileName = "decompressed_lzw.bmp";
+    if (compressLZWImage(inputFileName, encodedFileName) != 0) {
+        return 1;
+    }
+    return decompressLZWImage(encodedFileName, decodedFileName) == 0 ? 0 : 1;
+}
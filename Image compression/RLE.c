@@ -1,7 +1,13 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
+#include "bmp_io.h"
+#include "selective_rle.h"
+#include "../Text compression/crc32c.h"
+#include "../Text compression/parallel_for.h"
 
 #pragma pack(1)
 
@@ -29,135 +35,705 @@ typedef struct {
 
 #pragma pack()
 
-#define RLE_THRESHOLD 5  // Adjusted threshold for selective RLE
+// The reserved1 field must be zero in a BMP, so the compressed file uses it to tag its layout. Both layouts
+// check the decoded pixels with CRC32C (of each row's width * 3 pixel bytes, without the padding), so a
+// truncated or damaged file is reported instead of decoding to a wrong image. Files from before the checks
+// (reserved1 0 or "RB") are rejected.
+#define RLE_LAYOUT_ROWS 0x5252   // "RR": rows encoded back to back, then a uint32 CRC32C of the rows
+#define RLE_LAYOUT_BANDS 0x5052  // "RP": bands of rows with a band table, see compress_bmp_bands
+
+// Write the source BMP's header bytes (everything up to the pixel data) with layout in the reserved1 field
+void write_rle_headers(FILE *outputFile, const BmpImage *image, uint16_t layout) {
+    uint8_t tag[2] = {layout & 0xFF, layout >> 8};
+    fwrite(image->data, 1, 6, outputFile);
+    fwrite(tag, 1, 2, outputFile);
+    fwrite(&image->data[8], 1, image->headerSize - 8, outputFile);
+}
+
+// Read the header bytes of a compressed file (they are the original BMP headers with the layout tag).
+// Returns the bytes up to the pixel data with reserved1 cleared, or NULL if the headers are not a 24-bit BMP.
+uint8_t *read_rle_headers(FILE *inputFile, BMPHeader *header, BMPInfoHeader *infoHeader) {
+    if (fread(header, sizeof(BMPHeader), 1, inputFile) != 1 ||
+        fread(infoHeader, sizeof(BMPInfoHeader), 1, inputFile) != 1 || header->type != 0x4D42) {
+        printf("Not a valid BMP file.\n");
+        return NULL;
+    }
+    if (infoHeader->bitCount != 24 || infoHeader->compression != 0 ||
+        header->offset < sizeof(BMPHeader) + sizeof(BMPInfoHeader)) {
+        printf("Only 24-bit uncompressed BMP files are supported.\n");
+        return NULL;
+    }
+    // As in bmp_open; the width limit also keeps the per-row byte counts (width * 4) within an int
+    if (infoHeader->width <= 0 || infoHeader->width > INT_MAX / 4 || infoHeader->height == 0 ||
+        infoHeader->height == INT_MIN) {
+        printf("Invalid BMP dimensions: %d x %d.\n", infoHeader->width, infoHeader->height);
+        return NULL;
+    }
 
-// Check if three RGB values (pixels) are the same
-int pixels_equal(uint8_t *pixel1, uint8_t *pixel2) {
-    return (pixel1[0] == pixel2[0] && pixel1[1] == pixel2[1] && pixel1[2] == pixel2[2]);
+    uint8_t *bytes = (uint8_t*) malloc(header->offset);
+    if (!bytes) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    BMPHeader outputHeader = *header;
+    outputHeader.reserved1 = 0;
+    memcpy(bytes, &outputHeader, sizeof(BMPHeader));
+    memcpy(&bytes[sizeof(BMPHeader)], infoHeader, sizeof(BMPInfoHeader));
+
+    // Larger info headers (V4/V5) and color masks sit between the 54 bytes above and the pixels
+    size_t extra = header->offset - (sizeof(BMPHeader) + sizeof(BMPInfoHeader));
+    if (fread(&bytes[sizeof(BMPHeader) + sizeof(BMPInfoHeader)], 1, extra, inputFile) != extra) {
+        printf("BMP header is truncated.\n");
+        free(bytes);
+        return NULL;
+    }
+    return bytes;
 }
 
-// Selective RLE Compression
-void selective_compress_rle(uint8_t *data, int size, FILE *outputFile) {
-    int i = 0;
-    while (i < size) {
-        uint8_t *pixel = &data[i];
-        int runLength = 1;
-
-        // Calculate run length
-        while (i + runLength * 3 < size && pixels_equal(&data[i], &data[i + runLength * 3]) && runLength < 255) {
-            runLength++;
-        }
-
-        if (runLength >= RLE_THRESHOLD) {
-            // Write compressed data for long runs
-            fputc(runLength, outputFile);
-            fwrite(pixel, 1, 3, outputFile);
-        } else {
-            // Write each pixel uncompressed for short runs
-            for (int j = 0; j < runLength; j++) {
-                fputc(1, outputFile);  // Run length of 1
-                fwrite(&data[i + j * 3], 1, 3, outputFile);
-            }
+// Compress BMP file with selective RLE, one scanline at a time.
+// Each row's pixel bytes are encoded on their own, so runs never cross a row and padding is not stored.
+// The rows are read straight from the mapped source file. Returns 0 on success, -1 on failure.
+int compress_bmp(const char *inputPath, const char *outputPath) {
+    BmpImage image;
+    if (bmp_open(inputPath, &image) != 0) {
+        return -1;
+    }
+    FILE *outputFile = fopen(outputPath, "wb");
+    if (!outputFile) {
+        perror("File error");
+        bmp_close(&image);
+        return -1;
+    }
+
+    // Write the BMP headers to the output file
+    write_rle_headers(outputFile, &image, RLE_LAYOUT_ROWS);
+
+    uint8_t *encoded = (uint8_t*) malloc((size_t)image.width * 4);
+    if (!encoded) {
+        perror("Memory allocation failed");
+        bmp_close(&image);
+        fclose(outputFile);
+        return -1;
+    }
+
+    // Selectively compress each scanline and write it to output file
+    uint32_t crc = 0;
+    for (int y = 0; y < image.rows; y++) {
+        size_t encodedSize = selective_compress_rle(bmp_row(&image, y), image.width * 3, encoded);
+        fwrite(encoded, 1, encodedSize, outputFile);
+        crc = crc32c(crc, bmp_row(&image, y), image.width * 3);
+    }
+    fwrite(&crc, sizeof(uint32_t), 1, outputFile);
+
+    free(encoded);
+    bmp_close(&image);
+    return fclose(outputFile) == 0 ? 0 : -1;
+}
+
+#define RLE_READ_CHUNK 65536  // Compressed bytes fetched per refill while decoding
+
+// Decode RLE_LAYOUT_ROWS pixel data, one scanline at a time, straight into the mapped output bitmap, and check
+// the CRC32C after it. Returns 0 on success, -1 on corrupt input or allocation failure.
+int decompress_rows(FILE *inputFile, BmpImage *output) {
+    int pixelBytes = output->width * 3;
+
+    // A row never needs more than one 4-byte packet per pixel
+    size_t capacity = (size_t)output->width * 4;
+    if (capacity < RLE_READ_CHUNK) {
+        capacity = RLE_READ_CHUNK;
+    }
+    uint8_t *compressed = (uint8_t*) malloc(capacity);
+    if (!compressed) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+
+    size_t start = 0, available = 0;
+    uint32_t crc = 0;
+    int y;
+    for (y = 0; y < output->rows; y++) {
+        // Keep at least one worst-case row of compressed bytes in the window
+        if (available < (size_t)output->width * 4) {
+            memmove(compressed, &compressed[start], available);
+            start = 0;
+            available += fread(&compressed[available], 1, capacity - available, inputFile);
         }
 
-        i += runLength * 3;
+        // Decompress the row; padding bytes stay zero
+        long used = decompress_rle(&compressed[start], available, bmp_row(output, y), pixelBytes);
+        if (used < 0) {
+            printf("Corrupt or truncated RLE data in row %d.\n", y);
+            break;
+        }
+        crc = crc32c(crc, bmp_row(output, y), pixelBytes);
+        start += used;
+        available -= used;
     }
+
+    // The rows are followed by their CRC32C
+    int result = y == output->rows ? 0 : -1;
+    if (result == 0) {
+        memmove(compressed, &compressed[start], available);
+        available += fread(&compressed[available], 1, capacity - available, inputFile);
+        uint32_t expected;
+        memcpy(&expected, compressed, sizeof(expected));
+        if (available < sizeof(expected) || expected != crc) {
+            printf("Pixel data does not match its checksum.\n");
+            result = -1;
+        }
+    }
+
+    free(compressed);
+    return result;
 }
 
-// Decompress RLE data
-void decompress_rle(FILE *inputFile, uint8_t *outputData, int dataSize) {
-    int i = 0;
+#define BAND_TARGET_BYTES (1 << 20)  // Approximate raw pixel bytes per band
 
-    while (i < dataSize) {
-        int runLength = fgetc(inputFile);
-        uint8_t pixel[3];
-        fread(pixel, 1, 3, inputFile);
+// One band of scanlines handled by a worker thread
+typedef struct {
+    const uint8_t *input;   // Padded rows (compress) or the band's compressed bytes (decompress)
+    uint8_t *output;        // Compressed bytes (compress) or padded rows (decompress)
+    size_t inputSize;       // Compressed bytes available to the decoder
+    size_t outputSize;      // Compressed bytes produced by the encoder
+    uint32_t crc;           // CRC32C of the band's pixel bytes (computed by the encoder, checked by the decoder)
+    int rows;
+    int rowSize;
+    int width;
+    int status;             // 0 on success, -1 if the band failed to decode
+} BandJob;
+
+// parallel_for task: encode band index of a BandJob array
+void compress_band(void *context, int index) {
+    BandJob *job = &((BandJob *)context)[index];
+    job->outputSize = 0;
+    job->crc = 0;
+    for (int y = 0; y < job->rows; y++) {
+        const uint8_t *row = &job->input[(size_t)y * job->rowSize];
+        job->outputSize += selective_compress_rle(row, job->width * 3, &job->output[job->outputSize]);
+        job->crc = crc32c(job->crc, row, job->width * 3);
+    }
+}
 
-        for (int j = 0; j < runLength && i < dataSize; j++) {
-            memcpy(&outputData[i], pixel, 3);
-            i += 3;
+// parallel_for task: decode band index of a BandJob array
+void decompress_band(void *context, int index) {
+    BandJob *job = &((BandJob *)context)[index];
+    size_t pos = 0;
+    uint32_t crc = 0;
+    job->status = 0;
+    for (int y = 0; y < job->rows; y++) {
+        uint8_t *row = &job->output[(size_t)y * job->rowSize];
+        long used = decompress_rle(&job->input[pos], job->inputSize - pos, row, job->width * 3);
+        if (used < 0) {
+            job->status = -1;
+            return;
         }
+        memset(&row[job->width * 3], 0, job->rowSize - job->width * 3);
+        crc = crc32c(crc, row, job->width * 3);
+        pos += used;
+    }
+    if (pos != job->inputSize) {
+        printf("Band has %zu trailing bytes.\n", job->inputSize - pos);
+        job->status = -1;
+    } else if (crc != job->crc) {
+        job->status = -1;
     }
 }
 
-// Compress BMP file with selective RLE
-void compress_bmp(const char *inputPath, const char *outputPath) {
-    FILE *inputFile = fopen(inputPath, "rb");
+// Compress BMP file with selective RLE using threadCount workers.
+// The image is cut into bands of rowsPerBand scanlines that are encoded independently, and the output is
+//   headers (reserved1 = RLE_LAYOUT_BANDS), uint32 rowsPerBand, uint32 bandCount,
+//   uint32 compressed size of each band, uint32 CRC32C of each band's pixel bytes, then the bands back to back.
+// Each band is checked on its own, so the checks run in parallel with the decoding.
+// Workers read their rows straight from the mapped source. Bands are encoded threadCount at a time,
+// so the output buffers stay bounded by the batch, not the image. Returns 0 on success, -1 on failure.
+int compress_bmp_bands(const char *inputPath, const char *outputPath, int threadCount) {
+    BmpImage image;
+    if (bmp_open(inputPath, &image) != 0) {
+        return -1;
+    }
     FILE *outputFile = fopen(outputPath, "wb");
+    if (!outputFile) {
+        perror("File error");
+        bmp_close(&image);
+        return -1;
+    }
+
+    write_rle_headers(outputFile, &image, RLE_LAYOUT_BANDS);
+
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > PARALLEL_MAX_THREADS) threadCount = PARALLEL_MAX_THREADS;
+
+    int rowSize = (int)image.rowSize;
+    int rows = image.rows;
+    uint32_t rowsPerBand = BAND_TARGET_BYTES / rowSize;
+    if (rowsPerBand < 1) rowsPerBand = 1;
+    uint32_t bandCount = (rows + rowsPerBand - 1) / rowsPerBand;
+
+    size_t bandOutput = (size_t)rowsPerBand * image.width * 4;
+    uint8_t *output = (uint8_t*) malloc(bandOutput * threadCount);
+    uint32_t *bandSizes = (uint32_t*) calloc(2 * bandCount + 1, sizeof(uint32_t));  // Sizes, then CRCs
+    if (!output || !bandSizes) {
+        perror("Memory allocation failed");
+        free(output);
+        free(bandSizes);
+        bmp_close(&image);
+        fclose(outputFile);
+        return -1;
+    }
+
+    // Reserve the band table; it is filled in once the band sizes and CRCs are known
+    long tableOffset = ftell(outputFile);
+    fwrite(&rowsPerBand, sizeof(uint32_t), 1, outputFile);
+    fwrite(&bandCount, sizeof(uint32_t), 1, outputFile);
+    fwrite(bandSizes, sizeof(uint32_t), 2 * bandCount, outputFile);
+
+    BandJob jobs[PARALLEL_MAX_THREADS];
+    for (uint32_t first = 0; first < bandCount; first += threadCount) {
+        int batch = (bandCount - first) < (uint32_t)threadCount ? (int)(bandCount - first) : threadCount;
+        for (int b = 0; b < batch; b++) {
+            int firstRow = (int)((first + b) * rowsPerBand);
+            int bandRows = rows - firstRow;
+            if (bandRows > (int)rowsPerBand) bandRows = rowsPerBand;
+
+            jobs[b].input = bmp_row(&image, firstRow);
+            jobs[b].output = &output[b * bandOutput];
+            jobs[b].rows = bandRows;
+            jobs[b].rowSize = rowSize;
+            jobs[b].width = image.width;
+        }
+
+        parallel_for(batch, batch, compress_band, jobs);
+
+        for (int b = 0; b < batch; b++) {
+            bandSizes[first + b] = (uint32_t)jobs[b].outputSize;
+            bandSizes[bandCount + first + b] = jobs[b].crc;
+            fwrite(jobs[b].output, 1, jobs[b].outputSize, outputFile);
+        }
+    }
+
+    fseek(outputFile, tableOffset + 2 * sizeof(uint32_t), SEEK_SET);
+    fwrite(bandSizes, sizeof(uint32_t), 2 * bandCount, outputFile);
 
-    if (!inputFile || !outputFile) {
+    free(bandSizes);
+    free(output);
+    bmp_close(&image);
+    return fclose(outputFile) == 0 ? 0 : -1;
+}
+
+// Decode RLE_LAYOUT_BANDS pixel data, threadCount bands at a time, each straight into its slice of the mapped bitmap.
+// Returns 0 once every band is decoded, -1 if the data is corrupt or truncated.
+int decompress_bands(FILE *inputFile, BmpImage *outputImage, int threadCount) {
+    uint32_t rowsPerBand, bandCount;
+    int rowSize = (int)outputImage->rowSize;
+    int rows = outputImage->rows;
+
+    if (fread(&rowsPerBand, sizeof(uint32_t), 1, inputFile) != 1 ||
+        fread(&bandCount, sizeof(uint32_t), 1, inputFile) != 1 ||
+        rowsPerBand == 0 || bandCount != (rows + rowsPerBand - 1) / rowsPerBand) {
+        printf("Corrupt band table.\n");
+        return -1;
+    }
+
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > PARALLEL_MAX_THREADS) threadCount = PARALLEL_MAX_THREADS;
+
+    size_t bandLimit = (size_t)rowsPerBand * outputImage->width * 4;
+    uint32_t *bandSizes = (uint32_t*) malloc((2 * bandCount + 1) * sizeof(uint32_t));  // Sizes, then CRCs
+    uint8_t *input = (uint8_t*) malloc(bandLimit * threadCount);
+    int result = 0;
+    if (!bandSizes || !input) {
+        perror("Memory allocation failed");
+        free(bandSizes);
+        free(input);
+        return -1;
+    }
+    if (fread(bandSizes, sizeof(uint32_t), 2 * bandCount, inputFile) != 2 * bandCount) {
+        printf("Corrupt band table.\n");
+        bandCount = 0;
+        result = -1;
+    }
+
+    BandJob jobs[PARALLEL_MAX_THREADS];
+    for (uint32_t first = 0; first < bandCount; first += threadCount) {
+        int batch = (bandCount - first) < (uint32_t)threadCount ? (int)(bandCount - first) : threadCount;
+        size_t batchInput = 0;
+        for (int b = 0; b < batch; b++) {
+            int firstRow = (int)((first + b) * rowsPerBand);
+            int bandRows = rows - firstRow;
+            if (bandRows > (int)rowsPerBand) bandRows = rowsPerBand;
+
+            if (bandSizes[first + b] > bandLimit) {
+                printf("Corrupt size for band %u.\n", first + b);
+                batch = 0;
+                bandCount = 0;
+                break;
+            }
+            jobs[b].input = &input[batchInput];
+            jobs[b].inputSize = bandSizes[first + b];
+            jobs[b].crc = bandSizes[bandCount + first + b];
+            jobs[b].output = bmp_row(outputImage, firstRow);
+            jobs[b].rows = bandRows;
+            jobs[b].rowSize = rowSize;
+            jobs[b].width = outputImage->width;
+            batchInput += bandSizes[first + b];
+        }
+        if (batch == 0 || fread(input, 1, batchInput, inputFile) != batchInput) {
+            printf("Compressed data is truncated.\n");
+            result = -1;
+            break;
+        }
+
+        parallel_for(batch, batch, decompress_band, jobs);
+
+        int failed = 0;
+        for (int b = 0; b < batch; b++) {
+            failed |= jobs[b].status;
+        }
+        if (failed) {
+            printf("Corrupt data in bands %u to %u.\n", first, first + batch - 1);
+            result = -1;
+            break;
+        }
+    }
+
+    free(input);
+    free(bandSizes);
+    return result;
+}
+
+// Decompress BMP file in whichever layout it was compressed with.
+// The output bitmap is created at its final size and mapped, so the decoders write pixels in place.
+// Returns 0 on success; on corrupt or truncated input the partial bitmap is removed and -1 returned.
+int decompress_bmp(const char *inputPath, const char *outputPath) {
+    FILE *inputFile = fopen(inputPath, "rb");
+    if (!inputFile) {
         perror("File error");
-        return;
+        return -1;
     }
 
     BMPHeader header;
     BMPInfoHeader infoHeader;
 
-    // Read BMP headers
-    fread(&header, sizeof(BMPHeader), 1, inputFile);
-    fread(&infoHeader, sizeof(BMPInfoHeader), 1, inputFile);
-
-    // Write headers to output file
-    fwrite(&header, sizeof(BMPHeader), 1, outputFile);
-    fwrite(&infoHeader, sizeof(BMPInfoHeader), 1, outputFile);
-
-    int dataSize = infoHeader.imageSize;
-    uint8_t *data = (uint8_t*) malloc(dataSize);
-    fread(data, 1, dataSize, inputFile);
+    // Read headers from compressed file and create the output BMP file with them
+    uint8_t *headerBytes = read_rle_headers(inputFile, &header, &infoHeader);
+    if (!headerBytes) {
+        fclose(inputFile);
+        return -1;
+    }
+    if (header.reserved1 != RLE_LAYOUT_ROWS && header.reserved1 != RLE_LAYOUT_BANDS) {
+        printf("Not a checked RLE file (it may be from an older version without checksums).\n");
+        free(headerBytes);
+        fclose(inputFile);
+        return -1;
+    }
+    BmpImage output;
+    int rows = infoHeader.height < 0 ? -infoHeader.height : infoHeader.height;
+    int created = bmp_create(outputPath, headerBytes, header.offset, infoHeader.width, rows, &output);
+    free(headerBytes);
+    if (created != 0) {
+        fclose(inputFile);
+        return -1;
+    }
 
-    // Selectively compress pixel data and write to output file
-    selective_compress_rle(data, dataSize, outputFile);
+    int result;
+    if (header.reserved1 == RLE_LAYOUT_BANDS) {
+        result = decompress_bands(inputFile, &output, parallel_thread_count());
+    } else {
+        result = decompress_rows(inputFile, &output);
+    }
 
-    free(data);
+    bmp_close(&output);
     fclose(inputFile);
-    fclose(outputFile);
+    if (result != 0) {
+        printf("Compressed file is corrupt or truncated.\n");
+        remove(outputPath);
+        return -1;
+    }
+    return 0;
 }
 
-// Decompress BMP file
-void decompress_bmp(const char *inputPath, const char *outputPath) {
-    FILE *inputFile = fopen(inputPath, "rb");
+// Sequences of same-sized frames (e.g. from a fixed camera) store most frames as the XOR with the previous frame.
+// Unchanged pixels become zero, so a slowly changing frame is mostly long zero runs that selective RLE collapses.
+// Every keyframeInterval-th frame is stored whole, so any frame can be decoded from the keyframe before it.
+// File layout:
+//   "RSEQ", uint32 frameCount, uint32 keyframeInterval,
+//   the first frame's BMP headers (reserved1 = RLE_LAYOUT_ROWS), uint64 offset of each frame,
+//   then each frame as RLE_LAYOUT_ROWS pixel data (of the frame itself for keyframes, else of the XOR), which
+//   ends with its CRC32C, so each frame is checked as it is decoded.
+#define SEQUENCE_MAGIC "RSEQ"
+
+// Compress frameCount BMP frames of equal size and header into one sequence file.
+// Returns 0 when every frame is stored. If a later frame can't be read or has another size, the frames before it
+// are kept as a shorter, valid sequence and -1 is returned; -1 with no output file means nothing could be written.
+int compress_bmp_sequence(const char **framePaths, int frameCount, const char *outputPath, uint32_t keyframeInterval) {
+    if (frameCount < 1) {
+        return -1;
+    }
+    if (keyframeInterval < 1) keyframeInterval = 1;
+
+    BmpImage previous = {0}, frame;
+    if (bmp_open(framePaths[0], &frame) != 0) {
+        return -1;
+    }
     FILE *outputFile = fopen(outputPath, "wb");
+    if (!outputFile) {
+        perror("File error");
+        bmp_close(&frame);
+        return -1;
+    }
+
+    uint32_t count = frameCount;
+    fwrite(SEQUENCE_MAGIC, 1, 4, outputFile);
+    fwrite(&count, sizeof(uint32_t), 1, outputFile);
+    fwrite(&keyframeInterval, sizeof(uint32_t), 1, outputFile);
+    write_rle_headers(outputFile, &frame, RLE_LAYOUT_ROWS);
+
+    int pixelBytes = frame.width * 3;
+    uint8_t *delta = (uint8_t*) malloc(pixelBytes);
+    uint8_t *encoded = (uint8_t*) malloc((size_t)frame.width * 4);
+    uint64_t *offsets = (uint64_t*) calloc(frameCount, sizeof(uint64_t));
+    if (!delta || !encoded || !offsets) {
+        perror("Memory allocation failed");
+        free(delta);
+        free(encoded);
+        free(offsets);
+        bmp_close(&frame);
+        fclose(outputFile);
+        remove(outputPath);
+        return -1;
+    }
 
-    if (!inputFile || !outputFile) {
+    // Reserve the frame index; it is filled in once the frame offsets are known
+    long tableOffset = ftell(outputFile);
+    fwrite(offsets, sizeof(uint64_t), frameCount, outputFile);
+
+    int written = 0;
+    for (int f = 0; f < frameCount; f++) {
+        if (f > 0) {
+            if (bmp_open(framePaths[f], &frame) != 0) {
+                break;
+            }
+            // Report the first property that differs from the sequence
+            int mismatch = 1;
+            if (frame.width != previous.width || frame.rows != previous.rows) {
+                printf("Frame %s is %dx%d, the sequence is %dx%d.\n", framePaths[f], frame.width, frame.rows,
+                       previous.width, previous.rows);
+            } else if (frame.headerSize != previous.headerSize) {
+                printf("Frame %s has %zu header bytes, the sequence has %zu.\n", framePaths[f], frame.headerSize,
+                       previous.headerSize);
+            } else if (frame.topDown != previous.topDown) {
+                printf("Frame %s stores its rows %s, the sequence stores them %s.\n", framePaths[f],
+                       frame.topDown ? "top-down" : "bottom-up", previous.topDown ? "top-down" : "bottom-up");
+            } else {
+                mismatch = 0;
+            }
+            if (mismatch) {
+                bmp_close(&frame);
+                break;
+            }
+        }
+
+        offsets[f] = (uint64_t)ftell(outputFile);
+        int keyframe = f % keyframeInterval == 0;
+        uint32_t crc = 0;
+        for (int y = 0; y < frame.rows; y++) {
+            const uint8_t *row = bmp_row(&frame, y);
+            if (!keyframe) {
+                const uint8_t *previousRow = bmp_row(&previous, y);
+                for (int i = 0; i < pixelBytes; i++) {
+                    delta[i] = row[i] ^ previousRow[i];
+                }
+                row = delta;
+            }
+            size_t encodedSize = selective_compress_rle(row, pixelBytes, encoded);
+            fwrite(encoded, 1, encodedSize, outputFile);
+            crc = crc32c(crc, row, pixelBytes);
+        }
+        fwrite(&crc, sizeof(uint32_t), 1, outputFile);
+
+        // Keep this frame mapped as the reference for the next one
+        if (f > 0) bmp_close(&previous);
+        previous = frame;
+        written++;
+    }
+    bmp_close(&previous);
+
+    // Record the frames actually written, then their offsets
+    count = written;
+    fseek(outputFile, 4, SEEK_SET);
+    fwrite(&count, sizeof(uint32_t), 1, outputFile);
+    fseek(outputFile, tableOffset, SEEK_SET);
+    fwrite(offsets, sizeof(uint64_t), written, outputFile);
+    if (written < frameCount) {
+        printf("Only %d of %d frames were compressed.\n", written, frameCount);
+    }
+
+    free(delta);
+    free(encoded);
+    free(offsets);
+    if (fclose(outputFile) != 0) {
+        perror("Error writing sequence file");
+        remove(outputPath);
+        return -1;
+    }
+    return written == frameCount ? 0 : -1;
+}
+
+// Check that a frame name pattern holds exactly one integer conversion (such as %d or %03d) and otherwise only
+// literal text and %%, so it is safe to pass to snprintf with the frame number
+static int valid_frame_pattern(const char *pattern) {
+    int conversions = 0;
+    for (const char *p = pattern; *p; p++) {
+        if (*p != '%') continue;
+        p++;
+        if (*p == '%') continue;
+        while (*p && strchr("-+ 0#", *p)) p++;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p != 'd' && *p != 'i') {
+            return 0;
+        }
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// Decompress frames first..last of a sequence file, each to a BMP named by outputPattern (a printf format taking the
+// frame number, e.g. "frame%03d.bmp"). Decoding starts at the keyframe at or before first.
+// Returns the number of frames written.
+int decompress_bmp_sequence(const char *inputPath, int first, int last, const char *outputPattern) {
+    if (!valid_frame_pattern(outputPattern)) {
+        printf("The output pattern must contain one frame number conversion such as %%d or %%03d.\n");
+        return 0;
+    }
+    FILE *inputFile = fopen(inputPath, "rb");
+    if (!inputFile) {
         perror("File error");
-        return;
+        return 0;
+    }
+
+    char magic[4];
+    uint32_t count, keyframeInterval;
+    if (fread(magic, 1, 4, inputFile) != 4 || memcmp(magic, SEQUENCE_MAGIC, 4) != 0 ||
+        fread(&count, sizeof(uint32_t), 1, inputFile) != 1 || fread(&keyframeInterval, sizeof(uint32_t), 1, inputFile) != 1 ||
+        keyframeInterval == 0) {
+        printf("Not a BMP sequence file.\n");
+        fclose(inputFile);
+        return 0;
+    }
+    if (last >= (int)count) last = (int)count - 1;
+    if (first < 0 || first > last) {
+        printf("The sequence has %u frames.\n", count);
+        fclose(inputFile);
+        return 0;
     }
 
     BMPHeader header;
     BMPInfoHeader infoHeader;
+    uint8_t *headerBytes = read_rle_headers(inputFile, &header, &infoHeader);
+    if (!headerBytes) {
+        fclose(inputFile);
+        return 0;
+    }
+    if (header.reserved1 != RLE_LAYOUT_ROWS) {
+        printf("Not a checked sequence file (it may be from an older version without checksums).\n");
+        free(headerBytes);
+        fclose(inputFile);
+        return 0;
+    }
 
-    // Read headers from compressed file
-    fread(&header, sizeof(BMPHeader), 1, inputFile);
-    fread(&infoHeader, sizeof(BMPInfoHeader), 1, inputFile);
-
-    // Write headers to output BMP file
-    fwrite(&header, sizeof(BMPHeader), 1, outputFile);
-    fwrite(&infoHeader, sizeof(BMPInfoHeader), 1, outputFile);
+    // The reconstructed frame and the XOR being decoded, as in-memory images (only the pixel fields are used)
+    BmpImage current = {0}, delta = {0};
+    current.width = delta.width = infoHeader.width;
+    current.rows = delta.rows = infoHeader.height < 0 ? -infoHeader.height : infoHeader.height;
+    current.rowSize = delta.rowSize = bmp_row_size(infoHeader.width);
+    size_t frameBytes = current.rowSize * current.rows;
+    uint64_t *offsets = (uint64_t*) malloc((size_t)(last + 1) * sizeof(uint64_t));
+    current.pixels = (uint8_t*) calloc(frameBytes, 1);
+    delta.pixels = (uint8_t*) calloc(frameBytes, 1);
+    if (!offsets || !current.pixels || !delta.pixels ||
+        fread(offsets, sizeof(uint64_t), last + 1, inputFile) != (size_t)(last + 1)) {
+        printf("Sequence file is truncated or out of memory.\n");
+        free(offsets);
+        free(current.pixels);
+        free(delta.pixels);
+        free(headerBytes);
+        fclose(inputFile);
+        return 0;
+    }
 
-    int dataSize = infoHeader.imageSize;
-    uint8_t *data = (uint8_t*) malloc(dataSize);
+    int written = 0;
+    for (int f = first - first % keyframeInterval; f <= last; f++) {
+        int keyframe = f % keyframeInterval == 0;
+        if (fseek(inputFile, (long)offsets[f], SEEK_SET) != 0 || decompress_rows(inputFile, keyframe ? &current : &delta) != 0) {
+            printf("Frame %d is corrupt.\n", f);
+            break;
+        }
+        if (!keyframe) {
+            for (size_t i = 0; i < frameBytes; i++) {
+                current.pixels[i] ^= delta.pixels[i];
+            }
+        }
+        if (f < first) {
+            continue;
+        }
 
-    // Decompress the data
-    decompress_rle(inputFile, data, dataSize);
-    fwrite(data, 1, dataSize, outputFile);
+        char outputPath[1024];
+        snprintf(outputPath, sizeof(outputPath), outputPattern, f);
+        BmpImage output;
+        if (bmp_create(outputPath, headerBytes, header.offset, current.width, current.rows, &output) != 0) {
+            break;
+        }
+        memcpy(output.pixels, current.pixels, frameBytes);
+        bmp_close(&output);
+        written++;
+    }
 
-    free(data);
+    free(offsets);
+    free(current.pixels);
+    free(delta.pixels);
+    free(headerBytes);
     fclose(inputFile);
-    fclose(outputFile);
+    return written;
 }
 
-// Main function to compress and decompress BMP files
-int main() {
+// Main function to compress and decompress BMP files.
+// Single images:   rle compress <input.bmp> <output.rle> | rle decompress <input.rle> <output.bmp>
+// Frame sequences: rle sequence <output.rse> <keyframe interval> <frame.bmp>...
+//                  rle frames <input.rse> <first> <last> <output pattern, e.g. frame%03d.bmp>
+// Without arguments, sample.bmp is compressed to compressed.rle and decoded back to decompressed.bmp.
+int main(int argc, char **argv) {
+    // Images are banded across all cores when there is more than one
+    int threads = parallel_thread_count();
+    if (argc == 4 && strcmp(argv[1], "compress") == 0) {
+        int result = threads > 1 ? compress_bmp_bands(argv[2], argv[3], threads) : compress_bmp(argv[2], argv[3]);
+        return result == 0 ? 0 : 1;
+    }
+    if (argc == 4 && strcmp(argv[1], "decompress") == 0) {
+        return decompress_bmp(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+    if (argc >= 5 && strcmp(argv[1], "sequence") == 0) {
+        return compress_bmp_sequence((const char **)&argv[4], argc - 4, argv[2], (uint32_t)atoi(argv[3])) == 0 ? 0 : 1;
+    }
+    if (argc == 6 && strcmp(argv[1], "frames") == 0) {
+        int written = decompress_bmp_sequence(argv[2], atoi(argv[3]), atoi(argv[4]), argv[5]);
+        printf("Frames decompressed: %d\n", written);
+        return written > 0 ? 0 : 1;
+    }
+
     const char *inputFile = "sample.bmp";
     const char *compressedFile = "compressed.rle";
     const char *decompressedFile = "decompressed.bmp";
 
-    // Compress the BMP file
-    compress_bmp(inputFile, compressedFile);
+    int result = threads > 1 ? compress_bmp_bands(inputFile, compressedFile, threads) : compress_bmp(inputFile, compressedFile);
+    if (result != 0) {
+        return 1;
+    }
     printf("Selective compression completed: %s\n", compressedFile);
 
     // Decompress back to BMP
-    decompress_bmp(compressedFile, decompressedFile);
+    if (decompress_bmp(compressedFile, decompressedFile) != 0) {
+        return 1;
+    }
     printf("Decompression completed: %s\n", decompressedFile);
 
     return 0;
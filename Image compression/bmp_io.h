@@ -0,0 +1,220 @@
+// Memory-mapped 24-bit BMP input and output shared by the image codecs.
+// The source file is mapped once and its headers are validated in place. Pixel rows are then read
+// straight from the mapping. Output files are sized up front and mapped too, so decoders write
+// pixels directly into the page cache instead of through a separate buffer and fwrite.
+#ifndef BMP_IO_H
+#define BMP_IO_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define BMP_FILE_HEADER_SIZE 14  // BITMAPFILEHEADER
+#define BMP_INFO_HEADER_SIZE 40  // BITMAPINFOHEADER, the smallest DIB header we accept
+
+// A mapped BMP file. Rows are in file order (bottom-up unless topDown is set).
+typedef struct {
+    unsigned char *data;    // The whole file (read-only for bmp_open, writable for bmp_create)
+    size_t size;            // File size in bytes
+    size_t headerSize;      // Bytes before the pixel data (bfOffBits)
+    unsigned char *pixels;  // data + headerSize
+    int width;
+    int rows;               // Number of scanlines
+    int topDown;            // 1 if biHeight is negative
+    size_t rowSize;         // Padded scanline size in bytes
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+} BmpImage;
+
+static inline unsigned int bmp_u16(const unsigned char *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static inline unsigned int bmp_u32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+// Padded scanline size; derived from the width since biSizeImage may be 0 for BI_RGB files
+static inline size_t bmp_row_size(int width) {
+    return ((size_t)width * 3 + 3) & ~(size_t)3;
+}
+
+// Scanline y as it is stored in the file
+static inline unsigned char *bmp_row(const BmpImage *image, int y) {
+    return &image->pixels[(size_t)y * image->rowSize];
+}
+
+// Unmap the file and close it; output written through the mapping reaches the file
+static inline void bmp_close(BmpImage *image) {
+#ifdef _WIN32
+    if (image->data != NULL) UnmapViewOfFile(image->data);
+    if (image->mapping != NULL) CloseHandle(image->mapping);
+    if (image->file != INVALID_HANDLE_VALUE) CloseHandle(image->file);
+    image->mapping = NULL;
+    image->file = INVALID_HANDLE_VALUE;
+#else
+    if (image->data != NULL) munmap(image->data, image->size);
+    if (image->fd >= 0) close(image->fd);
+    image->fd = -1;
+#endif
+    image->data = image->pixels = NULL;
+}
+
+// Map size bytes of an open file; writable mappings extend the file to size first
+static inline int bmp_map(BmpImage *image, size_t size, int writable) {
+    image->size = size;
+#ifdef _WIN32
+    DWORD protect = writable ? PAGE_READWRITE : PAGE_READONLY;
+    image->mapping = CreateFileMappingA(image->file, NULL, protect, (DWORD)((unsigned long long)size >> 32),
+                                        (DWORD)size, NULL);
+    if (image->mapping != NULL) {
+        image->data = (unsigned char *)MapViewOfFile(image->mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size);
+    }
+    if (image->data == NULL) {
+        printf("Error mapping BMP file (error %lu).\n", (unsigned long)GetLastError());
+        return -1;
+    }
+#else
+    if (writable && ftruncate(image->fd, (off_t)size) != 0) {
+        perror("Error sizing BMP file");
+        return -1;
+    }
+    void *data = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, writable ? MAP_SHARED : MAP_PRIVATE,
+                      image->fd, 0);
+    if (data == MAP_FAILED) {
+        perror("Error mapping BMP file");
+        return -1;
+    }
+    image->data = (unsigned char *)data;
+#endif
+    return 0;
+}
+
+// Map any file read-only without looking at its contents (the codecs also use this for their encoded files).
+// Returns 0 on success; on failure an error is printed and nothing stays open.
+static inline int bmp_map_file(const char *path, BmpImage *image) {
+    memset(image, 0, sizeof(*image));
+#ifdef _WIN32
+    image->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER fileSize;
+    if (image->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(image->file, &fileSize)) {
+        printf("Error opening file: %s\n", path);
+        bmp_close(image);
+        return -1;
+    }
+    size_t size = (size_t)fileSize.QuadPart;
+#else
+    image->fd = open(path, O_RDONLY);
+    struct stat status;
+    if (image->fd < 0 || fstat(image->fd, &status) != 0) {
+        perror("Error opening file");
+        bmp_close(image);
+        return -1;
+    }
+    size_t size = (size_t)status.st_size;
+#endif
+    if (size == 0) {
+        printf("File is empty: %s\n", path);
+        bmp_close(image);
+        return -1;
+    }
+    if (bmp_map(image, size, 0) != 0) {
+        bmp_close(image);
+        return -1;
+    }
+    return 0;
+}
+
+// Map a 24-bit uncompressed BMP for reading and validate its headers and pixel data size.
+// Returns 0 on success; on failure an error is printed and nothing stays open.
+static inline int bmp_open(const char *path, BmpImage *image) {
+    if (bmp_map_file(path, image) != 0) {
+        return -1;
+    }
+    size_t size = image->size;
+    if (size < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE) {
+        printf("Not a valid BMP file.\n");
+        bmp_close(image);
+        return -1;
+    }
+#ifndef _WIN32
+    posix_madvise(image->data, size, POSIX_MADV_SEQUENTIAL);
+#endif
+
+    const unsigned char *header = image->data;
+    unsigned int offset = bmp_u32(&header[10]);
+    int width = (int)bmp_u32(&header[18]);
+    int height = (int)bmp_u32(&header[22]);
+    unsigned int bitCount = bmp_u16(&header[28]);
+    unsigned int compression = bmp_u32(&header[30]);
+    if (header[0] != 'B' || header[1] != 'M' || bmp_u32(&header[14]) < BMP_INFO_HEADER_SIZE) {
+        printf("Not a valid BMP file.\n");
+    } else if (bitCount != 24) {
+        printf("Only 24-bit BMP files are supported. Found: %u bits.\n", bitCount);
+    } else if (compression != 0) {
+        printf("Only uncompressed BMP files are supported. Found compression type: %u.\n", compression);
+    } else if (width <= 0 || height == 0 || height == (int)0x80000000) {
+        printf("Invalid BMP dimensions: %d x %d.\n", width, height);
+    } else if (offset < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE || offset > size) {
+        printf("Invalid pixel data offset: %u.\n", offset);
+    } else {
+        image->headerSize = offset;
+        image->pixels = &image->data[offset];
+        image->width = width;
+        image->rows = height < 0 ? -height : height;
+        image->topDown = height < 0;
+        image->rowSize = bmp_row_size(width);
+        if ((size - offset) / image->rowSize >= (size_t)image->rows) {
+            return 0;
+        }
+        printf("Pixel data is truncated: %zu of %zu bytes.\n", size - offset, image->rowSize * image->rows);
+    }
+    bmp_close(image);
+    return -1;
+}
+
+// Create (or replace) path as a BMP with the given header bytes and width x rows zeroed pixels, mapped for writing.
+// Decoders fill the rows with bmp_row; bmp_close finishes the file.
+static inline int bmp_create(const char *path, const unsigned char *header, size_t headerSize, int width, int rows, BmpImage *image) {
+    memset(image, 0, sizeof(*image));
+    image->rowSize = bmp_row_size(width);
+    size_t size = headerSize + image->rowSize * rows;
+#ifdef _WIN32
+    image->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (image->file == INVALID_HANDLE_VALUE) {
+        printf("Error creating output BMP file: %s\n", path);
+        return -1;
+    }
+#else
+    image->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (image->fd < 0) {
+        perror("Error creating output BMP file");
+        return -1;
+    }
+#endif
+    if (bmp_map(image, size, 1) != 0) {
+        bmp_close(image);
+        return -1;
+    }
+    memcpy(image->data, header, headerSize);
+    image->headerSize = headerSize;
+    image->pixels = &image->data[headerSize];
+    image->width = width;
+    image->rows = rows;
+    image->topDown = headerSize >= 26 && (int)bmp_u32(&header[22]) < 0;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,207 @@
+// GIF-style LZW shared by the image LZW program and the codec library. The dictionary is built over bytes
+// (a prefix code plus one byte per entry), so any binary buffer can be coded, including NUL bytes.
+// Codes are 9 to 16 bits packed LSB first; a clear code restarts a full dictionary and an end code closes
+// the stream, which is then padded to a whole byte.
+#ifndef LZW_CODER_H
+#define LZW_CODER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Text compression/bit_io.h"
+
+#define LZW_ALPHABET 256                      // Single-byte strings
+#define LZW_CLEAR_CODE 256                    // Resets the dictionary when it is full
+#define LZW_END_CODE 257                      // Ends the code stream
+#define LZW_FIRST_CODE 258                    // First dictionary string
+#define LZW_MIN_BITS 9                        // Initial code width
+#define LZW_MAX_BITS 16                       // Widest code, so the dictionary holds 65536 strings
+#define LZW_MAX_CODES (1 << LZW_MAX_BITS)
+#define LZW_HASH_SIZE (LZW_MAX_CODES * 2)     // Open-addressing slots for (prefix, byte) pairs (power of two)
+
+// Encoder dictionary. Each slot holds generation << 24 | prefix << 8 | byte, and slots of an older
+// generation count as empty, so starting a new dictionary is one increment instead of clearing 512 KB.
+// It can be kept and reused across calls.
+typedef struct {
+    uint32_t *keys;
+    uint16_t *codes;
+    uint32_t generation;
+} LzwEncoder;
+
+// Decoder dictionary: each code's prefix code, last byte and string length
+typedef struct {
+    uint16_t *prefix;
+    uint8_t *suffix;
+    uint32_t *length;
+} LzwDecoder;
+
+static inline int lzw_encoder_init(LzwEncoder *encoder) {
+    encoder->keys = (uint32_t *)calloc(LZW_HASH_SIZE, sizeof(uint32_t));
+    encoder->codes = (uint16_t *)malloc(LZW_HASH_SIZE * sizeof(uint16_t));
+    encoder->generation = 0;
+    if (encoder->keys == NULL || encoder->codes == NULL) {
+        free(encoder->keys);
+        free(encoder->codes);
+        encoder->keys = NULL;
+        encoder->codes = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void lzw_encoder_free(LzwEncoder *encoder) {
+    free(encoder->keys);
+    free(encoder->codes);
+    encoder->keys = NULL;
+    encoder->codes = NULL;
+}
+
+static inline int lzw_decoder_init(LzwDecoder *decoder) {
+    decoder->prefix = (uint16_t *)malloc(LZW_MAX_CODES * sizeof(uint16_t));
+    decoder->suffix = (uint8_t *)malloc(LZW_MAX_CODES);
+    decoder->length = (uint32_t *)malloc(LZW_MAX_CODES * sizeof(uint32_t));
+    if (decoder->prefix == NULL || decoder->suffix == NULL || decoder->length == NULL) {
+        free(decoder->prefix);
+        free(decoder->suffix);
+        free(decoder->length);
+        decoder->prefix = NULL;
+        decoder->suffix = NULL;
+        decoder->length = NULL;
+        return -1;
+    }
+    for (int i = 0; i < LZW_ALPHABET; i++) {
+        decoder->suffix[i] = (uint8_t)i;
+        decoder->length[i] = 1;
+    }
+    return 0;
+}
+
+static inline void lzw_decoder_free(LzwDecoder *decoder) {
+    free(decoder->prefix);
+    free(decoder->suffix);
+    free(decoder->length);
+    decoder->prefix = NULL;
+    decoder->suffix = NULL;
+    decoder->length = NULL;
+}
+
+// LZW-code size bytes of input into writer. The stream starts at LZW_MIN_BITS per code and widens whenever
+// the next free code no longer fits; when all LZW_MAX_CODES are used a clear code restarts the dictionary.
+// Returns 0, or -1 if the writer ran out of memory.
+static inline int lzw_encode(LzwEncoder *encoder, BitWriter *writer, const uint8_t *input, size_t size) {
+    uint32_t *keys = encoder->keys;
+    uint16_t *codes = encoder->codes;
+    uint32_t generation = 0;
+
+    unsigned int nextCode = LZW_FIRST_CODE;
+    int width = LZW_MIN_BITS;
+    int restart = 1;
+    if (size > 0) {
+        unsigned int prefix = input[0];
+        for (size_t i = 1; i < size; i++) {
+            if (restart) {
+                // New dictionary: move to the next generation, clearing the slots only when the stamp wraps
+                if (++encoder->generation > 0xFF) {
+                    memset(keys, 0, LZW_HASH_SIZE * sizeof(uint32_t));
+                    encoder->generation = 1;
+                }
+                generation = encoder->generation << 24;
+                restart = 0;
+            }
+            uint32_t key = generation | (prefix << 8) | input[i];
+            unsigned int slot = (((prefix << 8) | input[i]) * 2654435761u) >> (32 - (LZW_MAX_BITS + 1));
+            while (keys[slot] != key && (keys[slot] & 0xFF000000u) == generation) {
+                slot = (slot + 1) & (LZW_HASH_SIZE - 1);
+            }
+            if (keys[slot] == key) {
+                prefix = codes[slot];
+                continue;
+            }
+
+            bit_writer_put(writer, prefix, width);
+            if (nextCode < LZW_MAX_CODES) {
+                keys[slot] = key;
+                codes[slot] = (uint16_t)nextCode++;
+                // The decoder adds its entry one code later, so widen once the code just added needs it
+                if (nextCode > (1u << width) && width < LZW_MAX_BITS) {
+                    width++;
+                }
+            } else {
+                bit_writer_put(writer, LZW_CLEAR_CODE, width);
+                nextCode = LZW_FIRST_CODE;
+                width = LZW_MIN_BITS;
+                restart = 1;
+            }
+            prefix = input[i];
+        }
+        bit_writer_put(writer, prefix, width);
+    }
+    bit_writer_put(writer, LZW_END_CODE, width);
+    bit_writer_align(writer);
+    return writer->failed ? -1 : 0;
+}
+
+// Decode an LZW code stream into exactly size bytes of output.
+// Returns 0 on success, -1 if the stream is corrupt or does not decode to size bytes.
+static inline int lzw_decode(LzwDecoder *decoder, const uint8_t *input, size_t inputSize, uint8_t *output,
+                             size_t size) {
+    uint16_t *prefix = decoder->prefix;
+    uint8_t *suffix = decoder->suffix;
+    uint32_t *length = decoder->length;
+
+    BitReader reader;
+    bit_reader_init(&reader, input, inputSize);
+    size_t pos = 0;
+    unsigned int nextCode = LZW_FIRST_CODE;
+    int width = LZW_MIN_BITS;
+    int previous = -1;
+    for (;;) {
+        unsigned int code = bit_reader_get(&reader, width);
+        if (bit_reader_overrun(&reader)) {
+            return -1;  // Truncated before the end code
+        }
+        if (code == LZW_END_CODE) {
+            return pos == size ? 0 : -1;
+        }
+        if (code == LZW_CLEAR_CODE) {
+            nextCode = LZW_FIRST_CODE;
+            width = LZW_MIN_BITS;
+            previous = -1;
+            continue;
+        }
+
+        // code == nextCode is the KwKwK case: the previous string plus its own first byte
+        if (code > nextCode || (code == nextCode && previous < 0)) {
+            return -1;
+        }
+        unsigned int stringCode = code == nextCode ? (unsigned int)previous : code;
+        size_t stringLength = length[stringCode] + (code == nextCode);
+        if (stringLength > size - pos) {
+            return -1;
+        }
+
+        // Write the string back to front by following the prefix chain
+        size_t end = pos + length[stringCode];
+        for (unsigned int c = stringCode;; c = prefix[c]) {
+            output[--end] = suffix[c];
+            if (c < LZW_ALPHABET) break;
+        }
+        if (code == nextCode) {
+            output[pos + stringLength - 1] = output[pos];
+        }
+
+        if (previous >= 0 && nextCode < LZW_MAX_CODES) {
+            prefix[nextCode] = (uint16_t)previous;
+            suffix[nextCode] = output[pos];
+            length[nextCode] = length[previous] + 1;
+            nextCode++;
+            if (nextCode + 1 > (1u << width) && width < LZW_MAX_BITS) {
+                width++;
+            }
+        }
+        pos += stringLength;
+        previous = (int)code;
+    }
+}
+
+#endif
@@ -0,0 +1,98 @@
+// PNG-style row filters over 24-bit pixel rows, shared by the image Huffman program's predictive mode and
+// the codec library's Huffman image coder. Each byte is predicted from the same channel of the pixel to the
+// left, the pixel above, or both; previous is the row above (all zeros for the first row).
+#ifndef ROW_FILTER_H
+#define ROW_FILTER_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FILTER_NONE 0
+#define FILTER_LEFT 1
+#define FILTER_UP 2
+#define FILTER_AVERAGE 3
+#define FILTER_PAETH 4
+#define FILTER_COUNT 5
+
+static inline unsigned char row_filter_paeth(int left, int up, int upLeft) {
+    int estimate = left + up - upLeft;
+    int distanceLeft = abs(estimate - left);
+    int distanceUp = abs(estimate - up);
+    int distanceUpLeft = abs(estimate - upLeft);
+    if (distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft) return (unsigned char)left;
+    if (distanceUp <= distanceUpLeft) return (unsigned char)up;
+    return (unsigned char)upLeft;
+}
+
+// Residuals of a row under one filter
+static inline void row_filter_apply(int filter, const unsigned char *row, const unsigned char *previous,
+                                    size_t length, unsigned char *out) {
+    size_t k;
+    switch (filter) {
+        case FILTER_LEFT:
+            for (k = 0; k < 3 && k < length; k++) out[k] = row[k];
+            for (; k < length; k++) out[k] = row[k] - row[k - 3];
+            break;
+        case FILTER_UP:
+            for (k = 0; k < length; k++) out[k] = row[k] - previous[k];
+            break;
+        case FILTER_AVERAGE:
+            for (k = 0; k < 3 && k < length; k++) out[k] = row[k] - (previous[k] >> 1);
+            for (; k < length; k++) out[k] = row[k] - ((row[k - 3] + previous[k]) >> 1);
+            break;
+        case FILTER_PAETH:
+            for (k = 0; k < 3 && k < length; k++) out[k] = row[k] - previous[k];
+            for (; k < length; k++) out[k] = row[k] - row_filter_paeth(row[k - 3], previous[k], previous[k - 3]);
+            break;
+        default:
+            memcpy(out, row, length);
+            break;
+    }
+}
+
+// Filter a row with every predictor and keep the one with the smallest sum of absolute residuals (ties go to
+// the lower filter number). residuals receives the kept row; scratch must hold length bytes.
+// Returns the filter.
+static inline int row_filter_choose(const unsigned char *row, const unsigned char *previous, size_t length,
+                                    unsigned char *residuals, unsigned char *scratch) {
+    int bestFilter = -1;
+    unsigned long bestCost = 0;
+    for (int filter = 0; filter < FILTER_COUNT; filter++) {
+        row_filter_apply(filter, row, previous, length, scratch);
+        unsigned long cost = 0;
+        for (size_t k = 0; k < length; k++) {
+            cost += abs((signed char)scratch[k]);
+        }
+        if (bestFilter < 0 || cost < bestCost) {
+            bestCost = cost;
+            bestFilter = filter;
+            memcpy(residuals, scratch, length);
+        }
+    }
+    return bestFilter;
+}
+
+// Undo row_filter_apply in place: residuals become the original row
+static inline void row_filter_undo(int filter, unsigned char *row, const unsigned char *previous, size_t length) {
+    size_t k;
+    switch (filter) {
+        case FILTER_LEFT:
+            for (k = 3; k < length; k++) row[k] += row[k - 3];
+            break;
+        case FILTER_UP:
+            for (k = 0; k < length; k++) row[k] += previous[k];
+            break;
+        case FILTER_AVERAGE:
+            for (k = 0; k < 3 && k < length; k++) row[k] += previous[k] >> 1;
+            for (; k < length; k++) row[k] += (row[k - 3] + previous[k]) >> 1;
+            break;
+        case FILTER_PAETH:
+            for (k = 0; k < 3 && k < length; k++) row[k] += previous[k];
+            for (; k < length; k++) row[k] += row_filter_paeth(row[k - 3], previous[k], previous[k - 3]);
+            break;
+        default:
+            break;
+    }
+}
+
+#endif
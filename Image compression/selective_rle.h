@@ -0,0 +1,167 @@
+// Selective RLE over 24-bit pixels, shared by the image RLE program and the codec library.
+// Every packet is a one-byte run length followed by one 3-byte pixel. Runs of at least RLE_THRESHOLD
+// identical pixels become one packet; shorter runs are written as one packet per pixel (run length 1).
+// If the size is not a multiple of 3, the last packet holds the partial pixel padded with zeros.
+#ifndef SELECTIVE_RLE_H
+#define SELECTIVE_RLE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define RLE_THRESHOLD 5  // Adjusted threshold for selective RLE
+#define MAX_RUN_LENGTH 255  // Largest run that fits in the one-byte count
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RLE_USE_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit (value must not be zero)
+static inline int rle_ctz32(uint32_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctz(value);
+#endif
+}
+
+static inline int rle_ctz64(uint64_t value) {
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#elif defined(_MSC_VER)
+    return (uint32_t)value != 0 ? rle_ctz32((uint32_t)value) : 32 + rle_ctz32((uint32_t)(value >> 32));
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+// Unaligned 8-byte load
+static inline uint64_t load_u64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Find how many identical 24-bit pixels start at data[i] (at least 1, at most MAX_RUN_LENGTH).
+// A run of one pixel is a byte sequence with period 3, so the run ends at the first byte that
+// differs from the byte three positions before it. Comparing the two overlapping windows
+// data[k..] and data[k-3..] lets us test 16 (SSE2) or 8 bytes per step instead of one pixel.
+static inline int scan_run(const uint8_t *data, int i, int size) {
+    int limit = i + MAX_RUN_LENGTH * 3;
+    if (limit > size) {
+        limit = size;
+    }
+
+    int k = i + 3;
+#ifdef RLE_USE_SSE2
+    while (k + 16 <= limit) {
+        __m128i current = _mm_loadu_si128((const __m128i *)&data[k]);
+        __m128i previous = _mm_loadu_si128((const __m128i *)&data[k - 3]);
+        int mismatch = _mm_movemask_epi8(_mm_cmpeq_epi8(current, previous)) ^ 0xFFFF;
+        if (mismatch) {
+            return (k + rle_ctz32((uint32_t)mismatch) - i) / 3;
+        }
+        k += 16;
+    }
+#endif
+    while (k + 8 <= limit) {
+        uint64_t diff = load_u64(&data[k]) ^ load_u64(&data[k - 3]);
+        if (diff) {
+            // BMP data is read as little-endian, so the lowest set byte is the first mismatch
+            return (k + rle_ctz64(diff) / 8 - i) / 3;
+        }
+        k += 8;
+    }
+    while (k < limit && data[k] == data[k - 3]) {
+        k++;
+    }
+    return (k - i) / 3;
+}
+
+// Selective RLE Compression of size bytes into output (which must hold (size / 3 + 1) * 4 bytes).
+// Returns the number of bytes written.
+static inline size_t selective_compress_rle(const uint8_t *data, int size, uint8_t *output) {
+    size_t out = 0;
+    int i = 0;
+    while (i < size) {
+        if (size - i < 3) {
+            // Partial final pixel: never part of a run, and only its own bytes may be read
+            output[out] = 1;
+            memset(&output[out + 1], 0, 3);
+            memcpy(&output[out + 1], &data[i], size - i);
+            out += 4;
+            break;
+        }
+
+        // Calculate run length
+        int runLength = scan_run(data, i, size);
+
+        if (runLength >= RLE_THRESHOLD) {
+            // Write compressed data for long runs
+            output[out] = runLength;
+            memcpy(&output[out + 1], &data[i], 3);
+            out += 4;
+        } else {
+            // Write each pixel uncompressed for short runs (one packet with run length 1 each)
+            for (int j = 0; j < runLength; j++) {
+                output[out] = 1;
+                memcpy(&output[out + 1], &data[i + j * 3], 3);
+                out += 4;
+            }
+        }
+
+        i += runLength * 3;
+    }
+    return out;
+}
+
+// Fill count copies of a 3-byte pixel by doubling the already written pattern
+static inline void fill_pixel_run(uint8_t *output, const uint8_t *pixel, int bytes) {
+    int filled = bytes < 3 ? bytes : 3;
+    memcpy(output, pixel, filled);
+    while (filled * 2 <= bytes) {
+        memcpy(&output[filled], output, filled);
+        filled *= 2;
+    }
+    memcpy(&output[filled], output, bytes - filled);
+}
+
+// Decompress selective RLE packets from an in-memory buffer into exactly dataSize bytes.
+// Returns the number of input bytes consumed, or -1 on truncated or corrupt input.
+static inline long decompress_rle(const uint8_t *input, size_t inputSize, uint8_t *outputData, int dataSize) {
+    size_t pos = 0;
+    int i = 0;
+
+    while (i < dataSize) {
+        if (pos + 4 > inputSize) {
+            return -1;
+        }
+
+        int runLength = input[pos];
+        const uint8_t *pixel = &input[pos + 1];
+        pos += 4;
+
+        // Only the final pixel may be partial (when the size is not a multiple of 3)
+        int bytes = runLength * 3;
+        if (runLength == 0 || (i + bytes > dataSize && i + bytes - dataSize >= 3)) {
+            return -1;
+        }
+        if (i + bytes > dataSize) {
+            bytes = dataSize - i;
+        }
+
+        fill_pixel_run(&outputData[i], pixel, bytes);
+        i += bytes;
+    }
+    return (long)pos;
+}
+
+#endif
@@ -0,0 +1,683 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "huffman_coder.h"
+#include "tans_coder.h"
+#include "file_util.h"
+#include "parallel_for.h"
+
+// Block-sorting compression in the style of bzip2. Each block goes through the Burrows-Wheeler transform
+// (built from a suffix array made with SA-IS in linear time), move-to-front, and a run-length code for the
+// zero runs MTF produces, and the result is tANS-coded with several tables per block. Blocks are independent,
+// so they are compressed and decompressed on several threads.
+#define DEFAULT_BLOCK_KB 1024   // Larger blocks find more context but take more memory per thread
+#define MIN_BLOCK_KB 16
+#define MAX_BLOCK_KB 8192       // Inverse BWT packs a row index and a byte into 32 bits
+#define BWT_VERSION 1
+#define BWT_CHAINS 8            // Slices of a block the inverse transform walks at the same time
+#define FILE_HEADER_SIZE 17
+#define BLOCK_HEADER_SIZE (12 + 4 * BWT_CHAINS)
+#define RUN_A 0                 // Zero runs are written in bijective base 2 with digits RUN_A = 1 and RUN_B = 2
+#define RUN_B 1
+#define RUN_SYMBOLS 257         // RUN_A, RUN_B and MTF values 1-255 as 2-256
+#define GROUP_SIZE 64           // Symbols per group; each group is coded with one of the block's tables
+#define MAX_TABLES 6
+#define BWT_TABLE_LOG 12        // States per table; the largest tANS table costs little next to a block
+#define TABLE_PASSES 6          // Rounds of assigning groups to tables and rebuilding the tables
+
+// Start (or, with end set, one past the end) of each character's bucket in the suffix array
+static void getBuckets(const int32_t *counts, int32_t *buckets, int alphabetSize, int end) {
+    int32_t sum = 0;
+    for (int c = 0; c < alphabetSize; c++) {
+        sum += counts[c];
+        buckets[c] = end ? sum : sum - counts[c];
+    }
+}
+
+// Induce the order of L-type suffixes from the suffixes already placed, then of S-type suffixes from those
+static void induceSuffixes(const int32_t *s, const uint8_t *isS, int32_t *sa, int n, const int32_t *counts,
+                           int32_t *buckets, int alphabetSize) {
+    getBuckets(counts, buckets, alphabetSize, 0);
+    for (int i = 0; i < n; i++) {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && !isS[j]) sa[buckets[s[j]]++] = j;
+    }
+    getBuckets(counts, buckets, alphabetSize, 1);
+    for (int i = n - 1; i >= 0; i--) {
+        int32_t j = sa[i] - 1;
+        if (j >= 0 && isS[j]) sa[--buckets[s[j]]] = j;
+    }
+}
+
+#define IS_LMS(i) ((i) > 0 && isS[i] && !isS[(i) - 1])
+
+// Suffix array of s[0, n) by induced sorting (SA-IS, Nong, Zhang and Chan 2009). s[n - 1] must be a unique
+// 0 sentinel and every other character in [1, alphabetSize). Returns 0, or -1 if memory runs out.
+static int suffixArray(const int32_t *s, int32_t *sa, int n, int alphabetSize) {
+    uint8_t *isS = (uint8_t *)malloc(n);
+    int32_t *counts = (int32_t *)calloc(alphabetSize, sizeof(int32_t));
+    int32_t *buckets = (int32_t *)malloc(alphabetSize * sizeof(int32_t));
+    if (isS == NULL || counts == NULL || buckets == NULL) {
+        free(isS);
+        free(counts);
+        free(buckets);
+        return -1;
+    }
+    if (n == 1) {
+        sa[0] = 0;
+        free(isS);
+        free(counts);
+        free(buckets);
+        return 0;
+    }
+
+    // Classify suffixes as S-type (smaller than the next suffix) or L-type
+    isS[n - 1] = 1;
+    isS[n - 2] = 0;
+    for (int i = n - 3; i >= 0; i--) isS[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && isS[i + 1]);
+    for (int i = 0; i < n; i++) counts[s[i]]++;
+
+    // Sort the LMS substrings: drop the LMS positions at their bucket ends and induce
+    getBuckets(counts, buckets, alphabetSize, 1);
+    for (int i = 0; i < n; i++) sa[i] = -1;
+    for (int i = 1; i < n; i++) {
+        if (IS_LMS(i)) sa[--buckets[s[i]]] = i;
+    }
+    induceSuffixes(s, isS, sa, n, counts, buckets, alphabetSize);
+
+    // Compact the sorted LMS positions to the front and name the substrings, equal substrings sharing a name.
+    // No two LMS positions are adjacent, so position / 2 gives each a distinct slot in the back half.
+    int n1 = 0;
+    for (int i = 0; i < n; i++) {
+        if (IS_LMS(sa[i])) sa[n1++] = sa[i];
+    }
+    for (int i = n1; i < n; i++) sa[i] = -1;
+    int names = 0, previous = -1;
+    for (int i = 0; i < n1; i++) {
+        int pos = sa[i], differs = previous < 0;
+        for (int d = 0; !differs; d++) {
+            if (s[pos + d] != s[previous + d] || isS[pos + d] != isS[previous + d]) {
+                differs = 1;
+            } else if (d > 0 && (IS_LMS(pos + d) || IS_LMS(previous + d))) {
+                break;
+            }
+        }
+        if (differs) {
+            names++;
+            previous = pos;
+        }
+        sa[n1 + pos / 2] = names - 1;
+    }
+    for (int i = n - 1, j = n - 1; i >= n1; i--) {
+        if (sa[i] >= 0) sa[j--] = sa[i];
+    }
+
+    // Sort the LMS suffixes by their names, recursing if any name repeats
+    int32_t *sa1 = sa, *s1 = sa + n - n1;
+    int result = 0;
+    if (names < n1) {
+        result = suffixArray(s1, sa1, n1, names);
+    } else {
+        for (int i = 0; i < n1; i++) sa1[s1[i]] = i;
+    }
+
+    // Place the sorted LMS suffixes at their bucket ends and induce the rest
+    if (result == 0) {
+        for (int i = 1, j = 0; i < n; i++) {
+            if (IS_LMS(i)) s1[j++] = i;
+        }
+        for (int i = 0; i < n1; i++) sa1[i] = s1[sa1[i]];
+        for (int i = n1; i < n; i++) sa[i] = -1;
+        getBuckets(counts, buckets, alphabetSize, 1);
+        for (int i = n1 - 1; i >= 0; i--) {
+            int32_t j = sa[i];
+            sa[i] = -1;
+            sa[--buckets[s[j]]] = j;
+        }
+        induceSuffixes(s, isS, sa, n, counts, buckets, alphabetSize);
+    }
+    free(isS);
+    free(counts);
+    free(buckets);
+    return result;
+}
+
+// Start of chain c of the inverse transform: the block is cut into BWT_CHAINS equal slices
+static inline int chainStart(int n, int c) {
+    return (int)((int64_t)n * c / BWT_CHAINS);
+}
+
+// Burrows-Wheeler transform of data[0, n) into bwt[0, n): the byte before each suffix in sorted order, with
+// the end-of-block marker (which sorts before every byte) left out. rows[0] is set to the row where the marker
+// would be, and rows[c] to the row of the suffix at chainStart(n, c) for the other chains.
+// Returns 0, or -1 if memory runs out.
+static int burrowsWheeler(const uint8_t *data, int n, uint8_t *bwt, uint32_t rows[BWT_CHAINS]) {
+    int32_t *s = (int32_t *)malloc((n + 1) * sizeof(int32_t));
+    int32_t *sa = (int32_t *)malloc((n + 1) * sizeof(int32_t));
+    int result = -1;
+    if (s != NULL && sa != NULL) {
+        for (int i = 0; i < n; i++) s[i] = data[i] + 1;
+        s[n] = 0;
+        result = suffixArray(s, sa, n + 1, 257);
+    }
+    if (result == 0) {
+        // Row 0 is the marker's own suffix, preceded by the last byte
+        int32_t starts[BWT_CHAINS];
+        for (int c = 0; c < BWT_CHAINS; c++) starts[c] = chainStart(n, c);
+        int out = 0;
+        for (int row = 0; row <= n; row++) {
+            int32_t pos = sa[row];
+            for (int c = 0; c < BWT_CHAINS; c++) {
+                if (pos == starts[c]) rows[c] = (uint32_t)row;
+            }
+            if (pos > 0) bwt[out++] = data[pos - 1];
+        }
+    }
+    free(s);
+    free(sa);
+    return result;
+}
+
+// Invert burrowsWheeler. Each row's entry packs the row its byte's rotation moves to (LF mapping) above the
+// byte itself. Walking back from a row yields the block backwards one byte per memory access; the slices are
+// walked together so their cache misses overlap. Returns 0, or -1 if memory runs out or a row is out of range.
+static int inverseBurrowsWheeler(const uint8_t *bwt, int n, const uint32_t starts[BWT_CHAINS], uint8_t *data) {
+    for (int c = 0; c < BWT_CHAINS; c++) {
+        if (starts[c] > (uint32_t)n) return -1;
+    }
+    uint32_t *rows = (uint32_t *)malloc((n + 1) * sizeof(uint32_t));
+    if (rows == NULL) return -1;
+    uint32_t next[256], count[256] = {0};
+    for (int i = 0; i < n; i++) count[bwt[i]]++;
+    uint32_t sum = 1;  // F row 0 holds the marker
+    for (int c = 0; c < 256; c++) {
+        next[c] = sum;
+        sum += count[c];
+    }
+    for (uint32_t row = 0, i = 0; row <= (uint32_t)n; row++) {
+        if (row == starts[0]) {
+            rows[row] = 0;
+            continue;
+        }
+        uint8_t c = bwt[i++];
+        rows[row] = next[c]++ << 8 | c;
+    }
+
+    // Chain c fills [chainStart(c), chainStart(c + 1)) from the end; the last one starts at the marker's row 0
+    uint32_t row[BWT_CHAINS];
+    int pos[BWT_CHAINS];
+    for (int c = 0; c < BWT_CHAINS; c++) {
+        row[c] = c + 1 < BWT_CHAINS ? starts[c + 1] : 0;
+        pos[c] = chainStart(n, c + 1);
+    }
+    for (int step = n / BWT_CHAINS; step > 0; step--) {
+        for (int c = 0; c < BWT_CHAINS; c++) {
+            uint32_t entry = rows[row[c]];
+            data[--pos[c]] = (uint8_t)entry;
+            row[c] = entry >> 8;
+        }
+    }
+    for (int c = 0; c < BWT_CHAINS; c++) {
+        while (pos[c] > chainStart(n, c)) {
+            uint32_t entry = rows[row[c]];
+            data[--pos[c]] = (uint8_t)entry;
+            row[c] = entry >> 8;
+        }
+    }
+    free(rows);
+    return 0;
+}
+
+// Move-to-front coding of the transformed block followed by zero-run coding: a run of r zeros becomes the
+// bijective base-2 digits of r (RUN_A, RUN_B), and any other MTF value v becomes v + 1.
+// Returns the number of symbols written to symbols (at most n).
+static size_t moveToFrontEncode(const uint8_t *bwt, int n, uint16_t *symbols) {
+    uint8_t order[256];
+    for (int c = 0; c < 256; c++) order[c] = (uint8_t)c;
+    size_t count = 0, zeros = 0;
+    for (int i = 0; i <= n; i++) {
+        int rank = 0;
+        if (i < n) {
+            uint8_t c = bwt[i];
+            while (order[rank] != c) rank++;
+            memmove(&order[1], &order[0], rank);
+            order[0] = c;
+        }
+        if (rank == 0 && i < n) {
+            zeros++;
+            continue;
+        }
+        // Flush the pending zero run
+        while (zeros > 0) {
+            zeros--;
+            symbols[count++] = (zeros & 1) ? RUN_B : RUN_A;
+            zeros >>= 1;
+        }
+        if (i < n) symbols[count++] = (uint16_t)(rank + 1);
+    }
+    return count;
+}
+
+// Undo moveToFrontEncode. Returns 0, or -1 if the symbols do not describe exactly n bytes.
+static int moveToFrontDecode(const uint16_t *symbols, size_t count, uint8_t *bwt, int n) {
+    uint8_t order[256];
+    for (int c = 0; c < 256; c++) order[c] = (uint8_t)c;
+    size_t out = 0, run = 0, weight = 1;
+    for (size_t i = 0; i <= count; i++) {
+        if (i < count && symbols[i] <= RUN_B) {
+            run += weight << symbols[i];
+            weight <<= 1;
+            if (run > (size_t)n) return -1;
+            continue;
+        }
+        if (run > (size_t)n - out) return -1;
+        memset(&bwt[out], order[0], run);
+        out += run;
+        run = 0;
+        weight = 1;
+        if (i == count) break;
+        if (out == (size_t)n || symbols[i] >= RUN_SYMBOLS) return -1;
+        int rank = symbols[i] - 1;
+        uint8_t c = order[rank];
+        memmove(&order[1], &order[0], rank);
+        order[0] = c;
+        bwt[out++] = c;
+    }
+    return out == (size_t)n ? 0 : -1;
+}
+
+// A table count of a used symbol (1 to 1 << BWT_TABLE_LOG): its bit length b in 4 bits, then the count without
+// its leading 1 in b - 1 bits
+static void writeCount(BitWriter *writer, uint32_t count) {
+    int length = tans_highbit(count) + 1;
+    bit_writer_put(writer, length, 4);
+    bit_writer_put(writer, count - (1u << (length - 1)), length - 1);
+}
+
+static uint32_t readCount(BitReader *reader) {
+    int length = (int)bit_reader_get(reader, 4);
+    return length > 0 ? (1u << (length - 1)) + bit_reader_get(reader, length - 1) : 0;
+}
+
+// Entropy-code the symbols with several tANS tables, chosen the way bzip2 chooses its Huffman tables. The
+// symbols are cut into groups of GROUP_SIZE and each group uses the table that codes it in the fewest bits.
+// The tables start out favoring slices of the alphabet with about equal frequency; each pass reassigns the
+// groups and rebuilds every table from its groups. All tables have the same number of states, so the coder
+// can switch tables between any two symbols.
+// Stream layout: byte table count, the group selectors as a Huffman stream, one bit per symbol telling whether
+// the block uses it, each table's counts for the used symbols (see writeCount), the two initial states and the
+// transition bits (as in tans_encode_stream). Returns 0, or -1 if memory runs out.
+static int encodeSymbols(BitWriter *writer, const uint16_t *symbols, size_t count) {
+    int tableCount = count < 200 ? 2 : count < 600 ? 3 : count < 1200 ? 4 : count < 2400 ? 5 : MAX_TABLES;
+    size_t groupCount = (count + GROUP_SIZE - 1) / GROUP_SIZE;
+    uint16_t *selectors = (uint16_t *)malloc((groupCount > 0 ? groupCount : 1) * sizeof(uint16_t));
+    uint32_t *shed = (uint32_t *)malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    TansEncoder *encoders = (TansEncoder *)malloc(tableCount * sizeof(TansEncoder));
+    if (selectors == NULL || shed == NULL || encoders == NULL) {
+        free(selectors);
+        free(shed);
+        free(encoders);
+        return -1;
+    }
+    uint32_t total[RUN_SYMBOLS] = {0};
+    for (size_t i = 0; i < count; i++) total[symbols[i]]++;
+
+    // Costs in 1/16 bits; until the first pass they are 0 inside the table's slice and 15 bits outside
+    uint16_t cost[MAX_TABLES][RUN_SYMBOLS], normalized[MAX_TABLES][RUN_SYMBOLS];
+    size_t remaining = count;
+    for (int t = 0, first = 0; t < tableCount; t++) {
+        size_t target = remaining / (tableCount - t), taken = 0;
+        int last = first - 1;
+        while (taken < target && last < RUN_SYMBOLS - 1) taken += total[++last];
+        for (int c = 0; c < RUN_SYMBOLS; c++) cost[t][c] = (c >= first && c <= last) ? 0 : 15 * 16;
+        first = last + 1;
+        remaining -= taken;
+    }
+    for (int pass = 0; pass < TABLE_PASSES; pass++) {
+        uint32_t frequency[MAX_TABLES][RUN_SYMBOLS];
+        memset(frequency, 0, sizeof(frequency));
+        for (size_t g = 0; g < groupCount; g++) {
+            size_t start = g * GROUP_SIZE, end = start + GROUP_SIZE < count ? start + GROUP_SIZE : count;
+            uint32_t groupCost[MAX_TABLES] = {0};
+            for (size_t i = start; i < end; i++) {
+                for (int t = 0; t < tableCount; t++) groupCost[t] += cost[t][symbols[i]];
+            }
+            int best = 0;
+            for (int t = 1; t < tableCount; t++) {
+                if (groupCost[t] < groupCost[best]) best = t;
+            }
+            selectors[g] = (uint16_t)best;
+            for (size_t i = start; i < end; i++) frequency[best][symbols[i]]++;
+        }
+        // Every table must be able to code every symbol of the block
+        for (int t = 0; t < tableCount; t++) {
+            for (int c = 0; c < RUN_SYMBOLS; c++) {
+                if (total[c] > 0 && frequency[t][c] == 0) frequency[t][c] = 1;
+            }
+            tans_normalize(frequency[t], RUN_SYMBOLS, BWT_TABLE_LOG, normalized[t]);
+            for (int c = 0; c < RUN_SYMBOLS; c++) {
+                uint32_t bits = ((uint32_t)BWT_TABLE_LOG << 16) - (normalized[t][c] ? tans_log2_fixed(normalized[t][c]) : 0);
+                cost[t][c] = (uint16_t)(bits >> 12);
+            }
+        }
+    }
+
+    bit_writer_put(writer, tableCount, 8);
+    huffman_encode_stream(writer, selectors, groupCount, MAX_TABLES);
+    for (int c = 0; c < RUN_SYMBOLS; c++) bit_writer_put(writer, total[c] > 0, 1);
+    for (int t = 0; t < tableCount; t++) {
+        for (int c = 0; c < RUN_SYMBOLS; c++) {
+            if (total[c] > 0) writeCount(writer, normalized[t][c]);
+        }
+        tans_build_encoder(normalized[t], RUN_SYMBOLS, BWT_TABLE_LOG, &encoders[t]);
+    }
+    uint32_t tableSize = 1u << BWT_TABLE_LOG, state[2] = {tableSize, tableSize};
+    for (size_t i = count; i-- > 0;) {
+        shed[i] = tans_encode_symbol(&encoders[selectors[i / GROUP_SIZE]], &state[i & 1], symbols[i]);
+    }
+    bit_writer_put(writer, state[0] - tableSize, BWT_TABLE_LOG);
+    bit_writer_put(writer, state[1] - tableSize, BWT_TABLE_LOG);
+    for (size_t i = 0; i + 2 < count; i++) bit_writer_put(writer, shed[i] >> 4, shed[i] & 15);
+    bit_writer_align(writer);
+    free(selectors);
+    free(shed);
+    free(encoders);
+    return 0;
+}
+
+// Decode a stream written by encodeSymbols into count symbols. Returns 0, or -1 if it is corrupt.
+static int decodeSymbols(const uint8_t *data, size_t size, uint16_t *symbols, size_t count) {
+    size_t groupCount = (count + GROUP_SIZE - 1) / GROUP_SIZE;
+    int tableCount = size > 0 ? data[0] : 0;
+    if (tableCount < 1 || tableCount > MAX_TABLES || count == 0) return -1;
+    uint16_t *selectors = (uint16_t *)malloc(groupCount * sizeof(uint16_t));
+    TansDecoder *decoders = (TansDecoder *)malloc(tableCount * sizeof(TansDecoder));
+    long used = -1;
+    if (selectors != NULL && decoders != NULL) {
+        used = huffman_decode_stream(&data[1], size - 1, selectors, groupCount, MAX_TABLES);
+    }
+    BitReader reader;
+    int failed = used < 0;
+    if (!failed) {
+        bit_reader_init(&reader, &data[1 + used], size - 1 - used);
+        uint8_t isUsed[RUN_SYMBOLS];
+        for (int c = 0; c < RUN_SYMBOLS; c++) isUsed[c] = (uint8_t)bit_reader_get(&reader, 1);
+        for (int t = 0; t < tableCount && !failed; t++) {
+            uint16_t normalized[RUN_SYMBOLS];
+            uint32_t sum = 0;
+            for (int c = 0; c < RUN_SYMBOLS; c++) {
+                uint32_t n = isUsed[c] ? readCount(&reader) : 0;
+                if (n > (1u << BWT_TABLE_LOG)) n = 0;
+                normalized[c] = (uint16_t)n;
+                sum += n;
+            }
+            failed = sum != (1u << BWT_TABLE_LOG);
+            if (!failed) tans_build_decoder(normalized, RUN_SYMBOLS, BWT_TABLE_LOG, &decoders[t]);
+        }
+    }
+    for (size_t g = 0; g < groupCount && !failed; g++) failed = selectors[g] >= tableCount;
+
+    // The last symbol of each state needs no transition
+    if (!failed) {
+        uint32_t even = bit_reader_get(&reader, BWT_TABLE_LOG), odd = bit_reader_get(&reader, BWT_TABLE_LOG);
+        size_t limit = count >= 2 ? count - 2 : 0;
+        for (size_t g = 0; g < groupCount; g++) {
+            const TansDecoder *decoder = &decoders[selectors[g]];
+            size_t i = g * GROUP_SIZE, end = i + GROUP_SIZE < limit ? i + GROUP_SIZE : limit;
+            // Groups start at even symbols; four transitions of at most 12 bits fit in one refill
+            while (i + 4 <= end) {
+                bit_reader_refill(&reader);
+                symbols[i] = (uint16_t)tans_decode_symbol(decoder, &even, &reader);
+                symbols[i + 1] = (uint16_t)tans_decode_symbol(decoder, &odd, &reader);
+                symbols[i + 2] = (uint16_t)tans_decode_symbol(decoder, &even, &reader);
+                symbols[i + 3] = (uint16_t)tans_decode_symbol(decoder, &odd, &reader);
+                i += 4;
+            }
+            for (; i < end; i++) {
+                bit_reader_refill(&reader);
+                symbols[i] = (uint16_t)tans_decode_symbol(decoder, (i & 1) ? &odd : &even, &reader);
+            }
+        }
+        for (size_t i = limit; i < count; i++) {
+            uint32_t entry = decoders[selectors[i / GROUP_SIZE]].entries[(i & 1) ? odd : even];
+            symbols[i] = (uint16_t)((entry >> 4) & 0xFFF);
+        }
+        failed = bit_reader_overrun(&reader);
+    }
+    free(selectors);
+    free(decoders);
+    return failed ? -1 : 0;
+}
+
+static void writeU32(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+static uint32_t readU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Blocks of one file; each task fills in (or reads) its own block
+typedef struct {
+    uint8_t *data;          // Uncompressed file
+    size_t size;
+    size_t blockSize;
+    BitWriter *encoded;     // Compression: each block with its header
+    const uint8_t **blocks; // Decompression: start of each block in the input
+    int *failed;            // Per block
+} BlockJobs;
+
+// Compress block index into encoded[index]: uint32 raw size, uint32 symbol count, uint32 stream size, uint32
+// start row of each chain of the inverse transform (the first is the end-of-block marker's row), then the stream
+static void compressBlock(void *context, int index) {
+    BlockJobs *jobs = (BlockJobs *)context;
+    size_t start = (size_t)index * jobs->blockSize;
+    int n = (int)(jobs->size - start < jobs->blockSize ? jobs->size - start : jobs->blockSize);
+    BitWriter *writer = &jobs->encoded[index];
+    uint8_t *bwt = (uint8_t *)malloc(n);
+    uint16_t *symbols = (uint16_t *)malloc(n * sizeof(uint16_t));
+    uint32_t rows[BWT_CHAINS];
+    int failed = bwt == NULL || symbols == NULL || burrowsWheeler(&jobs->data[start], n, bwt, rows) != 0 ||
+                 bit_writer_reserve(writer, BLOCK_HEADER_SIZE) != 0;
+    size_t count = 0;
+    if (!failed) {
+        count = moveToFrontEncode(bwt, n, symbols);
+        writer->size = BLOCK_HEADER_SIZE;
+        failed = encodeSymbols(writer, symbols, count) != 0 || writer->failed;
+    }
+    if (!failed) {
+        writeU32(&writer->data[0], (uint32_t)n);
+        writeU32(&writer->data[4], (uint32_t)count);
+        writeU32(&writer->data[8], (uint32_t)(writer->size - BLOCK_HEADER_SIZE));
+        for (int c = 0; c < BWT_CHAINS; c++) writeU32(&writer->data[12 + 4 * c], rows[c]);
+    }
+    jobs->failed[index] = failed;
+    free(bwt);
+    free(symbols);
+}
+
+// Compress a file in blocks of blockKB kilobytes on threadCount threads.
+// File layout: "BWTC", byte version, uint32 block size, uint32 size low, uint32 size high, then the blocks
+// (see compressBlock).
+int compressFile(const char *inputFilename, const char *outputFilename, int blockKB, int threadCount) {
+    size_t size;
+    uint8_t *data = read_file(inputFilename, &size);
+    if (data == NULL) {
+        return -1;
+    }
+    if (blockKB < MIN_BLOCK_KB) blockKB = MIN_BLOCK_KB;
+    if (blockKB > MAX_BLOCK_KB) blockKB = MAX_BLOCK_KB;
+    size_t blockSize = (size_t)blockKB << 10;
+    if ((size + blockSize - 1) / blockSize > 0x7FFFFFFF) {
+        printf("File is too large: %zu bytes.\n", size);
+        free(data);
+        return -1;
+    }
+    int blockCount = (int)((size + blockSize - 1) / blockSize);
+
+    double start = wall_seconds();
+    BlockJobs jobs = {data, size, blockSize, NULL, NULL, NULL};
+    jobs.encoded = (BitWriter *)calloc(blockCount > 0 ? blockCount : 1, sizeof(BitWriter));
+    jobs.failed = (int *)calloc(blockCount > 0 ? blockCount : 1, sizeof(int));
+    int result = -1;
+    if (jobs.encoded == NULL || jobs.failed == NULL) {
+        perror("Error allocating memory for blocks");
+    } else {
+        parallel_for(blockCount, threadCount, compressBlock, &jobs);
+        result = 0;
+        for (int b = 0; b < blockCount; b++) {
+            if (jobs.failed[b]) result = -1;
+        }
+        if (result != 0) perror("Error allocating memory for block sorting");
+    }
+
+    FILE *outputFile = NULL;
+    if (result == 0 && (outputFile = fopen(outputFilename, "wb")) == NULL) {
+        perror("Error creating output file");
+        result = -1;
+    }
+    if (result == 0) {
+        uint8_t header[FILE_HEADER_SIZE] = {'B', 'W', 'T', 'C', BWT_VERSION};
+        writeU32(&header[5], (uint32_t)blockSize);
+        writeU32(&header[9], (uint32_t)size);
+        writeU32(&header[13], (uint32_t)((uint64_t)size >> 32));
+        fwrite(header, 1, sizeof(header), outputFile);
+        for (int b = 0; b < blockCount; b++) fwrite(jobs.encoded[b].data, 1, jobs.encoded[b].size, outputFile);
+        long compressedSize = ftell(outputFile);
+        if (fclose(outputFile) != 0) {
+            perror("Error writing output file");
+            result = -1;
+            remove(outputFilename);
+        } else {
+            double seconds = wall_seconds() - start;
+            printf("Compressed %zu bytes to %ld bytes (%d KB blocks)", size, compressedSize, blockKB);
+            if (seconds > 0) printf(" at %.1f MB/s", size / seconds / 1e6);
+            printf("\n");
+        }
+    }
+
+    for (int b = 0; jobs.encoded != NULL && b < blockCount; b++) free(jobs.encoded[b].data);
+    free(jobs.encoded);
+    free(jobs.failed);
+    free(data);
+    return result;
+}
+
+// Decode block index (already bounds-checked by decompressFile) into its place in the output
+static void decompressBlock(void *context, int index) {
+    BlockJobs *jobs = (BlockJobs *)context;
+    const uint8_t *block = jobs->blocks[index];
+    int n = (int)readU32(block);
+    size_t count = readU32(&block[4]), streamSize = readU32(&block[8]);
+    uint32_t starts[BWT_CHAINS];
+    for (int c = 0; c < BWT_CHAINS; c++) starts[c] = readU32(&block[12 + 4 * c]);
+    int failed = count > (size_t)n;
+    uint16_t *symbols = failed ? NULL : (uint16_t *)malloc((count > 0 ? count : 1) * sizeof(uint16_t));
+    uint8_t *bwt = (uint8_t *)malloc(n);
+    failed = failed || symbols == NULL || bwt == NULL ||
+             decodeSymbols(&block[BLOCK_HEADER_SIZE], streamSize, symbols, count) != 0 ||
+             moveToFrontDecode(symbols, count, bwt, n) != 0 ||
+             inverseBurrowsWheeler(bwt, n, starts, &jobs->data[(size_t)index * jobs->blockSize]) != 0;
+    jobs->failed[index] = failed;
+    free(symbols);
+    free(bwt);
+}
+
+int decompressFile(const char *inputFilename, const char *outputFilename, int threadCount) {
+    size_t inputSize;
+    uint8_t *input = read_file(inputFilename, &inputSize);
+    if (input == NULL) {
+        return -1;
+    }
+    size_t blockSize = inputSize >= FILE_HEADER_SIZE ? readU32(&input[5]) : 0;
+    if (inputSize < FILE_HEADER_SIZE || memcmp(input, "BWTC", 4) != 0 || input[4] != BWT_VERSION ||
+        blockSize < ((size_t)MIN_BLOCK_KB << 10) || blockSize > ((size_t)MAX_BLOCK_KB << 10)) {
+        printf("Not a BWT file: %s\n", inputFilename);
+        free(input);
+        return -1;
+    }
+    uint64_t size = readU32(&input[9]) | (uint64_t)readU32(&input[13]) << 32;
+    uint64_t blockCount = (size + blockSize - 1) / blockSize;
+    if (blockCount > inputSize / BLOCK_HEADER_SIZE) {
+        printf("Corrupt BWT header.\n");
+        free(input);
+        return -1;
+    }
+
+    // Find every block first so they can be decoded in parallel
+    double start = wall_seconds();
+    BlockJobs jobs = {NULL, (size_t)size, blockSize, NULL, NULL, NULL};
+    jobs.data = (uint8_t *)malloc(size > 0 ? size : 1);
+    jobs.blocks = (const uint8_t **)malloc((blockCount > 0 ? blockCount : 1) * sizeof(uint8_t *));
+    jobs.failed = (int *)calloc(blockCount > 0 ? blockCount : 1, sizeof(int));
+    int result = -1;
+    if (jobs.data == NULL || jobs.blocks == NULL || jobs.failed == NULL) {
+        perror("Error allocating memory for BWT output");
+    } else {
+        size_t pos = FILE_HEADER_SIZE;
+        result = 0;
+        for (uint64_t b = 0; b < blockCount && result == 0; b++) {
+            uint64_t expected = size - b * blockSize < blockSize ? size - b * blockSize : blockSize;
+            if (inputSize - pos < BLOCK_HEADER_SIZE || readU32(&input[pos]) != expected ||
+                readU32(&input[pos + 8]) > inputSize - pos - BLOCK_HEADER_SIZE) {
+                printf("Corrupt or truncated BWT data in block %llu.\n", (unsigned long long)b);
+                result = -1;
+                break;
+            }
+            jobs.blocks[b] = &input[pos];
+            pos += BLOCK_HEADER_SIZE + readU32(&input[pos + 8]);
+        }
+        if (result == 0) {
+            parallel_for((int)blockCount, threadCount, decompressBlock, &jobs);
+            for (uint64_t b = 0; b < blockCount; b++) {
+                if (jobs.failed[b] && result == 0) {
+                    printf("Corrupt BWT data in block %llu.\n", (unsigned long long)b);
+                    result = -1;
+                }
+            }
+        }
+    }
+    double seconds = wall_seconds() - start;
+
+    if (result == 0) {
+        FILE *outputFile = fopen(outputFilename, "wb");
+        if (outputFile == NULL || fwrite(jobs.data, 1, size, outputFile) != size) {
+            perror("Error writing output file");
+            result = -1;
+        }
+        if (outputFile != NULL) fclose(outputFile);
+        printf("Decompressed %llu bytes", (unsigned long long)size);
+        if (seconds > 0) printf(" at %.1f MB/s", size / seconds / 1e6);
+        printf("\n");
+    }
+    free(jobs.data);
+    free(jobs.blocks);
+    free(jobs.failed);
+    free(input);
+    return result;
+}
+
+// Usage: BWT [compress <input> <output.bwt> [block KB 16-8192] [threads] | decompress <input.bwt> <output> [threads]]
+// Without arguments, sample.txt is compressed to compressed.bwt and decoded back to decompressed.txt.
+int main(int argc, char **argv) {
+    if (argc >= 4 && argc <= 6 && strcmp(argv[1], "compress") == 0) {
+        int blockKB = argc > 4 ? atoi(argv[4]) : DEFAULT_BLOCK_KB;
+        int threads = argc > 5 ? atoi(argv[5]) : parallel_thread_count();
+        return compressFile(argv[2], argv[3], blockKB, threads) == 0 ? 0 : 1;
+    }
+    if (argc >= 4 && argc <= 5 && strcmp(argv[1], "decompress") == 0) {
+        int threads = argc > 4 ? atoi(argv[4]) : parallel_thread_count();
+        return decompressFile(argv[2], argv[3], threads) == 0 ? 0 : 1;
+    }
+
+    if (compressFile("sample.txt", "compressed.bwt", DEFAULT_BLOCK_KB, parallel_thread_count()) != 0) {
+        return 1;
+    }
+    return decompressFile("compressed.bwt", "decompressed.txt", parallel_thread_count()) == 0 ? 0 : 1;
+}
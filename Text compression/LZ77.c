@@ -0,0 +1,613 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "huffman_coder.h"
+#include "tans_coder.h"
+#include "file_util.h"
+
+// Sliding-window LZ77 with a hash-chain match finder, or a binary tree at the highest levels. The input is
+// parsed into sequences of (literal run, match length, distance) as in zstd, and each block stores its literal
+// bytes and the three sequence fields as separate entropy-coded streams, so the decoder is a loop of two memcpy
+// calls per sequence. Each stream is coded with Huffman or tANS, whichever comes out smaller for that block.
+#define MIN_MATCH 4                  // Shortest match; also the number of bytes hashed
+#define MAX_MATCH 65536              // Longest match
+#define HASH_BITS 17                 // Hash table of 128K chain heads
+#define MIN_WINDOW_LOG 15            // 32 KB
+#define MAX_WINDOW_LOG 23            // 8 MB
+#define DEFAULT_WINDOW_LOG 20        // 1 MB
+#define BLOCK_SIZE (1 << 20)         // Input bytes per block; each block gets its own entropy tables
+#define DEFAULT_LEVEL 6
+#define NO_POSITION UINT32_MAX       // Empty chain link or tree child; inputs must be shorter than this
+
+#define LZ77_VERSION 2
+#define VALUE_CODES 48               // Codes for values below 2^24, see valueCode
+#define LITERAL_SYMBOLS 256
+#define BLOCK_HEADER_SIZE 36
+
+// Entropy coder of a stream, as stored in the block header
+#define CODER_HUFFMAN 0
+#define CODER_TANS 1
+#define CODER_AUTO 2                 // Compression only: whichever is estimated smaller, per stream
+
+// Search effort per level, as in zlib: chain links followed, match length that ends the search early, the
+// length below which the next position is also searched for a longer match (lazy matching; 0 turns it off),
+// and the length of the pending match above which that lazy search follows only a quarter of the chain.
+// Levels 7-9 search a binary tree instead (see treeMatch), where maxChain counts the tree nodes visited and
+// goodLength is unused. zlib's deep chains assume its 32 KB window: in a 1 MB window of low-entropy input
+// nearly every chain link is a cache miss on a short match, so the chains stop at level 6.
+typedef struct {
+    int maxChain;
+    int niceLength;
+    int lazyLength;
+    int goodLength;
+    int tree;
+} LevelParams;
+
+static const LevelParams levels[10] = {
+    {0, 0, 0, 0, 0},
+    {4, 8, 0, 4, 0},        {8, 16, 0, 4, 0},       {32, 32, 0, 4, 0},
+    {16, 16, 4, 4, 0},      {32, 32, 16, 8, 0},     {48, 96, 16, 8, 0},
+    {16, 128, 128, 0, 1},   {24, 128, 128, 0, 1},   {64, 258, 258, 0, 1},
+};
+
+// Values (literal runs, match lengths - MIN_MATCH, distances - 1) are coded as a symbol plus extra bits:
+// values below 8 are their own code; above that, each power of two [2^n, 2^(n+1)) gets two codes, split by
+// the bit below the leading one, followed by the remaining n - 1 bits.
+static inline int valueCode(uint32_t value, int *extraBits) {
+    if (value < 8) {
+        *extraBits = 0;
+        return (int)value;
+    }
+    int n = 31 - __builtin_clz(value);
+    *extraBits = n - 1;
+    return 8 + 2 * (n - 3) + ((value >> (n - 1)) & 1);
+}
+
+static inline uint32_t valueBase(int code, int *extraBits) {
+    if (code < 8) {
+        *extraBits = 0;
+        return (uint32_t)code;
+    }
+    int n = (code - 8) / 2 + 3;
+    *extraBits = n - 1;
+    return (uint32_t)(2 | ((code - 8) & 1)) << (n - 1);
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static inline uint32_t hash4(const uint8_t *p) {
+    return (load32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Number of equal bytes at a and b, up to limit
+static inline int matchLength(const uint8_t *a, const uint8_t *b, int limit) {
+    int length = 0;
+    while (length + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + length, 8);
+        memcpy(&y, b + length, 8);
+        if (x != y) {
+            return length + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        length += 8;
+    }
+    while (length < limit && a[length] == b[length]) length++;
+    return length;
+}
+
+// Hash chains over the whole input: head holds the latest position of each hash, chain[pos & windowMask]
+// the previous position with the same hash. The tree levels use tree instead of chain.
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    uint32_t *head;
+    uint32_t *chain;
+    uint32_t *tree;
+    uint32_t windowMask;
+    LevelParams params;
+} MatchFinder;
+
+// Binary-tree match finder, as in LZMA's bt4: each hash head is the root of a tree of the earlier positions in
+// the window with that hash, ordered by the bytes that follow them, and tree[2 * slot] and tree[2 * slot + 1]
+// hold the children of the position in that window slot. Searching pos walks down from the root and rebuilds
+// the tree with pos as the new root, splitting the nodes it passes into those that sort before and after pos;
+// the bytes each side is known to share with pos are not compared again. Returns what findMatch does.
+static int treeMatch(MatchFinder *finder, size_t pos, size_t limit, int pending, uint32_t *distance) {
+    const uint8_t *data = finder->data;
+    uint32_t h = hash4(&data[pos]);
+    uint32_t candidate = finder->head[h];
+    finder->head[h] = (uint32_t)pos;
+    uint32_t *before = &finder->tree[2 * (pos & finder->windowMask)], *after = before + 1;
+    int beforeLength = 0, afterLength = 0;
+
+    // The tree orders positions by at most niceLength bytes; a match that long is then extended to maxLength
+    size_t available = finder->size - pos;
+    int compareLimit = available < (size_t)finder->params.niceLength ? (int)available : finder->params.niceLength;
+    int maxLength = limit - pos < MAX_MATCH ? (int)(limit - pos) : MAX_MATCH;
+    int best = pending > MIN_MATCH - 1 ? pending : MIN_MATCH - 1;
+    int found = 0;
+    for (int steps = finder->params.maxChain; candidate != NO_POSITION && steps > 0; steps--) {
+        size_t back = pos - candidate;
+        if (back > finder->windowMask) break;
+        uint32_t *node = &finder->tree[2 * (candidate & finder->windowMask)];
+        int length = beforeLength < afterLength ? beforeLength : afterLength;
+        length += matchLength(&data[candidate + length], &data[pos + length], compareLimit - length);
+        int usable = length < maxLength ? length : maxLength;
+        if (length == compareLimit && length < maxLength) {
+            usable += matchLength(&data[candidate + length], &data[pos + length], maxLength - length);
+        }
+        if (usable > best) {
+            best = usable;
+            found = 1;
+            *distance = (uint32_t)back;
+        }
+        if (length == compareLimit) {
+            // Equal to pos as far as the tree looks: pos takes its place and its children
+            *before = node[0];
+            *after = node[1];
+            return found ? best : 0;
+        }
+        if (data[candidate + length] < data[pos + length]) {
+            *before = candidate;
+            before = &node[1];
+            candidate = *before;
+            beforeLength = length;
+        } else {
+            *after = candidate;
+            after = &node[0];
+            candidate = *after;
+            afterLength = length;
+        }
+    }
+    *before = *after = NO_POSITION;
+    return found ? best : 0;
+}
+
+static void insertPosition(MatchFinder *finder, size_t pos) {
+    if (finder->params.tree) {
+        // Placing pos in its tree takes the same walk as a search; a limit of pos asks for no match
+        uint32_t distance;
+        treeMatch(finder, pos, pos, 0, &distance);
+        return;
+    }
+    uint32_t h = hash4(&finder->data[pos]);
+    finder->chain[pos & finder->windowMask] = finder->head[h];
+    finder->head[h] = (uint32_t)pos;
+}
+
+// Longest match for pos that ends by limit and beats pending (the match already in hand, 0 if none);
+// inserts pos into the chains. Returns its length, or 0 if there is none of at least MIN_MATCH.
+static int findMatch(MatchFinder *finder, size_t pos, size_t limit, int pending, uint32_t *distance) {
+    if (finder->params.tree) return treeMatch(finder, pos, limit, pending, distance);
+    const uint8_t *data = finder->data;
+    uint32_t h = hash4(&data[pos]);
+    uint32_t candidate = finder->head[h];
+    finder->chain[pos & finder->windowMask] = candidate;
+    finder->head[h] = (uint32_t)pos;
+
+    int maxLength = limit - pos < MAX_MATCH ? (int)(limit - pos) : MAX_MATCH;
+    int best = pending > MIN_MATCH - 1 ? pending : MIN_MATCH - 1;
+    int steps = finder->params.maxChain;
+    if (pending >= finder->params.goodLength) steps >>= 2;
+    if (best >= maxLength) return 0;
+    int found = 0;
+    for (; candidate != NO_POSITION && steps > 0; steps--) {
+        size_t back = pos - candidate;
+        if (back > finder->windowMask) break;
+        // Cheap test of the byte that would make this match longer before comparing the whole thing
+        if (data[candidate + best] == data[pos + best]) {
+            int length = matchLength(&data[candidate], &data[pos], maxLength);
+            if (length > best) {
+                best = length;
+                found = 1;
+                *distance = (uint32_t)back;
+                if (length >= finder->params.niceLength || length == maxLength) break;
+            }
+        }
+        candidate = finder->chain[candidate & finder->windowMask];
+    }
+    return found ? best : 0;
+}
+
+// Sequences of one block, each field as a code plus its extra bits in the shared extra-bits stream
+typedef struct {
+    uint16_t *literalRunCodes;
+    uint16_t *lengthCodes;
+    uint16_t *distanceCodes;
+    uint16_t *literals;
+    size_t sequenceCount;
+    size_t literalCount;
+    BitWriter extra;
+} BlockSequences;
+
+static void addValue(BlockSequences *block, uint16_t *codes, uint32_t value) {
+    int extraBits;
+    codes[block->sequenceCount] = (uint16_t)valueCode(value, &extraBits);
+    bit_writer_put(&block->extra, value & ((1u << extraBits) - 1), extraBits);
+}
+
+// Parse data[start, end) into sequences. Matches may reach back across earlier blocks but stay inside this one.
+static void parseBlock(MatchFinder *finder, size_t start, size_t end, BlockSequences *block) {
+    const uint8_t *data = finder->data;
+    size_t pos = start, literalStart = start;
+    size_t hashEnd = finder->size >= MIN_MATCH ? finder->size - MIN_MATCH + 1 : 0;
+    block->sequenceCount = block->literalCount = 0;
+
+    while (pos < end && pos < hashEnd) {
+        uint32_t distance = 0;
+        int length = findMatch(finder, pos, end, 0, &distance);
+        size_t inserted = pos;
+        if (length == 0) {
+            pos++;
+            continue;
+        }
+
+        // Lazy matching: if the next position has a longer match, emit a literal first
+        while (length < finder->params.lazyLength && pos + 1 < end && pos + 1 < hashEnd) {
+            uint32_t nextDistance = 0;
+            int nextLength = findMatch(finder, pos + 1, end, length, &nextDistance);
+            inserted = pos + 1;
+            if (nextLength == 0) break;
+            pos++;
+            length = nextLength;
+            distance = nextDistance;
+        }
+
+        // Literals since the last match, then the match
+        for (size_t i = literalStart; i < pos; i++) block->literals[block->literalCount++] = data[i];
+        addValue(block, block->literalRunCodes, (uint32_t)(pos - literalStart));
+        addValue(block, block->lengthCodes, (uint32_t)(length - MIN_MATCH));
+        addValue(block, block->distanceCodes, distance - 1);
+        block->sequenceCount++;
+
+        // The rest of the match's positions join the chains
+        size_t matchEnd = pos + length;
+        for (size_t p = inserted + 1; p < matchEnd && p < hashEnd; p++) {
+            insertPosition(finder, p);
+        }
+        pos = literalStart = matchEnd;
+    }
+
+    // Trailing literals belong to no sequence; the decoder copies whatever literals are left
+    for (size_t i = literalStart; i < end; i++) block->literals[block->literalCount++] = data[i];
+}
+
+static void writeU32(FILE *file, uint32_t value) {
+    uint8_t bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+    fwrite(bytes, 1, 4, file);
+}
+
+static uint32_t readU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Entropy-code one stream with coder (or with the coder estimated to be smaller). Returns the coder used.
+static int encodeStream(BitWriter *streams, const uint16_t *symbols, size_t count, int alphabetSize, int coder,
+                        int tableLog) {
+    if (coder == CODER_AUTO) {
+        uint32_t frequency[HUFFMAN_MAX_SYMBOLS] = {0};
+        for (size_t i = 0; i < count; i++) frequency[symbols[i]]++;
+        uint64_t tansBits = tans_stream_bits(frequency, alphabetSize, tableLog);
+        coder = tansBits < huffman_stream_bits(frequency, alphabetSize) ? CODER_TANS : CODER_HUFFMAN;
+    }
+    if (coder == CODER_TANS) {
+        tans_encode_stream(streams, symbols, count, alphabetSize, tableLog);
+    } else {
+        huffman_encode_stream(streams, symbols, count, alphabetSize);
+    }
+    return coder;
+}
+
+// Parse and write every block of the input, counting the streams given to each coder in coderStreams.
+// Returns 0, or -1 if memory runs out.
+static int writeBlocks(FILE *outputFile, MatchFinder *finder, BlockSequences *block, int coder, int tableLog,
+                       int coderStreams[2]) {
+    BitWriter streams = {0};
+    for (size_t blockStart = 0; blockStart < finder->size; blockStart += BLOCK_SIZE) {
+        size_t blockEnd = finder->size - blockStart < BLOCK_SIZE ? finder->size : blockStart + BLOCK_SIZE;
+        block->extra.size = 0;
+        parseBlock(finder, blockStart, blockEnd, block);
+        bit_writer_align(&block->extra);
+
+        // Entropy-code each stream, remembering its coder and size
+        uint32_t streamSizes[5];
+        uint8_t coders[4];
+        streams.size = 0;
+        coders[0] = (uint8_t)encodeStream(&streams, block->literals, block->literalCount, LITERAL_SYMBOLS, coder, tableLog);
+        streamSizes[0] = (uint32_t)streams.size;
+        uint16_t *codeStreams[3] = {block->literalRunCodes, block->lengthCodes, block->distanceCodes};
+        for (int s = 0; s < 3; s++) {
+            size_t before = streams.size;
+            coders[s + 1] = (uint8_t)encodeStream(&streams, codeStreams[s], block->sequenceCount, VALUE_CODES, coder,
+                                                  tableLog);
+            streamSizes[s + 1] = (uint32_t)(streams.size - before);
+        }
+        for (int s = 0; s < 4; s++) coderStreams[coders[s]]++;
+        streamSizes[4] = (uint32_t)block->extra.size;
+        if (streams.failed || block->extra.failed) {
+            perror("Error allocating memory for LZ77 streams");
+            free(streams.data);
+            return -1;
+        }
+
+        writeU32(outputFile, (uint32_t)(blockEnd - blockStart));
+        writeU32(outputFile, (uint32_t)block->sequenceCount);
+        writeU32(outputFile, (uint32_t)block->literalCount);
+        fwrite(coders, 1, 4, outputFile);
+        for (int s = 0; s < 5; s++) writeU32(outputFile, streamSizes[s]);
+        fwrite(streams.data, 1, streams.size, outputFile);
+        if (block->extra.size > 0) fwrite(block->extra.data, 1, block->extra.size, outputFile);
+    }
+    free(streams.data);
+    return 0;
+}
+
+// Compress a file with the given level (1-9) and window of 2^windowLog bytes. coder is CODER_HUFFMAN, CODER_TANS
+// or CODER_AUTO, and tANS streams use tables of 2^tableLog states.
+// File layout: "LZ77", byte version, byte window log, uint32 size low, uint32 size high, then blocks of
+//   uint32 raw size, uint32 sequence count, uint32 literal count,
+//   byte coder of each entropy-coded stream (literals, literal runs, match lengths, distances),
+//   uint32 byte size of each stream (the same four, then extra bits),
+//   then the streams: four Huffman or tANS streams and the raw extra bits.
+int compressFile(const char *inputFilename, const char *outputFilename, int level, int windowLog, int coder,
+                 int tableLog) {
+    size_t size;
+    uint8_t *data = read_file(inputFilename, &size);
+    if (data == NULL) {
+        return -1;
+    }
+    if (size >= NO_POSITION) {
+        // Match positions are 32-bit
+        printf("Input too large for LZ77: %zu bytes (at most %u).\n", size, NO_POSITION - 1);
+        free(data);
+        return -1;
+    }
+    if (level < 1) level = 1;
+    if (level > 9) level = 9;
+    if (windowLog < MIN_WINDOW_LOG) windowLog = MIN_WINDOW_LOG;
+    if (windowLog > MAX_WINDOW_LOG) windowLog = MAX_WINDOW_LOG;
+
+    clock_t start = clock();
+    MatchFinder finder = {data, size, NULL, NULL, NULL, (1u << windowLog) - 1, levels[level]};
+    finder.head = (uint32_t *)malloc(sizeof(uint32_t) << HASH_BITS);
+    if (finder.params.tree) {
+        finder.tree = (uint32_t *)malloc(sizeof(uint32_t) << (windowLog + 1));
+    } else {
+        finder.chain = (uint32_t *)malloc(sizeof(uint32_t) << windowLog);
+    }
+    BlockSequences block = {0};
+    size_t maxSequences = BLOCK_SIZE / MIN_MATCH + 1;
+    block.literalRunCodes = (uint16_t *)malloc(maxSequences * sizeof(uint16_t));
+    block.lengthCodes = (uint16_t *)malloc(maxSequences * sizeof(uint16_t));
+    block.distanceCodes = (uint16_t *)malloc(maxSequences * sizeof(uint16_t));
+    block.literals = (uint16_t *)malloc(BLOCK_SIZE * sizeof(uint16_t));
+    FILE *outputFile = NULL;
+    int result = -1;
+    if (finder.head == NULL || (finder.chain == NULL && finder.tree == NULL) || block.literalRunCodes == NULL || block.lengthCodes == NULL ||
+        block.distanceCodes == NULL || block.literals == NULL) {
+        perror("Error allocating memory for LZ77");
+    } else if ((outputFile = fopen(outputFilename, "wb")) == NULL) {
+        perror("Error creating output file");
+    } else {
+        memset(finder.head, 0xFF, sizeof(uint32_t) << HASH_BITS);
+        fwrite("LZ77", 1, 4, outputFile);
+        fputc(LZ77_VERSION, outputFile);
+        fputc(windowLog, outputFile);
+        writeU32(outputFile, (uint32_t)size);
+        writeU32(outputFile, (uint32_t)((uint64_t)size >> 32));
+        int coderStreams[2] = {0, 0};
+        result = writeBlocks(outputFile, &finder, &block, coder, tableLog, coderStreams);
+
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        long compressedSize = ftell(outputFile);
+        if (fclose(outputFile) != 0) result = -1;
+        if (result == 0) {
+            printf("Compressed %zu bytes to %ld bytes (level %d, %d KB window)", size, compressedSize, level,
+                   1 << (windowLog - 10));
+            if (seconds > 0) printf(" at %.1f MB/s", size / seconds / 1e6);
+            printf(", %d of %d streams tANS\n", coderStreams[CODER_TANS], coderStreams[0] + coderStreams[1]);
+        } else {
+            remove(outputFilename);
+        }
+    }
+
+    free(finder.head);
+    free(finder.chain);
+    free(finder.tree);
+    free(block.literalRunCodes);
+    free(block.lengthCodes);
+    free(block.distanceCodes);
+    free(block.literals);
+    free(block.extra.data);
+    free(data);
+    return result;
+}
+
+// Copy a match of length bytes from distance back; overlapping matches repeat their pattern, so each
+// copy doubles the span that is known to be periodic
+static inline void copyMatch(uint8_t *out, size_t distance, size_t length) {
+    while (length > 0) {
+        size_t n = length < distance ? length : distance;
+        memcpy(out, out - distance, n);
+        out += n;
+        length -= n;
+        distance += n;
+    }
+}
+
+// Buffers reused by every block
+typedef struct {
+    uint16_t *symbols;
+    uint8_t *literals;
+    uint16_t *codes[3];
+} BlockDecoder;
+
+// Decode a stream written by encodeStream. Returns its size in bytes, or -1 if it is corrupt.
+static long decodeStream(int coder, const uint8_t *data, size_t size, uint16_t *symbols, size_t count, int alphabetSize) {
+    if (coder == CODER_HUFFMAN) return huffman_decode_stream(data, size, symbols, count, alphabetSize);
+    if (coder == CODER_TANS) return tans_decode_stream(data, size, symbols, count, alphabetSize);
+    return -1;
+}
+
+// Decode one block into output at pos, where room bytes are left. Returns the bytes of input used and sets
+// *rawSize, or returns -1 if the block is corrupt.
+static long decodeBlock(const uint8_t *input, size_t inputSize, uint8_t *output, size_t pos, size_t room,
+                        size_t windowSize, BlockDecoder *decoder, size_t *rawSizeOut) {
+    if (inputSize < BLOCK_HEADER_SIZE) return -1;
+    size_t rawSize = readU32(input), sequenceCount = readU32(&input[4]), literalCount = readU32(&input[8]);
+    const uint8_t *coders = &input[12];
+    uint32_t streamSizes[5];
+    size_t total = BLOCK_HEADER_SIZE;
+    for (int s = 0; s < 5; s++) {
+        streamSizes[s] = readU32(&input[16 + 4 * s]);
+        total += streamSizes[s];
+    }
+    if (rawSize == 0 || rawSize > BLOCK_SIZE || rawSize > room || literalCount > rawSize ||
+        sequenceCount > rawSize / MIN_MATCH + 1 || total > inputSize) {
+        return -1;
+    }
+
+    // Entropy-decode the streams, then replay the sequences
+    const uint8_t *stream = &input[BLOCK_HEADER_SIZE];
+    if (decodeStream(coders[0], stream, streamSizes[0], decoder->symbols, literalCount, LITERAL_SYMBOLS) < 0) return -1;
+    for (size_t i = 0; i < literalCount; i++) decoder->literals[i] = (uint8_t)decoder->symbols[i];
+    stream += streamSizes[0];
+    uint16_t **codes = decoder->codes;
+    for (int s = 0; s < 3; s++) {
+        if (decodeStream(coders[s + 1], stream, streamSizes[s + 1], codes[s], sequenceCount, VALUE_CODES) < 0) return -1;
+        stream += streamSizes[s + 1];
+    }
+    BitReader extra;
+    bit_reader_init(&extra, stream, streamSizes[4]);
+
+    uint8_t *out = &output[pos], *end = out + rawSize;
+    const uint8_t *literal = decoder->literals, *literalEnd = literal + literalCount;
+    for (size_t i = 0; i < sequenceCount; i++) {
+        uint32_t value[3];
+        for (int f = 0; f < 3; f++) {
+            int extraBits;
+            value[f] = valueBase(codes[f][i], &extraBits);
+            value[f] += bit_reader_get(&extra, extraBits);
+        }
+        size_t run = value[0], length = value[1] + MIN_MATCH, distance = (size_t)value[2] + 1;
+        if (run > (size_t)(literalEnd - literal) || run + length > (size_t)(end - out) ||
+            distance > (size_t)(out - output) + run || distance > windowSize) {
+            return -1;
+        }
+        memcpy(out, literal, run);
+        out += run;
+        literal += run;
+        copyMatch(out, distance, length);
+        out += length;
+    }
+    if ((size_t)(literalEnd - literal) != (size_t)(end - out) || bit_reader_overrun(&extra)) {
+        return -1;
+    }
+    memcpy(out, literal, literalEnd - literal);
+    *rawSizeOut = rawSize;
+    return (long)total;
+}
+
+int decompressFile(const char *inputFilename, const char *outputFilename) {
+    size_t inputSize;
+    uint8_t *input = read_file(inputFilename, &inputSize);
+    if (input == NULL) {
+        return -1;
+    }
+    if (inputSize < 14 || memcmp(input, "LZ77", 4) != 0 || input[4] != LZ77_VERSION || input[5] < MIN_WINDOW_LOG ||
+        input[5] > MAX_WINDOW_LOG) {
+        printf("Not an LZ77 file: %s\n", inputFilename);
+        free(input);
+        return -1;
+    }
+    size_t windowSize = (size_t)1 << input[5];
+    uint64_t size = readU32(&input[6]) | (uint64_t)readU32(&input[10]) << 32;
+    if (size / BLOCK_SIZE > inputSize) {
+        printf("Corrupt LZ77 header.\n");
+        free(input);
+        return -1;
+    }
+
+    clock_t start = clock();
+    uint8_t *output = (uint8_t *)malloc(size > 0 ? size : 1);
+    BlockDecoder decoder;
+    decoder.symbols = (uint16_t *)malloc(BLOCK_SIZE * sizeof(uint16_t));
+    decoder.literals = (uint8_t *)malloc(BLOCK_SIZE);
+    for (int s = 0; s < 3; s++) decoder.codes[s] = (uint16_t *)malloc((BLOCK_SIZE / MIN_MATCH + 1) * sizeof(uint16_t));
+    int result = -1;
+    if (output != NULL && decoder.symbols != NULL && decoder.literals != NULL && decoder.codes[0] != NULL &&
+        decoder.codes[1] != NULL && decoder.codes[2] != NULL) {
+        size_t inPos = 14, pos = 0;
+        result = 0;
+        while (pos < size) {
+            size_t blockSize = 0;
+            long used = decodeBlock(&input[inPos], inputSize - inPos, output, pos, size - pos, windowSize, &decoder,
+                                    &blockSize);
+            if (used < 0) {
+                printf("Corrupt or truncated LZ77 data at byte %zu of the output.\n", pos);
+                result = -1;
+                break;
+            }
+            inPos += used;
+            pos += blockSize;
+        }
+    } else {
+        perror("Error allocating memory for LZ77 output");
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    if (result == 0) {
+        FILE *outputFile = fopen(outputFilename, "wb");
+        if (outputFile == NULL || fwrite(output, 1, size, outputFile) != size) {
+            perror("Error writing output file");
+            result = -1;
+        }
+        if (outputFile != NULL) fclose(outputFile);
+        printf("Decompressed %llu bytes", (unsigned long long)size);
+        if (seconds > 0) printf(" at %.1f MB/s", size / seconds / 1e6);
+        printf("\n");
+    }
+    free(output);
+    free(decoder.symbols);
+    free(decoder.literals);
+    for (int s = 0; s < 3; s++) free(decoder.codes[s]);
+    free(input);
+    return result;
+}
+
+// Usage: LZ77 [compress <input> <output.lz> [level 1-9] [window log 15-23] [auto|huffman|tans] [table log 5-12]
+//             | decompress <input.lz> <output>]
+// Without arguments, sample.txt is compressed to compressed.lz and decoded back to decompressed.txt.
+int main(int argc, char **argv) {
+    if (argc >= 4 && argc <= 8 && strcmp(argv[1], "compress") == 0) {
+        int level = argc > 4 ? atoi(argv[4]) : DEFAULT_LEVEL;
+        int windowLog = argc > 5 ? atoi(argv[5]) : DEFAULT_WINDOW_LOG;
+        int coder = CODER_AUTO;
+        if (argc > 6 && strcmp(argv[6], "huffman") == 0) {
+            coder = CODER_HUFFMAN;
+        } else if (argc > 6 && strcmp(argv[6], "tans") == 0) {
+            coder = CODER_TANS;
+        } else if (argc > 6 && strcmp(argv[6], "auto") != 0) {
+            printf("Unknown entropy coder: %s (use auto, huffman or tans)\n", argv[6]);
+            return 1;
+        }
+        int tableLog = argc > 7 ? atoi(argv[7]) : TANS_DEFAULT_TABLE_LOG;
+        return compressFile(argv[2], argv[3], level, windowLog, coder, tableLog) == 0 ? 0 : 1;
+    }
+    if (argc == 4 && strcmp(argv[1], "decompress") == 0) {
+        return decompressFile(argv[2], argv[3]) == 0 ? 0 : 1;
+    }
+
+    if (compressFile("sample.txt", "compressed.lz", DEFAULT_LEVEL, DEFAULT_WINDOW_LOG, CODER_AUTO,
+                     TANS_DEFAULT_TABLE_LOG) != 0) {
+        return 1;
+    }
+    return decompressFile("compressed.lz", "decompressed.txt") == 0 ? 0 : 1;
+}
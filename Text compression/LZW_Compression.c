@@ -4,6 +4,13 @@
 #include <windows.h>
 #include <psapi.h>
 #include <time.h>
+#include <stdint.h>
+#include "crc32c.h"
+
+// compressed.bin layout: "LZWT", uint32 text length, uint32 CRC32C of the text, uint32 code count, then the
+// codes as ints. LZW_Decompression checks all of it, so another file, a truncated file or damaged codes are
+// reported instead of decoding to wrong text.
+#define LZW_TEXT_MAGIC "LZWT"
 
 #define MAX_DICT_SIZE 4096   // LZW dictionary size (12-bit)
 #define INIT_DICT_SIZE 256   // Initial dictionary size (ASCII)
@@ -167,15 +174,23 @@ char* readFileToString(const char* filename) {
     return content; // Return the file contents as a string
 }
 
-void saveArrayToBinFile(const char *filename, int *arr, size_t size) {
+// Write the codes to a .bin file after the header with the text's length and CRC32C
+void saveArrayToBinFile(const char *filename, int *arr, size_t size, const char *text) {
     FILE *file = fopen(filename, "wb");
     if (file == NULL) {
         printf("Error opening file for writing.\n");
         exit(1);
     }
 
+    uint32_t length = (uint32_t)strlen(text);
+    uint32_t header[3] = {length, crc32c(0, text, length), (uint32_t)size};
+    fwrite(LZW_TEXT_MAGIC, 1, 4, file);
+    fwrite(header, sizeof(uint32_t), 3, file);
     fwrite(arr, sizeof(int), size, file);
-    fclose(file);
+    if (fclose(file) != 0) {
+        printf("Error writing %s.\n", filename);
+        exit(1);
+    }
 }
 
 // Main function to test LZW compression
@@ -190,10 +205,16 @@ int main() {
     scanf("%255s", filename);  // Limit input to avoid overflow
     
     const char *input = readFileToString(filename);
+    if (input == NULL) {
+        return 1;
+    }
     int output_size;
     
-    // Perform LZW compression
+    // Perform LZW compression (an empty text has no codes)
     int *compressed_codes = LZWCompress(input, &output_size);
+    if (input[0] == '\0') {
+        output_size = 0;
+    }
 
     // // Print the compressed LZW codes
     // printf("LZW Compressed Codes: ");
@@ -201,7 +222,7 @@ int main() {
     //     printf("%d ", compressed_codes[i]);
     // }
     // printf("\n");
-    saveArrayToBinFile("compressed.bin", compressed_codes, output_size);
+    saveArrayToBinFile("compressed.bin", compressed_codes, output_size, input);
 
     // Free allocated memory
     free(compressed_codes);
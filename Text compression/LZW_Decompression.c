@@ -4,6 +4,13 @@
 #include <windows.h>
 #include <psapi.h>
 #include <time.h>
+#include <stdint.h>
+#include "crc32c.h"
+
+// compressed.bin layout (see LZW_Compression): "LZWT", uint32 text length, uint32 CRC32C of the text,
+// uint32 code count, then the codes as ints
+#define LZW_TEXT_MAGIC "LZWT"
+#define MAX_STRING_LENGTH 1023  // Longest dictionary string (the compressor's string buffers hold 1024 chars)
 
 #define MAX_DICT_SIZE 4096   // Maximum dictionary size for LZW (12-bit codes)
 #define INIT_DICT_SIZE 256   // Initial dictionary size (ASCII)
@@ -16,8 +23,16 @@ void printMemoryUsage() {
 }
 
 
-// Function to perform LZW decompression
+// Function to perform LZW decompression.
+// Returns NULL if a code is not in the dictionary, which only happens in a damaged file.
 char* LZWDecompress(int* codes, int num_codes) {
+    if (num_codes == 0) {
+        return (char*)calloc(1, 1);
+    }
+    if (codes[0] < 0 || codes[0] >= INIT_DICT_SIZE) {
+        return NULL;
+    }
+
     // Initialize the dictionary with single-character strings (ASCII)
     char* dictionary[MAX_DICT_SIZE];
     for (int i = 0; i < INIT_DICT_SIZE; i++) {
@@ -45,6 +60,13 @@ char* LZWDecompress(int* codes, int num_codes) {
         int NEW = codes[i];
         char S[1024]; // Temporary buffer for the translation
 
+        // A code may only be one past the newest entry, and strings never outgrow the buffers
+        if (NEW < 0 || NEW > dict_size || (NEW == dict_size && dict_size == MAX_DICT_SIZE) ||
+            strlen(dictionary[OLD]) >= MAX_STRING_LENGTH) {
+            free(output);
+            return NULL;
+        }
+
         // If NEW is not in the dictionary
         if (NEW >= dict_size) {
             // S = translation of OLD + C
@@ -89,8 +111,8 @@ char* LZWDecompress(int* codes, int num_codes) {
 }
 
 
-// Function to read an integer array from a .bin file
-int* readArrayFromBinFile(const char *filename, int *size) {
+// Function to read an integer array from a .bin file, with the text length and CRC32C from its header
+int* readArrayFromBinFile(const char *filename, int *size, uint32_t *length, uint32_t *crc) {
     FILE *file = fopen(filename, "rb");
     if (file == NULL) {
         printf("Error opening file for reading.\n");
@@ -102,11 +124,25 @@ int* readArrayFromBinFile(const char *filename, int *size) {
     long fileSize = ftell(file);
     rewind(file);
 
+    // Check the header; the code count must account for the rest of the file exactly
+    char magic[4];
+    uint32_t header[3];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, LZW_TEXT_MAGIC, 4) != 0 ||
+        fread(header, sizeof(uint32_t), 3, file) != 3 ||
+        (long)header[2] != (fileSize - 16) / (long)sizeof(int) || (fileSize - 16) % sizeof(int) != 0) {
+        printf("%s is not an LZW compressed file or is truncated.\n", filename);
+        fclose(file);
+        exit(1);
+    }
+    *length = header[0];
+    *crc = header[1];
+    fileSize -= 16;
+
     // Calculate the number of integers in the file
     *size = fileSize / sizeof(int);
 
     // Allocate memory for the array
-    int *arr = (int*)malloc(fileSize);
+    int *arr = (int*)malloc(fileSize + 1);
     if (arr == NULL) {
         printf("Memory allocation failed.\n");
         fclose(file);
@@ -128,10 +164,18 @@ int main() {
 
     // Read the compressed codes from a binary file
     int num_codes;
-    int* codes = readArrayFromBinFile("compressed.bin", &num_codes);
+    uint32_t length, crc;
+    int* codes = readArrayFromBinFile("compressed.bin", &num_codes, &length, &crc);
 
-    // Perform LZW decompression
+    // Perform LZW decompression, then check the text against the header
     char* decompressed_str = LZWDecompress(codes, num_codes);
+    free(codes);
+    if (decompressed_str == NULL || strlen(decompressed_str) != length ||
+        crc32c(0, decompressed_str, length) != crc) {
+        printf("compressed.bin is corrupt.\n");
+        free(decompressed_str);
+        return 1;
+    }
 
     //write to a .txt
     FILE* file=fopen("decompressed.txt", "w");
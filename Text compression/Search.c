@@ -0,0 +1,445 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "context_huffman.h"
+#include "pattern_search.h"
+#include "file_util.h"
+
+// Finds patterns in compressed text without writing out the text. Reads the 12-bit LZW code files of
+// LZW_Compression.c (a 16-byte header, then native 32-bit ints) and the Huffman files of Huffmann.c (order 0 or
+// order 1). The LZW header's text length is checked; its CRC32C needs the text, so only decompression checks it.
+#define LZW_TEXT_MAGIC "LZWT"
+#define LZW_HEADER_SIZE 16            // Magic, text length, CRC32C, code count
+#define MAX_DICT_SIZE 4096           // LZW dictionary size (12-bit); it stops growing once full
+#define INIT_DICT_SIZE 256
+#define NO_CODE 0xFFFF
+#define HUFFMAN_VERSION 1
+#define HUFFMAN_HEADER_SIZE 13
+#define WINDOW_BITS 10                // Input bits the Huffman search resolves per lookup
+#define MAX_WINDOW_ENTRIES (1 << 22)  // Beyond this, the Huffman search falls back to one code per lookup
+
+static uint32_t readU32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// ---- LZW ----
+
+// The dictionary as the decoder rebuilds it, plus the match state of every phrase. For each code and automaton
+// state q, jump holds the state after reading the phrase from q, and hit the longest prefix of the phrase (a
+// code itself) at whose end a pattern ends when read from q, or NO_CODE. A new code's rows follow from its
+// parent's with one transition per state, so a phrase is searched in one lookup however long it is, and the
+// matches inside it are listed by following hit from prefix to shorter prefix.
+typedef struct {
+    int stateCount;
+    int dictSize;
+    uint16_t *jump;
+    uint16_t *hit;
+    uint16_t parent[MAX_DICT_SIZE];
+    uint16_t length[MAX_DICT_SIZE];
+    uint8_t first[MAX_DICT_SIZE];
+    uint8_t last[MAX_DICT_SIZE];
+} LZWSearch;
+
+static void addPhrase(LZWSearch *search, const PatternMatcher *matcher, int parent, uint8_t c) {
+    int code = search->dictSize++, states = search->stateCount;
+    uint16_t *jump = &search->jump[(size_t)code * states], *hit = &search->hit[(size_t)code * states];
+    search->parent[code] = parent < 0 ? NO_CODE : (uint16_t)parent;
+    search->length[code] = parent < 0 ? 1 : search->length[parent] + 1;
+    search->first[code] = parent < 0 ? c : search->first[parent];
+    search->last[code] = c;
+    for (int q = 0; q < states; q++) {
+        int from = parent < 0 ? q : search->jump[(size_t)parent * states + q];
+        jump[q] = matcher->next[from][c];
+        hit[q] = matcher->matches[jump[q]] ? (uint16_t)code
+                 : parent < 0              ? NO_CODE
+                                           : search->hit[(size_t)parent * states + q];
+    }
+}
+
+// Check the next code against the dictionary. Returns -1 if it cannot follow old, 0 if the dictionary stays as
+// it is, or 1 if the decoder adds old's phrase plus c (the first byte of code's phrase) before reading it.
+static int nextPhrase(const LZWSearch *search, int old, int code, uint8_t *c) {
+    if (code < 0 || code > search->dictSize || (code == search->dictSize && (old < 0 || code == MAX_DICT_SIZE))) {
+        return -1;
+    }
+    if (old < 0 || search->dictSize == MAX_DICT_SIZE) {
+        return 0;
+    }
+    *c = code < search->dictSize ? search->first[code] : search->first[old];
+    return 1;
+}
+
+// Search count LZW codes. Sets textSize to the length of the text they stand for.
+// Returns 0, or -1 if the codes are corrupt or memory runs out.
+int searchLZW(const int32_t *codes, size_t count, const PatternMatcher *matcher, MatchList *list,
+              uint64_t *textSize) {
+    LZWSearch *search = (LZWSearch *)malloc(sizeof(LZWSearch));
+    size_t rows = (size_t)MAX_DICT_SIZE * matcher->stateCount;
+    if (search != NULL) {
+        search->jump = (uint16_t *)malloc(rows * sizeof(uint16_t));
+        search->hit = (uint16_t *)malloc(rows * sizeof(uint16_t));
+    }
+    if (search == NULL || search->jump == NULL || search->hit == NULL) {
+        perror("Error allocating memory for LZW search");
+        if (search != NULL) {
+            free(search->jump);
+            free(search->hit);
+        }
+        free(search);
+        return -1;
+    }
+    search->stateCount = matcher->stateCount;
+    search->dictSize = 0;
+    for (int c = 0; c < INIT_DICT_SIZE; c++) addPhrase(search, matcher, -1, (uint8_t)c);
+
+    // The compressor writes a lone code 0 (its empty string) for an empty file
+    int result = 0, state = 0, old = -1;
+    uint64_t pos = 0;
+    for (size_t i = 0; i < count && !(count == 1 && codes[0] == 0); i++) {
+        int code = codes[i];
+        uint8_t c;
+        int grow = nextPhrase(search, old, code, &c);
+        if (grow < 0) {
+            result = -1;
+            break;
+        }
+        if (grow) addPhrase(search, matcher, old, c);
+
+        size_t row = (size_t)code * search->stateCount + state;
+        for (int h = search->hit[row]; h != NO_CODE;) {
+            pattern_report(matcher, search->jump[(size_t)h * search->stateCount + state], pos + search->length[h],
+                           list);
+            int parent = search->parent[h];
+            h = parent == NO_CODE ? NO_CODE : search->hit[(size_t)parent * search->stateCount + state];
+        }
+        state = search->jump[row];
+        pos += search->length[code];
+        old = code;
+    }
+    *textSize = pos;
+    free(search->jump);
+    free(search->hit);
+    free(search);
+    return result;
+}
+
+// Plain LZW decoding into memory, used to compare against searching the codes directly.
+// Returns the text (its length in textSize), or NULL if the codes are corrupt or memory runs out.
+uint8_t *decodeLZW(const int32_t *codes, size_t count, uint64_t *textSize) {
+    static LZWSearch search;  // Only the dictionary fields are used
+    size_t capacity = 4 * count + 1, pos = 0;
+    uint8_t *text = (uint8_t *)malloc(capacity);
+    if (text == NULL) {
+        perror("Error allocating memory for LZW output");
+        return NULL;
+    }
+    for (int c = 0; c < INIT_DICT_SIZE; c++) {
+        search.parent[c] = NO_CODE;
+        search.length[c] = 1;
+        search.first[c] = search.last[c] = (uint8_t)c;
+    }
+    search.dictSize = INIT_DICT_SIZE;
+    int old = -1;
+    for (size_t i = 0; i < count && !(count == 1 && codes[0] == 0); i++) {
+        int code = codes[i];
+        uint8_t c;
+        int grow = nextPhrase(&search, old, code, &c);
+        if (grow < 0) {
+            free(text);
+            return NULL;
+        }
+        if (grow) {
+            int n = search.dictSize++;
+            search.parent[n] = (uint16_t)old;
+            search.length[n] = search.length[old] + 1;
+            search.first[n] = search.first[old];
+            search.last[n] = c;
+        }
+        if (pos + search.length[code] > capacity) {
+            while (pos + search.length[code] > capacity) capacity *= 2;
+            uint8_t *grown = (uint8_t *)realloc(text, capacity);
+            if (grown == NULL) {
+                perror("Error allocating memory for LZW output");
+                free(text);
+                return NULL;
+            }
+            text = grown;
+        }
+        pos += search.length[code];
+        for (int k = code, at = (int)pos - 1; k != NO_CODE; k = search.parent[k]) text[at--] = search.last[k];
+        old = code;
+    }
+    *textSize = pos;
+    return text;
+}
+
+// ---- Huffman ----
+
+typedef struct {
+    ContextHuffmanDecoder *decoder;
+    uint64_t size;
+    BitReader reader;  // At the first code
+} HuffmanStream;
+
+// Read a Huffmann.c file's header and code tables. Returns 0, or -1 if it is not a valid file.
+static int openHuffman(const uint8_t *input, size_t inputSize, HuffmanStream *stream) {
+    stream->decoder = NULL;
+    if (inputSize < HUFFMAN_HEADER_SIZE || memcmp(input, "HUFF", 4) != 0 || input[4] != HUFFMAN_VERSION) {
+        printf("Not a Huffman file.\n");
+        return -1;
+    }
+    stream->size = readU32(&input[5]) | (uint64_t)readU32(&input[9]) << 32;
+    if (stream->size / 8 > inputSize) {
+        printf("Corrupt Huffman header.\n");
+        return -1;
+    }
+    stream->decoder = (ContextHuffmanDecoder *)malloc(sizeof(ContextHuffmanDecoder));
+    if (stream->decoder == NULL) {
+        perror("Error allocating memory for Huffman decoder");
+        return -1;
+    }
+    bit_reader_init(&stream->reader, &input[HUFFMAN_HEADER_SIZE], inputSize - HUFFMAN_HEADER_SIZE);
+    if (context_huffman_read_tables(&stream->reader, stream->decoder) != 0) {
+        printf("Corrupt Huffman code tables.\n");
+        free(stream->decoder);
+        stream->decoder = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// The search runs on combined states: an automaton state together with the table the next code is read
+// with. Past the root the table is fixed by the state's last byte, so only the root needs one combined state
+// per table: combined states 0..tableCount-1 are the root, and tableCount + s - 1 is automaton state s.
+static inline int combineState(const HuffmanStream *stream, int state, int table) {
+    return state == 0 ? table : stream->decoder->tableCount + state - 1;
+}
+
+static inline void splitState(const HuffmanStream *stream, const PatternMatcher *matcher, int combined, int *state,
+                              int *table) {
+    *state = combined < stream->decoder->tableCount ? 0 : combined - stream->decoder->tableCount + 1;
+    *table = combined < stream->decoder->tableCount ? combined : stream->decoder->tableOf[matcher->lastByte[*state]];
+}
+
+// Read every whole code in a WINDOW_BITS-bit window from a combined state, reporting matches if list is set.
+// Returns the window entry: combined state after << 16 | match seen << 8 | codes read << 4 | bits used.
+// No codes read means the window starts with a code longer than the window, or an invalid one.
+static uint32_t readWindow(const HuffmanStream *stream, const PatternMatcher *matcher, int combined, uint32_t window,
+                           uint64_t pos, MatchList *list) {
+    int state, table, used = 0, count = 0, match = 0;
+    splitState(stream, matcher, combined, &state, &table);
+    for (;;) {
+        uint16_t entry = stream->decoder->decoders[table].entries[window >> used];
+        int length = entry & 15, symbol = entry >> 4;
+        if (length == 0 || used + length > WINDOW_BITS) break;
+        used += length;
+        count++;
+        state = matcher->next[state][symbol];
+        table = stream->decoder->tableOf[symbol];
+        if (matcher->matches[state]) {
+            match = 1;
+            if (list != NULL) pattern_report(matcher, state, pos + count, list);
+        }
+    }
+    return (uint32_t)combineState(stream, state, table) << 16 | match << 8 | count << 4 | used;
+}
+
+// Read one code from a combined state, reporting any match it completes. Returns 0, or -1 for an invalid code.
+static inline int readCode(HuffmanStream *stream, const PatternMatcher *matcher, int *combined, uint64_t *pos,
+                           MatchList *list) {
+    int state, table;
+    splitState(stream, matcher, *combined, &state, &table);
+    int symbol = huffman_decode_symbol(&stream->decoder->decoders[table], &stream->reader);
+    if (symbol < 0) {
+        return -1;
+    }
+    state = matcher->next[state][symbol];
+    (*pos)++;
+    if (matcher->matches[state]) pattern_report(matcher, state, *pos, list);
+    *combined = combineState(stream, state, stream->decoder->tableOf[symbol]);
+    return 0;
+}
+
+// Search a Huffman stream. Each lookup in a table indexed by combined state and the next WINDOW_BITS bits
+// reads all the codes that fit in the window and steps the automaton over them, so several bytes are handled
+// per lookup and none are stored. A combined state's row of the table is filled the first time it is entered.
+// Windows in which a pattern ends are read again code by code to list the matches. Codes longer than the
+// window, the last few bytes, and streams whose table would be too large are read one code at a time.
+// Returns 0, or -1 if the codes are invalid or run past the data.
+int searchHuffman(HuffmanStream *stream, const PatternMatcher *matcher, MatchList *list) {
+    BitReader *reader = &stream->reader;
+    int combinedCount = stream->decoder->tableCount + matcher->stateCount - 1;
+    uint32_t *windows = NULL;
+    uint8_t *filled = NULL;
+    if ((size_t)combinedCount << WINDOW_BITS <= MAX_WINDOW_ENTRIES) {
+        windows = (uint32_t *)malloc(((size_t)combinedCount << WINDOW_BITS) * sizeof(uint32_t));
+        filled = (uint8_t *)calloc(combinedCount, 1);
+    }
+    int combined = combineState(stream, 0, stream->decoder->tableOf[0]), failed = 0;
+    uint64_t pos = 0;
+    if (windows != NULL && filled != NULL) {
+        // Four windows fit in one refill of at least 56 bits; each reads at most WINDOW_BITS codes
+        while (!failed && pos + 4 * WINDOW_BITS <= stream->size) {
+            bit_reader_refill(reader);
+            for (int k = 0; k < 4; k++) {
+                uint32_t *row = &windows[(size_t)combined << WINDOW_BITS];
+                if (!filled[combined]) {
+                    for (uint32_t w = 0; w < (1u << WINDOW_BITS); w++) {
+                        row[w] = readWindow(stream, matcher, combined, w, 0, NULL);
+                    }
+                    filled[combined] = 1;
+                }
+                uint32_t window = (uint32_t)reader->bits & ((1u << WINDOW_BITS) - 1);
+                uint32_t entry = row[window];
+                if ((entry & 0xF0) == 0) {
+                    failed = readCode(stream, matcher, &combined, &pos, list) != 0;
+                    continue;
+                }
+                if (entry & 0x100) readWindow(stream, matcher, combined, window, pos, list);
+                reader->bits >>= entry & 15;
+                reader->count -= entry & 15;
+                pos += (entry >> 4) & 15;
+                combined = entry >> 16;
+            }
+        }
+    }
+    free(windows);
+    free(filled);
+
+    while (!failed && pos < stream->size) {
+        bit_reader_refill(reader);
+        failed = readCode(stream, matcher, &combined, &pos, list) != 0;
+    }
+    return failed || bit_reader_overrun(reader) ? -1 : 0;
+}
+
+// Plain Huffman decoding into memory, as Huffmann.c does it, used to compare against searching the codes directly.
+// Returns the text, or NULL if the codes are invalid or memory runs out.
+uint8_t *decodeHuffman(HuffmanStream *stream) {
+    uint8_t *text = (uint8_t *)malloc(stream->size > 0 ? stream->size : 1);
+    if (text == NULL) {
+        perror("Error allocating memory for Huffman output");
+        return NULL;
+    }
+    if (context_huffman_decode(&stream->reader, stream->decoder, text, stream->size) != 0) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+// ---- Driver ----
+
+// Search (or, with decode set, decompress and then scan) a compressed file.
+// Returns 0, or -1 if it cannot be read or is corrupt.
+static int searchFile(const char *format, const char *filename, const PatternMatcher *matcher, int decode,
+                      MatchList *list, uint64_t *textSize, double *seconds) {
+    size_t inputSize;
+    uint8_t *input = read_file(filename, &inputSize);
+    if (input == NULL) {
+        return -1;
+    }
+    int result = -1;
+    double start = wall_seconds();
+    if (strcmp(format, "lzw") == 0) {
+        // Codes are copied out so they are aligned; the file holds the compressor's native ints
+        size_t count = inputSize >= LZW_HEADER_SIZE ? (inputSize - LZW_HEADER_SIZE) / 4 : 0;
+        int32_t *codes = (int32_t *)malloc(count > 0 ? count * 4 : 4);
+        if (codes == NULL || inputSize < LZW_HEADER_SIZE || memcmp(input, LZW_TEXT_MAGIC, 4) != 0 ||
+            inputSize % 4 != 0 || readU32(&input[12]) != count) {
+            printf("Not an LZW code file: %s\n", filename);
+        } else {
+            const uint8_t *data = &input[LZW_HEADER_SIZE];
+            for (size_t i = 0; i < count; i++) codes[i] = (int32_t)readU32(&data[4 * i]);
+            if (decode) {
+                uint8_t *text = decodeLZW(codes, count, textSize);
+                if (text != NULL) {
+                    pattern_scan(matcher, 0, text, *textSize, 0, list);
+                    free(text);
+                    result = 0;
+                }
+            } else {
+                result = searchLZW(codes, count, matcher, list, textSize);
+            }
+            if (result == 0 && *textSize != readU32(&input[4])) result = -1;
+            if (result != 0) printf("Corrupt LZW codes in %s\n", filename);
+        }
+        free(codes);
+    } else {
+        HuffmanStream stream;
+        if (openHuffman(input, inputSize, &stream) == 0) {
+            *textSize = stream.size;
+            if (decode) {
+                uint8_t *text = decodeHuffman(&stream);
+                if (text != NULL) {
+                    pattern_scan(matcher, 0, text, stream.size, 0, list);
+                    free(text);
+                    result = 0;
+                }
+            } else {
+                result = searchHuffman(&stream, matcher, list);
+            }
+            if (result != 0) printf("Corrupt or truncated Huffman data in %s\n", filename);
+        }
+        free(stream.decoder);
+    }
+    match_list_sort(list);
+    *seconds = wall_seconds() - start;
+    if (list->failed) {
+        perror("Error allocating memory for matches");
+        result = -1;
+    }
+    free(input);
+    return result;
+}
+
+// Usage: Search [compare] <lzw|huffman> <input> <pattern>...
+// Prints the byte offset and pattern of every match. With compare, the file is also decompressed in memory and
+// scanned, the two match lists are checked against each other and both speeds are printed.
+int main(int argc, char **argv) {
+    int compare = argc > 1 && strcmp(argv[1], "compare") == 0;
+    int first = compare ? 2 : 1;
+    if (argc < first + 3 || (strcmp(argv[first], "lzw") != 0 && strcmp(argv[first], "huffman") != 0)) {
+        printf("Usage: %s [compare] <lzw|huffman> <input> <pattern>...\n", argv[0]);
+        return 1;
+    }
+    const char *format = argv[first], *filename = argv[first + 1];
+    const char *const *patterns = (const char *const *)&argv[first + 2];
+    int patternCount = argc - first - 2;
+    PatternMatcher matcher;
+    if (pattern_build(&matcher, patterns, patternCount) != 0) {
+        return 1;
+    }
+
+    MatchList found = {0}, scanned = {0};
+    uint64_t textSize = 0, scannedSize = 0;
+    double seconds, scanSeconds = 0;
+    int result = searchFile(format, filename, &matcher, 0, &found, &textSize, &seconds);
+    if (result == 0 && compare) {
+        result = searchFile(format, filename, &matcher, 1, &scanned, &scannedSize, &scanSeconds);
+        int same = scannedSize == textSize && scanned.count == found.count;
+        for (size_t i = 0; same && i < found.count; i++) {
+            same = scanned.items[i].offset == found.items[i].offset && scanned.items[i].pattern == found.items[i].pattern;
+        }
+        if (result == 0 && !same) {
+            printf("Search and decompress-then-scan disagree.\n");
+            result = -1;
+        }
+    }
+    if (result == 0) {
+        for (size_t i = 0; i < found.count && !compare; i++) {
+            printf("%llu\t%s\n", (unsigned long long)found.items[i].offset, patterns[found.items[i].pattern]);
+        }
+        printf("%zu matches in %llu bytes of text", found.count, (unsigned long long)textSize);
+        if (seconds > 0) printf(", searched at %.1f MB/s", textSize / seconds / 1e6);
+        if (compare && scanSeconds > 0) printf(", decompressed and scanned at %.1f MB/s", textSize / scanSeconds / 1e6);
+        printf("\n");
+    }
+    free(found.items);
+    free(scanned.items);
+    pattern_free(&matcher);
+    return result == 0 ? 0 : 1;
+}
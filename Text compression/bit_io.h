@@ -0,0 +1,105 @@
+// LSB-first bit writer and reader shared by the text codecs' entropy coders.
+#ifndef BIT_IO_H
+#define BIT_IO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Growable LSB-first bit writer; failed is set (and further output dropped) if memory runs out
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    uint64_t bits;
+    int count;
+    int failed;
+} BitWriter;
+
+static int bit_writer_reserve(BitWriter *writer, size_t bytes) {
+    if (writer->size + bytes <= writer->capacity) {
+        return 0;
+    }
+    size_t capacity = writer->capacity ? writer->capacity : 4096;
+    while (capacity < writer->size + bytes) capacity *= 2;
+    uint8_t *data = (uint8_t *)realloc(writer->data, capacity);
+    if (data == NULL) {
+        writer->failed = 1;
+        return -1;
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+    return 0;
+}
+
+// Append the low n bits of value (n <= 32)
+static inline void bit_writer_put(BitWriter *writer, uint32_t value, int n) {
+    writer->bits |= (uint64_t)value << writer->count;
+    writer->count += n;
+    if (writer->count >= 32) {
+        if (bit_writer_reserve(writer, 4) == 0) {
+            for (int i = 0; i < 4; i++) writer->data[writer->size++] = (uint8_t)(writer->bits >> (8 * i));
+        }
+        writer->bits >>= 32;
+        writer->count -= 32;
+    }
+}
+
+// Write out pending bits, zero-padded to a whole byte
+static void bit_writer_align(BitWriter *writer) {
+    while (writer->count > 0) {
+        if (bit_writer_reserve(writer, 1) == 0) writer->data[writer->size++] = (uint8_t)writer->bits;
+        writer->bits >>= 8;
+        writer->count = writer->count > 8 ? writer->count - 8 : 0;
+    }
+    writer->bits = 0;
+}
+
+// LSB-first bit reader over a byte range. Reading past the end yields zero bits; bit_reader_overrun reports it.
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    uint64_t bits;
+    int count;
+} BitReader;
+
+static void bit_reader_init(BitReader *reader, const uint8_t *data, size_t size) {
+    reader->data = data;
+    reader->size = size;
+    reader->pos = 0;
+    reader->bits = 0;
+    reader->count = 0;
+}
+
+// Top up the buffer to at least 56 bits
+static inline void bit_reader_refill(BitReader *reader) {
+    if (reader->pos + 8 <= reader->size) {
+        uint64_t word = 0;
+        for (int i = 0; i < 8; i++) word |= (uint64_t)reader->data[reader->pos + i] << (8 * i);
+        reader->bits |= word << reader->count;
+        reader->pos += (63 - reader->count) >> 3;
+        reader->count |= 56;
+        return;
+    }
+    while (reader->count <= 56) {
+        uint64_t byte = reader->pos < reader->size ? reader->data[reader->pos] : 0;
+        reader->bits |= byte << reader->count;
+        reader->pos++;
+        reader->count += 8;
+    }
+}
+
+// Read n bits (n <= 32), refilling as needed
+static inline uint32_t bit_reader_get(BitReader *reader, int n) {
+    if (reader->count < n) bit_reader_refill(reader);
+    uint32_t value = (uint32_t)(reader->bits & ((((uint64_t)1) << n) - 1));
+    reader->bits >>= n;
+    reader->count -= n;
+    return value;
+}
+
+static inline int bit_reader_overrun(const BitReader *reader) {
+    return reader->pos * 8 - reader->count > reader->size * 8;
+}
+
+#endif
@@ -0,0 +1,218 @@
+// Byte coding with a canonical Huffman table per previous-byte context, or per cluster of contexts, shared by
+// Huffmann.c, Search.c and the codec library. A stream is laid out as
+//   8 bits table count, the context -> table map (only with more than one table), each table's code lengths,
+//   then the codes, padded to a whole byte.
+// Each byte is coded with the table of the byte before it (0 before the first byte); order 0 is the one-table case.
+#ifndef CONTEXT_HUFFMAN_H
+#define CONTEXT_HUFFMAN_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "huffman_coder.h"
+
+#define CONTEXT_HUFFMAN_CONTEXTS 256
+#define CONTEXT_HUFFMAN_MAX_TABLES 32  // Order-1 contexts are grouped into at most this many code tables
+#define CONTEXT_HUFFMAN_PASSES 8       // Assign / rebuild rounds when grouping contexts
+#define CONTEXT_HUFFMAN_MISSING_BITS (HUFFMAN_MAX_BITS + 4)  // Charged for a byte a table has no code for yet
+
+// Encoder state; about 300 KB, so callers that code many buffers keep one and reuse it
+typedef struct {
+    uint32_t freq[CONTEXT_HUFFMAN_CONTEXTS][256];
+    uint8_t lengths[2 * CONTEXT_HUFFMAN_MAX_TABLES][256];  // The chosen tables, then room for a trial
+    uint16_t codes[CONTEXT_HUFFMAN_MAX_TABLES][256];
+    uint8_t tableOf[CONTEXT_HUFFMAN_CONTEXTS];
+    int tableCount;
+} ContextHuffmanModel;
+
+typedef struct {
+    int tableCount;
+    uint8_t tableOf[CONTEXT_HUFFMAN_CONTEXTS];
+    HuffmanDecoder decoders[CONTEXT_HUFFMAN_MAX_TABLES];
+} ContextHuffmanDecoder;
+
+static inline int context_huffman_index_bits(int tableCount) {
+    int bits = 0;
+    while ((1 << bits) < tableCount) bits++;
+    return bits;
+}
+
+// Group the contexts into tableCount code tables, k-means style: every context moves to the table that codes
+// its bytes in the fewest bits, then each table is rebuilt from the contexts it holds. Tables are seeded with
+// the busiest contexts. Fills tableOf and lengths and returns the size of the resulting stream in bits.
+static inline uint64_t context_huffman_cluster(uint32_t freq[][256], int tableCount, uint8_t *tableOf,
+                                               uint8_t lengths[][256]) {
+    uint64_t total[CONTEXT_HUFFMAN_CONTEXTS];
+    int order[CONTEXT_HUFFMAN_CONTEXTS];
+    for (int c = 0; c < CONTEXT_HUFFMAN_CONTEXTS; c++) {
+        total[c] = 0;
+        for (int s = 0; s < 256; s++) total[c] += freq[c][s];
+        int j = c;
+        while (j > 0 && total[order[j - 1]] < total[c]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = c;
+    }
+    for (int t = 0; t < tableCount; t++) huffman_build_lengths(freq[order[t]], 256, lengths[t]);
+
+    uint32_t tableFreq[CONTEXT_HUFFMAN_MAX_TABLES][256];
+    for (int pass = 0; pass < CONTEXT_HUFFMAN_PASSES; pass++) {
+        int moved = 0;
+        for (int c = 0; c < CONTEXT_HUFFMAN_CONTEXTS; c++) {
+            uint64_t bestBits = UINT64_MAX;
+            int best = 0;
+            for (int t = 0; t < tableCount && total[c] > 0; t++) {
+                uint64_t bits = 0;
+                for (int s = 0; s < 256; s++) {
+                    bits += (uint64_t)freq[c][s] * (lengths[t][s] ? lengths[t][s] : CONTEXT_HUFFMAN_MISSING_BITS);
+                }
+                if (bits < bestBits) {
+                    bestBits = bits;
+                    best = t;
+                }
+            }
+            moved |= pass == 0 || tableOf[c] != best;
+            tableOf[c] = (uint8_t)best;
+        }
+        if (!moved) break;
+        memset(tableFreq, 0, sizeof(tableFreq));
+        for (int c = 0; c < CONTEXT_HUFFMAN_CONTEXTS; c++) {
+            for (int s = 0; s < 256; s++) tableFreq[tableOf[c]][s] += freq[c][s];
+        }
+        for (int t = 0; t < tableCount; t++) huffman_build_lengths(tableFreq[t], 256, lengths[t]);
+    }
+
+    uint64_t bits = 8 + (tableCount > 1 ? CONTEXT_HUFFMAN_CONTEXTS * context_huffman_index_bits(tableCount) : 0);
+    for (int t = 0; t < tableCount; t++) bits += huffman_stream_bits(tableFreq[t], 256);
+    return bits;
+}
+
+// Count the data and choose its tables. Order 0 uses one table; order 1 tries 1, 2, 4, ...
+// CONTEXT_HUFFMAN_MAX_TABLES tables for the previous-byte contexts and keeps whichever count codes smallest.
+static inline void context_huffman_build(ContextHuffmanModel *model, const uint8_t *data, size_t size, int order) {
+    memset(model->freq, 0, sizeof(model->freq));
+    uint8_t prev = 0;
+    for (size_t i = 0; i < size; i++) {
+        model->freq[prev][data[i]]++;
+        prev = data[i];
+    }
+
+    memset(model->tableOf, 0, sizeof(model->tableOf));
+    model->tableCount = 1;
+    if (order == 0) {
+        // Fold every context into row 0
+        for (int c = 1; c < CONTEXT_HUFFMAN_CONTEXTS; c++) {
+            for (int s = 0; s < 256; s++) model->freq[0][s] += model->freq[c][s];
+        }
+        huffman_build_lengths(model->freq[0], 256, model->lengths[0]);
+    } else {
+        uint8_t (*trial)[256] = &model->lengths[CONTEXT_HUFFMAN_MAX_TABLES];
+        uint8_t trialTableOf[CONTEXT_HUFFMAN_CONTEXTS];
+        uint64_t bestBits = UINT64_MAX;
+        for (int count = 1; count <= CONTEXT_HUFFMAN_MAX_TABLES; count *= 2) {
+            uint64_t bits = context_huffman_cluster(model->freq, count, trialTableOf, trial);
+            if (bits < bestBits) {
+                bestBits = bits;
+                model->tableCount = count;
+                memcpy(model->tableOf, trialTableOf, sizeof(model->tableOf));
+                memcpy(model->lengths, trial, count * sizeof(model->lengths[0]));
+            }
+        }
+    }
+    for (int t = 0; t < model->tableCount; t++) huffman_assign_codes(model->lengths[t], 256, model->codes[t]);
+}
+
+// Append size bytes as a stream, using the tables context_huffman_build chose for them
+static inline void context_huffman_encode(BitWriter *writer, const ContextHuffmanModel *model, const uint8_t *data,
+                                          size_t size) {
+    bit_writer_put(writer, model->tableCount, 8);
+    if (model->tableCount > 1) {
+        int indexBits = context_huffman_index_bits(model->tableCount);
+        for (int c = 0; c < CONTEXT_HUFFMAN_CONTEXTS; c++) bit_writer_put(writer, model->tableOf[c], indexBits);
+    }
+    for (int t = 0; t < model->tableCount; t++) huffman_write_table(writer, model->lengths[t], 256);
+
+    const uint16_t *contextCodes[CONTEXT_HUFFMAN_CONTEXTS];
+    const uint8_t *contextLengths[CONTEXT_HUFFMAN_CONTEXTS];
+    for (int c = 0; c < CONTEXT_HUFFMAN_CONTEXTS; c++) {
+        contextCodes[c] = model->codes[model->tableOf[c]];
+        contextLengths[c] = model->lengths[model->tableOf[c]];
+    }
+    uint8_t prev = 0;
+    for (size_t i = 0; i < size; i++) {
+        bit_writer_put(writer, contextCodes[prev][data[i]], contextLengths[prev][data[i]]);
+        prev = data[i];
+    }
+    bit_writer_align(writer);
+}
+
+// Read a stream's table count, context map and code tables. Returns 0, or -1 if they are invalid.
+static inline int context_huffman_read_tables(BitReader *reader, ContextHuffmanDecoder *decoder) {
+    decoder->tableCount = (int)bit_reader_get(reader, 8);
+    memset(decoder->tableOf, 0, sizeof(decoder->tableOf));
+    if (decoder->tableCount < 1 || decoder->tableCount > CONTEXT_HUFFMAN_MAX_TABLES) {
+        return -1;
+    }
+    if (decoder->tableCount > 1) {
+        int indexBits = context_huffman_index_bits(decoder->tableCount);
+        for (int c = 0; c < CONTEXT_HUFFMAN_CONTEXTS; c++) {
+            decoder->tableOf[c] = (uint8_t)bit_reader_get(reader, indexBits);
+            if (decoder->tableOf[c] >= decoder->tableCount) return -1;
+        }
+    }
+    for (int t = 0; t < decoder->tableCount; t++) {
+        if (huffman_read_table(reader, &decoder->decoders[t], 256) != 0) return -1;
+    }
+    return 0;
+}
+
+// Decode size bytes. With one table the lookups are independent; with several, each lookup waits on the
+// byte before it to pick its table. Returns 0, or -1 if the codes are invalid or run past the data.
+static inline int context_huffman_decode(BitReader *reader, const ContextHuffmanDecoder *decoder, uint8_t *output,
+                                          size_t size) {
+    const HuffmanDecoder *decoders = decoder->decoders;
+    const uint8_t *tableOf = decoder->tableOf;
+    int failed = 0;
+    size_t i = 0;
+    if (decoder->tableCount == 1) {
+        while (!failed && i + 4 <= size) {
+            bit_reader_refill(reader);
+            int a = huffman_decode_symbol(decoders, reader);
+            int b = huffman_decode_symbol(decoders, reader);
+            int c = huffman_decode_symbol(decoders, reader);
+            int d = huffman_decode_symbol(decoders, reader);
+            failed = (a | b | c | d) < 0;
+            output[i] = (uint8_t)a;
+            output[i + 1] = (uint8_t)b;
+            output[i + 2] = (uint8_t)c;
+            output[i + 3] = (uint8_t)d;
+            i += 4;
+        }
+    } else {
+        const HuffmanDecoder *contextDecoder[CONTEXT_HUFFMAN_CONTEXTS];
+        for (int c = 0; c < CONTEXT_HUFFMAN_CONTEXTS; c++) contextDecoder[c] = &decoders[tableOf[c]];
+        int prev = 0;
+        while (!failed && i + 4 <= size) {
+            bit_reader_refill(reader);
+            for (int k = 0; k < 4; k++) {
+                int symbol = huffman_decode_symbol(contextDecoder[prev & 0xFF], reader);
+                failed |= symbol < 0;
+                output[i + k] = (uint8_t)symbol;
+                prev = symbol;
+            }
+            i += 4;
+        }
+    }
+    int prev = i > 0 ? output[i - 1] : 0;
+    while (!failed && i < size) {
+        bit_reader_refill(reader);
+        int symbol = huffman_decode_symbol(&decoders[tableOf[prev]], reader);
+        failed = symbol < 0;
+        output[i++] = (uint8_t)symbol;
+        prev = (uint8_t)symbol;
+    }
+    return failed || bit_reader_overrun(reader) ? -1 : 0;
+}
+
+#endif
@@ -0,0 +1,92 @@
+// CRC32C (Castagnoli) shared by the programs' file checks and the codec library's container.
+// Uses the SSE4.2 or ARMv8 CRC instructions when the CPU has them. Build the programs that use it with -pthread.
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+// Castagnoli polynomial, reflected. The SSE4.2 and ARMv8 CRC instructions compute this same CRC.
+#define CRC32C_POLYNOMIAL 0x82F63B78u
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static inline void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+        crc32c_table[0][i] = crc;
+    }
+    for (int t = 1; t < 8; t++) {
+        for (int i = 0; i < 256; i++) {
+            crc32c_table[t][i] = (crc32c_table[t - 1][i] >> 8) ^ crc32c_table[0][crc32c_table[t - 1][i] & 0xFF];
+        }
+    }
+}
+
+// Slicing-by-8: eight table lookups per 8 bytes
+static inline uint32_t crc32c_software(uint32_t crc, const uint8_t *p, size_t size) {
+    pthread_once(&crc32c_once, crc32c_init);
+    while (size >= 8) {
+        uint32_t low = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t high = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = crc32c_table[7][low & 0xFF] ^ crc32c_table[6][(low >> 8) & 0xFF] ^ crc32c_table[5][(low >> 16) & 0xFF] ^
+              crc32c_table[4][low >> 24] ^ crc32c_table[3][high & 0xFF] ^ crc32c_table[2][(high >> 8) & 0xFF] ^
+              crc32c_table[1][(high >> 16) & 0xFF] ^ crc32c_table[0][high >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size--) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32C_SSE42
+// Built for SSE4.2 whatever the compiler flags, and only called once the CPU is known to have it
+__attribute__((target("sse4.2"))) static inline uint32_t crc32c_hardware(uint32_t crc, const uint8_t *p,
+                                                                        size_t size) {
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (size--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+static inline uint32_t crc32c_hardware(uint32_t crc, const uint8_t *p, size_t size) {
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        size -= 8;
+    }
+    while (size--) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+// CRC32C of size bytes, continuing from crc (0 to start)
+static inline uint32_t crc32c(uint32_t crc, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+    crc = ~crc;
+#if defined(CRC32C_SSE42)
+    crc = __builtin_cpu_supports("sse4.2") ? crc32c_hardware(crc, p, size) : crc32c_software(crc, p, size);
+#elif defined(__ARM_FEATURE_CRC32)
+    crc = crc32c_hardware(crc, p, size);
+#else
+    crc = crc32c_software(crc, p, size);
+#endif
+    return ~crc;
+}
+
+#endif
@@ -0,0 +1,44 @@
+// Whole-file reading and wall-clock timing shared by the text and image programs.
+#ifndef FILE_UTIL_H
+#define FILE_UTIL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Read a whole file into memory; the caller frees it. Returns NULL (after printing why) on failure.
+static inline uint8_t *read_file(const char *filename, size_t *size) {
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        perror("Failed to open file");
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+    uint8_t *data = (uint8_t *)malloc(fileSize > 0 ? fileSize : 1);
+    if (data == NULL || fileSize < 0 || fread(data, 1, fileSize, file) != (size_t)fileSize) {
+        perror("Failed to read file");
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *size = (size_t)fileSize;
+    return data;
+}
+
+// Wall-clock seconds, for throughput reports that stay honest when several threads run.
+// Uses the POSIX monotonic clock where there is one, and C11 timespec_get otherwise.
+static inline double wall_seconds(void) {
+    struct timespec now;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#else
+    timespec_get(&now, TIME_UTC);
+#endif
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+#endif
@@ -0,0 +1,231 @@
+// Canonical, length-limited Huffman coding of symbol streams, shared by the text codecs.
+// Each stream describes itself: its code lengths come first, then the packed codes. Any stage (LZ77 sequences,
+// literal bytes, ...) can entropy-code an array of small integers with one call. Codes are packed LSB first
+// and are at most HUFFMAN_MAX_BITS long, so the decoder resolves every symbol with a single table lookup.
+#ifndef HUFFMAN_CODER_H
+#define HUFFMAN_CODER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bit_io.h"
+
+#define HUFFMAN_MAX_BITS 12       // Longest code; the decode table has 1 << HUFFMAN_MAX_BITS entries
+#define HUFFMAN_MAX_SYMBOLS 1024  // Largest alphabet a stream may use
+
+// Code lengths for the symbols of frequency (0 for unused symbols), none longer than HUFFMAN_MAX_BITS.
+// The tree is built with the two-queue method over leaves sorted by frequency. If it comes out too deep, the
+// overlong codes are cut to HUFFMAN_MAX_BITS and the code space they overdraw is repaid by lengthening the
+// deepest codes that are still shorter, as zlib does; the lengths are then handed back to the leaves in order
+// of frequency, so the rarest symbols get the longest codes.
+static void huffman_build_lengths(const uint32_t *frequency, int alphabetSize, uint8_t *lengths) {
+    uint32_t weight[2 * HUFFMAN_MAX_SYMBOLS];
+    int parent[2 * HUFFMAN_MAX_SYMBOLS];
+    int leaves[HUFFMAN_MAX_SYMBOLS];
+    int leafCount = 0;
+    memset(lengths, 0, alphabetSize);
+    for (int s = 0; s < alphabetSize; s++) {
+        if (frequency[s] > 0) leaves[leafCount++] = s;
+    }
+    if (leafCount == 0) return;
+    if (leafCount == 1) {
+        lengths[leaves[0]] = 1;
+        return;
+    }
+
+    // Insertion sort keeps this simple; alphabets are small
+    for (int i = 1; i < leafCount; i++) {
+        int s = leaves[i], j = i;
+        while (j > 0 && frequency[leaves[j - 1]] > frequency[s]) {
+            leaves[j] = leaves[j - 1];
+            j--;
+        }
+        leaves[j] = s;
+    }
+    for (int i = 0; i < leafCount; i++) weight[i] = frequency[leaves[i]];
+
+    // Nodes 0..leafCount-1 are leaves, leafCount.. are internal nodes in the order they are made
+    int nextLeaf = 0, nextNode = leafCount, made = leafCount;
+    while (made < 2 * leafCount - 1) {
+        int pick[2];
+        for (int k = 0; k < 2; k++) {
+            if (nextLeaf < leafCount && (nextNode == made || weight[nextLeaf] <= weight[nextNode])) {
+                pick[k] = nextLeaf++;
+            } else {
+                pick[k] = nextNode++;
+            }
+        }
+        weight[made] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = made;
+        made++;
+    }
+
+    // Count the leaves at each depth from the root (the last node made) down, clamping overlong ones
+    int depth[2 * HUFFMAN_MAX_SYMBOLS];
+    int lengthCount[HUFFMAN_MAX_BITS + 1] = {0};
+    uint32_t kraft = 0;
+    depth[made - 1] = 0;
+    for (int node = made - 2; node >= 0; node--) {
+        depth[node] = depth[parent[node]] + 1;
+        if (node < leafCount) {
+            int length = depth[node] < HUFFMAN_MAX_BITS ? depth[node] : HUFFMAN_MAX_BITS;
+            lengthCount[length]++;
+            kraft += 1u << (HUFFMAN_MAX_BITS - length);
+        }
+    }
+    // Each step moves a code from length bits to bits + 1, where it is joined by one of the clamped codes
+    while (kraft > (1u << HUFFMAN_MAX_BITS)) {
+        int bits = HUFFMAN_MAX_BITS - 1;
+        while (lengthCount[bits] == 0) bits--;
+        lengthCount[bits]--;
+        lengthCount[bits + 1] += 2;
+        lengthCount[HUFFMAN_MAX_BITS]--;
+        kraft--;
+    }
+    for (int length = HUFFMAN_MAX_BITS, i = 0; length > 0; length--) {
+        for (int k = 0; k < lengthCount[length]; k++) lengths[leaves[i++]] = (uint8_t)length;
+    }
+}
+
+// Canonical codes for the lengths (handed out in order of length, then symbol), bit-reversed for LSB-first output
+static void huffman_assign_codes(const uint8_t *lengths, int alphabetSize, uint16_t *codes) {
+    int lengthCount[HUFFMAN_MAX_BITS + 1] = {0};
+    uint32_t nextCode[HUFFMAN_MAX_BITS + 1];
+    for (int s = 0; s < alphabetSize; s++) lengthCount[lengths[s]]++;
+    lengthCount[0] = 0;
+    uint32_t code = 0;
+    for (int length = 1; length <= HUFFMAN_MAX_BITS; length++) {
+        code = (code + lengthCount[length - 1]) << 1;
+        nextCode[length] = code;
+    }
+    for (int s = 0; s < alphabetSize; s++) {
+        int length = lengths[s];
+        codes[s] = 0;
+        if (length == 0) continue;
+        uint32_t c = nextCode[length]++, reversed = 0;
+        for (int i = 0; i < length; i++) reversed |= ((c >> i) & 1) << (length - 1 - i);
+        codes[s] = (uint16_t)reversed;
+    }
+}
+
+// Size in bits of the stream huffman_encode_stream would write for these symbol frequencies
+static inline uint64_t huffman_stream_bits(const uint32_t *frequency, int alphabetSize) {
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    huffman_build_lengths(frequency, alphabetSize, lengths);
+    int used = alphabetSize;
+    while (used > 0 && lengths[used - 1] == 0) used--;
+    uint64_t bits = 16 + 4 * (uint64_t)used;
+    for (int s = 0; s < used; s++) bits += (uint64_t)frequency[s] * lengths[s];
+    return bits;
+}
+
+// Append a code length table as huffman_read_table expects it:
+//   16 bits n (one past the highest used symbol), then n 4-bit code lengths
+static inline void huffman_write_table(BitWriter *writer, const uint8_t *lengths, int alphabetSize) {
+    int used = alphabetSize;
+    while (used > 0 && lengths[used - 1] == 0) used--;
+    bit_writer_put(writer, used, 16);
+    for (int s = 0; s < used; s++) bit_writer_put(writer, lengths[s], 4);
+}
+
+// Append count symbols (each below alphabetSize) as a Huffman stream and pad it to a whole byte:
+// the code length table, then the codes
+static inline void huffman_encode_stream(BitWriter *writer, const uint16_t *symbols, size_t count, int alphabetSize) {
+    uint32_t frequency[HUFFMAN_MAX_SYMBOLS] = {0};
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    uint16_t codes[HUFFMAN_MAX_SYMBOLS];
+    for (size_t i = 0; i < count; i++) frequency[symbols[i]]++;
+    huffman_build_lengths(frequency, alphabetSize, lengths);
+    huffman_assign_codes(lengths, alphabetSize, codes);
+
+    huffman_write_table(writer, lengths, alphabetSize);
+    for (size_t i = 0; i < count; i++) bit_writer_put(writer, codes[symbols[i]], lengths[symbols[i]]);
+    bit_writer_align(writer);
+}
+
+// Single-level decode table: entry = symbol << 4 | code length, 0 for bit patterns no code starts with
+typedef struct {
+    uint16_t entries[1 << HUFFMAN_MAX_BITS];
+} HuffmanDecoder;
+
+// Read a stream's code lengths and build its decode table. Returns 0, or -1 if the table is invalid.
+static int huffman_read_table(BitReader *reader, HuffmanDecoder *decoder, int alphabetSize) {
+    uint8_t lengths[HUFFMAN_MAX_SYMBOLS];
+    uint16_t codes[HUFFMAN_MAX_SYMBOLS];
+    int used = (int)bit_reader_get(reader, 16);
+    if (used > alphabetSize) {
+        return -1;
+    }
+    memset(lengths, 0, alphabetSize);
+    uint32_t kraft = 0;
+    for (int s = 0; s < used; s++) {
+        lengths[s] = (uint8_t)bit_reader_get(reader, 4);
+        if (lengths[s] > HUFFMAN_MAX_BITS) return -1;
+        if (lengths[s]) kraft += 1u << (HUFFMAN_MAX_BITS - lengths[s]);
+    }
+    if (kraft > (1u << HUFFMAN_MAX_BITS) || bit_reader_overrun(reader)) {
+        return -1;
+    }
+    huffman_assign_codes(lengths, alphabetSize, codes);
+    memset(decoder->entries, 0, sizeof(decoder->entries));
+    for (int s = 0; s < used; s++) {
+        if (lengths[s] == 0) continue;
+        uint16_t entry = (uint16_t)(s << 4 | lengths[s]);
+        for (uint32_t i = codes[s]; i < (1u << HUFFMAN_MAX_BITS); i += 1u << lengths[s]) {
+            decoder->entries[i] = entry;
+        }
+    }
+    return 0;
+}
+
+// Decode one symbol; the reader must hold at least HUFFMAN_MAX_BITS bits. Returns -1 for an invalid code.
+static inline int huffman_decode_symbol(const HuffmanDecoder *decoder, BitReader *reader) {
+    uint16_t entry = decoder->entries[reader->bits & ((1u << HUFFMAN_MAX_BITS) - 1)];
+    int length = entry & 15;
+    reader->bits >>= length;
+    reader->count -= length;
+    return length ? entry >> 4 : -1;
+}
+
+// Decode a stream written by huffman_encode_stream into count symbols.
+// Returns the number of bytes the stream occupied, or -1 if it is corrupt or truncated.
+static inline long huffman_decode_stream(const uint8_t *data, size_t size, uint16_t *symbols, size_t count, int alphabetSize) {
+    BitReader reader;
+    HuffmanDecoder *decoder = (HuffmanDecoder *)malloc(sizeof(HuffmanDecoder));
+    if (decoder == NULL) {
+        perror("Error allocating memory for Huffman decoder");
+        return -1;
+    }
+    bit_reader_init(&reader, data, size);
+    int failed = huffman_read_table(&reader, decoder, alphabetSize) != 0;
+
+    // Four codes of HUFFMAN_MAX_BITS fit in one refill of at least 56 bits
+    size_t i = 0;
+    while (!failed && i + 4 <= count) {
+        bit_reader_refill(&reader);
+        int a = huffman_decode_symbol(decoder, &reader);
+        int b = huffman_decode_symbol(decoder, &reader);
+        int c = huffman_decode_symbol(decoder, &reader);
+        int d = huffman_decode_symbol(decoder, &reader);
+        failed = (a | b | c | d) < 0;
+        symbols[i] = (uint16_t)a;
+        symbols[i + 1] = (uint16_t)b;
+        symbols[i + 2] = (uint16_t)c;
+        symbols[i + 3] = (uint16_t)d;
+        i += 4;
+    }
+    while (!failed && i < count) {
+        bit_reader_refill(&reader);
+        int symbol = huffman_decode_symbol(decoder, &reader);
+        failed = symbol < 0;
+        symbols[i++] = (uint16_t)symbol;
+    }
+    free(decoder);
+    if (failed || bit_reader_overrun(&reader)) {
+        return -1;
+    }
+    return (long)((reader.pos * 8 - reader.count + 7) / 8);
+}
+
+#endif
@@ -0,0 +1,84 @@
+// A minimal parallel loop over pthreads, shared by the text and image programs and the codec library.
+// Build the programs that use it with -pthread.
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define PARALLEL_MAX_THREADS 64  // Upper bound on worker threads
+
+// Number of worker threads to use (one per online core)
+static inline int parallel_thread_count(void) {
+    int count = 1;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    count = (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (count < 1) count = 1;
+    if (count > PARALLEL_MAX_THREADS) count = PARALLEL_MAX_THREADS;
+    return count;
+}
+
+// One worker of parallel_for: runs tasks first, first + stride, ...
+typedef struct {
+    void (*task)(void *context, int index);
+    void *context;
+    int count;
+    int first;
+    int stride;
+} ParallelJob;
+
+static inline void *parallel_run_job(void *arg) {
+    ParallelJob *job = (ParallelJob *)arg;
+    for (int i = job->first; i < job->count; i += job->stride) {
+        job->task(job->context, i);
+    }
+    return NULL;
+}
+
+// Number of workers parallel_for runs for count tasks when asked for threadCount
+static inline int parallel_for_threads(int count, int threadCount) {
+    if (threadCount > count) threadCount = count;
+    if (threadCount > PARALLEL_MAX_THREADS) threadCount = PARALLEL_MAX_THREADS;
+    if (threadCount < 1) threadCount = 1;
+    return threadCount;
+}
+
+// Run task(context, i) for every i in [0, count) on up to threadCount threads and wait for all of them.
+// Worker t runs tasks t, t + workers, t + 2 * workers, ... in order, where workers is
+// parallel_for_threads(count, threadCount), so index % workers picks per-worker state no two threads share.
+// A worker whose thread can't start runs on the calling thread instead.
+static inline void parallel_for(int count, int threadCount, void (*task)(void *context, int index), void *context) {
+    if (count < 1) return;
+    threadCount = parallel_for_threads(count, threadCount);
+
+    ParallelJob jobs[PARALLEL_MAX_THREADS];
+    pthread_t threads[PARALLEL_MAX_THREADS];
+    int started[PARALLEL_MAX_THREADS];
+    for (int t = 0; t < threadCount; t++) {
+        jobs[t].task = task;
+        jobs[t].context = context;
+        jobs[t].count = count;
+        jobs[t].first = t;
+        jobs[t].stride = threadCount;
+        started[t] = (t > 0 && pthread_create(&threads[t], NULL, parallel_run_job, &jobs[t]) == 0);
+    }
+    parallel_run_job(&jobs[0]);
+    for (int t = 1; t < threadCount; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        } else {
+            parallel_run_job(&jobs[t]);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,171 @@
+// Aho-Corasick matching of several byte patterns at once, shared by the compressed-domain searches.
+// The automaton is built as a full transition table, so feeding it a byte is one lookup. State 0 is the root;
+// every other state stands for a prefix of some pattern, the longest one that ends the text read so far.
+#ifndef PATTERN_SEARCH_H
+#define PATTERN_SEARCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATTERN_MAX_STATES 1024  // Total pattern length + 1; keeps states in 16 bits and per-state tables small
+
+typedef struct {
+    int stateCount;
+    int patternCount;
+    uint16_t (*next)[256];  // next[state][byte]
+    int16_t *output;        // Pattern that ends exactly at this state, or -1
+    uint16_t *outputLink;   // Nearest shorter suffix state that has an output, or 0
+    uint8_t *matches;       // 1 if any pattern ends at this state
+    uint8_t *lastByte;      // Last byte of the state's prefix (0 for the root)
+    int *patternLength;
+} PatternMatcher;
+
+typedef struct {
+    uint64_t offset;  // Position of the first byte of the match
+    int pattern;
+} PatternMatch;
+
+// Growable list of matches; failed is set (and further matches dropped) if memory runs out
+typedef struct {
+    PatternMatch *items;
+    size_t count;
+    size_t capacity;
+    int failed;
+} MatchList;
+
+static void pattern_free(PatternMatcher *matcher) {
+    free(matcher->next);
+    free(matcher->output);
+    free(matcher->outputLink);
+    free(matcher->matches);
+    free(matcher->lastByte);
+    free(matcher->patternLength);
+    memset(matcher, 0, sizeof(*matcher));
+}
+
+// Build the automaton for count patterns. A pattern that repeats an earlier one is reported as the earlier one.
+// Returns 0, or -1 if a pattern is empty, the patterns are too long in total, or memory runs out.
+static int pattern_build(PatternMatcher *matcher, const char *const *patterns, int count) {
+    size_t total = 1;
+    for (int p = 0; p < count; p++) {
+        if (patterns[p][0] == '\0') {
+            printf("Search patterns must not be empty.\n");
+            return -1;
+        }
+        total += strlen(patterns[p]);
+    }
+    if (count < 1 || total > PATTERN_MAX_STATES) {
+        printf("Search patterns must hold 1 to %d bytes in total.\n", PATTERN_MAX_STATES - 1);
+        return -1;
+    }
+    memset(matcher, 0, sizeof(*matcher));
+    matcher->patternCount = count;
+    matcher->next = (uint16_t(*)[256])calloc(total, sizeof(*matcher->next));
+    matcher->output = (int16_t *)malloc(total * sizeof(int16_t));
+    matcher->outputLink = (uint16_t *)calloc(total, sizeof(uint16_t));
+    matcher->matches = (uint8_t *)calloc(total, 1);
+    matcher->lastByte = (uint8_t *)calloc(total, 1);
+    matcher->patternLength = (int *)malloc(count * sizeof(int));
+    uint16_t *fail = (uint16_t *)calloc(total, sizeof(uint16_t));
+    uint16_t *queue = (uint16_t *)malloc(total * sizeof(uint16_t));
+    if (matcher->next == NULL || matcher->output == NULL || matcher->outputLink == NULL || matcher->matches == NULL ||
+        matcher->lastByte == NULL || matcher->patternLength == NULL || fail == NULL || queue == NULL) {
+        perror("Error allocating memory for search patterns");
+        pattern_free(matcher);
+        free(fail);
+        free(queue);
+        return -1;
+    }
+    for (size_t s = 0; s < total; s++) matcher->output[s] = -1;
+
+    // Trie of the patterns; next[state][byte] == 0 means no edge yet (no edge can lead back to the root)
+    matcher->stateCount = 1;
+    for (int p = 0; p < count; p++) {
+        const uint8_t *pattern = (const uint8_t *)patterns[p];
+        int state = 0;
+        matcher->patternLength[p] = (int)strlen(patterns[p]);
+        for (int i = 0; pattern[i]; i++) {
+            if (matcher->next[state][pattern[i]] == 0) {
+                matcher->lastByte[matcher->stateCount] = pattern[i];
+                matcher->next[state][pattern[i]] = (uint16_t)matcher->stateCount++;
+            }
+            state = matcher->next[state][pattern[i]];
+        }
+        if (matcher->output[state] < 0) matcher->output[state] = (int16_t)p;
+    }
+
+    // Breadth-first, each state's missing edges are copied from its failure state, which is already complete
+    int head = 0, tail = 0;
+    for (int b = 0; b < 256; b++) {
+        if (matcher->next[0][b]) queue[tail++] = matcher->next[0][b];
+    }
+    while (head < tail) {
+        int state = queue[head++];
+        int link = fail[state];
+        matcher->outputLink[state] = matcher->output[link] >= 0 ? (uint16_t)link : matcher->outputLink[link];
+        matcher->matches[state] = matcher->output[state] >= 0 || matcher->outputLink[state] != 0;
+        for (int b = 0; b < 256; b++) {
+            int child = matcher->next[state][b];
+            if (child) {
+                fail[child] = matcher->next[link][b];
+                queue[tail++] = (uint16_t)child;
+            } else {
+                matcher->next[state][b] = matcher->next[link][b];
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+static inline void match_list_add(MatchList *list, uint64_t offset, int pattern) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        PatternMatch *items = (PatternMatch *)realloc(list->items, capacity * sizeof(PatternMatch));
+        if (items == NULL) {
+            list->failed = 1;
+            return;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count].offset = offset;
+    list->items[list->count].pattern = pattern;
+    list->count++;
+}
+
+// Record every pattern that ends at state, where end is the position one past the last byte read
+static inline void pattern_report(const PatternMatcher *matcher, int state, uint64_t end, MatchList *list) {
+    int s = matcher->output[state] >= 0 ? state : matcher->outputLink[state];
+    while (s != 0) {
+        int p = matcher->output[s];
+        match_list_add(list, end - matcher->patternLength[p], p);
+        s = matcher->outputLink[s];
+    }
+}
+
+// Scan plain text, returning the state the automaton ends in
+static int pattern_scan(const PatternMatcher *matcher, int state, const uint8_t *text, size_t size, uint64_t offset,
+                        MatchList *list) {
+    for (size_t i = 0; i < size; i++) {
+        state = matcher->next[state][text[i]];
+        if (matcher->matches[state]) pattern_report(matcher, state, offset + i + 1, list);
+    }
+    return state;
+}
+
+static int compare_matches(const void *a, const void *b) {
+    const PatternMatch *x = (const PatternMatch *)a, *y = (const PatternMatch *)b;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return x->pattern - y->pattern;
+}
+
+// Searches may find matches out of order; this puts them in order of offset, then pattern
+static void match_list_sort(MatchList *list) {
+    if (list->count > 1) qsort(list->items, list->count, sizeof(PatternMatch), compare_matches);
+}
+
+#endif
@@ -2,6 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdint.h>
+#include "crc32c.h"
+
+// compressed.txt starts with a header line "RLE1 <original length> <CRC32C of the original, 8 hex digits>",
+// followed by the encoded text. Decompression reads the file back and checks the length and CRC, so another
+// file, a truncated file or damaged data is reported instead of producing wrong text.
+#define RLE_TEXT_MAGIC "RLE1"
 
 // Function to read the entire file into memory
 char *read_file(const char *filename, size_t *file_size) {
@@ -29,15 +36,18 @@ char *read_file(const char *filename, size_t *file_size) {
     return data;
 }
 
-// Function to write data to a file
-void write_file(const char *filename, const char *data) {
+// Function to write data to a file, after the header line if there is one
+int write_file(const char *filename, const char *header, const char *data) {
     FILE *file = fopen(filename, "wb");
     if (!file) {
         perror("Error opening file for writing");
-        return;
+        return -1;
+    }
+    if (header) {
+        fputs(header, file);
     }
     fwrite(data, 1, strlen(data), file);
-    fclose(file);
+    return fclose(file) == 0 ? 0 : -1;
 }
 
 // Function to perform Run-Length Encoding (compression)
@@ -78,9 +88,11 @@ void rle_compress(const char *input, char *output) {
     output[j] = '\0'; // Null-terminate the output string
 }
 
-// Function to perform Run-Length Decoding (decompression)
-void rle_decompress(const char *input, char *output) {
-    int i, j = 0;
+// Function to perform Run-Length Decoding (decompression) into at most capacity characters.
+// Returns the decoded length, or -1 if the data would decode to more than capacity characters.
+long rle_decompress(const char *input, char *output, size_t capacity) {
+    size_t j = 0;
+    int i;
     int length = strlen(input);
 
     for (i = 0; i < length; i++) {
@@ -88,6 +100,7 @@ void rle_decompress(const char *input, char *output) {
         if (input[i] == '_') {
             i++; // Move to the first digit after `_`
             while (i < length && isdigit(input[i])) {
+                if (j == capacity) return -1;
                 output[j++] = input[i++];
             }
             i--; // Adjust the position since the for loop will increment `i` again
@@ -96,20 +109,61 @@ void rle_decompress(const char *input, char *output) {
 
         // Copy the character to output
         char current_char = input[i];
+        if (j == capacity) return -1;
         output[j++] = current_char;
 
         // Check if the next characters are digits (representing the count)
-        int count = 0;
+        size_t count = 0;
         while (i + 1 < length && isdigit(input[i + 1])) {
             count = count * 10 + (input[++i] - '0');
+            if (count > capacity) return -1;
         }
 
         // Repeat the character (count - 1) times
-        for (int k = 1; k < count; k++) {
+        if (count > 1 && count - 1 > capacity - j) return -1;
+        for (size_t k = 1; k < count; k++) {
             output[j++] = current_char;
         }
     }
     output[j] = '\0'; // Null-terminate the output string
+    return (long)j;
+}
+
+// Read compressed.txt back and decode it, checking the header's length and CRC.
+// Returns the decoded text, or NULL if the file is not a valid compressed file.
+char *read_compressed(const char *filename, size_t *text_length) {
+    size_t file_size;
+    char *file = read_file(filename, &file_size);
+    if (!file) {
+        return NULL;
+    }
+
+    char magic[5];
+    unsigned long long length;
+    unsigned int crc;
+    int header_length = 0;
+    if (sscanf(file, "%4s %llu %8x%n", magic, &length, &crc, &header_length) != 3 ||
+        strcmp(magic, RLE_TEXT_MAGIC) != 0 || file[header_length] != '\n' || length > (1ULL << 40)) {
+        printf("%s is not an RLE compressed file.\n", filename);
+        free(file);
+        return NULL;
+    }
+
+    char *text = (char *)malloc(length + 1);
+    if (!text) {
+        perror("Memory allocation failed for decompressed data");
+        free(file);
+        return NULL;
+    }
+    long decoded = rle_decompress(&file[header_length + 1], text, length);
+    free(file);
+    if (decoded != (long)length || crc32c(0, text, length) != crc) {
+        printf("%s is truncated or corrupt.\n", filename);
+        free(text);
+        return NULL;
+    }
+    *text_length = length;
+    return text;
 }
 
 int main() {
@@ -118,6 +172,7 @@ int main() {
     if (!input) {
         return 1;
     }
+    input_length = strlen(input); // The encoding is for text, so it stops at a NUL byte
 
     // Allocate memory for compressed output (twice the input length is a safe estimate)
     char *compressed = (char *)malloc(2 * input_length + 1);
@@ -128,30 +183,34 @@ int main() {
     }
     rle_compress(input, compressed);
 
-    // Write compressed data to compressed.txt
-    write_file("compressed.txt", compressed);
+    // Write compressed data to compressed.txt, after its header line
+    char header[64];
+    snprintf(header, sizeof(header), "%s %zu %08x\n", RLE_TEXT_MAGIC, input_length,
+             (unsigned int)crc32c(0, input, input_length));
+    if (write_file("compressed.txt", header, compressed) != 0) {
+        free(input);
+        free(compressed);
+        return 1;
+    }
 
     // Free the input data, as it's no longer needed
     free(input);
 
-    // Allocate memory for decompressed output
-    char *decompressed = (char *)malloc(input_length + 1); // Should be enough to hold the original size
+    // Decompress the file that was written, so its header and checksum are checked
+    size_t decompressed_length;
+    char *decompressed = read_compressed("compressed.txt", &decompressed_length);
     if (!decompressed) {
-        perror("Memory allocation failed for decompressed data");
         free(compressed);
         return 1;
     }
 
-    // Decompress the compressed data
-    rle_decompress(compressed, decompressed);
-
     // Write decompressed data to decompressed.txt
-    write_file("decompressed.txt", decompressed);
+    write_file("decompressed.txt", NULL, decompressed);
 
     // Print sizes of the files
     printf("Size of sample.txt: %zu bytes\n", input_length);
-    printf("Size of compressed.txt: %zu bytes\n", strlen(compressed));
-    printf("Size of decompressed.txt: %zu bytes\n", strlen(decompressed));
+    printf("Size of compressed.txt: %zu bytes\n", strlen(header) + strlen(compressed));
+    printf("Size of decompressed.txt: %zu bytes\n", decompressed_length);
 
     // Free the compressed and decompressed data
     free(compressed);
@@ -0,0 +1,304 @@
+// Table-based asymmetric numeral system (tANS) coding of symbol streams, as in FSE, shared by the text codecs.
+// It has the same stream interface as huffman_coder.h, so a codec can pick either per stream. Symbol probabilities
+// are approximated as counts out of 1 << tableLog rather than powers of two, so a skewed stream (one symbol
+// above half the input, say) costs close to its entropy instead of at least one bit per symbol. Coding a symbol
+// is a table lookup, a shift and an add, with no data-dependent branches.
+#ifndef TANS_CODER_H
+#define TANS_CODER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bit_io.h"
+
+#define TANS_MIN_TABLE_LOG 5
+#define TANS_MAX_TABLE_LOG 12      // States are decoded with one refill per four symbols, as Huffman codes are
+#define TANS_DEFAULT_TABLE_LOG 11
+#define TANS_MAX_SYMBOLS 1024      // Largest alphabet a stream may use
+
+static inline int tans_highbit(uint32_t value) {
+    int bit = 0;
+    while (value >>= 1) bit++;
+    return bit;
+}
+
+// log2(value) in 1/65536 units for 1 <= value < 2^16: the integer part from the top bit, then 16 fraction
+// bits by repeated squaring (this avoids linking libm for size estimates)
+static uint32_t tans_log2_fixed(uint32_t value) {
+    int top = tans_highbit(value);
+    uint32_t result = (uint32_t)top << 16;
+    uint64_t mantissa = ((uint64_t)value << 16) >> top;
+    for (int bit = 15; bit >= 0; bit--) {
+        mantissa = (mantissa * mantissa) >> 16;
+        if (mantissa >= (2u << 16)) {
+            mantissa >>= 1;
+            result |= 1u << bit;
+        }
+    }
+    return result;
+}
+
+// Scale frequency to counts that sum to 1 << tableLog, keeping every used symbol at least 1. The table is
+// enlarged if it has fewer slots than there are used symbols. Rounding errors are settled one count at a time,
+// taking from (or giving to) the symbol where that changes the coded size least. Returns the table log used.
+static int tans_normalize(const uint32_t *frequency, int alphabetSize, int tableLog, uint16_t *normalized) {
+    uint64_t total = 0;
+    int used = 0;
+    for (int s = 0; s < alphabetSize; s++) {
+        total += frequency[s];
+        used += frequency[s] > 0;
+    }
+    if (tableLog < TANS_MIN_TABLE_LOG) tableLog = TANS_MIN_TABLE_LOG;
+    if (tableLog > TANS_MAX_TABLE_LOG) tableLog = TANS_MAX_TABLE_LOG;
+    while ((1 << tableLog) < used) tableLog++;
+    memset(normalized, 0, alphabetSize * sizeof(uint16_t));
+    if (total == 0) return tableLog;
+
+    int32_t tableSize = 1 << tableLog, sum = 0;
+    for (int s = 0; s < alphabetSize; s++) {
+        if (frequency[s] == 0) continue;
+        uint64_t scaled = ((uint64_t)frequency[s] * tableSize + total / 2) / total;
+        normalized[s] = (uint16_t)(scaled > 0 ? scaled : 1);
+        sum += normalized[s];
+    }
+    // Moving a count changes the cost of symbol s by about frequency / (count -+ 1/2) bits
+    while (sum != tableSize) {
+        int best = -1;
+        double bestCost = 0;
+        for (int s = 0; s < alphabetSize; s++) {
+            if (frequency[s] == 0 || (sum > tableSize && normalized[s] == 1)) continue;
+            double cost = sum > tableSize ? frequency[s] / (2.0 * normalized[s] - 1) : frequency[s] / (2.0 * normalized[s] + 1);
+            if (best < 0 || (sum > tableSize ? cost < bestCost : cost > bestCost)) {
+                best = s;
+                bestCost = cost;
+            }
+        }
+        normalized[best] += sum > tableSize ? -1 : 1;
+        sum += sum > tableSize ? -1 : 1;
+    }
+    return tableLog;
+}
+
+// Spread each symbol's slots over the table with an odd stride, so its states are interleaved with the others'
+static void tans_spread(const uint16_t *normalized, int used, int tableLog, uint16_t *slots) {
+    uint32_t tableSize = 1u << tableLog, mask = tableSize - 1, step = (tableSize >> 1) + (tableSize >> 3) + 3, pos = 0;
+    for (int s = 0; s < used; s++) {
+        for (int i = 0; i < normalized[s]; i++) {
+            slots[pos] = (uint16_t)s;
+            pos = (pos + step) & mask;
+        }
+    }
+}
+
+// Number of symbols the table describes: one past the highest used symbol
+static int tans_used_symbols(const uint16_t *normalized, int alphabetSize) {
+    int used = alphabetSize;
+    while (used > 0 && normalized[used - 1] == 0) used--;
+    return used;
+}
+
+// Bits of the table description: 16 bits n, 4 bits table log, then per symbol below n the bit length b of its
+// count in 4 bits followed by the count without its leading 1 in b - 1 bits
+static uint64_t tans_table_bits(const uint16_t *normalized, int used) {
+    uint64_t bits = 16;
+    if (used == 0) return bits;
+    bits += 4;
+    for (int s = 0; s < used; s++) {
+        int length = normalized[s] ? tans_highbit(normalized[s]) + 1 : 0;
+        bits += 4 + (length > 1 ? length - 1 : 0);
+    }
+    return bits;
+}
+
+// Estimated size in bits of the stream tans_encode_stream would write for these symbol frequencies
+static inline uint64_t tans_stream_bits(const uint32_t *frequency, int alphabetSize, int tableLog) {
+    uint16_t normalized[TANS_MAX_SYMBOLS];
+    tableLog = tans_normalize(frequency, alphabetSize, tableLog, normalized);
+    int used = tans_used_symbols(normalized, alphabetSize);
+    uint64_t bits = tans_table_bits(normalized, used), payload = 0;
+    if (used == 0) return bits;
+    for (int s = 0; s < used; s++) {
+        if (normalized[s] == 0) continue;
+        payload += (uint64_t)frequency[s] * (((uint32_t)tableLog << 16) - tans_log2_fixed(normalized[s]));
+    }
+    return bits + tableLog + (payload >> 16);
+}
+
+// Write the table description that tans_read_table reads (see tans_table_bits)
+static inline void tans_write_table(BitWriter *writer, const uint16_t *normalized, int used, int tableLog) {
+    bit_writer_put(writer, used, 16);
+    if (used == 0) return;
+    bit_writer_put(writer, tableLog, 4);
+    for (int s = 0; s < used; s++) {
+        int length = normalized[s] ? tans_highbit(normalized[s]) + 1 : 0;
+        bit_writer_put(writer, length, 4);
+        if (length > 1) bit_writer_put(writer, normalized[s] - (1u << (length - 1)), length - 1);
+    }
+}
+
+// Encoder states are tableSize + slot. For symbol s, a state x first sheds nbBits = (x + deltaBits[s]) >> 16
+// low bits, which brings it into [count, 2 * count); that value indexes s's run of next states.
+typedef struct {
+    uint16_t nextStates[1 << TANS_MAX_TABLE_LOG];
+    int32_t findState[TANS_MAX_SYMBOLS];
+    uint32_t deltaBits[TANS_MAX_SYMBOLS];
+} TansEncoder;
+
+static void tans_build_encoder(const uint16_t *normalized, int used, int tableLog, TansEncoder *encoder) {
+    uint32_t tableSize = 1u << tableLog;
+    uint16_t slots[1 << TANS_MAX_TABLE_LOG];
+    uint32_t start[TANS_MAX_SYMBOLS + 1];
+    tans_spread(normalized, used, tableLog, slots);
+    start[0] = 0;
+    for (int s = 0; s < used; s++) start[s + 1] = start[s] + normalized[s];
+    for (uint32_t u = 0; u < tableSize; u++) encoder->nextStates[start[slots[u]]++] = (uint16_t)(tableSize + u);
+    for (int s = 0; s < used; s++) {
+        start[s] -= normalized[s];
+        if (normalized[s] == 0) continue;
+        int maxBits = tableLog - (normalized[s] > 1 ? tans_highbit(normalized[s] - 1u) : 0);
+        encoder->deltaBits[s] = ((uint32_t)maxBits << 16) - ((uint32_t)normalized[s] << maxBits);
+        encoder->findState[s] = (int32_t)start[s] - normalized[s];
+    }
+}
+
+// Encode symbol from *state. Returns the bits the state sheds, as value << 4 | bit count.
+static inline uint32_t tans_encode_symbol(const TansEncoder *encoder, uint32_t *state, int symbol) {
+    uint32_t x = *state, bits = (x + encoder->deltaBits[symbol]) >> 16;
+    *state = encoder->nextStates[(int32_t)(x >> bits) + encoder->findState[symbol]];
+    return (x & ((1u << bits) - 1)) << 4 | bits;
+}
+
+// Append count symbols (each below alphabetSize) as a tANS stream with a table of 1 << tableLog states and pad
+// it to a whole byte: the table description, the decoder's two initial states in tableLog bits each, then the
+// state transition bits in decoding order. Even and odd symbols are coded by separate states, so the decoder
+// can look up one while the other is still being computed.
+static inline void tans_encode_stream(BitWriter *writer, const uint16_t *symbols, size_t count, int alphabetSize, int tableLog) {
+    uint32_t frequency[TANS_MAX_SYMBOLS] = {0};
+    uint16_t normalized[TANS_MAX_SYMBOLS];
+    for (size_t i = 0; i < count; i++) frequency[symbols[i]]++;
+    tableLog = tans_normalize(frequency, alphabetSize, tableLog, normalized);
+    int used = tans_used_symbols(normalized, alphabetSize);
+    tans_write_table(writer, normalized, used, tableLog);
+    if (used == 0) {
+        bit_writer_align(writer);
+        return;
+    }
+
+    // tANS decodes in the reverse order of encoding, so the symbols are encoded last to first and their bits
+    // are kept until the end, to be written first to last. The bits shed for the last symbol of each state
+    // are never needed.
+    TansEncoder *encoder = (TansEncoder *)malloc(sizeof(TansEncoder));
+    uint32_t *shed = (uint32_t *)malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (encoder == NULL || shed == NULL) {
+        writer->failed = 1;
+        free(encoder);
+        free(shed);
+        return;
+    }
+    tans_build_encoder(normalized, used, tableLog, encoder);
+    uint32_t tableSize = 1u << tableLog, state[2] = {tableSize, tableSize};
+    for (size_t i = count; i-- > 0;) shed[i] = tans_encode_symbol(encoder, &state[i & 1], symbols[i]);
+    bit_writer_put(writer, state[0] - tableSize, tableLog);
+    bit_writer_put(writer, state[1] - tableSize, tableLog);
+    for (size_t i = 0; i + 2 < count; i++) bit_writer_put(writer, shed[i] >> 4, shed[i] & 15);
+    free(encoder);
+    free(shed);
+    bit_writer_align(writer);
+}
+
+// Decode table: entry = base << 16 | symbol << 4 | bits for each state, where the state yields symbol and the
+// next state is base plus the next bits read
+typedef struct {
+    uint32_t entries[1 << TANS_MAX_TABLE_LOG];
+    int tableLog;
+} TansDecoder;
+
+// Build the decode table for counts that sum to 1 << tableLog. The k-th slot of a symbol with count n (k running
+// from n to 2n - 1) reads enough bits to reach [tableSize, 2 * tableSize) from k.
+static void tans_build_decoder(const uint16_t *normalized, int used, int tableLog, TansDecoder *decoder) {
+    uint16_t slots[1 << TANS_MAX_TABLE_LOG];
+    uint32_t tableSize = 1u << tableLog, next[TANS_MAX_SYMBOLS];
+    tans_spread(normalized, used, tableLog, slots);
+    for (int s = 0; s < used; s++) next[s] = normalized[s];
+    for (uint32_t u = 0; u < tableSize; u++) {
+        int s = slots[u];
+        uint32_t k = next[s]++;
+        int bits = tableLog - tans_highbit(k);
+        decoder->entries[u] = ((k << bits) - tableSize) << 16 | (uint32_t)s << 4 | (uint32_t)bits;
+    }
+    decoder->tableLog = tableLog;
+}
+
+// Read a stream's table description and build its decode table. Sets *used to the number of symbols
+// described (0 for an empty stream). Returns 0, or -1 if the table is invalid.
+static inline int tans_read_table(BitReader *reader, TansDecoder *decoder, int alphabetSize, int *used) {
+    uint16_t normalized[TANS_MAX_SYMBOLS];
+    *used = (int)bit_reader_get(reader, 16);
+    if (*used > alphabetSize) return -1;
+    if (*used == 0) return 0;
+    int tableLog = (int)bit_reader_get(reader, 4);
+    if (tableLog < TANS_MIN_TABLE_LOG || tableLog > TANS_MAX_TABLE_LOG) return -1;
+    uint32_t tableSize = 1u << tableLog, sum = 0;
+    for (int s = 0; s < *used; s++) {
+        int length = (int)bit_reader_get(reader, 4);
+        if (length > tableLog + 1) return -1;
+        normalized[s] = (uint16_t)(length > 1 ? (1u << (length - 1)) + bit_reader_get(reader, length - 1) : (uint32_t)length);
+        sum += normalized[s];
+    }
+    if (sum != tableSize || bit_reader_overrun(reader)) return -1;
+    tans_build_decoder(normalized, *used, tableLog, decoder);
+    return 0;
+}
+
+// Yield the current state's symbol and move to the next state; the reader must hold at least tableLog bits
+static inline int tans_decode_symbol(const TansDecoder *decoder, uint32_t *state, BitReader *reader) {
+    uint32_t entry = decoder->entries[*state];
+    int bits = entry & 15;
+    *state = (entry >> 16) + (uint32_t)(reader->bits & ((1u << bits) - 1));
+    reader->bits >>= bits;
+    reader->count -= bits;
+    return (entry >> 4) & 0xFFF;
+}
+
+// Decode a stream written by tans_encode_stream into count symbols.
+// Returns the number of bytes the stream occupied, or -1 if it is corrupt or truncated.
+static inline long tans_decode_stream(const uint8_t *data, size_t size, uint16_t *symbols, size_t count, int alphabetSize) {
+    BitReader reader;
+    TansDecoder *decoder = (TansDecoder *)malloc(sizeof(TansDecoder));
+    if (decoder == NULL) {
+        perror("Error allocating memory for tANS decoder");
+        return -1;
+    }
+    bit_reader_init(&reader, data, size);
+    int used;
+    int failed = tans_read_table(&reader, decoder, alphabetSize, &used) != 0 || (used == 0 && count > 0);
+
+    // Every state is a valid table index, so corrupt bits can only produce wrong symbols, which the caller's
+    // checks (and the final overrun test) catch. Four transitions of at most 12 bits fit in one refill.
+    if (!failed && count > 0) {
+        uint32_t even = bit_reader_get(&reader, decoder->tableLog), odd = bit_reader_get(&reader, decoder->tableLog);
+        size_t i = 0;
+        while (i + 6 <= count) {
+            bit_reader_refill(&reader);
+            symbols[i] = (uint16_t)tans_decode_symbol(decoder, &even, &reader);
+            symbols[i + 1] = (uint16_t)tans_decode_symbol(decoder, &odd, &reader);
+            symbols[i + 2] = (uint16_t)tans_decode_symbol(decoder, &even, &reader);
+            symbols[i + 3] = (uint16_t)tans_decode_symbol(decoder, &odd, &reader);
+            i += 4;
+        }
+        for (; i + 2 < count; i++) {
+            bit_reader_refill(&reader);
+            symbols[i] = (uint16_t)tans_decode_symbol(decoder, (i & 1) ? &odd : &even, &reader);
+        }
+        // The last symbol of each state needs no transition
+        for (; i < count; i++) symbols[i] = (uint16_t)((decoder->entries[(i & 1) ? odd : even] >> 4) & 0xFFF);
+    }
+    free(decoder);
+    if (failed || bit_reader_overrun(&reader)) {
+        return -1;
+    }
+    return (long)((reader.pos * 8 - reader.count + 7) / 8);
+}
+
+#endif